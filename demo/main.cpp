@@ -8,12 +8,20 @@ constexpr double sqrt3 = 1.73205080757;
 #define errf(e) std::format("{} error: {}", #e, to_string(e.err()))
 
 int main() {
-    const auto engine = Engine::create();
+    const auto engine = Engine::create({});
     if (engine.has_err())
         ERROR(errf(engine));
     defer(engine->destroy());
 
-    auto window = Window::create(*engine, true, 0, 0);
+    auto uploads = UploadQueue::create(*engine, {});
+    if (uploads.has_err())
+        ERROR(errf(uploads));
+    defer(uploads->destroy(*engine));
+
+    ThreadPool thread_pool{};
+    const AssetLoader loader{thread_pool};
+
+    auto window = Window::create(*engine, {.fullscreen = true});
     if (window.has_err())
         ERROR(errf(window));
     defer(window->destroy(*engine));
@@ -22,6 +30,8 @@ int main() {
     if (pipeline.has_err())
         ERROR(errf(pipeline));
     defer(pipeline->destroy(*engine));
+    // The hex tiles and buildings overlap a lot, so depth is laid down before shading
+    pipeline->set_depth_prepass(true);
 
     auto skybox_renderer = SkyboxRenderer::create(*engine, *pipeline);
     auto model_renderer = PbrRenderer::create(*engine, *pipeline);
@@ -34,40 +44,143 @@ int main() {
     if (model_renderer.has_err())
         ERROR(errf(model_renderer));
 
-    const auto skybox = skybox_renderer->load_skybox(*engine, "../assets/cloudy_skyboxes/Cubemap/Cubemap_Sky_06-512x512.png");
+    const auto skybox = skybox_renderer->load_skybox(*engine, *uploads, "../assets/cloudy_skyboxes/Cubemap/Cubemap_Sky_06-512x512.png");
     if (skybox.has_err())
         ERROR(errf(skybox));
 
     std::array<glm::vec4, 4> default_normal_image = {};
     default_normal_image.fill(glm::vec4{0.0f, 0.0f, -1.0f, 0.0f});
-    const auto default_normal_texture = model_renderer->load_texture_from_data(*engine, {default_normal_image.data(), sizeof(glm::vec4), {2, 2, 1}}, vk::Format::eR32G32B32A32Sfloat);
+    const auto default_normal_texture = model_renderer->load_texture_from_data(*engine, *uploads, {default_normal_image.data(), sizeof(glm::vec4), {2, 2, 1}}, vk::Format::eR32G32B32A32Sfloat);
+    if (default_normal_texture.has_err())
+        ERROR(errf(default_normal_texture));
 
-    const auto perlin_normal_image = create_normals_from_heightmap(generate_fractal_perlin_noise({512, 512}, {128, 128}));
-    const auto perlin_normal_texture = model_renderer->load_texture_from_data(*engine, {perlin_normal_image.data(), sizeof(glm::vec4), {512, 512, 1}}, vk::Format::eR32G32B32A32Sfloat);
+    auto noise_generator = GpuNoiseGenerator::create(*engine);
+    if (noise_generator.has_err() && noise_generator.err() != Err::StorageImagesUnsupported)
+        ERROR(errf(noise_generator));
+    defer(if (!noise_generator.has_err()) noise_generator->destroy(*engine));
 
-    const auto perlin_noise_color_image = map_image<u32>(generate_fractal_perlin_noise({512, 512}, {8, 8}), [](const f32 val) -> u32 {
-        return (static_cast<u32>(val * 255.0f) << 0) + (static_cast<u32>(val * 255.0f) << 8) + (static_cast<u32>(val * 255.0f) << 16) + 0xff000000;
-    });
-    const auto perlin_noise_texture = model_renderer->load_texture_from_data(*engine, {perlin_noise_color_image.data(), sizeof(u32), {512, 512, 1}});
+    // The normal map is generated straight into its image on the gpu, or on the cpu when it can't write storage images
+    constexpr vk::Extent2D perlin_normal_extent = {512, 512};
+    const auto perlin_normal_texture = [&] {
+        if (noise_generator.has_err()) {
+            // Encoded a row at a time straight into staging, in the gpu generator's format
+            const auto heightmap = generate_fractal_perlin_noise({perlin_normal_extent.width, perlin_normal_extent.height}, {128, 128});
+            constexpr vk::Format format = GpuNoiseGenerator::output_format(GpuNoiseGenerator::Output::NormalMap);
+            constexpr vk::Extent3D extent = {perlin_normal_extent.width, perlin_normal_extent.height, 1};
+            const u32 mips = engine->gpu.getFormatProperties(format).optimalTilingFeatures & vk::FormatFeatureFlagBits::eSampledImageFilterLinear
+                ? get_mip_count(extent) : 1;
+            const auto image = GpuImage::create_result(*engine, {
+                .extent = extent,
+                .format = format,
+                .usage = vk::ImageUsageFlagBits::eSampled | vk::ImageUsageFlagBits::eTransferSrc | vk::ImageUsageFlagBits::eTransferDst,
+                .mip_levels = mips,
+            });
+            if (image.has_err())
+                ERROR(errf(image));
+            const auto upload_layout = mips > 1 ? vk::ImageLayout::eTransferDstOptimal : vk::ImageLayout::eShaderReadOnlyOptimal;
+            const auto upload = uploads->upload_image_with(
+                *engine, image->image, extent.width * extent.height * sizeof(u32), extent, upload_layout, [&](u8* const staging) {
+                    create_normals_from_heightmap(
+                        heightmap.view(), ImageView<u32>{reinterpret_cast<u32*>(staging), {extent.width, extent.height}},
+                        [](const glm::vec4& normal) { return glm::packSnorm4x8(normal); }
+                    );
+                }
+            );
+            if (upload.has_err())
+                ERROR(errf(upload));
+            if (mips > 1) {
+                const auto mipmaps = uploads->generate_mipmaps(
+                    *engine, image->image, mips, extent, format, vk::ImageLayout::eTransferDstOptimal,
+                    vk::ImageLayout::eShaderReadOnlyOptimal
+                );
+                if (mipmaps.has_err())
+                    ERROR(errf(mipmaps));
+            }
+            return model_renderer->load_texture_from_image(*engine, *image);
+        }
+        const auto perlin_normal_image = noise_generator->generate_image(
+            *engine, GpuNoiseGenerator::Output::NormalMap, perlin_normal_extent, {.initial_size = {128, 128}}
+        );
+        if (perlin_normal_image.has_err())
+            ERROR(errf(perlin_normal_image));
+        return model_renderer->load_texture_from_image(*engine, *perlin_normal_image);
+    }();
+    if (perlin_normal_texture.has_err())
+        ERROR(errf(perlin_normal_texture));
+
+    // Other generated textures are block compressed on the thread pool and streamed in when ready, or left as RGBA8 on
+    // gpus that can't sample BC7
+    const bool use_bc7 = is_format_sampleable(*engine, vk::Format::eBc7SrgbBlock);
+    const auto perlin_noise_texture = model_renderer->load_texture_async(*engine, thread_pool.submit([use_bc7] {
+        const auto color = map_image<u32>(generate_fractal_perlin_noise({512, 512}, {8, 8}), [](const f32 val) -> u32 {
+            return (static_cast<u32>(val * 255.0f) << 0) + (static_cast<u32>(val * 255.0f) << 8) + (static_cast<u32>(val * 255.0f) << 16) + 0xff000000;
+        });
+        return ok(use_bc7 ? compress_bc7(color) : build_mip_chain(color));
+    }));
+    if (perlin_noise_texture.has_err())
+        ERROR(errf(perlin_noise_texture));
 
     std::array<u32, 4> gold_color = {};
     gold_color.fill(0xff44ccff);
-    const auto gold_texture = model_renderer->load_texture_from_data(*engine, {gold_color.data(), 4, {2, 2, 1}});
+    const auto gold_texture = model_renderer->load_texture_from_data(*engine, *uploads, {gold_color.data(), 4, {2, 2, 1}});
+    if (gold_texture.has_err())
+        ERROR(errf(gold_texture));
 
     std::array<u32, 4> gray_color = {};
     gray_color.fill(0xff777777);
-    const auto gray_texture = model_renderer->load_texture_from_data(*engine, {gray_color.data(), 4, {2, 2, 1}});
+    const auto gray_texture = model_renderer->load_texture_from_data(*engine, *uploads, {gray_color.data(), 4, {2, 2, 1}});
+    if (gray_texture.has_err())
+        ERROR(errf(gray_texture));
 
-    const auto hex_texture = *model_renderer->load_texture(*engine, "../assets/hexagon_models/Textures/hexagons_medieval.png");
+    // The atlas is shared by every hex model, so only the levels the nearest of them need are kept on the gpu
+    const auto hex_texture = model_renderer->load_texture_streamed(*engine, thread_pool.submit([]() -> Result<CompressedImage> {
+        const auto image = ImageData::load("../assets/hexagon_models/Textures/hexagons_medieval.png");
+        if (image.has_err())
+            return image.err();
+        return ok(build_mip_chain(*image));
+    }));
+    if (hex_texture.has_err())
+        ERROR(errf(hex_texture));
 
-    const auto cube = model_renderer->load_model_from_data(*engine, generate_cube(), perlin_normal_texture, gray_texture, 0.2f, 0.0f);
-    const auto sphere = model_renderer->load_model_from_data(*engine, generate_sphere({64, 32}), perlin_normal_texture, gray_texture, 0.2f, 1.0f);
-    const auto grass = *model_renderer->load_model(*engine, "../assets/hexagon_models/Assets/gltf/tiles/base/hex_grass.gltf", default_normal_texture, hex_texture);
-    const auto building = *model_renderer->load_model(*engine, "../assets/hexagon_models/Assets/gltf/buildings/blue/building_home_A_blue.gltf", default_normal_texture, hex_texture);
-    const auto tower = *model_renderer->load_model(*engine, "../assets/hexagon_models/Assets/gltf/buildings/blue/building_tower_A_blue.gltf", default_normal_texture, hex_texture);
+    const auto cube = model_renderer->load_model_from_data(*engine, *uploads, generate_cube(), *perlin_normal_texture, *gray_texture, 0.2f, 0.0f);
+    if (cube.has_err())
+        ERROR(errf(cube));
+    auto sphere_mesh = generate_sphere({64, 32});
+    generate_lods(sphere_mesh);
+    const auto sphere = model_renderer->load_model_from_data(*engine, *uploads, sphere_mesh, *perlin_normal_texture, *gray_texture, 0.2f, 1.0f, PbrRenderer::VertexFormat::Packed);
+    if (sphere.has_err())
+        ERROR(errf(sphere));
 
-    const f32 aspect_ratio = static_cast<f32>(window->extent().width) / static_cast<f32>(window->extent().height);
-    pipeline->update_projection(*engine, glm::perspective(glm::pi<f32>() / 4.0f, aspect_ratio, 0.1f, 100.f));
+    // Prefers meshes baked with `bake_mesh ../assets/hexagon_models/Assets/gltf ../assets/hexagon_models/Assets/baked`.
+    // Baked files are only mapped, so they are checked here, and ones from an older bake_mesh load the gltf instead.
+    const auto load_hex_model = [&](const std::filesystem::path& name) {
+        auto baked = "../assets/hexagon_models/Assets/baked" / name;
+        baked.replace_extension(".hgmesh");
+        if (std::filesystem::exists(baked)) {
+            const auto model = model_renderer->load_baked_model(
+                *engine, *uploads, baked, *default_normal_texture, *hex_texture, PbrRenderer::VertexFormat::Packed
+            );
+            if (!model.has_err())
+                return *model;
+            if (model.err() != Err::MeshFileInvalid)
+                ERROR(errf(model));
+        }
+        const auto model = model_renderer->load_model_async(
+            *engine, loader.load_gltf("../assets/hexagon_models/Assets/gltf" / name), *default_normal_texture, *hex_texture, PbrRenderer::VertexFormat::Packed
+        );
+        if (model.has_err())
+            ERROR(errf(model));
+        return *model;
+    };
+    const auto grass = load_hex_model("tiles/base/hex_grass.gltf");
+    const auto building = load_hex_model("buildings/blue/building_home_A_blue.gltf");
+    const auto tower = load_hex_model("buildings/blue/building_tower_A_blue.gltf");
+
+    const auto scene_uploads = uploads->flush(*engine);
+    if (scene_uploads.has_err())
+        ERROR(errf(scene_uploads));
+
+    vk::Extent2D projection_extent = {};
 
     Cameraf camera = {};
     camera.translate({0.0f, -2.0f, -4.0f});
@@ -90,6 +203,9 @@ int main() {
         time_count += delta;
         ++frame_count;
 
+        const auto paced = window->pace_frame(*engine);
+        if (paced.has_err())
+            ERROR(errf(paced));
         glfwPollEvents();
 
         constexpr f32 speed = 2.0f;
@@ -119,8 +235,8 @@ int main() {
         model_renderer->clear_queue();
 
         model_renderer->queue_model(grass, {.position = {0.0f, 0.0f, 0.0f}});
-        model_renderer->queue_model(sphere, {.position = {-0.5f, -0.5f, 0.0f}, .scale = {0.25f, 0.25f, 0.25f}});
-        model_renderer->queue_model(cube, {.position = {0.5f, -0.5f, 0.0f}, .scale = {0.25f, 0.25f, 0.25f}});
+        model_renderer->queue_model(*sphere, {.position = {-0.5f, -0.5f, 0.0f}, .scale = {0.25f, 0.25f, 0.25f}});
+        model_renderer->queue_model(*cube, {.position = {0.5f, -0.5f, 0.0f}, .scale = {0.25f, 0.25f, 0.25f}});
 
         model_renderer->queue_model(grass, {.position = {-1.0f, -0.25f, sqrt3}});
         model_renderer->queue_model(building, {.position = {-1.0f, -0.25f, sqrt3}});
@@ -132,18 +248,26 @@ int main() {
 
         pipeline->add_light({-2.0f, -3.0f, -2.0f}, {glm::vec3{1.0f, 1.0f, 1.0f} * 300.0f});
 
-        pipeline->update_camera(*engine, camera);
+        if (window->extent() != projection_extent) {
+            projection_extent = window->extent();
+            const f32 aspect_ratio = static_cast<f32>(projection_extent.width) / static_cast<f32>(projection_extent.height);
+            pipeline->update_projection(glm::perspective(glm::pi<f32>() / 4.0f, aspect_ratio, 0.1f, 100.f));
+        }
+        pipeline->update_camera(camera);
+
+        model_renderer->select_lods(*pipeline);
+        const auto streaming = model_renderer->update_streaming(*engine, *uploads, *pipeline);
+        if (streaming.has_err())
+            ERROR(errf(streaming));
+        const auto frame_uploads = uploads->flush(*engine);
+        if (frame_uploads.has_err())
+            ERROR(errf(frame_uploads));
 
         const auto frame_result = window->draw_frame(*engine, *pipeline);
         if (frame_result.has_err()) {
             if (frame_result.err() == Err::InvalidWindowSize) {
-                for (int w = 0, h = 0; w == 0 || h == 0; glfwGetWindowSize(window->window(), &w, &h)) {
-                    glfwPollEvents();
-                }
-                const auto res = window->resize(*engine);
-                if (res.has_err())
-                    ERROR("Could not resize window");
-                pipeline->resize(*engine, window->extent());
+                // Minimized, the swapchain is recreated once the window has a size again
+                glfwWaitEvents();
             } else {
                 ERROR(errf(frame_result));
             }
@@ -151,4 +275,8 @@ int main() {
     }
 
     (void)engine->device.waitIdle();
+
+    const auto trace = g_profiler.export_chrome_trace("hurdy_gurdy_trace.json");
+    if (trace.has_err())
+        std::cout << std::format("Could not write trace: {}\n", to_string(trace.err()));
 }
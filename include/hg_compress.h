@@ -0,0 +1,24 @@
+#pragma once
+
+#include "hg_utils.h"
+#include "hg_generate.h"
+#include "hg_load.h"
+
+namespace hg {
+
+// Cpu block compression for generated textures, or for baking files offline with compress_texture.
+// The whole mip chain is built on the cpu, so nothing is left for the gpu to blit at load.
+
+// Packed RGBA8 pixels, red in the low byte, with only BC7 mode 6 so it's quick enough to run on a worker thread
+[[nodiscard]] CompressedImage compress_bc7(const Image<u32>& image, bool srgb = true);
+
+// Leaves the pixels uncompressed, RGBA8 with the whole chain box filtered on the cpu, such as for PbrRenderer's
+// load_texture_streamed to upload one level at a time
+[[nodiscard]] CompressedImage build_mip_chain(const ImageData& image, bool srgb = true);
+[[nodiscard]] CompressedImage build_mip_chain(const Image<u32>& image, bool srgb = true);
+
+// Tangent space normals, as made by create_normals_from_heightmap, into signed BC5 holding x and y.
+// pbr.frag reconstructs z from them.
+[[nodiscard]] CompressedImage compress_bc5(const Image<glm::vec4>& normals);
+
+} // namespace hg
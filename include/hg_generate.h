@@ -1,8 +1,9 @@
 #pragma once
 
 #include "hg_utils.h"
+#include "hg_math.h"
 
-#include <random>
+#include <type_traits>
 
 namespace hg {
 
@@ -15,17 +16,89 @@ struct Vertex {
 
 void create_tangents(std::span<Vertex> primitives);
 
+[[nodiscard]] AABBf compute_aabb(std::span<const Vertex> vertices);
+// Centered on the aabb rather than minimal, which is tight enough for culling
+[[nodiscard]] BoundingSpheref compute_bounding_sphere(std::span<const Vertex> vertices, const AABBf& aabb);
+// Texture coordinate units per position unit, the square root of the mesh's total uv area over its surface area
+[[nodiscard]] f32 compute_uv_density(std::span<const u32> indices, std::span<const Vertex> vertices);
+
+// 20 byte vertex: half float position with the tangent sign in w, octahedral snorm16 normal and tangent, unorm16 uv
+struct PackedVertex {
+    glm::u16vec4 position = {};
+    glm::i16vec2 normal = {};
+    glm::i16vec2 tangent = {};
+    glm::u16vec2 tex_coord = {};
+};
+static_assert(sizeof(PackedVertex) == 20);
+
+// Packing requires every uv to be within [0, 1]
+[[nodiscard]] bool can_pack_vertices(std::span<const Vertex> vertices);
+[[nodiscard]] std::vector<PackedVertex> pack_vertices(std::span<const Vertex> vertices);
+
+// A coarser level of detail, indexing the same vertices as the full mesh
+struct MeshLod {
+    // Into Mesh::lod_indices
+    u32 first_index = 0;
+    u32 index_count = 0;
+    // How far, in position units, the level's surface may stray from the full mesh
+    f32 error = 0.0f;
+};
+
+// The full mesh and coarser levels of detail
+constexpr u32 MaxMeshLods = 4;
+
 struct Mesh {
     std::vector<u32> indices = {};
     std::vector<Vertex> vertices = {};
+    // Coarsest last, empty until generate_lods
+    std::vector<u32> lod_indices = {};
+    std::vector<MeshLod> lods = {};
 
     [[nodiscard]] static Mesh from_primitives(std::span<const Vertex> primitives);
 };
 
+// Quadric error edge collapse onto existing vertices, so the result indexes the same vertex buffer.
+// Vertices at one position collapse together, open borders are kept, and error receives the largest collapse's
+// distance from the surface it replaced.
+[[nodiscard]] std::vector<u32> simplify_mesh(
+    std::span<const u32> indices, std::span<const Vertex> vertices, usize target_index_count, f32& error
+);
+// Halves the triangle count for each level until MaxMeshLods levels, or until simplification stalls
+void generate_lods(Mesh& mesh);
+
 [[nodiscard]] Mesh generate_square();
 [[nodiscard]] Mesh generate_cube();
 [[nodiscard]] Mesh generate_sphere(glm::uvec2 fidelity);
 
+// Rows of texels in memory the view doesn't own, such as another Image, a reused scratch buffer or mapped staging
+template <typename T> class ImageView {
+public:
+    constexpr ImageView() = default;
+    constexpr ImageView(T* data, const glm::vec<2, usize> size, const usize stride)
+        : m_data{data}, m_width{size.x}, m_height{size.y}, m_stride{stride} {
+        ASSERT(stride >= size.x);
+    }
+    constexpr ImageView(T* data, const glm::vec<2, usize> size) : ImageView{data, size, size.x} {}
+    // Mutable views convert to read only ones
+    template <typename U> requires std::is_same_v<const U, T>
+    constexpr ImageView(const ImageView<U>& other)
+        : m_data{other.data()}, m_width{other.width()}, m_height{other.height()}, m_stride{other.stride()} {}
+
+    [[nodiscard]] constexpr usize width() const { return m_width; }
+    [[nodiscard]] constexpr usize height() const { return m_height; }
+    // Texels from the start of one row to the next
+    [[nodiscard]] constexpr usize stride() const { return m_stride; }
+
+    [[nodiscard]] constexpr std::span<T> operator[](const usize y) const { return {m_data + y * m_stride, m_width}; }
+    [[nodiscard]] constexpr T* data() const { return m_data; }
+
+private:
+    T* m_data = nullptr;
+    usize m_width = 0;
+    usize m_height = 0;
+    usize m_stride = 0;
+};
+
 template<typename T>
 class Image {
 public:
@@ -34,6 +107,13 @@ public:
         m_vals.resize(size.x * size.y);
     }
 
+    // Keeps the storage when shrinking, so a scratch image can be reused between steps without reallocating.
+    // Kept texels are not moved to their new rows and added texels are value initialized.
+    constexpr void resize(const glm::vec<2, usize> size) {
+        m_vals.resize(size.x * size.y);
+        m_stride = size.x;
+    }
+
     [[nodiscard]] constexpr usize size() const { return m_vals.size(); }
     [[nodiscard]] constexpr usize width() const { return m_stride; }
     [[nodiscard]] constexpr usize height() const { return m_vals.size() / m_stride; }
@@ -44,6 +124,9 @@ public:
     [[nodiscard]] constexpr T* data() { return m_vals.data(); }
     [[nodiscard]] constexpr const T* data() const { return m_vals.data(); }
 
+    [[nodiscard]] constexpr ImageView<T> view() { return {m_vals.data(), {width(), height()}}; }
+    [[nodiscard]] constexpr ImageView<const T> view() const { return {m_vals.data(), {width(), height()}}; }
+
     constexpr Image& operator+=(const Image& other) {
         ASSERT(m_vals.size() == other.m_vals.size());
         ASSERT(m_stride == other.m_stride);
@@ -54,67 +137,147 @@ public:
     }
 
 private:
-    std::vector<T> m_vals = {};
+    std::vector<T, AlignedAllocator<T>> m_vals = {};
     usize m_stride = 0;
 };
 
-template<typename T, typename U, typename F> Image<T> map_image(const Image<U>& image, F pred) {
-    Image<T> mapped = {{image.width(), image.height()}};
+// Writes into existing storage, so a step can go straight into a reused image or mapped staging memory
+template<typename T, typename U, typename F> void map_image(const ImageView<const U> image, const ImageView<T> mapped, F pred) {
+    ASSERT(image.width() == mapped.width());
+    ASSERT(image.height() == mapped.height());
     for (usize y = 0; y < image.height(); ++y) {
+        const U* src = image[y].data();
+        T* dst = mapped[y].data();
         for (usize x = 0; x < image.width(); ++x) {
-            mapped[y][x] = pred(image[y][x]);
+            dst[x] = pred(src[x]);
         }
     }
+}
+
+template<typename T, typename U, typename F> Image<T> map_image(const Image<U>& image, F pred) {
+    Image<T> mapped = {{image.width(), image.height()}};
+    map_image(image.view(), mapped.view(), pred);
     return mapped;
 }
 
+// Images are contiguous, so the texels are walked in one run rather than by row
 template<typename T, typename F> void transform_image(Image<T>& image, F pred) {
-    for (usize y = 0; y < image.height(); ++y) {
-        for (usize x = 0; x < image.width(); ++x) {
-            image[y][x] = pred(image[y][x]);
-        }
+    T* vals = image.data();
+    for (usize i = 0; i < image.size(); ++i) {
+        vals[i] = pred(vals[i]);
     }
 }
 
 template<typename T, typename F> [[nodiscard]] Image<T> transform_image(Image<T>&& image, F pred) {
-    for (usize y = 0; y < image.height(); ++y) {
-        for (usize x = 0; x < image.width(); ++x) {
-            image[y][x] = pred(image[y][x]);
-        }
-    }
+    transform_image(image, pred);
     return image;
 }
 
+// Row y of the normals of a heightmap that wraps at its edges, which only reads rows y - 1 to y + 1
+void create_normal_row(ImageView<const f32> heightmap, usize y, std::span<glm::vec4> normals);
+
 [[nodiscard]] Image<glm::vec4> create_normals_from_heightmap(const Image<f32>& heightmap);
 
-inline std::random_device g_random_device = {};
-inline std::mt19937_64 g_twister{g_random_device()};
-using Twister = std::mt19937_64;
+// Encodes each row of normals as it is made, so generating, converting and writing into staging is a single pass that
+// only keeps one row of normals aside
+template <typename T, typename F> void create_normals_from_heightmap(
+    const ImageView<const f32> heightmap, const ImageView<T> normals, F encode
+) {
+    ASSERT(heightmap.width() == normals.width());
+    ASSERT(heightmap.height() == normals.height());
+    std::vector<glm::vec4> row(heightmap.width());
+    for (usize y = 0; y < heightmap.height(); ++y) {
+        create_normal_row(heightmap, y, row);
+        T* dst = normals[y].data();
+        for (usize x = 0; x < row.size(); ++x) {
+            dst[x] = encode(row[x]);
+        }
+    }
+}
+
+// pcg3d from Jarzynski and Olano, Hash Functions for GPU Rendering, the same hash as noise.comp
+[[nodiscard]] inline glm::uvec3 pcg3d(u32 x, u32 y, u32 z) {
+    x = x * 1664525u + 1013904223u;
+    y = y * 1664525u + 1013904223u;
+    z = z * 1664525u + 1013904223u;
+    x += y * z;
+    y += z * x;
+    z += x * y;
+    x ^= x >> 16u;
+    y ^= y >> 16u;
+    z ^= z >> 16u;
+    x += y * z;
+    y += z * x;
+    z += x * y;
+    return {x, y, z};
+}
+
+// Stateless counter based rng, every value is a hash of the seed, a stream and a 2D coordinate.
+// Nothing is shared or mutated, so it can be used from any thread and gives the same values however work is split,
+// and on the gpu in noise.comp.
+class HashRng {
+public:
+    constexpr HashRng() = default;
+    constexpr explicit HashRng(const u32 seed) : m_seed{seed} {}
+
+    [[nodiscard]] constexpr u32 seed() const { return m_seed; }
+
+    [[nodiscard]] u32 hash(const glm::uvec2 coord, const u32 stream = 0) const {
+        return pcg3d(coord.x, coord.y, stream_key(stream)).x;
+    }
+
+    template <typename T> [[nodiscard]] T at(glm::uvec2 coord, u32 stream = 0) const;
+
+    // Batches of hash and at<f32> for count coordinates from first along x, vectorized where the target allows
+    void hash_row(glm::uvec2 first, u32 stream, std::span<u32> out) const;
+    void unorm_row(glm::uvec2 first, u32 stream, std::span<f32> out) const;
+
+    // The 24 high bits, so every value is exactly representable and within [0, 1)
+    [[nodiscard]] static constexpr f32 to_unorm(const u32 hash) { return static_cast<f32>(hash >> 8) * (1.0f / 16777216.0f); }
 
-template <typename T> T rng();
+private:
+    [[nodiscard]] constexpr u32 stream_key(const u32 stream) const { return stream ^ m_seed * 0x9e3779b9u; }
 
-template <> [[nodiscard]] inline f64 rng<f64>() { return std::uniform_real_distribution<f64>{0.0f, 1.0f}(g_twister); }
-template <> [[nodiscard]] inline f32 rng<f32>() { return std::uniform_real_distribution<f32>{0.0f, 1.0f}(g_twister); }
+    u32 m_seed = 0;
+};
 
-template <> [[nodiscard]] inline u64 rng<u64>() { return g_twister(); }
-template <> [[nodiscard]] inline u32 rng<u32>() { return static_cast<u32>(rng<u64>()); }
-template <> [[nodiscard]] inline u16 rng<u16>() { return static_cast<u16>(rng<u64>()); }
-template <> [[nodiscard]] inline u8 rng<u8>() { return static_cast<u8>(rng<u64>()); }
+template <> [[nodiscard]] inline u32 HashRng::at<u32>(const glm::uvec2 coord, const u32 stream) const { return hash(coord, stream); }
+template <> [[nodiscard]] inline u16 HashRng::at<u16>(const glm::uvec2 coord, const u32 stream) const { return static_cast<u16>(hash(coord, stream)); }
+template <> [[nodiscard]] inline u8 HashRng::at<u8>(const glm::uvec2 coord, const u32 stream) const { return static_cast<u8>(hash(coord, stream)); }
+template <> [[nodiscard]] inline u64 HashRng::at<u64>(const glm::uvec2 coord, const u32 stream) const {
+    const glm::uvec3 h = pcg3d(coord.x, coord.y, stream_key(stream));
+    return static_cast<u64>(h.x) << 32 | h.y;
+}
 
-template <> [[nodiscard]] inline i64 rng<i64>() { return static_cast<i64>(rng<u64>()); }
-template <> [[nodiscard]] inline i32 rng<i32>() { return static_cast<i32>(rng<u64>()); }
-template <> [[nodiscard]] inline i16 rng<i16>() { return static_cast<i16>(rng<u64>()); }
-template <> [[nodiscard]] inline i8 rng<i8>() { return static_cast<i8>(rng<u64>()); }
+template <> [[nodiscard]] inline i64 HashRng::at<i64>(const glm::uvec2 coord, const u32 stream) const { return static_cast<i64>(at<u64>(coord, stream)); }
+template <> [[nodiscard]] inline i32 HashRng::at<i32>(const glm::uvec2 coord, const u32 stream) const { return static_cast<i32>(hash(coord, stream)); }
+template <> [[nodiscard]] inline i16 HashRng::at<i16>(const glm::uvec2 coord, const u32 stream) const { return static_cast<i16>(hash(coord, stream)); }
+template <> [[nodiscard]] inline i8 HashRng::at<i8>(const glm::uvec2 coord, const u32 stream) const { return static_cast<i8>(hash(coord, stream)); }
 
-template <> [[nodiscard]] inline glm::vec2 rng<glm::vec2>() {
-    const f32 angle = rng<f32>() * glm::two_pi<f32>();
+template <> [[nodiscard]] inline f32 HashRng::at<f32>(const glm::uvec2 coord, const u32 stream) const { return to_unorm(hash(coord, stream)); }
+template <> [[nodiscard]] inline f64 HashRng::at<f64>(const glm::uvec2 coord, const u32 stream) const {
+    return static_cast<f64>(at<u64>(coord, stream) >> 11) / 9007199254740992.0;
+}
+
+// A unit vector at a uniform angle
+template <> [[nodiscard]] inline glm::vec2 HashRng::at<glm::vec2>(const glm::uvec2 coord, const u32 stream) const {
+    const f32 angle = at<f32>(coord, stream) * glm::two_pi<f32>();
     return {std::cos(angle), std::sin(angle)};
 }
 
-template <typename T, typename RandGen = decltype(rng<T>)> Image<T> generate_white_noise(const glm::vec<2, usize> size, RandGen rand_gen = rng<T>) {
+// Texel (x, y) is rng.at<T>({x, y}, stream)
+template <typename T> [[nodiscard]] Image<T> generate_white_noise(const glm::vec<2, usize> size, const HashRng& rng, const u32 stream = 0) {
     Image<T> image = size;
-    for (T* pixel = image.data(); pixel < image.data() + image.size(); ++pixel) {
-        *pixel = rand_gen();
+    for (usize y = 0; y < image.height(); ++y) {
+        if constexpr (std::is_same_v<T, f32>) {
+            rng.unorm_row({0, to_u32(y)}, stream, image[y]);
+        } else if constexpr (std::is_same_v<T, u32>) {
+            rng.hash_row({0, to_u32(y)}, stream, image[y]);
+        } else {
+            for (usize x = 0; x < image.width(); ++x) {
+                image[y][x] = rng.at<T>({to_u32(x), to_u32(y)}, stream);
+            }
+        }
     }
     return image;
 }
@@ -122,11 +285,13 @@ template <typename T, typename RandGen = decltype(rng<T>)> Image<T> generate_whi
 [[nodiscard]] Image<f32> generate_value_noise(glm::vec<2, usize> size, const Image<f32>& fixed_points);
 [[nodiscard]] Image<f32> generate_perlin_noise(glm::vec<2, usize> size, const Image<glm::vec2>& gradients);
 
+// Octave i draws its lattice from stream i of HashRng{seed}, as GpuNoiseGenerator does with the same seed. Value lattices
+// match the gpu's exactly, perlin gradients and the interpolated noise only up to float rounding.
 [[nodiscard]] Image<f32> generate_fractal_value_noise(
-    glm::vec<2, usize> size, glm::vec<2, usize> initial_size, usize max_octaves = SIZE_MAX
+    glm::vec<2, usize> size, glm::vec<2, usize> initial_size, usize max_octaves = SIZE_MAX, u32 seed = 0
 );
 [[nodiscard]] Image<f32> generate_fractal_perlin_noise(
-    glm::vec<2, usize> size, glm::vec<2, usize> initial_size, usize max_octaves = SIZE_MAX
+    glm::vec<2, usize> size, glm::vec<2, usize> initial_size, usize max_octaves = SIZE_MAX, u32 seed = 0
 );
 
 } // namespace hg
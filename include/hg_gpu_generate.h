@@ -0,0 +1,97 @@
+#pragma once
+
+#include "hg_utils.h"
+#include "hg_math.h"
+#include "hg_vulkan_engine.h"
+
+namespace hg {
+
+// Compute shader versions of the fractal noise and create_normals_from_heightmap in hg_generate.h, which write straight
+// into device images, so procedural textures need no cpu time or staging upload.
+// The lattice is hashed with HashRng, so a seed gives the same lattice as the cpu functions, and the noise only differs
+// by the gpu's float rounding.
+class GpuNoiseGenerator {
+public:
+    // Match noise.comp
+    enum class Noise : u32 {
+        Value,
+        Perlin,
+    };
+    enum class Output : u32 {
+        // The fractal noise, within [0, 1]
+        Heightmap,
+        // Tangent space normals of the noise as a heightmap, in xyz
+        NormalMap,
+    };
+
+    [[nodiscard]] static constexpr vk::Format output_format(const Output output) {
+        return output == Output::Heightmap ? vk::Format::eR32Sfloat : vk::Format::eR8G8B8A8Snorm;
+    }
+    // The transfer bits are only needed for images with mips, which are blitted from the generated first level
+    static constexpr vk::ImageUsageFlags TargetUsage = vk::ImageUsageFlagBits::eStorage
+                                                     | vk::ImageUsageFlagBits::eSampled
+                                                     | vk::ImageUsageFlagBits::eTransferSrc
+                                                     | vk::ImageUsageFlagBits::eTransferDst;
+
+    struct Config {
+        Noise noise = Noise::Perlin;
+        // Grid cells across the first octave, each octave doubles them until they would be finer than the image
+        glm::uvec2 initial_size = {8, 8};
+        u32 max_octaves = UINT32_MAX;
+        u32 seed = 0;
+    };
+
+    // A storage view of an image's first level, registered with the engine's BindlessHeap
+    struct Target {
+        vk::Image image = {};
+        vk::ImageView view = {};
+        u32 index = BindlessHeap::InvalidIndex;
+        Output output = Output::Heightmap;
+        vk::Extent2D extent = {};
+        u32 mip_levels = 1;
+    };
+
+    // Err::StorageImagesUnsupported without Engine::storage_images, the cpu functions are the fallback
+    [[nodiscard]] static Result<GpuNoiseGenerator> create(const Engine& engine);
+    void destroy(const Engine& engine) const;
+
+    // The image has to be 2D, in output_format(output) and created with TargetUsage
+    [[nodiscard]] static Result<Target> create_target(
+        const Engine& engine, const GpuImage& image, Output output, vk::Extent2D extent, u32 mip_levels = 1
+    );
+    // The view and heap index are freed once the gpu has stopped writing through them, the image is left alone
+    static void destroy_target(const Engine& engine, const Target& target);
+
+    // Overwrites every level of the target and leaves them in final_layout, visible to every later stage.
+    // Cheap enough to record each frame, from a render system's cmd_prepare, to animate the noise through its seed.
+    void cmd_generate(
+        vk::CommandBuffer cmd, const Target& target, const Config& config,
+        vk::ImageLayout final_layout = vk::ImageLayout::eShaderReadOnlyOptimal
+    ) const;
+
+    // Creates an image with a full mip chain and generates into it on the main queue, waiting for it to finish
+    [[nodiscard]] Result<GpuImage> generate_image(
+        const Engine& engine, Output output, vk::Extent2D extent, const Config& config
+    ) const;
+
+private:
+    static constexpr u32 WorkgroupSize = 8;
+
+    // Matches noise.comp
+    struct Push {
+        glm::uvec2 extent = {};
+        glm::uvec2 initial_size = {};
+        u32 octave_count = 0;
+        f32 amplitude = 0.0f;
+        u32 seed = 0;
+        Noise noise = Noise::Perlin;
+        Output output = Output::Heightmap;
+        u32 image = BindlessHeap::InvalidIndex;
+    };
+
+    vk::DescriptorSet m_bindless_set = {};
+    vk::PipelineLayout m_pipeline_layout = {};
+    vk::ShaderEXT m_shader = {};
+};
+
+} // namespace hg
@@ -2,13 +2,17 @@
 
 #include "hg_utils.h"
 #include "hg_generate.h"
+#include "hg_threads.h"
 
+#include <array>
 #include <filesystem>
+#include <future>
 #include <memory>
+#include <span>
+#include <vector>
 
 namespace hg {
 
-
 struct ImageData {
 private:
     static constexpr auto FreeDeleter = [](u8* ptr) { std::free(ptr); };
@@ -22,6 +26,57 @@ public:
     [[nodiscard]] static Result<ImageData> load(std::filesystem::path path);
 };
 
+// Read-only view of a whole file, mapped into memory for as long as the object lives
+class MappedFile {
+public:
+    MappedFile() = default;
+    ~MappedFile() { close(); }
+
+    MappedFile(const MappedFile&) = delete;
+    MappedFile& operator=(const MappedFile&) = delete;
+    MappedFile(MappedFile&& other) noexcept { *this = std::move(other); }
+    MappedFile& operator=(MappedFile&& other) noexcept {
+        close();
+        std::swap(m_data, other.m_data);
+        std::swap(m_size, other.m_size);
+        std::swap(m_mapping, other.m_mapping);
+        return *this;
+    }
+
+    [[nodiscard]] static Result<MappedFile> open(const std::filesystem::path& path);
+    void close();
+
+    [[nodiscard]] const u8* data() const { return static_cast<const u8*>(m_data); }
+    [[nodiscard]] usize size() const { return m_size; }
+
+private:
+    void* m_data = nullptr;
+    usize m_size = 0;
+    void* m_mapping = nullptr;
+};
+
+// An image encoded ahead of time, such as block compressed, with its whole mip chain
+struct CompressedImage {
+    struct Level {
+        std::span<const u8> data = {};
+        u32 width = 0;
+        u32 height = 0;
+    };
+
+    vk::Format format = vk::Format::eUndefined;
+    // Level 0 first, pointing into file or storage
+    std::vector<Level> levels = {};
+    MappedFile file = {};
+    std::vector<u8> storage = {};
+
+    // Picks the container by extension, .ktx2 or .dds, KTX2 files can't be supercompressed
+    [[nodiscard]] static Result<CompressedImage> load(const std::filesystem::path& path);
+    [[nodiscard]] static Result<CompressedImage> load_ktx2(const std::filesystem::path& path);
+    [[nodiscard]] static Result<CompressedImage> load_dds(const std::filesystem::path& path);
+    // Only BC5 and BC7, the formats compress_bc5 and compress_bc7 write
+    [[nodiscard]] Result<void> save_ktx2(const std::filesystem::path& path) const;
+};
+
 struct ModelData {
     Mesh mesh = {};
     float roughness = 0.0f;
@@ -30,4 +85,67 @@ struct ModelData {
     [[nodiscard]] static Result<ModelData> load_gltf(std::filesystem::path path);
 };
 
+// Layout of a .hgmesh file: this header, lod_count MeshLod values, index_count u32 indices, lod_index_count u32 indices,
+// then vertex_count Vertex values at vertex_offset
+struct BakedMeshHeader {
+    static constexpr std::array<char, 4> Magic = {'H', 'G', 'M', 'S'};
+    static constexpr u32 CurrentVersion = 2;
+
+    std::array<char, 4> magic = Magic;
+    u32 version = CurrentVersion;
+    u32 vertex_size = sizeof(Vertex);
+    u32 index_count = 0;
+    u32 lod_count = 0;
+    u32 lod_index_count = 0;
+    u32 vertex_count = 0;
+    u32 vertex_offset = 0;
+    float roughness = 0.0f;
+    float metalness = 0.0f;
+};
+
+// A baked mesh, with indices and vertices pointing straight into the mapped file
+struct BakedModel {
+    MappedFile file = {};
+    std::span<const u32> indices = {};
+    std::span<const u32> lod_indices = {};
+    std::vector<MeshLod> lods = {};
+    std::span<const Vertex> vertices = {};
+    float roughness = 0.0f;
+    float metalness = 0.0f;
+
+    [[nodiscard]] static Result<BakedModel> load(const std::filesystem::path& path);
+    [[nodiscard]] static Result<void> save(
+        const std::filesystem::path& path, const Mesh& mesh, float roughness, float metalness
+    );
+};
+
+// Decodes assets on a thread pool, so the caller can keep rendering while they load
+class AssetLoader {
+public:
+    explicit AssetLoader(ThreadPool& pool) : m_pool{&pool} {}
+
+    [[nodiscard]] std::future<Result<ImageData>> load_image(std::filesystem::path path) const {
+        ASSERT(!path.empty());
+        return m_pool->submit([path = std::move(path)] { return ImageData::load(path); });
+    }
+
+    [[nodiscard]] std::future<Result<CompressedImage>> load_compressed_image(std::filesystem::path path) const {
+        ASSERT(!path.empty());
+        return m_pool->submit([path = std::move(path)] { return CompressedImage::load(path); });
+    }
+
+    [[nodiscard]] std::future<Result<ModelData>> load_gltf(std::filesystem::path path) const {
+        ASSERT(!path.empty());
+        return m_pool->submit([path = std::move(path)] { return ModelData::load_gltf(path); });
+    }
+
+    [[nodiscard]] std::future<Result<BakedModel>> load_baked(std::filesystem::path path) const {
+        ASSERT(!path.empty());
+        return m_pool->submit([path = std::move(path)] { return BakedModel::load(path); });
+    }
+
+private:
+    ThreadPool* m_pool = nullptr;
+};
+
 } // namespace hg
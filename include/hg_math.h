@@ -3,6 +3,9 @@
 #include "hg_pch.h"
 #include "hg_utils.h"
 
+#include <array>
+#include <span>
+
 namespace glm {
 
 template <typename T> constexpr mat<3, 3, T> operator*(qua<T> lhs, mat<3, 3, T> rhs) noexcept {
@@ -93,6 +96,67 @@ template <typename T> struct Transform3D {
 
 using Transform3Df = Transform3D<f32>;
 
+template <typename T> struct AABB {
+    glm::vec<3, T> min = {0, 0, 0};
+    glm::vec<3, T> max = {0, 0, 0};
+
+    [[nodiscard]] constexpr glm::vec<3, T> center() const noexcept { return (min + max) / T{2}; }
+    [[nodiscard]] constexpr glm::vec<3, T> extent() const noexcept { return (max - min) / T{2}; }
+};
+
+using AABBf = AABB<f32>;
+
+template <typename T> struct BoundingSphere {
+    glm::vec<3, T> center = {0, 0, 0};
+    T radius = 0;
+
+    // Conservative under non-uniform scale, the largest scale axis is used for the radius
+    [[nodiscard]] constexpr BoundingSphere transformed(const glm::mat<4, 4, T>& matrix, const glm::vec<3, T> scale) const noexcept {
+        const T max_scale = std::max({std::abs(scale.x), std::abs(scale.y), std::abs(scale.z)});
+        return {glm::vec<3, T>{matrix * glm::vec<4, T>{center, 1}}, radius * max_scale};
+    }
+};
+
+using BoundingSpheref = BoundingSphere<f32>;
+
+template <typename T> struct Frustum {
+    // Normalized planes facing inward: left, right, bottom, top, near, far
+    std::array<glm::vec<4, T>, 6> planes = {};
+
+    // Expects a zero to one depth range, as set in hg_pch.h
+    [[nodiscard]] static Frustum from_matrix(const glm::mat<4, 4, T>& view_projection) noexcept {
+        const auto row = [&](const int i) {
+            return glm::vec<4, T>{view_projection[0][i], view_projection[1][i], view_projection[2][i], view_projection[3][i]};
+        };
+        Frustum frustum = {{row(3) + row(0), row(3) - row(0), row(3) + row(1), row(3) - row(1), row(2), row(3) - row(2)}};
+        for (auto& plane : frustum.planes) {
+            plane /= glm::length(glm::vec<3, T>{plane});
+        }
+        return frustum;
+    }
+
+    // Tests spheres stored as separate component arrays, the inner loop is branchless so it vectorizes
+    void cull_spheres(
+        const std::span<const T> x, const std::span<const T> y, const std::span<const T> z,
+        const std::span<const T> radius, const std::span<u8> visible
+    ) const noexcept {
+        ASSERT(y.size() == x.size());
+        ASSERT(z.size() == x.size());
+        ASSERT(radius.size() == x.size());
+        ASSERT(visible.size() == x.size());
+
+        std::fill(visible.begin(), visible.end(), u8{1});
+        for (const auto& plane : planes) {
+            for (usize i = 0; i < x.size(); ++i) {
+                const T distance = plane.x * x[i] + plane.y * y[i] + plane.z * z[i] + plane.w;
+                visible[i] &= static_cast<u8>(distance >= -radius[i]);
+            }
+        }
+    }
+};
+
+using Frustumf = Frustum<f32>;
+
 template <typename T> struct Camera {
     glm::vec<3, T> position = {0, 0, 0};
     glm::qua<T> rotation = glm::qua<T>::wxyz(1, 0, 0, 0);
@@ -3,7 +3,10 @@
 #include "hg_utils.h"
 #include "hg_math.h"
 #include "hg_generate.h"
+#include "hg_load.h"
+#include "hg_threads.h"
 #include "hg_vulkan_engine.h"
+#include "hg_upload_queue.h"
 
 namespace hg {
 
@@ -11,92 +14,227 @@ class DefaultPipeline : public Pipeline {
 public:
     DefaultPipeline() = default;
 
+    // The view projection, light and cluster bindings of the global set are dynamic, one slot per frame in flight
+    static constexpr u32 GlobalDynamicOffsetCount = 3;
+
+    // Render systems draw with one shared layout, so the global set and the engine's BindlessHeap are bound only once
+    static constexpr u32 GlobalSet = 0;
+    static constexpr u32 BindlessSet = 1;
+    static constexpr vk::PushConstantRange DrawPushRange = {
+        .stageFlags = vk::ShaderStageFlagBits::eVertex | vk::ShaderStageFlagBits::eFragment,
+        .offset = 0,
+        .size = 128,
+    };
+
+    struct DrawContext {
+        vk::CommandBuffer cmd = {};
+        // The global and bindless sets are already bound to it for graphics, draws only push constants
+        vk::PipelineLayout draw_layout = {};
+        vk::DescriptorSet global_set = {};
+        // Bind with global_set to select this frame's slots
+        std::array<u32, GlobalDynamicOffsetCount> global_offsets = {};
+        u32 frame_index = 0;
+        GpuProfiler* profiler = nullptr;
+        // World space frustum from the last update_projection and update_camera
+        Frustumf frustum = {};
+        // Lights in view for the frame, before they are binned into clusters
+        u32 light_count = 0;
+        // The depth pre-pass has run, so geometry drawn in cmd_draw_depth should test eEqual without writing depth
+        bool depth_prepass = false;
+    };
+
     class RenderSystem {
     public:
         virtual ~RenderSystem() = default;
 
-        virtual void cmd_draw(const vk::CommandBuffer cmd, const vk::DescriptorSet global_set) const = 0;
+        // Labels the system's gpu profiler scopes
+        [[nodiscard]] virtual const char* name() const { return "render_system"; }
+
+        // Records work that has to happen outside of rendering, such as compute passes
+        virtual void cmd_prepare(const DrawContext&) const {}
+        // Records depth only draws of opaque geometry into the pre-pass, always on the primary command buffer
+        virtual void cmd_draw_depth(const DrawContext&) const {}
+        virtual void cmd_draw(const DrawContext& ctx) const = 0;
     };
 
+    // Lights are binned into a froxel grid, exponentially sliced in depth, by light_cull.comp
+    static constexpr u32 ClusterCountX = 16;
+    static constexpr u32 ClusterCountY = 9;
+    static constexpr u32 ClusterCountZ = 24;
+    static constexpr u32 ClusterCount = ClusterCountX * ClusterCountY * ClusterCountZ;
+    // Must match light_cull.comp and pbr.frag
+    static constexpr u32 MaxLightsPerCluster = 64;
+
     struct ViewProjectionUniform {
         glm::mat4 projection = {1.0f};
         glm::mat4 view = {1.0f};
+        glm::mat4 inverse_projection = {1.0f};
+        glm::uvec4 cluster_grid = {ClusterCountX, ClusterCountY, ClusterCountZ, 0};
+        // Window width and height, then the near and far planes
+        glm::vec4 screen = {1.0f, 1.0f, 0.1f, 100.0f};
     };
 
-    static constexpr usize MaxLights = 10;
+    static constexpr usize MaxLights = 1024;
+    // Lights are cut off where their intensity falls below this, unless given a radius
+    static constexpr f32 LightCutoff = 0.05f;
     struct Light {
+        // The light's radius is held in w
         glm::vec4 position = {};
         glm::vec4 color = {};
     };
 
-    struct LightUniform {
-        alignas(16) usize count = 0;
+    struct LightBuffer {
+        alignas(16) u32 count = 0;
         alignas(16) Light vals[MaxLights] = {};
     };
 
+    struct Cluster {
+        u32 count = 0;
+        u32 indices[MaxLightsPerCluster] = {};
+    };
+
     [[nodiscard]] static Result<DefaultPipeline> create(const Engine& engine, vk::Extent2D window_size);
     void destroy(const Engine& engine) const;
-    void resize(const Engine& engine, const vk::Extent2D window_size);
+    // Resizes the render area to the window, reallocating the render targets only when they have to grow
+    void begin_frame(const Engine& engine, vk::Extent2D window_size, u32) override;
 
-    void cmd_draw(vk::CommandBuffer cmd, vk::Image render_target, vk::Extent2D window_size) const override;
+    // Returns the error of a secondary that failed to record, the render pass is then drawn without it
+    [[nodiscard]] Result<void> cmd_draw(
+        vk::CommandBuffer cmd, const RenderTarget& target, u32 frame_index, GpuProfiler& profiler
+    ) const override;
 
     vk::DescriptorSetLayout get_global_set_layout() const { return m_set_layout; }
+    // Graphics shaders of render systems are created against these and DrawPushRange
+    std::array<vk::DescriptorSetLayout, 2> get_draw_set_layouts() const { return m_draw_set_layouts; }
+    vk::PipelineLayout get_draw_layout() const { return m_draw_layout; }
+    // As of the last update_projection, update_camera and begin_frame
+    const ViewProjectionUniform& get_view_projection() const { return m_vp; }
 
+    // Systems have to be added before enable_parallel_recording
     void add_render_system(const RenderSystem& system) {
+        ASSERT(m_thread_pool == nullptr);
         m_render_systems.emplace_back(&system);
     }
 
-    void update_projection(const Engine& engine, const glm::mat4& projection) const {
-        ASSERT(m_vp_buffer.allocation != nullptr);
-        ASSERT(m_vp_buffer.buffer != nullptr);
-        m_vp_buffer.write(engine, projection, offsetof(ViewProjectionUniform, projection));
-    }
+    // Opts in to recording each render system's draws into its own secondary command buffer on the thread pool,
+    // which has to outlive the pipeline
+    [[nodiscard]] Result<void> enable_parallel_recording(const Engine& engine, ThreadPool& thread_pool);
+
+    // Expects a perspective projection, the cluster depth slices are derived from its near and far planes
+    void update_projection(const glm::mat4& projection);
 
-    void update_camera(const Engine& engine, const Cameraf& camera);
+    // Camera and light changes are copied into the frame's slots when it is recorded.
+    // Lights are culled against the last update_projection, so call it first when both change.
+    void update_camera(const Cameraf& camera);
 
-    void add_light(const glm::vec3 position, const glm::vec3 color) {
-        ASSERT(m_lights.size() <= MaxLights);
-        m_lights.emplace_back(glm::vec4{position, 1.0f}, glm::vec4{color, 1.0});
+    // A radius of zero is derived from the color and LightCutoff
+    void add_light(const glm::vec3 position, const glm::vec3 color, f32 radius = 0.0f) {
+        ASSERT(m_lights.size() < MaxLights);
+        ASSERT(radius >= 0.0f);
+        if (radius == 0.0f)
+            radius = std::sqrt(std::max({color.r, color.g, color.b}) / LightCutoff);
+        m_lights.emplace_back(glm::vec4{position, radius}, glm::vec4{color, 1.0f});
     }
 
     void clear_lights() {
         m_lights.clear();
     }
 
+    // Lays down depth before the main pass, so each covered sample is shaded once however much geometry overlaps
+    void set_depth_prepass(const bool enabled) {
+        m_depth_prepass = enabled;
+    }
+
+    // One sample skips the multisampled color target entirely, otherwise it is resolved by the render pass itself.
+    // Fails with SampleCountUnsupported unless the gpu can render both color and depth with the count.
+    [[nodiscard]] Result<void> set_sample_count(const Engine& engine, vk::SampleCountFlagBits samples);
+    [[nodiscard]] vk::SampleCountFlagBits get_sample_count() const { return m_sample_count; }
+
+    // Renders at a fraction of the window's resolution and upscales into it, taking effect on the next begin_frame.
+    // Cheap enough to change every frame for dynamic resolution, the targets only grow.
+    void set_render_scale(const f32 scale) {
+        ASSERT(scale > 0.0f && scale <= 1.0f);
+        m_render_scale = scale;
+    }
+    [[nodiscard]] f32 get_render_scale() const { return m_render_scale; }
+
 private:
+    static constexpr u32 TargetGranularity = 256;
+
+    void create_render_targets(const Engine& engine, vk::Extent2D extent, bool scaled);
+    // The color and scaled images may be empty
+    static void destroy_render_targets(const Engine& engine, const GpuImage& color, const GpuImage& depth, const GpuImage& scaled);
+    void update_cluster_params();
+    [[nodiscard]] std::array<u32, GlobalDynamicOffsetCount> write_frame_uniforms(u32 frame_index) const;
+    [[nodiscard]] Result<void> record_secondary(const DrawContext& ctx, usize system_index) const;
+
+    // Only allocated with more than one sample
     GpuImage m_color_image = {};
     GpuImage m_depth_image = {};
+    // The single sampled image the pass leaves for upscaling, only allocated while rendering below the window size
+    GpuImage m_scaled_image = {};
+    // The render area, at most the extent the targets were allocated with
+    vk::Extent2D m_extent = {};
+    vk::Extent2D m_window_extent = {};
+    vk::Extent2D m_target_extent = {};
+    vk::SampleCountFlagBits m_sample_count = vk::SampleCountFlagBits::e4;
+    // The sample count the targets were allocated with, they are recreated once it differs from m_sample_count
+    vk::SampleCountFlagBits m_target_samples = vk::SampleCountFlagBits::e4;
+    f32 m_render_scale = 1.0f;
 
     vk::DescriptorPool m_descriptor_pool = {};
     vk::DescriptorSetLayout m_set_layout = {};
     vk::DescriptorSet m_global_set = {};
+    vk::DescriptorSet m_bindless_set = {};
+    std::array<vk::DescriptorSetLayout, 2> m_draw_set_layouts = {};
+    vk::PipelineLayout m_draw_layout = {};
     GpuBuffer m_vp_buffer = {};
     GpuBuffer m_light_buffer = {};
+    GpuBuffer m_cluster_buffer = {};
+    vk::DeviceSize m_vp_stride = 0;
+    vk::DeviceSize m_light_stride = 0;
+    vk::DeviceSize m_cluster_stride = 0;
+    ViewProjectionUniform m_vp = {};
+    std::vector<Light> m_view_lights = {};
+    vk::PipelineLayout m_light_cull_layout = {};
+    vk::ShaderEXT m_light_cull_shader = {};
     std::vector<Light> m_lights = {};
 
     std::vector<const RenderSystem*> m_render_systems = {};
+    bool m_depth_prepass = false;
+
+    struct SecondaryCommands {
+        vk::CommandPool pool = {};
+        vk::CommandBuffer cmd = {};
+    };
+    ThreadPool* m_thread_pool = nullptr;
+    // One pool per render system and frame in flight
+    std::vector<std::array<SecondaryCommands, MaxFramesInFlight>> m_secondaries = {};
 };
 
 class SkyboxRenderer : public DefaultPipeline::RenderSystem {
 public:
     [[nodiscard]] static Result<SkyboxRenderer> create(const Engine& engine, const DefaultPipeline& pipeline);
     void destroy(const Engine& engine) const;
-    void cmd_draw(const vk::CommandBuffer cmd, const vk::DescriptorSet global_set) const override;
+
+    [[nodiscard]] const char* name() const override { return "skybox"; }
+    void cmd_draw(const DefaultPipeline::DrawContext& ctx) const override;
 
     [[nodiscard]] Result<void> load_skybox(
-        const Engine& engine, const std::filesystem::path path
+        const Engine& engine, UploadQueue& uploads, const std::filesystem::path path
     );
 
 private:
-    vk::DescriptorSetLayout m_set_layout = {};
-    vk::PipelineLayout m_pipeline_layout = {};
-    std::array<vk::ShaderEXT, 2> m_shaders = {};
+    // Matches skybox.frag
+    struct Push {
+        u32 cubemap = BindlessHeap::InvalidIndex;
+        u32 sampler = BindlessHeap::InvalidIndex;
+    };
 
-    vk::DescriptorPool m_descriptor_pool = {};
-    vk::DescriptorSet m_set = {};
+    std::array<vk::ShaderEXT, 2> m_shaders = {};
 
     GpuImage m_cubemap = {};
-    vk::Sampler m_sampler = {};
+    Push m_push = {};
 
     GpuBuffer m_index_buffer = {};
     GpuBuffer m_vertex_buffer = {};
@@ -107,79 +245,226 @@ public:
     [[nodiscard]] static Result<PbrRenderer> create(const Engine& engine, const DefaultPipeline& pipeline);
     void destroy(const Engine& engine) const;
 
-    struct PushConstant {
+    static constexpr usize MaxInstances = 16384;
+    struct alignas(16) InstanceData {
         glm::mat4 model = {1.0f};
-        u32 normal_map_index = UINT32_MAX;
-        u32 texture_index = UINT32_MAX;
+        // Indices into the engine's BindlessHeap, a model without a normal map has BindlessHeap::InvalidIndex
+        u32 normal_map_index = BindlessHeap::InvalidIndex;
+        u32 texture_index = BindlessHeap::InvalidIndex;
         float roughness = 0.0f;
         float metalness = 0.0f;
+        u32 draw_index = 0;
+        u32 normal_map_sampler = BindlessHeap::InvalidIndex;
+        u32 texture_sampler = BindlessHeap::InvalidIndex;
+        float alpha_cutoff = 0.0f;
     };
 
-    void cmd_draw(const vk::CommandBuffer cmd, const vk::DescriptorSet global_set) const override;
-
-    static constexpr usize MaxTextures = 256;
+    [[nodiscard]] const char* name() const override { return "pbr"; }
+
+    // Culls the queue on the gpu and writes the indirect draws used by cmd_draw
+    void cmd_prepare(const DefaultPipeline::DrawContext& ctx) const override;
+    // Alpha tested models are left to the main pass, the rest are drawn from their position streams
+    void cmd_draw_depth(const DefaultPipeline::DrawContext& ctx) const override;
+    void cmd_draw(const DefaultPipeline::DrawContext& ctx) const override;
+
+    // Registry capacity, slots of unloaded textures are reused so only resident textures count against it.
+    // Descriptors live in the engine's BindlessHeap and samplers are shared through its cache.
+    static constexpr usize MaxTextures = 4096;
+    // Textures aren't evicted below this width or height, so distant surfaces keep some detail
+    static constexpr u32 MinEvictedExtent = 64;
+    // Streamed textures always keep the levels at or below this size resident
+    static constexpr u32 StreamedBaseExtent = 128;
+    // Bounds how much of the staging ring streamed levels take each frame
+    static constexpr vk::DeviceSize StreamedBytesPerFrame = 8 * 1024 * 1024;
+    // Frames a streamed texture's largest level goes unneeded before it is dropped
+    static constexpr u32 StreamedIdleFrames = 240;
     struct Texture {
         GpuImage image = {};
-        vk::Sampler sampler = {};
+        u32 descriptor = BindlessHeap::InvalidIndex;
+        u32 sampler = BindlessHeap::InvalidIndex;
+        // Zero mip levels for images the renderer was given rather than created, which are never evicted
+        vk::Extent3D extent = {};
+        vk::Format format = vk::Format::eUndefined;
+        u32 mip_levels = 0;
+        // Leaves out a streamed texture's levels that are still waiting on their upload, the descriptor points at it
+        // instead of the image's view until they have all landed
+        vk::ImageView level_view = {};
+        // Set when an async load failed, the texture then stays without an image until it is unloaded
+        std::optional<Err> error = std::nullopt;
+    };
 
-        void destroy(const Engine& engine) const {
-            ASSERT(sampler != nullptr);
-            ASSERT(engine.device != nullptr);
-            engine.device.destroySampler(sampler);
+    using TextureHandle = Handle<Texture>;
 
-            image.destroy(engine);
-        }
+    [[nodiscard]] Result<TextureHandle> load_texture(const Engine& engine, UploadQueue& uploads, std::filesystem::path path);
+    // Every loader returns Err::TextureRegistryFull once MaxTextures are loaded
+    [[nodiscard]] Result<TextureHandle> load_texture_from_data(
+        const Engine& engine, UploadQueue& uploads, const GpuImage::Data& data, vk::Format format = vk::Format::eR8G8B8A8Srgb
+    );
+    // Reserves a slot that is filled by update_streaming once the image has been decoded. If decoding or the upload
+    // fails the slot is marked failed instead, see get_load_result.
+    [[nodiscard]] Result<TextureHandle> load_texture_async(const Engine& engine, std::future<Result<ImageData>> data);
+    // Uploads every level of a .ktx2 or .dds as is, Err::ImageFormatUnsupported when the gpu can't sample its format
+    [[nodiscard]] Result<TextureHandle> load_compressed_texture(const Engine& engine, UploadQueue& uploads, const std::filesystem::path& path);
+    [[nodiscard]] Result<TextureHandle> load_texture_from_compressed(
+        const Engine& engine, UploadQueue& uploads, const CompressedImage& image
+    );
+    [[nodiscard]] Result<TextureHandle> load_texture_async(const Engine& engine, std::future<Result<CompressedImage>> data);
+    // Keeps the chain on the cpu and only uploads the levels that queued models are estimated to sample, starting
+    // from StreamedBaseExtent. Higher levels stream in a few at a time while the texture's view is clamped to those
+    // uploaded, and are dropped again once nothing needs them.
+    [[nodiscard]] Result<TextureHandle> load_texture_streamed(const Engine& engine, std::future<Result<CompressedImage>> data);
+    // Takes ownership of an image that is already in ShaderReadOnlyOptimal, such as one from GpuNoiseGenerator
+    [[nodiscard]] Result<TextureHandle> load_texture_from_image(const Engine& engine, const GpuImage& image);
+    // The handle is invalidated immediately, the image and its slot are freed once the gpu has stopped using them.
+    // Models using the texture are no longer drawn.
+    void unload_texture(const Engine& engine, TextureHandle texture);
+
+    static constexpr usize MaxModels = 4096;
+    static constexpr usize MaxVertices = 1 << 20;
+    static constexpr usize MaxIndices = 1 << 22;
+    // Packed vertices are 20 bytes instead of 48, models whose tex coords are outside [0, 1] fall back to Full
+    enum class VertexFormat : u32 {
+        Full,
+        Packed,
     };
+    static constexpr usize VertexFormatCount = 2;
+    [[nodiscard]] static constexpr usize vertex_size(const VertexFormat format) {
+        return format == VertexFormat::Packed ? sizeof(PackedVertex) : sizeof(Vertex);
+    }
+    // Positions are also kept apart for the depth pre-pass, in the same encoding as the vertices
+    [[nodiscard]] static constexpr usize position_size(const VertexFormat format) {
+        return format == VertexFormat::Packed ? sizeof(PackedVertex::position) : sizeof(Vertex::position);
+    }
 
-    struct TextureHandle {
-        usize index = SIZE_MAX;
+    // A level's simplification error may cover this many pixels before a finer level is drawn
+    static constexpr f32 LodErrorPixels = 1.0f;
+    // Coarser levels than last frame's are only taken well within the error, so instances near a switch don't flicker
+    static constexpr f32 LodHysteresis = 0.8f;
+    struct Lod {
+        u32 first_index = 0;
+        u32 index_count = 0;
+        float error = 0.0f;
     };
 
-    [[nodiscard]] Result<TextureHandle> load_texture(const Engine& engine, std::filesystem::path path);
-    [[nodiscard]] TextureHandle load_texture_from_data(
-        const Engine& engine, const GpuImage::Data& data, vk::Format format = vk::Format::eR8G8B8A8Srgb
-    );
-
     struct Model {
+        // The arena range of every level's indices, the full mesh first
+        u32 first_index = 0;
         u32 index_count = 0;
-        GpuBuffer index_buffer = {};
-        GpuBuffer vertex_buffer = {};
+        u32 first_vertex = 0;
+        u32 vertex_count = 0;
         TextureHandle normal_map = {};
         TextureHandle texture = {};
         float roughness = 0.0;
         float metalness = 0.0;
-
-        void destroy(const Engine& engine) const {
-            vertex_buffer.destroy(engine);
-            index_buffer.destroy(engine);
-        }
+        // Texels with less albedo alpha are discarded, zero draws the model opaque
+        float alpha_cutoff = 0.0f;
+        AABBf aabb = {};
+        BoundingSpheref bounds = {};
+        VertexFormat vertex_format = VertexFormat::Full;
+        // Texture coordinate units per model space unit, averaged over the triangles, for estimating which mips the
+        // model samples on screen
+        float uv_density = 0.0f;
+        std::array<Lod, MaxMeshLods> lods = {};
+        u32 lod_count = 0;
+        // Set when an async load failed, the model then stays without geometry until it is unloaded
+        std::optional<Err> error = std::nullopt;
     };
 
-    struct ModelHandle {
-        usize index = SIZE_MAX;
-    };
+    using ModelHandle = Handle<Model>;
 
+    // Every loader returns Err::ModelRegistryFull once MaxModels are loaded, and Err::GeometryArenaFull when the mesh
+    // doesn't fit in what unloaded models have left of the arenas. Nothing is kept of a model that failed.
     [[nodiscard]] Result<ModelHandle> load_model(
         const Engine& engine,
+        UploadQueue& uploads,
         std::filesystem::path path,
         TextureHandle normal_map,
-        TextureHandle texture
+        TextureHandle texture,
+        VertexFormat format = VertexFormat::Full
     );
-    [[nodiscard]] ModelHandle load_model_from_data(
+    [[nodiscard]] Result<ModelHandle> load_model_from_data(
         const Engine& engine,
+        UploadQueue& uploads,
         const Mesh& data,
         TextureHandle normal_map,
         TextureHandle texture,
-        float roughness, float metalness
+        float roughness, float metalness,
+        VertexFormat format = VertexFormat::Full
+    );
+    // Uploads directly from the mapped file of a mesh baked by bake_mesh
+    [[nodiscard]] Result<ModelHandle> load_baked_model(
+        const Engine& engine,
+        UploadQueue& uploads,
+        std::filesystem::path path,
+        TextureHandle normal_map,
+        TextureHandle texture,
+        VertexFormat format = VertexFormat::Full
+    );
+    // Reserves a slot that is filled by update_streaming once the model has been decoded, models are not drawn until
+    // their mesh and textures are resident. A model whose load failed, or that uses a failed texture, is never drawn.
+    [[nodiscard]] Result<ModelHandle> load_model_async(
+        const Engine& engine,
+        std::future<Result<ModelData>> data,
+        TextureHandle normal_map,
+        TextureHandle texture,
+        VertexFormat format = VertexFormat::Full
     );
+    [[nodiscard]] Result<ModelHandle> load_model_async(
+        const Engine& engine,
+        std::future<Result<BakedModel>> data,
+        TextureHandle normal_map,
+        TextureHandle texture,
+        VertexFormat format = VertexFormat::Full
+    );
+    // The handle is invalidated immediately, its geometry and slot are freed once the gpu has stopped using them.
+    // Its textures are left loaded.
+    void unload_model(const Engine& engine, ModelHandle model);
+
+    // The error of an async load that failed, ok while the load is pending and once it has finished
+    [[nodiscard]] Result<void> get_load_result(const TextureHandle texture) const {
+        ASSERT(m_textures.contains(texture));
+        const auto& error = m_textures[texture].error;
+        if (error.has_value())
+            return *error;
+        return ok();
+    }
+    [[nodiscard]] Result<void> get_load_result(const ModelHandle model) const {
+        ASSERT(m_models.contains(model));
+        const auto& error = m_models[model].error;
+        if (error.has_value())
+            return *error;
+        return ok();
+    }
+    void set_alpha_cutoff(const Engine& engine, ModelHandle model, float cutoff);
+
+    // Replaces the texture's image with one lacking its largest level, returning false when it can't be shrunk.
+    // Streamed textures are never shrunk below their base level.
+    // The old image is freed once frames in flight have stopped sampling it.
+    bool evict_texture_mip(const Engine& engine, UploadQueue& uploads, TextureHandle texture);
+
+    // Uploads every asset that has finished decoding, call before flushing the upload queue for the frame.
+    // Streamed textures are sized to the queued models seen through the pipeline's camera, so queue the frame first.
+    // Under memory pressure new textures are held back and streamed ones stop growing, and past the eviction threshold
+    // the largest texture loses its top mip each call.
+    // Async loads that fail mark their slot failed instead of returning here. A streamed texture that fails to grow
+    // or upload a level is left as it was and tried again on the next call, the first such error is returned once
+    // everything else has been updated.
+    [[nodiscard]] Result<void> update_streaming(const Engine& engine, UploadQueue& uploads, const DefaultPipeline& pipeline);
+    [[nodiscard]] bool is_streaming() const {
+        return !m_pending_textures.empty() || !m_pending_compressed_textures.empty()
+            || !m_pending_streamed_textures.empty() || !m_pending_models.empty() || !m_pending_baked_models.empty();
+    }
 
     struct RenderTicket {
         ModelHandle model = {};
         Transform3Df transform = {};
+        // Set by select_lods, the full mesh until then
+        u32 lod = 0;
     };
 
     void queue_model(const ModelHandle model, const Transform3Df& transform) {
-        ASSERT(model.index < m_models.size());
+        ASSERT(m_models.contains(model));
+        ASSERT(m_render_queue.size() < MaxInstances);
         m_render_queue.emplace_back(model, transform);
     }
 
@@ -187,17 +472,178 @@ public:
         m_render_queue.clear();
     }
 
+    // Picks each queued instance's level of detail from its projected error through the pipeline's camera, call after
+    // queueing the frame. Instances keep last frame's level near a switch when the same model was queued in the same
+    // position, so queue the scene in a stable order.
+    void select_lods(const DefaultPipeline& pipeline);
+
 private:
-    vk::DescriptorSetLayout m_set_layout = {};
-    vk::PipelineLayout m_pipeline_layout = {};
-    std::array<vk::ShaderEXT, 2> m_shaders = {};
+    [[nodiscard]] Result<TextureHandle> insert_texture(const Engine& engine);
+    [[nodiscard]] Result<ModelHandle> insert_model(const Engine& engine, const Model& model);
+    // Leave the texture without an image when they fail
+    [[nodiscard]] Result<void> write_texture(
+        const Engine& engine, UploadQueue& uploads, TextureHandle texture, const GpuImage::Data& data, vk::Format format
+    );
+    [[nodiscard]] Result<void> write_compressed_texture(
+        const Engine& engine, UploadQueue& uploads, TextureHandle texture, const CompressedImage& image
+    );
+    [[nodiscard]] Result<void> write_streamed_texture(
+        const Engine& engine, UploadQueue& uploads, TextureHandle texture, CompressedImage image
+    );
+    // Leaves the model without geometry when it fails
+    [[nodiscard]] Result<void> write_model(
+        const Engine& engine, UploadQueue& uploads, ModelHandle handle,
+        std::span<const u32> indices, std::span<const u32> lod_indices, std::span<const MeshLod> lods,
+        std::span<const Vertex> vertices, float roughness, float metalness
+    );
+    // Returns the geometry of unloaded models to the arenas once the gpu has stopped drawing it
+    void reclaim_geometry(const Engine& engine);
+
+    [[nodiscard]] bool is_resident(const TextureHandle texture) const {
+        return m_textures.contains(texture) && m_textures[texture].descriptor != BindlessHeap::InvalidIndex;
+    }
+    [[nodiscard]] bool is_resident(const Model& model) const {
+        return model.index_count > 0
+            && is_resident(model.texture)
+            && (!model.normal_map.is_valid() || is_resident(model.normal_map));
+    }
+
+    // Shaders are specialized on what a model uses, so materials don't pay for features they don't have.
+    // Models are drawn in buckets of one vertex format and material, with the light tier picked per frame.
+    static constexpr u32 MaterialBucketCount = 4;
+    static constexpr u32 DrawBucketCount = VertexFormatCount * MaterialBucketCount;
+    // Every level of every model can be drawn in the same frame
+    static constexpr usize MaxDraws = MaxModels * MaxMeshLods;
+    [[nodiscard]] static u32 draw_bucket(const Model& model) {
+        return static_cast<u32>(model.vertex_format) * MaterialBucketCount
+             + (model.normal_map.is_valid() ? 1 : 0)
+             + (model.alpha_cutoff > 0.0f ? 2 : 0);
+    }
+
+    enum class LightTier : u32 {
+        // Only the ambient term, the clusters aren't read
+        None,
+        // Each cluster's light loop is bounded by FewLights
+        Few,
+        Clustered,
+    };
+    static constexpr u32 LightTierCount = 3;
+    static constexpr u32 FewLights = 8;
+    [[nodiscard]] static constexpr LightTier light_tier(const u32 light_count) {
+        return light_count == 0 ? LightTier::None : light_count <= FewLights ? LightTier::Few : LightTier::Clustered;
+    }
+    [[nodiscard]] static constexpr usize variant_index(const u32 bucket, const LightTier tier) {
+        return bucket * LightTierCount + static_cast<u32>(tier);
+    }
+    [[nodiscard]] static constexpr bool is_alpha_tested(const u32 bucket) {
+        return (bucket & 2) != 0;
+    }
+    // Bit per draw bucket with resident models in the render queue
+    [[nodiscard]] u32 queued_buckets() const;
+
+    // Compiles every light tier of a bucket the first time a model needs it
+    [[nodiscard]] Result<void> create_variants(const Engine& engine, u32 bucket);
+
+    // Matches Draw in pbr_cull.comp, one per level of detail of each model with queued instances
+    struct CullDraw {
+        vk::DrawIndexedIndirectCommand command = {};
+        u32 bucket = 0;
+        alignas(16) glm::vec4 bounds = {};
+    };
+    static_assert(sizeof(CullDraw) == 48);
+
+    // Matches pbr.vert and pbr.frag
+    struct DrawPush {
+        u32 instance_buffer = BindlessHeap::InvalidIndex;
+        u32 visible_buffer = BindlessHeap::InvalidIndex;
+    };
+
+    struct CullPush {
+        std::array<glm::vec4, 6> planes = {};
+        u32 instance_offset = 0;
+        u32 instance_count = 0;
+        u32 draw_count = 0;
+    };
+
+    template <typename T> struct PendingTexture {
+        TextureHandle texture = {};
+        std::future<Result<T>> data = {};
+    };
+    // A streamed texture's image holds the source's levels from top_level down, and those above loaded_level are still
+    // waiting on their upload. It never shrinks past base_level, the first level within StreamedBaseExtent.
+    struct StreamedTexture {
+        TextureHandle texture = {};
+        CompressedImage source = {};
+        u32 base_level = 0;
+        u32 top_level = 0;
+        u32 loaded_level = 0;
+        u32 idle_frames = 0;
+    };
+    // Pixels covered by one model space unit at the nearest point of the instance's bounds
+    [[nodiscard]] static f32 pixels_per_model_unit(
+        const DefaultPipeline::ViewProjectionUniform& vp, const Model& model, const Transform3Df& transform
+    );
+    // Estimates how far apart neighbouring pixels sample each texture, from the queued models' distances
+    void update_uv_per_pixel(const DefaultPipeline& pipeline);
+    [[nodiscard]] Result<void> grow_streamed_texture(
+        const Engine& engine, UploadQueue& uploads, StreamedTexture& streamed, u32 top_level
+    );
+    [[nodiscard]] Result<vk::DeviceSize> upload_streamed_level(const Engine& engine, UploadQueue& uploads, StreamedTexture& streamed);
+    [[nodiscard]] bool can_evict_mip(TextureHandle texture) const;
+
+    template <typename T> struct PendingModel {
+        ModelHandle model = {};
+        std::future<Result<T>> data = {};
+    };
+    struct RetiredGeometry {
+        u64 serial = 0;
+        Model model = {};
+    };
+
+    // Owned by the DefaultPipeline, kept for variants created after create
+    std::array<vk::DescriptorSetLayout, 2> m_draw_set_layouts = {};
+    // Indexed by variant_index, null until created
+    std::array<std::array<vk::ShaderEXT, 2>, DrawBucketCount * LightTierCount> m_shaders = {};
+    vk::ShaderEXT m_depth_shader = {};
+
+    GpuBuffer m_instance_buffer = {};
+    DrawPush m_draw_push = {};
 
     vk::DescriptorPool m_descriptor_pool = {};
-    vk::DescriptorSet m_texture_set = {};
 
-    std::vector<Texture> m_textures = {};
-    std::vector<Model> m_models = {};
+    vk::DescriptorSetLayout m_cull_set_layout = {};
+    vk::PipelineLayout m_cull_pipeline_layout = {};
+    vk::ShaderEXT m_cull_shader = {};
+    vk::ShaderEXT m_compact_shader = {};
+    vk::DescriptorSet m_cull_set = {};
+    GpuBuffer m_draw_staging_buffer = {};
+    GpuBuffer m_draw_buffer = {};
+    GpuBuffer m_visible_buffer = {};
+    GpuBuffer m_indirect_buffer = {};
+    GpuBuffer m_count_buffer = {};
+
+    std::array<GpuBuffer, VertexFormatCount> m_vertex_buffers = {};
+    std::array<GpuBuffer, VertexFormatCount> m_position_buffers = {};
+    GpuBuffer m_index_buffer = {};
+    std::array<FreeListAllocator, VertexFormatCount> m_vertex_allocators = {};
+    FreeListAllocator m_index_allocator = {};
+
+    SlotMap<Texture> m_textures = {};
+    SlotMap<Model> m_models = {};
+    std::vector<RetiredGeometry> m_retired_geometry = {};
     std::vector<RenderTicket> m_render_queue = {};
+    // Each queue position's model and level from the last select_lods
+    std::vector<std::pair<ModelHandle, u32>> m_previous_lods = {};
+
+    std::vector<PendingTexture<ImageData>> m_pending_textures = {};
+    std::vector<PendingTexture<CompressedImage>> m_pending_compressed_textures = {};
+    std::vector<PendingModel<ModelData>> m_pending_models = {};
+    std::vector<PendingModel<BakedModel>> m_pending_baked_models = {};
+    std::vector<PendingTexture<CompressedImage>> m_pending_streamed_textures = {};
+    std::vector<StreamedTexture> m_streamed_textures = {};
+    // By texture slot, the smallest uv step between pixels of any queued model using it, infinite when none do
+    std::vector<f32> m_uv_per_pixel = {};
+    u64 m_eviction_serial = 0;
 };
 
 } // namespace hg
@@ -0,0 +1,107 @@
+#pragma once
+
+#include "hg_utils.h"
+
+#include <array>
+#include <atomic>
+#include <deque>
+#include <filesystem>
+#include <memory>
+#include <mutex>
+#include <span>
+#include <vector>
+
+namespace hg {
+
+struct ProfileScope {
+    // Names are never copied, so string literals are expected
+    const char* name = nullptr;
+    u64 begin_ns = 0;
+    u64 end_ns = 0;
+    u32 thread = 0;
+    u32 depth = 0;
+};
+
+struct FrameStats {
+    u64 frame = 0;
+    u64 begin_ns = 0;
+    u64 end_ns = 0;
+    std::vector<ProfileScope> cpu_scopes = {};
+    // Relative to the first timestamp of the frame, filled in once the gpu has finished the frame
+    std::vector<ProfileScope> gpu_scopes = {};
+};
+
+// Each thread records into its own ring without locking, and next_frame gathers them into per frame stats.
+// A thread that fills its ring between two next_frame calls drops its later scopes.
+class Profiler {
+public:
+    static constexpr usize FrameHistory = 128;
+    static constexpr usize ThreadCapacity = 4096;
+    static constexpr usize MaxDepth = 32;
+
+    Profiler() = default;
+    Profiler(const Profiler&) = delete;
+    Profiler& operator=(const Profiler&) = delete;
+    Profiler(Profiler&&) = delete;
+    Profiler& operator=(Profiler&&) = delete;
+
+    void begin_cpu_scope(const char* name);
+    void end_cpu_scope();
+
+    // Closes the current frame, only call from one thread
+    void next_frame();
+    void add_gpu_scopes(u64 frame, std::span<const ProfileScope> scopes);
+
+    [[nodiscard]] u64 frame() const { return m_frame; }
+    // Finished frames, oldest first
+    [[nodiscard]] const std::deque<FrameStats>& history() const { return m_history; }
+
+    [[nodiscard]] Result<void> export_chrome_trace(const std::filesystem::path& path) const;
+
+    [[nodiscard]] static u64 now_ns() {
+        return static_cast<u64>(std::chrono::duration_cast<std::chrono::nanoseconds>(
+            std::chrono::steady_clock::now().time_since_epoch()
+        ).count());
+    }
+
+private:
+    struct OpenScope {
+        const char* name = nullptr;
+        u64 begin_ns = 0;
+    };
+
+    struct ThreadEvents {
+        // Slots from read to written are published to the collecting thread, the rest belong to the recording thread
+        std::array<ProfileScope, ThreadCapacity> scopes = {};
+        std::atomic<u64> written = 0;
+        std::atomic<u64> read = 0;
+        // Only touched by the recording thread
+        std::array<OpenScope, MaxDepth> open = {};
+        u32 depth = 0;
+        u32 thread = 0;
+    };
+
+    [[nodiscard]] ThreadEvents& thread_events();
+
+    std::mutex m_threads_mutex = {};
+    std::vector<std::unique_ptr<ThreadEvents>> m_threads = {};
+
+    u64 m_frame = 0;
+    u64 m_frame_begin_ns = now_ns();
+    std::deque<FrameStats> m_history = {};
+};
+
+inline Profiler g_profiler = {};
+
+class CpuScope {
+public:
+    explicit CpuScope(const char* name) { g_profiler.begin_cpu_scope(name); }
+    ~CpuScope() { g_profiler.end_cpu_scope(); }
+
+    CpuScope(const CpuScope&) = delete;
+    CpuScope& operator=(const CpuScope&) = delete;
+    CpuScope(CpuScope&&) = delete;
+    CpuScope& operator=(CpuScope&&) = delete;
+};
+
+} // namespace hg
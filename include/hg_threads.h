@@ -0,0 +1,61 @@
+#pragma once
+
+#include "hg_utils.h"
+
+#include <condition_variable>
+#include <deque>
+#include <functional>
+#include <future>
+#include <memory>
+#include <mutex>
+#include <thread>
+#include <vector>
+
+namespace hg {
+
+class ThreadPool {
+public:
+    // Leaves one hardware thread for the caller by default
+    explicit ThreadPool(usize thread_count = default_thread_count());
+    ~ThreadPool();
+
+    ThreadPool(const ThreadPool&) = delete;
+    ThreadPool& operator=(const ThreadPool&) = delete;
+    ThreadPool(ThreadPool&&) = delete;
+    ThreadPool& operator=(ThreadPool&&) = delete;
+
+    [[nodiscard]] usize thread_count() const { return m_threads.size(); }
+
+    template <typename F> [[nodiscard]] std::future<std::invoke_result_t<F>> submit(F&& job) {
+        auto task = std::make_shared<std::packaged_task<std::invoke_result_t<F>()>>(std::forward<F>(job));
+        auto future = task->get_future();
+        {
+            const std::lock_guard lock{m_mutex};
+            ASSERT(!m_stopping);
+            m_jobs.emplace_back([task] { (*task)(); });
+        }
+        m_job_available.notify_one();
+        return future;
+    }
+
+    [[nodiscard]] static usize default_thread_count() {
+        const usize hardware = std::thread::hardware_concurrency();
+        return hardware > 1 ? hardware - 1 : 1;
+    }
+
+private:
+    void work();
+
+    std::vector<std::thread> m_threads = {};
+    std::deque<std::function<void()>> m_jobs = {};
+    std::mutex m_mutex = {};
+    std::condition_variable m_job_available = {};
+    bool m_stopping = false;
+};
+
+template <typename T> [[nodiscard]] bool is_ready(const std::future<T>& future) {
+    ASSERT(future.valid());
+    return future.wait_for(std::chrono::seconds{0}) == std::future_status::ready;
+}
+
+} // namespace hg
@@ -0,0 +1,167 @@
+#pragma once
+
+#include "hg_pch.h"
+#include "hg_utils.h"
+#include "hg_vulkan_engine.h"
+
+#include <deque>
+#include <span>
+#include <unordered_set>
+#include <vector>
+
+namespace hg {
+
+// Batches transfers through a persistently mapped staging ring and submits them together on flush.
+// Work submitted to engine.queue after a flush may use everything recorded before that flush.
+class UploadQueue {
+public:
+    using Token = u64;
+
+    struct Config {
+        vk::DeviceSize staging_size = 64 * 1024 * 1024;
+        bool use_transfer_queue = true;
+    };
+
+    [[nodiscard]] static Result<UploadQueue> create(const Engine& engine, const Config& config);
+    void destroy(const Engine& engine) const;
+
+    [[nodiscard]] Result<Token> upload_buffer(
+        const Engine& engine, const GpuBuffer& dst, const void* data, vk::DeviceSize size, vk::DeviceSize offset
+    );
+    [[nodiscard]] Result<Token> upload_image(
+        const Engine& engine, vk::Image dst, const GpuImage::Data& data, vk::ImageLayout final_layout,
+        const vk::ImageSubresourceRange& subresource = {vk::ImageAspectFlagBits::eColor, 0, vk::RemainingMipLevels, 0, 1}
+    );
+    // Like upload_image, but write(u8*) fills the size bytes of staging itself, so an image generated for upload, such as
+    // through create_normals_from_heightmap into an ImageView, is written once instead of being copied in
+    template <typename F> [[nodiscard]] Result<Token> upload_image_with(
+        const Engine& engine, vk::Image dst, vk::DeviceSize size, vk::Extent3D extent, vk::ImageLayout final_layout, F write,
+        const vk::ImageSubresourceRange& subresource = {vk::ImageAspectFlagBits::eColor, 0, vk::RemainingMipLevels, 0, 1}
+    ) {
+        ASSERT(dst != nullptr);
+        ASSERT(size > 0);
+
+        vk::Buffer staging_buffer = {};
+        vk::DeviceSize staging_offset = 0;
+        const auto staging = reserve_staging(engine, size, staging_buffer, staging_offset);
+        if (staging.has_err())
+            return staging.err();
+        write(*staging);
+        return copy_staged_image(engine, dst, staging_buffer, staging_offset, extent, final_layout, subresource);
+    }
+    // Uploads a mip chain into consecutive levels from first_level, such as a block compressed image's
+    struct ImageLevel {
+        const void* data = nullptr;
+        vk::DeviceSize size = 0;
+        vk::Extent3D extent = {};
+    };
+    [[nodiscard]] Result<Token> upload_image_levels(
+        const Engine& engine, vk::Image dst, std::span<const ImageLevel> levels, vk::ImageLayout final_layout,
+        vk::ImageAspectFlags aspect = vk::ImageAspectFlagBits::eColor, u32 first_level = 0
+    );
+    // Expects every level of the image to be in current_layout, and leaves them all in final_layout
+    [[nodiscard]] Result<Token> generate_mipmaps(
+        const Engine& engine, vk::Image image, u32 mip_levels, vk::Extent3D extent, vk::Format format,
+        vk::ImageLayout current_layout, vk::ImageLayout final_layout
+    );
+    // Copies level_count levels of src, starting at src_first_level, into dst's levels from dst_first_level, on the
+    // main queue. dst_extent is the extent of dst's first copied level.
+    // Every copied level of src has to be in src_layout and is left in TransferSrcOptimal. dst's levels up to the last
+    // copied one are discarded and left in final_layout, so those above dst_first_level can be uploaded later.
+    [[nodiscard]] Result<Token> copy_image_levels(
+        const Engine& engine, vk::Image src, vk::ImageLayout src_layout, u32 src_first_level, vk::Image dst,
+        u32 dst_first_level, u32 level_count, vk::Extent3D dst_extent, vk::ImageLayout final_layout,
+        vk::ImageAspectFlags aspect = vk::ImageAspectFlagBits::eColor
+    );
+
+    // Submits everything recorded since the last flush, returning the token signalled at its completion
+    [[nodiscard]] Result<Token> flush(const Engine& engine);
+    [[nodiscard]] Result<void> wait(const Engine& engine, Token token) const;
+    [[nodiscard]] bool is_complete(const Engine& engine, Token token) const;
+
+    // The token that the next flush will signal
+    [[nodiscard]] Token pending_token() const { return m_batch_token; }
+    [[nodiscard]] bool uses_transfer_queue() const { return m_transfer_family != m_graphics_family; }
+    // Every byte copied into staging since creation, for measuring upload throughput
+    [[nodiscard]] u64 staged_bytes() const { return m_staged_bytes; }
+
+private:
+    static constexpr vk::DeviceSize StagingAlignment = 16;
+
+    // Each queue signals its own timeline, so the values on each only ever increase. On the graphics timeline the
+    // release of buffers back to the transfer queue signals the odd value before a token, the batch's end the even one.
+    // The transfer timeline is signalled with the token itself.
+    static constexpr u64 release_value(const Token token) { return token * 2 - 1; }
+    static constexpr u64 graphics_value(const Token token) { return token * 2; }
+
+    struct Stream {
+        vk::CommandPool pool = {};
+        vk::CommandBuffer cmd = {};
+        std::vector<vk::CommandBuffer> free_cmds = {};
+    };
+
+    struct Batch {
+        Token token = 0;
+        vk::DeviceSize ring_end = 0;
+        vk::DeviceSize ring_bytes = 0;
+        vk::CommandBuffer release_cmd = {};
+        vk::CommandBuffer transfer_cmd = {};
+        vk::CommandBuffer graphics_cmd = {};
+        std::vector<GpuBuffer> dedicated_staging = {};
+    };
+
+    [[nodiscard]] Result<vk::CommandBuffer> cmd_transfer(const Engine& engine);
+    [[nodiscard]] Result<vk::CommandBuffer> cmd_graphics(const Engine& engine);
+    [[nodiscard]] Result<vk::CommandBuffer> begin_stream(const Engine& engine, Stream& stream);
+    // Moves a buffer the main queue may own to the transfer queue before cmd writes it, it's handed back on flush
+    [[nodiscard]] Result<void> acquire_for_transfer(const Engine& engine, vk::CommandBuffer cmd, vk::Buffer buffer);
+
+    [[nodiscard]] Result<vk::DeviceSize> alloc_staging(const Engine& engine, vk::DeviceSize size);
+    [[nodiscard]] Result<u8*> reserve_staging(
+        const Engine& engine, vk::DeviceSize size, vk::Buffer& out_buffer, vk::DeviceSize& out_offset
+    );
+    [[nodiscard]] Result<void> stage(
+        const Engine& engine, const void* data, vk::DeviceSize size, vk::Buffer& out_buffer, vk::DeviceSize& out_offset
+    );
+    [[nodiscard]] Result<Token> copy_staged_image(
+        const Engine& engine, vk::Image dst, vk::Buffer staging_buffer, vk::DeviceSize staging_offset, vk::Extent3D extent,
+        vk::ImageLayout final_layout, const vk::ImageSubresourceRange& subresource
+    );
+    [[nodiscard]] Result<Token> finish_image_upload(
+        const Engine& engine, vk::CommandBuffer cmd, vk::Image dst, const vk::ImageSubresourceRange& subresource,
+        vk::ImageLayout final_layout
+    );
+    [[nodiscard]] Result<void> retire_oldest(const Engine& engine);
+    void retire_completed(const Engine& engine);
+    void release(const Engine& engine, Batch& batch);
+
+    u32 m_graphics_family = UINT32_MAX;
+    u32 m_transfer_family = UINT32_MAX;
+    vk::Queue m_transfer_queue = {};
+
+    Stream m_graphics = {};
+    Stream m_transfer = {};
+    // Recorded on the main queue and submitted ahead of the transfer stream
+    Stream m_release = {};
+
+    vk::Semaphore m_timeline = {};
+    vk::Semaphore m_transfer_timeline = {};
+    Token m_last_submitted = 0;
+    Token m_batch_token = 1;
+    bool m_batch_empty = true;
+
+    GpuBuffer m_staging = {};
+    vk::DeviceSize m_staging_size = 0;
+    vk::DeviceSize m_head = 0;
+    vk::DeviceSize m_tail = 0;
+    vk::DeviceSize m_used = 0;
+    vk::DeviceSize m_batch_bytes = 0;
+    std::vector<GpuBuffer> m_batch_dedicated = {};
+    // Buffers written on the transfer queue in this batch, and every buffer that has been handed to the main queue
+    std::vector<vk::Buffer> m_batch_buffers = {};
+    std::unordered_set<VkBuffer> m_graphics_buffers = {};
+    std::deque<Batch> m_in_flight = {};
+    u64 m_staged_bytes = 0;
+};
+
+} // namespace hg
@@ -1,13 +1,20 @@
 #pragma once
 
+#include <algorithm>
+#include <array>
 #include <chrono>
 #include <cstdint>
 #include <format>
 #include <iostream>
+#include <new>
+#include <optional>
+#include <span>
+#include <string>
 #include <string_view>
 #include <type_traits>
 #include <utility>
 #include <variant>
+#include <vector>
 
 using i8 = std::int8_t;
 using i16 = std::int16_t;
@@ -108,6 +115,231 @@ private:
     std::chrono::high_resolution_clock::time_point m_begin = std::chrono::high_resolution_clock::now();
 };
 
+// Stable least significant digit radix sort by the upper 32 bits, so the lower bits can carry a payload such as an index.
+// Scratch has to be as large as values, digits that are the same in every value are skipped.
+inline void radix_sort(const std::span<u64> values, const std::span<u64> scratch) {
+    ASSERT(scratch.size() >= values.size());
+    if (values.size() < 2)
+        return;
+
+    std::span<u64> src = values;
+    std::span<u64> dst = scratch.first(values.size());
+    for (u32 shift = 32; shift < 64; shift += 8) {
+        std::array<u32, 256> offsets = {};
+        for (const u64 value : src) {
+            ++offsets[(value >> shift) & 0xff];
+        }
+        if (offsets[(src[0] >> shift) & 0xff] == src.size())
+            continue;
+
+        u32 offset = 0;
+        for (auto& count : offsets) {
+            const u32 digit_count = count;
+            count = offset;
+            offset += digit_count;
+        }
+        for (const u64 value : src) {
+            dst[offsets[(value >> shift) & 0xff]++] = value;
+        }
+        std::swap(src, dst);
+    }
+    if (src.data() != values.data())
+        std::ranges::copy(src, values.begin());
+}
+
+// The contents of a json string literal, quotes not included
+[[nodiscard]] inline std::string escape_json(const std::string_view text) {
+    std::string escaped = {};
+    escaped.reserve(text.size());
+    for (const char c : text) {
+        if (c == '"' || c == '\\') {
+            escaped += '\\';
+            escaped += c;
+        } else if (static_cast<unsigned char>(c) < 0x20) {
+            escaped += std::format("\\u{:04x}", static_cast<u32>(c));
+        } else {
+            escaped += c;
+        }
+    }
+    return escaped;
+}
+
+// Starts every allocation on its own cache line, so vector loads from the front of a buffer never straddle two
+template <typename T, usize Alignment = 64> struct AlignedAllocator {
+    static_assert(Alignment >= alignof(T));
+    using value_type = T;
+
+    constexpr AlignedAllocator() = default;
+    template <typename U> constexpr AlignedAllocator(const AlignedAllocator<U, Alignment>&) {}
+    template <typename U> struct rebind {
+        using other = AlignedAllocator<U, Alignment>;
+    };
+
+    [[nodiscard]] T* allocate(const usize count) {
+        return static_cast<T*>(::operator new(count * sizeof(T), std::align_val_t{Alignment}));
+    }
+    void deallocate(T* ptr, const usize) { ::operator delete(ptr, std::align_val_t{Alignment}); }
+
+    template <typename U> constexpr bool operator==(const AlignedAllocator<U, Alignment>&) const { return true; }
+};
+
+class FreeListAllocator {
+public:
+    constexpr FreeListAllocator() = default;
+    explicit FreeListAllocator(const usize capacity) : m_capacity{capacity}, m_free{{0, capacity}} {}
+
+    [[nodiscard]] constexpr usize capacity() const { return m_capacity; }
+
+    [[nodiscard]] std::optional<usize> alloc(const usize size) {
+        ASSERT(size > 0);
+        const auto range = std::ranges::find_if(m_free, [size](const Range r) { return r.size >= size; });
+        if (range == m_free.end())
+            return std::nullopt;
+
+        const usize offset = range->offset;
+        range->offset += size;
+        range->size -= size;
+        if (range->size == 0)
+            m_free.erase(range);
+        return offset;
+    }
+
+    void free(const usize offset, const usize size) {
+        ASSERT(size > 0);
+        ASSERT(offset + size <= m_capacity);
+
+        const auto next = std::ranges::find_if(m_free, [offset](const Range r) { return r.offset > offset; });
+        ASSERT(next == m_free.end() || offset + size <= next->offset);
+        ASSERT(next == m_free.begin() || (next - 1)->offset + (next - 1)->size <= offset);
+        auto inserted = m_free.insert(next, {offset, size});
+        if (inserted + 1 != m_free.end() && inserted->offset + inserted->size == (inserted + 1)->offset) {
+            inserted->size += (inserted + 1)->size;
+            m_free.erase(inserted + 1);
+        }
+        if (inserted != m_free.begin() && (inserted - 1)->offset + (inserted - 1)->size == inserted->offset) {
+            (inserted - 1)->size += inserted->size;
+            m_free.erase(inserted);
+        }
+    }
+
+private:
+    struct Range {
+        usize offset = 0;
+        usize size = 0;
+    };
+
+    usize m_capacity = 0;
+    std::vector<Range> m_free = {};
+};
+
+// The generation changes every time the slot is erased, so stale handles are caught instead of aliasing whatever reuses it
+template <typename T> struct Handle {
+    u32 index = UINT32_MAX;
+    u32 generation = 0;
+
+    [[nodiscard]] constexpr bool is_valid() const { return index != UINT32_MAX; }
+    [[nodiscard]] constexpr bool operator==(const Handle&) const = default;
+};
+
+// Slots are only reused once the serial given when they were erased has completed, so anything the gpu may still
+// read through a slot's index, such as a descriptor, is left alone until the gpu is done with it
+template <typename T> class SlotMap {
+public:
+    constexpr SlotMap() = default;
+    explicit SlotMap(const u32 capacity) : m_capacity{capacity} {}
+
+    [[nodiscard]] constexpr u32 capacity() const { return m_capacity; }
+    // One past the highest slot index that has been used
+    [[nodiscard]] u32 slot_count() const { return to_u32(m_slots.size()); }
+    [[nodiscard]] u32 size() const { return m_size; }
+
+    [[nodiscard]] std::optional<Handle<T>> insert(T value, const u64 completed_serial) {
+        std::erase_if(m_retired, [&](const Retired retired) {
+            if (retired.serial > completed_serial)
+                return false;
+            m_free.push_back(retired.index);
+            return true;
+        });
+
+        u32 index = 0;
+        if (!m_free.empty()) {
+            index = m_free.back();
+            m_free.pop_back();
+        } else if (m_slots.size() < m_capacity) {
+            index = to_u32(m_slots.size());
+            m_slots.emplace_back();
+        } else {
+            return std::nullopt;
+        }
+
+        auto& slot = m_slots[index];
+        ASSERT(!slot.live);
+        slot.value = std::move(value);
+        slot.live = true;
+        ++m_size;
+        return Handle<T>{index, slot.generation};
+    }
+
+    // The value is dropped immediately, the slot once release_serial has completed
+    void erase(const Handle<T> handle, const u64 release_serial) {
+        ASSERT(contains(handle));
+        auto& slot = m_slots[handle.index];
+        slot.value = {};
+        slot.live = false;
+        ++slot.generation;
+        --m_size;
+        m_retired.push_back({handle.index, release_serial});
+    }
+
+    [[nodiscard]] bool contains(const Handle<T> handle) const {
+        return handle.index < m_slots.size() && m_slots[handle.index].live && m_slots[handle.index].generation == handle.generation;
+    }
+
+    [[nodiscard]] T& operator[](const Handle<T> handle) {
+        ASSERT(contains(handle));
+        return m_slots[handle.index].value;
+    }
+    [[nodiscard]] const T& operator[](const Handle<T> handle) const {
+        ASSERT(contains(handle));
+        return m_slots[handle.index].value;
+    }
+
+    // Access by slot index, for passes that visit slots in index order
+    [[nodiscard]] bool is_live(const u32 index) const { return index < m_slots.size() && m_slots[index].live; }
+    [[nodiscard]] const T& at(const u32 index) const {
+        ASSERT(is_live(index));
+        return m_slots[index].value;
+    }
+    [[nodiscard]] Handle<T> handle_at(const u32 index) const {
+        ASSERT(is_live(index));
+        return Handle<T>{index, m_slots[index].generation};
+    }
+
+    template <typename F> void for_each(F f) const {
+        for (const auto& slot : m_slots) {
+            if (slot.live)
+                f(slot.value);
+        }
+    }
+
+private:
+    struct Slot {
+        T value = {};
+        u32 generation = 0;
+        bool live = false;
+    };
+    struct Retired {
+        u32 index = 0;
+        u64 serial = 0;
+    };
+
+    u32 m_capacity = 0;
+    u32 m_size = 0;
+    std::vector<Slot> m_slots = {};
+    std::vector<u32> m_free = {};
+    std::vector<Retired> m_retired = {};
+};
+
 enum class Err : u8 {
     Unknown = 0,
 
@@ -122,6 +354,7 @@ enum class Err : u8 {
     VkQueueUnavailable,
     VkSwapchainImagesUnavailable,
     InvalidWindowSize,
+    StorageImagesUnsupported,
 
     // Vulkan
     CouldNotCreateVkInstance,
@@ -139,6 +372,7 @@ enum class Err : u8 {
     CouldNotCreateVkDescriptorPool,
     CouldNotAllocateVkDescriptorSets,
     CouldNotCreateVkSampler,
+    CouldNotCreateVkQueryPool,
 
     CouldNotCreateGpuBuffer,
     CouldNotWriteGpuBuffer,
@@ -146,6 +380,11 @@ enum class Err : u8 {
     CouldNotCreateGpuImageView,
     CouldNotWriteGpuImage,
     CouldNotGenerateMipmaps,
+    OutOfGpuMemory,
+    GeometryArenaFull,
+    TextureRegistryFull,
+    ModelRegistryFull,
+    BindlessHeapFull,
 
     CouldNotBeginVkCommandBuffer,
     CouldNotEndVkCommandBuffer,
@@ -153,6 +392,8 @@ enum class Err : u8 {
     CouldNotAcquireVkSwapchainImage,
     CouldNotPresentVkSwapchainImage,
     CouldNotWaitForVkFence,
+    CouldNotWaitForVkPresent,
+    CouldNotWaitForVkSemaphore,
     CouldNotWaitForVkQueue,
     CouldNotWaitForVkDevice,
 
@@ -161,8 +402,15 @@ enum class Err : u8 {
     ShaderFileInvalid,
     ImageFileNotFound,
     ImageFileInvalid,
+    ImageFormatUnsupported,
+    SampleCountUnsupported,
+    CouldNotWriteImageFile,
     GltfFileNotFound,
     GltfFileInvalid,
+    MeshFileNotFound,
+    MeshFileInvalid,
+    CouldNotWriteMeshFile,
+    CouldNotWriteTraceFile,
 
     // ... add more as needed
 };
@@ -183,6 +431,7 @@ constexpr std::string_view to_string(Err code) {
         HG_MAKE_ERROR_STRING(VkQueueUnavailable);
         HG_MAKE_ERROR_STRING(VkSwapchainImagesUnavailable);
         HG_MAKE_ERROR_STRING(InvalidWindowSize);
+        HG_MAKE_ERROR_STRING(StorageImagesUnsupported);
 
         // Vulkan
         HG_MAKE_ERROR_STRING(CouldNotCreateVkInstance);
@@ -200,6 +449,7 @@ constexpr std::string_view to_string(Err code) {
         HG_MAKE_ERROR_STRING(CouldNotCreateVkDescriptorPool);
         HG_MAKE_ERROR_STRING(CouldNotAllocateVkDescriptorSets);
         HG_MAKE_ERROR_STRING(CouldNotCreateVkSampler);
+        HG_MAKE_ERROR_STRING(CouldNotCreateVkQueryPool);
 
         HG_MAKE_ERROR_STRING(CouldNotCreateGpuBuffer);
         HG_MAKE_ERROR_STRING(CouldNotWriteGpuBuffer);
@@ -207,6 +457,11 @@ constexpr std::string_view to_string(Err code) {
         HG_MAKE_ERROR_STRING(CouldNotCreateGpuImageView);
         HG_MAKE_ERROR_STRING(CouldNotWriteGpuImage);
         HG_MAKE_ERROR_STRING(CouldNotGenerateMipmaps);
+        HG_MAKE_ERROR_STRING(OutOfGpuMemory);
+        HG_MAKE_ERROR_STRING(GeometryArenaFull);
+        HG_MAKE_ERROR_STRING(TextureRegistryFull);
+        HG_MAKE_ERROR_STRING(ModelRegistryFull);
+        HG_MAKE_ERROR_STRING(BindlessHeapFull);
 
         HG_MAKE_ERROR_STRING(CouldNotBeginVkCommandBuffer);
         HG_MAKE_ERROR_STRING(CouldNotEndVkCommandBuffer);
@@ -214,6 +469,8 @@ constexpr std::string_view to_string(Err code) {
         HG_MAKE_ERROR_STRING(CouldNotAcquireVkSwapchainImage);
         HG_MAKE_ERROR_STRING(CouldNotPresentVkSwapchainImage);
         HG_MAKE_ERROR_STRING(CouldNotWaitForVkFence);
+        HG_MAKE_ERROR_STRING(CouldNotWaitForVkPresent);
+        HG_MAKE_ERROR_STRING(CouldNotWaitForVkSemaphore);
         HG_MAKE_ERROR_STRING(CouldNotWaitForVkQueue);
         HG_MAKE_ERROR_STRING(CouldNotWaitForVkDevice);
 
@@ -222,8 +479,15 @@ constexpr std::string_view to_string(Err code) {
         HG_MAKE_ERROR_STRING(ShaderFileInvalid);
         HG_MAKE_ERROR_STRING(ImageFileNotFound);
         HG_MAKE_ERROR_STRING(ImageFileInvalid);
+        HG_MAKE_ERROR_STRING(ImageFormatUnsupported);
+        HG_MAKE_ERROR_STRING(SampleCountUnsupported);
+        HG_MAKE_ERROR_STRING(CouldNotWriteImageFile);
         HG_MAKE_ERROR_STRING(GltfFileNotFound);
         HG_MAKE_ERROR_STRING(GltfFileInvalid);
+        HG_MAKE_ERROR_STRING(MeshFileNotFound);
+        HG_MAKE_ERROR_STRING(MeshFileInvalid);
+        HG_MAKE_ERROR_STRING(CouldNotWriteMeshFile);
+        HG_MAKE_ERROR_STRING(CouldNotWriteTraceFile);
 
         // ... add more as needed
     }
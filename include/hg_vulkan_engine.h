@@ -2,13 +2,25 @@
 
 #include "hg_pch.h"
 #include "hg_utils.h"
+#include "hg_profiler.h"
 
 #include <array>
+#include <atomic>
+#include <chrono>
+#include <deque>
 #include <filesystem>
+#include <functional>
 #include <span>
+#include <unordered_map>
+#include <utility>
+#include <vector>
 
 namespace hg {
 
+class DeletionQueue;
+class BindlessHeap;
+class MemoryTracker;
+
 struct Engine {
     vk::Instance instance = {};
     vk::DebugUtilsMessengerEXT debug_messenger = {};
@@ -19,20 +31,237 @@ struct Engine {
     u32 queue_family_index = UINT32_MAX;
     vk::Queue queue = {};
 
+    // Same as the main queue when the gpu has no dedicated transfer family
+    u32 transfer_queue_family_index = UINT32_MAX;
+    vk::Queue transfer_queue = {};
+
     vk::CommandPool command_pool = {};
     vk::CommandPool single_time_command_pool = {};
 
-    [[nodiscard]] static Result<Engine> create();
+    // No glfw or VK_KHR_swapchain, so only a HeadlessTarget can be drawn into
+    bool headless = false;
+    // VK_KHR_present_id and VK_KHR_present_wait are enabled
+    bool present_wait = false;
+    // VK_EXT_memory_budget is enabled, so VMA reports the driver's budget rather than estimating it from heap sizes
+    bool memory_budget = false;
+    // Block compressed formats that can be sampled, see is_format_sampleable
+    bool texture_compression_bc = false;
+    bool texture_compression_etc2 = false;
+    bool texture_compression_astc = false;
+    // Storage images can be indexed and updated after bind, without them BindlessHeap has no storage image binding
+    // and GpuNoiseGenerator can't be created
+    bool storage_images = false;
+
+    // Shared by every copy of the engine, so resources can be retired through a const engine
+    DeletionQueue* deletions = nullptr;
+    // Shared the same way, every render system indexes into its one descriptor set
+    BindlessHeap* bindless = nullptr;
+    // Shared the same way, counts every GpuBuffer and GpuImage allocation
+    MemoryTracker* memory = nullptr;
+    // Shared the same way, a hash of each set layout's bindings from create_descriptor_set_layout, so shader binaries
+    // can be cached by what their layouts contain rather than by handle
+    std::unordered_map<VkDescriptorSetLayout, u64>* set_layout_hashes = nullptr;
+
+    // Driver binaries of compiled shaders are kept here between runs, an empty path always compiles the spirv
+    std::filesystem::path shader_cache = "shader_cache";
+
+    struct Config {
+        bool headless = false;
+    };
+
+    [[nodiscard]] static Result<Engine> create(const Config& config);
     void destroy() const;
 };
 
-constexpr u32 MaxFramesInFlight = 2;
-constexpr u32 MaxSwapchainImages = 3;
+// Destroys resources once every submission that could have used them has finished.
+// Deleters pushed before a submit() run after the serial it returns has completed, so they must capture by value.
+class DeletionQueue {
+public:
+    using Deleter = std::function<void(const Engine&)>;
+
+    void push(Deleter deleter) {
+        ASSERT(deleter != nullptr);
+        m_deleters.push_back({next_serial(), std::move(deleter)});
+    }
+
+    // The serial of the next submission, anything that submission may use is safe to free once it completes
+    [[nodiscard]] u64 next_serial() const { return m_submitted + 1; }
+    [[nodiscard]] u64 completed_serial() const { return m_completed; }
+
+    // Call for each submission to the queue, in submission order
+    [[nodiscard]] u64 submit() { return ++m_submitted; }
+
+    // Expects every submission up to completed to have finished
+    void flush(const Engine& engine, u64 completed);
+    // Expects the gpu to be idle, runs deleters that have not been submitted yet too
+    void flush_all(const Engine& engine);
+
+private:
+    struct Entry {
+        u64 serial = 0;
+        Deleter deleter = {};
+    };
+
+    u64 m_submitted = 0;
+    u64 m_completed = 0;
+    std::deque<Entry> m_deleters = {};
+};
+
+// Inferred from a buffer's or image's usage when it is created
+enum class MemoryCategory : u32 {
+    // Vertex and index buffers
+    Geometry,
+    // Sampled and storage images
+    Texture,
+    // Color and depth attachments
+    RenderTarget,
+    // Buffers that are only copied from
+    Staging,
+    // Uniform, storage and indirect buffers
+    Other,
+};
+constexpr usize MemoryCategoryCount = 5;
+
+enum class MemoryPressure : u32 {
+    None,
+    // Streaming should hold back new uploads
+    Throttle,
+    // Resident data should be evicted, such as the top mips of textures
+    Evict,
+};
+
+// Counts allocations by category, each allocation's category is kept in its VMA user data until it is freed
+class MemoryTracker {
+public:
+    struct Thresholds {
+        // Fractions of the fullest device local heap's budget
+        f32 throttle = 0.85f;
+        f32 evict = 0.95f;
+    };
+
+    struct CategoryStats {
+        u64 allocations = 0;
+        vk::DeviceSize bytes = 0;
+    };
+
+    void track(VmaAllocator allocator, VmaAllocation allocation, MemoryCategory category);
+    void untrack(VmaAllocator allocator, VmaAllocation allocation);
+
+    [[nodiscard]] CategoryStats get_category(MemoryCategory category) const;
+
+    void set_thresholds(const Thresholds& thresholds) {
+        ASSERT(thresholds.throttle > 0.0f && thresholds.throttle <= thresholds.evict);
+        m_thresholds = thresholds;
+    }
+    [[nodiscard]] const Thresholds& get_thresholds() const { return m_thresholds; }
+
+private:
+    // Allocations may be made from worker threads
+    std::array<std::atomic<u64>, MemoryCategoryCount> m_allocations = {};
+    std::array<std::atomic<vk::DeviceSize>, MemoryCategoryCount> m_bytes = {};
+    Thresholds m_thresholds = {};
+};
+
+struct MemoryReport {
+    struct Heap {
+        // The driver's budget for this process and its usage, including memory allocated outside of VMA
+        vk::DeviceSize budget = 0;
+        vk::DeviceSize usage = 0;
+        // Bytes of VMA's device memory blocks in the heap, and of the allocations inside them
+        vk::DeviceSize block_bytes = 0;
+        vk::DeviceSize allocation_bytes = 0;
+        bool device_local = false;
+    };
+    std::vector<Heap> heaps = {};
+    std::array<MemoryTracker::CategoryStats, MemoryCategoryCount> categories = {};
+
+    u32 block_count = 0;
+    u32 allocation_count = 0;
+    // Free bytes inside VMA's blocks
+    vk::DeviceSize unused_bytes = 0;
+    vk::DeviceSize largest_unused_range = 0;
+    // One minus the largest free range over all free bytes, zero when the free bytes are contiguous
+    f32 fragmentation = 0.0f;
+};
+
+// Walks every VMA block, too slow to call each frame
+[[nodiscard]] MemoryReport get_memory_report(const Engine& engine);
+// Only reads the heap budgets, cheap enough for every frame
+[[nodiscard]] MemoryPressure get_memory_pressure(const Engine& engine);
+
+// Capacities, Window::Config picks how many are used
+constexpr u32 MaxFramesInFlight = 3;
+constexpr u32 MaxSwapchainImages = 8;
+
+// Timestamp queries for each frame in flight, read back into g_profiler once the frame's fence has been waited on
+class GpuProfiler {
+public:
+    static constexpr u32 MaxScopes = 64;
+    static constexpr u32 InvalidScope = UINT32_MAX;
+
+    // Every call is a no-op on gpus without graphics queue timestamps
+    [[nodiscard]] static Result<GpuProfiler> create(const Engine& engine);
+    void destroy(const Engine& engine) const;
+
+    // Expects frame_index's previous submission to have finished
+    void cmd_begin_frame(const Engine& engine, vk::CommandBuffer cmd, u32 frame_index);
+
+    [[nodiscard]] u32 cmd_begin_scope(vk::CommandBuffer cmd, const char* name);
+    void cmd_end_scope(vk::CommandBuffer cmd, u32 scope);
+
+    [[nodiscard]] bool is_supported() const { return m_pools[0] != nullptr; }
+
+private:
+    struct FrameQueries {
+        u64 frame = 0;
+        std::vector<ProfileScope> scopes = {};
+    };
+
+    std::array<vk::QueryPool, MaxFramesInFlight> m_pools = {};
+    std::array<FrameQueries, MaxFramesInFlight> m_frames = {};
+    u32 m_frame_index = 0;
+    u32 m_depth = 0;
+    f64 m_period_ns = 1.0;
+    u64 m_valid_mask = UINT64_MAX;
+};
+
+class GpuScope {
+public:
+    GpuScope(GpuProfiler& profiler, const vk::CommandBuffer cmd, const char* name)
+        : m_profiler{profiler}, m_cmd{cmd}, m_scope{profiler.cmd_begin_scope(cmd, name)} {}
+    ~GpuScope() { m_profiler.cmd_end_scope(m_cmd, m_scope); }
+
+    GpuScope(const GpuScope&) = delete;
+    GpuScope& operator=(const GpuScope&) = delete;
+    GpuScope(GpuScope&&) = delete;
+    GpuScope& operator=(GpuScope&&) = delete;
+
+private:
+    GpuProfiler& m_profiler;
+    vk::CommandBuffer m_cmd = {};
+    u32 m_scope = GpuProfiler::InvalidScope;
+};
+
+// The image a pipeline draws a frame into, in an undefined layout until drawn
+struct RenderTarget {
+    vk::Image image = {};
+    vk::ImageView view = {};
+    vk::Extent2D extent = {};
+    vk::Format format = {};
+    // The target is left in this layout, visible to every later stage
+    vk::ImageLayout final_layout = vk::ImageLayout::ePresentSrcKHR;
+};
 
 class Pipeline {
 public:
     virtual ~Pipeline() = default;
-    virtual void cmd_draw(vk::CommandBuffer cmd, vk::Image render_target, vk::Extent2D window_size) const = 0;
+
+    // Called once the frame's fence has signaled, before recording, with the render target's current extent
+    virtual void begin_frame(const Engine&, vk::Extent2D, u32) {}
+    // A failed draw still leaves cmd complete enough to submit, so the frame can be ended before returning the error
+    [[nodiscard]] virtual Result<void> cmd_draw(
+        vk::CommandBuffer cmd, const RenderTarget& target, u32 frame_index, GpuProfiler& profiler
+    ) const = 0;
 };
 
 class Window {
@@ -40,24 +269,71 @@ public:
     static constexpr vk::Format SwapchainImageFormat = vk::Format::eR8G8B8A8Srgb;
     static constexpr vk::ColorSpaceKHR SwapchainColorSpace = vk::ColorSpaceKHR::eSrgbNonlinear;
 
-    [[nodiscard]] static Result<Window> create(const Engine& engine, bool fullscreen, i32 width, i32 height);
+    struct Config {
+        bool fullscreen = false;
+        // Ignored when fullscreen
+        i32 width = 0;
+        i32 height = 0;
+        // Falls back to fifo when the surface doesn't support it
+        vk::PresentModeKHR present_mode = vk::PresentModeKHR::eFifo;
+        // At most MaxSwapchainImages, zero picks one more than the surface's minimum
+        u32 swapchain_images = 0;
+        // At most MaxFramesInFlight, fewer frames trade throughput for latency
+        u32 frames_in_flight = 2;
+        // Zero leaves the frame rate uncapped
+        f64 frame_rate_limit = 0.0;
+        // Waits for earlier presents to reach the screen before starting a frame, needs engine.present_wait
+        bool low_latency = false;
+        u64 frame_timeout_ns = 1'000'000'000;
+    };
+
+    [[nodiscard]] static Result<Window> create(const Engine& engine, const Config& config);
     void destroy(const Engine& engine) const;
-    [[nodiscard]] Result<void> resize(const Engine& engine);
 
     [[nodiscard]] GLFWwindow* window() const { return m_window; }
     [[nodiscard]] vk::Extent2D extent() const { return m_extent; }
-
+    [[nodiscard]] GpuProfiler& profiler() { return m_profiler; }
+    [[nodiscard]] const Config& config() const { return m_config; }
+    // The present mode in use, which may differ from the requested one
+    [[nodiscard]] vk::PresentModeKHR present_mode() const { return m_present_mode; }
+
+    // The swapchain is recreated when the next frame begins
+    void set_present_mode(vk::PresentModeKHR present_mode);
+    // Waits for the gpu to go idle
+    [[nodiscard]] Result<void> set_frames_in_flight(const Engine& engine, u32 frames_in_flight);
+    void set_frame_rate_limit(f64 frame_rate_limit);
+    void set_low_latency(bool low_latency);
+
+    // Blocks until the next frame should start, call before polling input to sample it as late as possible
+    // begin_frame calls it if it hasn't been called for the frame
+    [[nodiscard]] Result<void> pace_frame(const Engine& engine);
+
+    // Recreates the swapchain when it is out of date, Err::InvalidWindowSize means the window is minimized
     [[nodiscard]] Result<vk::CommandBuffer> begin_frame(const Engine& engine);
     [[nodiscard]] Result<void> end_frame(const Engine& engine);
-    [[nodiscard]] Result<void> draw_frame(const Engine& engine, const Pipeline& pipeline) {
+    [[nodiscard]] Result<void> draw_frame(const Engine& engine, Pipeline& pipeline) {
         const auto cmd = begin_frame(engine);
         if (cmd.has_err())
             return cmd.err();
-        pipeline.cmd_draw(*cmd, current_image(), m_extent);
-        return end_frame(engine);
+        pipeline.begin_frame(engine, m_extent, m_current_frame_index);
+        const auto drawn = [&] {
+            const CpuScope scope{"record_frame"};
+            return pipeline.cmd_draw(*cmd, {
+                .image = current_image(),
+                .view = m_swapchain_views[m_current_image_index],
+                .extent = m_extent,
+                .format = SwapchainImageFormat,
+            }, m_current_frame_index, m_profiler);
+        }();
+        const auto ended = end_frame(engine);
+        if (drawn.has_err())
+            return drawn;
+        return ended;
     }
 
 private:
+    [[nodiscard]] Result<void> recreate_swapchain(const Engine& engine);
+
     [[nodiscard]] vk::CommandBuffer& current_cmd() { return m_command_buffers[m_current_frame_index]; }
     [[nodiscard]] vk::Image& current_image() { return m_swapchain_images[m_current_image_index]; }
     [[nodiscard]] vk::Fence& is_frame_finished() { return m_frame_finished_fences[m_current_frame_index]; }
@@ -69,11 +345,21 @@ private:
     [[nodiscard]] const vk::Semaphore& is_image_available() const { return m_image_available_semaphores[m_current_frame_index]; }
     [[nodiscard]] const vk::Semaphore& is_ready_to_present() const { return m_ready_to_present_semaphores[m_current_image_index]; }
 
+    Config m_config = {};
     GLFWwindow* m_window = nullptr;
     vk::SurfaceKHR m_surface = {};
     vk::Extent2D m_extent = {};
     vk::SwapchainKHR m_swapchain = {};
+    vk::PresentModeKHR m_present_mode = vk::PresentModeKHR::eFifo;
+    // Id of the last present to the current swapchain, counting from one
+    u64 m_present_id = 0;
+    bool m_swapchain_dirty = false;
+    // The engine.deletions serial of each frame index's last submission
+    std::array<u64, MaxFramesInFlight> m_frame_serials = {};
+    bool m_paced = false;
+    std::chrono::steady_clock::time_point m_next_frame_time = {};
     std::array<vk::Image, MaxSwapchainImages> m_swapchain_images = {};
+    std::array<vk::ImageView, MaxSwapchainImages> m_swapchain_views = {};
     u32 m_image_count = 0;
     u32 m_current_image_index = 0;
     u32 m_current_frame_index = 0;
@@ -82,6 +368,8 @@ private:
     std::array<vk::Fence, MaxFramesInFlight> m_frame_finished_fences = {};
     std::array<vk::Semaphore, MaxFramesInFlight> m_image_available_semaphores = {};
     std::array<vk::Semaphore, MaxSwapchainImages> m_ready_to_present_semaphores = {};
+    GpuProfiler m_profiler = {};
+    u32 m_frame_scope = GpuProfiler::InvalidScope;
 };
 
 struct GpuBuffer {
@@ -89,11 +377,14 @@ struct GpuBuffer {
         DeviceLocal,
         RandomAccess,
         Staging,
+        // Host coherent and mapped for the buffer's whole lifetime, for data rewritten every frame
+        Mapped,
     };
 
     VmaAllocation allocation = nullptr;
     vk::Buffer buffer = {};
     MemoryType memory_type = DeviceLocal;
+    void* mapped = nullptr;
 
     struct Config {
         vk::DeviceSize size;
@@ -112,6 +403,8 @@ struct GpuBuffer {
         ASSERT(allocation != nullptr);
         ASSERT(buffer != nullptr);
         ASSERT(engine.allocator != nullptr);
+        ASSERT(engine.memory != nullptr);
+        engine.memory->untrack(engine.allocator, allocation);
         vmaDestroyBuffer(engine.allocator, buffer, allocation);
     }
 
@@ -143,6 +436,8 @@ struct StagingGpuImage {
         ASSERT(allocation != nullptr);
         ASSERT(image != nullptr);
         ASSERT(engine.device != nullptr);
+        ASSERT(engine.memory != nullptr);
+        engine.memory->untrack(engine.allocator, allocation);
         vmaDestroyImage(engine.allocator, image, allocation);
     }
 
@@ -189,6 +484,8 @@ struct GpuImage {
         ASSERT(allocation != nullptr);
         ASSERT(image != nullptr);
         ASSERT(engine.allocator != nullptr);
+        ASSERT(engine.memory != nullptr);
+        engine.memory->untrack(engine.allocator, allocation);
         vmaDestroyImage(engine.allocator, image, allocation);
     }
 
@@ -221,6 +518,73 @@ struct GpuImage {
     }
 };
 
+// Draws pipelines into an image instead of a swapchain, for benchmarks and tests on machines without a display.
+// Frames are paced only by their fences, and each is left in eTransferSrcOptimal so it can be read back.
+class HeadlessTarget {
+public:
+    struct Config {
+        u32 width = 0;
+        u32 height = 0;
+        // At most MaxFramesInFlight, the frames share one image
+        u32 frames_in_flight = 2;
+        u64 frame_timeout_ns = 1'000'000'000;
+    };
+
+    [[nodiscard]] static Result<HeadlessTarget> create(const Engine& engine, const Config& config);
+    // Waits for the gpu to go idle
+    void destroy(const Engine& engine) const;
+
+    [[nodiscard]] vk::Extent2D extent() const { return m_extent; }
+    [[nodiscard]] const GpuImage& image() const { return m_image; }
+    [[nodiscard]] GpuProfiler& profiler() { return m_profiler; }
+
+    [[nodiscard]] Result<vk::CommandBuffer> begin_frame(const Engine& engine);
+    [[nodiscard]] Result<void> end_frame(const Engine& engine);
+    [[nodiscard]] Result<void> draw_frame(const Engine& engine, Pipeline& pipeline) {
+        const auto cmd = begin_frame(engine);
+        if (cmd.has_err())
+            return cmd.err();
+        pipeline.begin_frame(engine, m_extent, m_current_frame_index);
+        const auto drawn = [&] {
+            const CpuScope scope{"record_frame"};
+            return pipeline.cmd_draw(*cmd, {
+                .image = m_image.image,
+                .view = m_image.view,
+                .extent = m_extent,
+                .format = Format,
+                .final_layout = vk::ImageLayout::eTransferSrcOptimal,
+            }, m_current_frame_index, m_profiler);
+        }();
+        const auto ended = end_frame(engine);
+        if (drawn.has_err())
+            return drawn;
+        return ended;
+    }
+
+    // Blocks until every submitted frame has finished, the gpu timings of the last frames are still only read back
+    // by later begin_frame calls
+    [[nodiscard]] Result<void> wait_idle(const Engine& engine) const;
+
+private:
+    // Matches the swapchain, so pipelines can't tell the targets apart
+    static constexpr vk::Format Format = Window::SwapchainImageFormat;
+
+    Config m_config = {};
+    vk::Extent2D m_extent = {};
+    GpuImage m_image = {};
+    // The engine.deletions serial of each frame index's last submission
+    std::array<u64, MaxFramesInFlight> m_frame_serials = {};
+    u32 m_current_frame_index = 0;
+    bool m_recording = false;
+    std::array<vk::CommandBuffer, MaxFramesInFlight> m_command_buffers = {};
+    std::array<vk::Fence, MaxFramesInFlight> m_frame_finished_fences = {};
+    GpuProfiler m_profiler = {};
+    u32 m_frame_scope = GpuProfiler::InvalidScope;
+};
+
+// Whether images of the format can be sampled with linear filtering, compressed formats also need their feature
+[[nodiscard]] bool is_format_sampleable(const Engine& engine, vk::Format format);
+
 inline u32 get_mip_count(const vk::Extent3D extent) {
     return static_cast<u32>(std::floor(std::log2(std::max(std::max(extent.width, extent.height), extent.depth)))) + 1;
 }
@@ -229,10 +593,12 @@ enum class SamplerType {
     Nearest = VK_FILTER_NEAREST,
     Linear = VK_FILTER_LINEAR,
 };
+// Every level of the bound view can be sampled, so one sampler is shared by images with any number of levels
 struct SamplerConfig {
     SamplerType type = SamplerType::Nearest;
     vk::SamplerAddressMode edge_mode = vk::SamplerAddressMode::eRepeat;
-    u32 mip_levels = 1;
+
+    [[nodiscard]] bool operator==(const SamplerConfig&) const = default;
 };
 [[nodiscard]] Result<vk::Sampler> create_sampler_result(const Engine& engine, const SamplerConfig& config);
 [[nodiscard]] inline vk::Sampler create_sampler(const Engine& engine, const SamplerConfig& config) {
@@ -243,12 +609,14 @@ struct SamplerConfig {
 }
 
 [[nodiscard]] Result<vk::DescriptorPool> create_descriptor_pool(
-    const Engine& engine, u32 max_sets, std::span<const vk::DescriptorPoolSize> descriptors
+    const Engine& engine, u32 max_sets, std::span<const vk::DescriptorPoolSize> descriptors,
+    vk::DescriptorPoolCreateFlags pool_flags = {}
 );
 [[nodiscard]] Result<vk::DescriptorSetLayout> create_descriptor_set_layout(
     const Engine& engine,
     std::span<const vk::DescriptorSetLayoutBinding> bindings,
-    std::span<const vk::DescriptorBindingFlags> flags = {}
+    std::span<const vk::DescriptorBindingFlags> flags = {},
+    vk::DescriptorSetLayoutCreateFlags layout_flags = {}
 );
 
 [[nodiscard]] Result<void> allocate_descriptor_sets(
@@ -265,24 +633,108 @@ struct SamplerConfig {
         return alloc_result.err();
     return set;
 }
+void write_buffer_descriptor(
+    const Engine& engine, vk::DescriptorSet set, u32 binding, vk::DescriptorType type,
+    vk::Buffer buffer, vk::DeviceSize size, vk::DeviceSize offset = 0,
+    u32 binding_array_index = 0
+);
 void write_uniform_buffer_descriptor(
     const Engine& engine, vk::DescriptorSet set, u32 binding,
     vk::Buffer buffer, vk::DeviceSize size, vk::DeviceSize offset = 0,
     u32 binding_array_index = 0
 );
+void write_storage_buffer_descriptor(
+    const Engine& engine, vk::DescriptorSet set, u32 binding,
+    vk::Buffer buffer, vk::DeviceSize size, vk::DeviceSize offset = 0,
+    u32 binding_array_index = 0
+);
 void write_image_sampler_descriptor(
     const Engine& engine, vk::DescriptorSet set, u32 binding,
     vk::Sampler sampler, vk::ImageView view,
     u32 binding_array_index = 0
 );
 
+// Every sampled image, sampler, storage buffer and storage image that shaders index into, in one update after bind set which
+// DefaultPipeline binds once per frame for all render systems.
+// Writes are queued and applied together by flush_writes, which Window::end_frame calls before submitting.
+class BindlessHeap {
+public:
+    static constexpr u32 SampledImageBinding = 0;
+    static constexpr u32 SamplerBinding = 1;
+    static constexpr u32 StorageBufferBinding = 2;
+    static constexpr u32 StorageImageBinding = 3;
+
+    // Upper bounds, each is clamped to the gpu's update after bind limits
+    static constexpr u32 MaxSampledImages = 1 << 16;
+    static constexpr u32 MaxSamplers = 64;
+    static constexpr u32 MaxStorageBuffers = 1 << 12;
+    static constexpr u32 MaxStorageImages = 1 << 10;
+
+    static constexpr u32 InvalidIndex = UINT32_MAX;
+
+    [[nodiscard]] static Result<BindlessHeap> create(const Engine& engine);
+    void destroy(const Engine& engine) const;
+
+    [[nodiscard]] vk::DescriptorSetLayout get_set_layout() const { return m_set_layout; }
+    [[nodiscard]] vk::DescriptorSet get_set() const { return m_set; }
+
+    // Each returns Err::BindlessHeapFull once every index of its binding is in use
+    [[nodiscard]] Result<u32> add_sampled_image(
+        vk::ImageView view, vk::ImageLayout layout = vk::ImageLayout::eShaderReadOnlyOptimal
+    );
+    [[nodiscard]] Result<u32> add_storage_buffer(vk::Buffer buffer, vk::DeviceSize size, vk::DeviceSize offset = 0);
+    // Storage images are written in the general layout, the view may only have one mip level.
+    // Only available when Engine::storage_images is set.
+    [[nodiscard]] Result<u32> add_storage_image(vk::ImageView view);
+    // The index is reused once every submission that could have read it has finished, the resource is not destroyed
+    void remove_sampled_image(const Engine& engine, u32 index);
+    void remove_storage_buffer(const Engine& engine, u32 index);
+    void remove_storage_image(const Engine& engine, u32 index);
+
+    // Samplers are created once per config and live as long as the heap
+    [[nodiscard]] Result<u32> get_sampler(const Engine& engine, const SamplerConfig& config);
+
+    // Applies every queued write in one vkUpdateDescriptorSets
+    void flush_writes(const Engine& engine);
+
+private:
+    struct Slots {
+        u32 capacity = 0;
+        u32 count = 0;
+        std::vector<u32> free = {};
+
+        [[nodiscard]] Result<u32> alloc();
+    };
+
+    struct PendingWrite {
+        u32 binding = 0;
+        u32 index = 0;
+        vk::DescriptorImageInfo image = {};
+        vk::DescriptorBufferInfo buffer = {};
+    };
+
+    vk::DescriptorPool m_pool = {};
+    vk::DescriptorSetLayout m_set_layout = {};
+    vk::DescriptorSet m_set = {};
+
+    Slots m_images = {};
+    Slots m_buffers = {};
+    Slots m_storage_images = {};
+    u32 m_sampler_capacity = 0;
+    std::vector<std::pair<SamplerConfig, vk::Sampler>> m_samplers = {};
+
+    std::vector<PendingWrite> m_writes = {};
+};
+
 struct ShaderConfig {
     std::filesystem::path path = {};
+    // eBinary paths hold data from getShaderBinaryDataEXT for this exact driver, and skip Engine::shader_cache
     vk::ShaderCodeTypeEXT code_type = vk::ShaderCodeTypeEXT::eSpirv;
     vk::ShaderStageFlagBits stage = {};
     vk::ShaderStageFlags next_stage = {};
     std::span<const vk::DescriptorSetLayout> set_layouts = {};
     std::span<const vk::PushConstantRange> push_ranges = {};
+    const vk::SpecializationInfo* specialization = nullptr;
     vk::ShaderCreateFlagsEXT flags = {};
 };
 [[nodiscard]] Result<vk::ShaderEXT> create_unlinked_shader(const Engine& engine, const ShaderConfig& config);
@@ -302,6 +754,16 @@ struct ShaderConfig {
     return end_single_time_commands(engine, *cmd);
 }
 
+// Sets all the dynamic state shader objects rely on, secondary command buffers inherit none of it
+void cmd_set_default_state(vk::CommandBuffer cmd, vk::Extent2D extent);
+
+// Blits each level down from the one above, expects the first level in current_layout and leaves every level in
+// final_layout. The format has to support linear filtering.
+void cmd_generate_mipmaps(
+    vk::CommandBuffer cmd, vk::Image image, u32 mip_levels, vk::Extent3D extent,
+    vk::ImageLayout current_layout, vk::ImageLayout final_layout
+);
+
 class BarrierBuilder {
 public:
     explicit constexpr BarrierBuilder(const vk::CommandBuffer cmd) : m_cmd(cmd) {}
@@ -2,8 +2,13 @@
 
 #include "hg_pch.h"
 #include "hg_utils.h"
+#include "hg_threads.h"
+#include "hg_profiler.h"
 #include "hg_math.h"
 #include "hg_generate.h"
 #include "hg_load.h"
+#include "hg_compress.h"
 #include "hg_vulkan_engine.h"
+#include "hg_upload_queue.h"
+#include "hg_gpu_generate.h"
 #include "hg_pipeline.h"
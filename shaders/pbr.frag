@@ -7,30 +7,72 @@ layout(location = 0) in vec3 v_pos;
 layout(location = 1) in vec3 v_normal;
 layout(location = 2) in vec4 v_tangent;
 layout(location = 3) in vec2 v_uv;
+layout(location = 4) flat in uint v_instance;
 
 const float pi = 3.14159265;
 
-const uint MaxLights = 10;
+const uint MaxLightsPerCluster = 64;
+
+// Specialized per material by PbrRenderer, so unused features compile out
+layout(constant_id = 0) const bool NormalMapped = false;
+layout(constant_id = 1) const bool AlphaTested = false;
+// Bounds each cluster's light loop, zero skips the clusters entirely
+layout(constant_id = 2) const uint MaxClusterLights = 64;
+
+layout(set = 0, binding = 0) uniform VP {
+    mat4 projection;
+    mat4 view;
+    mat4 inverse_projection;
+    uvec4 cluster_grid;
+    vec4 screen;
+} u_vp;
 
 struct Light {
     vec4 pos;
     vec4 color;
 };
 
-layout(set = 0, binding = 1) uniform LightUniform {
+layout(std430, set = 0, binding = 1) readonly buffer LightBuffer {
     uint count;
-    Light vals[MaxLights];
-} u_light;
+    Light vals[];
+} s_lights;
 
-layout(set = 1, binding = 0) uniform sampler2D u_samplers[];
+struct Cluster {
+    uint count;
+    uint indices[MaxLightsPerCluster];
+};
 
-layout(push_constant) uniform PushConstant {
+layout(std430, set = 0, binding = 2) readonly buffer ClusterBuffer {
+    Cluster vals[];
+} s_clusters;
+
+layout(set = 1, binding = 0) uniform texture2D u_textures[];
+layout(set = 1, binding = 1) uniform sampler u_samplers[];
+
+struct Instance {
     mat4 model;
     uint normal_map_index;
     uint texture_index;
     float roughness;
     float metal;
-} push;
+    uint draw_index;
+    uint normal_map_sampler;
+    uint texture_sampler;
+    float alpha_cutoff;
+};
+
+layout(std430, set = 1, binding = 2) readonly buffer InstanceBuffer {
+    Instance vals[];
+} s_instances[];
+
+layout(push_constant) uniform Push {
+    uint instance_buffer;
+    uint visible_buffer;
+} u_push;
+
+vec4 sample_texture(const uint texture_index, const uint sampler_index, const vec2 uv) {
+    return texture(sampler2D(u_textures[nonuniformEXT(texture_index)], u_samplers[nonuniformEXT(sampler_index)]), uv);
+}
 
 float square(const float x) {
     return x * x;
@@ -73,25 +115,49 @@ vec3 calc_reflection(const Light light, const vec3 normal, const vec3 albedo, co
     const float ndoth = clamp(dot(normal, half_dir), 0.0, 1.0);
     const float vdoth = clamp(dot(view_dir, half_dir), 0.0, 1.0);
 
-    const float attenuation = 1.0 / dot(light_rel_pos, light_rel_pos);
+    // Inverse square falloff, windowed to reach zero at the light's radius
+    const float dist2 = dot(light_rel_pos, light_rel_pos);
+    const float window = square(clamp(1.0 - square(dist2 / square(light.pos.w)), 0.0, 1.0));
+    const float attenuation = window / dist2;
     return (light.color.xyz * attenuation) * (brdf(albedo, metal, roughness, f0, ndotv, ndotl, ndoth, vdoth) * ndotl);
 }
 
 void main() {
-    const mat3 tbn = mat3(normalize(v_tangent.xyz), normalize(v_tangent.w * cross(v_normal, v_tangent.xyz)), normalize(v_normal));
-    const vec3 normal = v_tangent == vec4(0.0) ? normalize(v_normal) : tbn * -texture(u_samplers[push.normal_map_index], v_uv).xyz;
+    const Instance instance = s_instances[u_push.instance_buffer].vals[v_instance];
 
-    const vec4 tex = texture(u_samplers[push.texture_index], v_uv);
+    const vec4 tex = sample_texture(instance.texture_index, instance.texture_sampler, v_uv);
+    if (AlphaTested && tex.w < instance.alpha_cutoff)
+        discard;
     const vec3 albedo = tex.xyz;
 
-    const float metal = push.metal;
-    const float roughness = push.roughness;
+    vec3 normal = normalize(v_normal);
+    // Meshes without tangents have them zeroed, and keep their vertex normals
+    if (NormalMapped && v_tangent != vec4(0.0)) {
+        const mat3 tbn = mat3(normalize(v_tangent.xyz), normalize(v_tangent.w * cross(v_normal, v_tangent.xyz)), normalize(v_normal));
+        // Only x and y are read, so two channel normal maps such as BC5 work, with z always facing out of the surface
+        const vec2 normal_xy = sample_texture(instance.normal_map_index, instance.normal_map_sampler, v_uv).xy;
+        const vec3 tangent_normal = vec3(normal_xy, -sqrt(max(1.0 - dot(normal_xy, normal_xy), 0.0)));
+        normal = normalize(tbn * -tangent_normal);
+    }
+
+    const float metal = instance.metal;
+    const float roughness = instance.roughness;
     const vec3 f0 = mix(vec3(0.04), albedo, metal);
 
     const vec3 ambient = vec3(0.03, 0.03, 0.03);
     vec3 total_light = ambient;
-    for (uint i = 0u; i < u_light.count; i++) {
-        total_light += calc_reflection(u_light.vals[i], normal, albedo, metal, roughness, f0);
+    if (MaxClusterLights > 0) {
+        const uvec3 grid = u_vp.cluster_grid.xyz;
+        const float near = u_vp.screen.z;
+        const float far = u_vp.screen.w;
+        const uint slice = uint(clamp(log(max(v_pos.z, near) / near) / log(far / near) * float(grid.z), 0.0, float(grid.z - 1)));
+        const uvec2 tile = min(uvec2(gl_FragCoord.xy / u_vp.screen.xy * vec2(grid.xy)), grid.xy - 1);
+        const uint cluster = tile.x + tile.y * grid.x + slice * grid.x * grid.y;
+
+        const uint count = min(s_clusters.vals[cluster].count, MaxClusterLights);
+        for (uint i = 0u; i < count; i++) {
+            total_light += calc_reflection(s_lights.vals[s_clusters.vals[cluster].indices[i]], normal, albedo, metal, roughness, f0);
+        }
     }
 
     const vec3 hdr_color = total_light * tex.xyz;
@@ -1,12 +1,19 @@
 #version 450
+#extension GL_EXT_nonuniform_qualifier : require
 
 layout(location = 0) out vec3 f_pos;
 layout(location = 1) out vec3 f_normal;
 layout(location = 2) out vec4 f_tangent;
 layout(location = 3) out vec2 f_uv;
+layout(location = 4) flat out uint f_instance;
+// pbr_depth.vert computes the same position, so its depth can be tested for equality
+invariant gl_Position;
 
-layout(location = 0) in vec3 in_pos;
-layout(location = 1) in vec3 in_normal;
+// Packed vertices hold the tangent sign in in_pos.w, and octahedral normals and tangents in .xy
+layout(constant_id = 0) const bool PackedVertices = false;
+
+layout(location = 0) in vec4 in_pos;
+layout(location = 1) in vec4 in_normal;
 layout(location = 2) in vec4 in_tangent;
 layout(location = 3) in vec2 in_uv;
 
@@ -15,23 +22,58 @@ layout(set = 0, binding = 0) uniform VP {
     mat4 view;
 } u_vp;
 
-layout(push_constant) uniform PushConstant {
+struct Instance {
     mat4 model;
     uint normal_map_index;
     uint texture_index;
     float roughness;
     float metal;
-} push;
+    uint draw_index;
+    uint normal_map_sampler;
+    uint texture_sampler;
+    float alpha_cutoff;
+};
+
+// Both live in the bindless heap's storage buffers, picked out by the push constants
+layout(std430, set = 1, binding = 2) readonly buffer InstanceBuffer {
+    Instance vals[];
+} s_instances[];
+
+// Written by pbr_cull.comp, maps each drawn instance to its index in s_instances
+layout(std430, set = 1, binding = 2) readonly buffer VisibleBuffer {
+    uint vals[];
+} s_visible[];
+
+layout(push_constant) uniform Push {
+    uint instance_buffer;
+    uint visible_buffer;
+} u_push;
+
+vec3 decode_octahedral(const vec2 e) {
+    vec3 n = vec3(e, 1.0 - abs(e.x) - abs(e.y));
+    const float t = max(-n.z, 0.0);
+    n.xy += mix(vec2(t), vec2(-t), greaterThanEqual(n.xy, vec2(0.0)));
+    return normalize(n);
+}
 
 void main() {
-    const mat4 mv = u_vp.view * push.model;
+    const uint instance = s_visible[u_push.visible_buffer].vals[gl_InstanceIndex];
+    const mat4 mv = u_vp.view * s_instances[u_push.instance_buffer].vals[instance].model;
     const mat3 imv = mat3(transpose(inverse(mv)));
-    const vec4 pos = mv * vec4(in_pos, 1.0);
+    const vec4 pos = mv * vec4(in_pos.xyz, 1.0);
+
+    vec3 normal = in_normal.xyz;
+    vec4 tangent = in_tangent;
+    if (PackedVertices) {
+        normal = decode_octahedral(in_normal.xy);
+        tangent = vec4(decode_octahedral(in_tangent.xy), in_pos.w);
+    }
 
     f_pos = pos.xyz;
-    f_normal = imv * in_normal;
-    f_tangent = vec4(imv * in_tangent.xyz, in_tangent.w);
+    f_normal = imv * normal;
+    f_tangent = vec4(imv * tangent.xyz, tangent.w);
     f_uv = in_uv;
+    f_instance = instance;
 
     gl_Position = u_vp.projection * pos;
 }
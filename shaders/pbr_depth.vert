@@ -0,0 +1,45 @@
+#version 450
+#extension GL_EXT_nonuniform_qualifier : require
+
+// Reads PbrRenderer's position streams, packed positions are the same halfs as in its packed vertices
+layout(location = 0) in vec4 in_pos;
+
+// Transformed exactly as in pbr.vert, so the main pass can test against this depth for equality
+invariant gl_Position;
+
+layout(set = 0, binding = 0) uniform VP {
+    mat4 projection;
+    mat4 view;
+} u_vp;
+
+struct Instance {
+    mat4 model;
+    uint normal_map_index;
+    uint texture_index;
+    float roughness;
+    float metal;
+    uint draw_index;
+    uint normal_map_sampler;
+    uint texture_sampler;
+    float alpha_cutoff;
+};
+
+layout(std430, set = 1, binding = 2) readonly buffer InstanceBuffer {
+    Instance vals[];
+} s_instances[];
+
+layout(std430, set = 1, binding = 2) readonly buffer VisibleBuffer {
+    uint vals[];
+} s_visible[];
+
+layout(push_constant) uniform Push {
+    uint instance_buffer;
+    uint visible_buffer;
+} u_push;
+
+void main() {
+    const uint instance = s_visible[u_push.visible_buffer].vals[gl_InstanceIndex];
+    const mat4 mv = u_vp.view * s_instances[u_push.instance_buffer].vals[instance].model;
+    const vec4 pos = mv * vec4(in_pos.xyz, 1.0);
+    gl_Position = u_vp.projection * pos;
+}
@@ -1,11 +1,19 @@
 #version 450
+#extension GL_EXT_nonuniform_qualifier : require
 
 layout(location = 0) out vec4 out_color;
 
 layout(location = 0) in vec3 v_pos;
 
-layout(set = 1, binding = 0) uniform samplerCube u_sampler;
+// The bindless heap's sampled images, aliased as cubes since the skybox only indexes its own cubemap
+layout(set = 1, binding = 0) uniform textureCube u_cubemaps[];
+layout(set = 1, binding = 1) uniform sampler u_samplers[];
+
+layout(push_constant) uniform Push {
+    uint cubemap_index;
+    uint sampler_index;
+} u_push;
 
 void main() {
-    out_color = texture(u_sampler, v_pos);
+    out_color = texture(samplerCube(u_cubemaps[u_push.cubemap_index], u_samplers[u_push.sampler_index]), v_pos);
 }
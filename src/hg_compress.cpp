@@ -0,0 +1,317 @@
+#include "hg_compress.h"
+
+#include <array>
+#include <cmath>
+#include <cstring>
+
+namespace hg {
+
+namespace {
+
+constexpr usize BlockBytes = 16;
+
+using Block = std::array<u8, BlockBytes>;
+
+class BitWriter {
+public:
+    explicit BitWriter(Block& block) : m_block{block} { m_block.fill(0); }
+
+    void write(const u32 value, const u32 bits) {
+        for (u32 i = 0; i < bits; ++i) {
+            if (value >> i & 1)
+                m_block[m_bit / 8] |= static_cast<u8>(1 << m_bit % 8);
+            ++m_bit;
+        }
+    }
+
+private:
+    Block& m_block;
+    u32 m_bit = 0;
+};
+
+f32 srgb_to_linear(const f32 c) {
+    return c <= 0.04045f ? c / 12.92f : std::pow((c + 0.055f) / 1.055f, 2.4f);
+}
+
+f32 linear_to_srgb(const f32 c) {
+    return c <= 0.0031308f ? c * 12.92f : 1.055f * std::pow(c, 1.0f / 2.4f) - 0.055f;
+}
+
+glm::vec4 unpack_rgba(const u32 pixel) {
+    return glm::vec4{pixel & 0xff, pixel >> 8 & 0xff, pixel >> 16 & 0xff, pixel >> 24 & 0xff} / 255.0f;
+}
+
+u32 pack_rgba(const glm::vec4 color) {
+    const auto c = glm::uvec4{glm::clamp(color, 0.0f, 1.0f) * 255.0f + 0.5f};
+    return c.r | c.g << 8 | c.b << 16 | c.a << 24;
+}
+
+// Box filters the image to half size, odd edges clamp onto their last texel
+template <typename T, typename F> Image<T> downsample(const Image<T>& image, F average) {
+    const usize width = std::max<usize>(image.width() / 2, 1);
+    const usize height = std::max<usize>(image.height() / 2, 1);
+    Image<T> half = {{width, height}};
+    for (usize y = 0; y < height; ++y) {
+        const usize y0 = std::min(y * 2, image.height() - 1);
+        const usize y1 = std::min(y * 2 + 1, image.height() - 1);
+        for (usize x = 0; x < width; ++x) {
+            const usize x0 = std::min(x * 2, image.width() - 1);
+            const usize x1 = std::min(x * 2 + 1, image.width() - 1);
+            half[y][x] = average(image[y0][x0], image[y0][x1], image[y1][x0], image[y1][x1]);
+        }
+    }
+    return half;
+}
+
+// The whole chain of packed RGBA8 levels, averaged in linear space when srgb
+std::vector<Image<u32>> build_rgba_mips(const Image<u32>& image, const bool srgb) {
+    const auto average = [srgb](const u32 a, const u32 b, const u32 c, const u32 d) {
+        const std::array texels = {unpack_rgba(a), unpack_rgba(b), unpack_rgba(c), unpack_rgba(d)};
+        glm::vec4 sum = {};
+        for (const auto texel : texels) {
+            sum += srgb ? glm::vec4{srgb_to_linear(texel.r), srgb_to_linear(texel.g), srgb_to_linear(texel.b), texel.a} : texel;
+        }
+        sum /= 4.0f;
+        return pack_rgba(srgb ? glm::vec4{linear_to_srgb(sum.r), linear_to_srgb(sum.g), linear_to_srgb(sum.b), sum.a} : sum);
+    };
+
+    std::vector<Image<u32>> mips = {image};
+    while (mips.back().width() > 1 || mips.back().height() > 1) {
+        mips.push_back(downsample(mips.back(), average));
+    }
+    return mips;
+}
+
+// Gathers each 4x4 block of every level, clamping at the edges, and packs what encode writes into one allocation
+template <typename T, typename F> CompressedImage compress(const vk::Format format, std::vector<Image<T>> mips, F encode) {
+    ASSERT(!mips.empty());
+
+    usize size = 0;
+    for (const auto& mip : mips) {
+        size += (mip.width() + 3) / 4 * ((mip.height() + 3) / 4) * BlockBytes;
+    }
+
+    CompressedImage compressed = {.format = format};
+    compressed.storage.resize(size);
+    usize offset = 0;
+    for (const auto& mip : mips) {
+        const usize level_offset = offset;
+        std::array<T, 16> texels = {};
+        for (usize by = 0; by < mip.height(); by += 4) {
+            for (usize bx = 0; bx < mip.width(); bx += 4) {
+                for (usize i = 0; i < 16; ++i) {
+                    texels[i] = mip[std::min(by + i / 4, mip.height() - 1)][std::min(bx + i % 4, mip.width() - 1)];
+                }
+                Block block = {};
+                encode(texels, block);
+                std::memcpy(compressed.storage.data() + offset, block.data(), block.size());
+                offset += BlockBytes;
+            }
+        }
+        compressed.levels.push_back({
+            .data = {compressed.storage.data() + level_offset, offset - level_offset},
+            .width = to_u32(mip.width()),
+            .height = to_u32(mip.height()),
+        });
+    }
+
+    ASSERT(offset == size);
+    return compressed;
+}
+
+// BC7 mode 6: one subset, 7 bit RGBA endpoints with a p bit each, and 4 bit indices
+void encode_bc7_block(const std::array<u32, 16>& texels, Block& block) {
+    constexpr std::array<u32, 16> weights = {0, 4, 9, 13, 17, 21, 26, 30, 34, 38, 43, 47, 51, 55, 60, 64};
+
+    std::array<glm::vec4, 16> colors = {};
+    glm::vec4 mean = {};
+    for (usize i = 0; i < 16; ++i) {
+        colors[i] = glm::vec4{texels[i] & 0xff, texels[i] >> 8 & 0xff, texels[i] >> 16 & 0xff, texels[i] >> 24 & 0xff};
+        mean += colors[i] / 16.0f;
+    }
+
+    // The endpoints span the block along its principal axis, found by power iteration on the covariance
+    glm::mat4 covariance = {0.0f};
+    for (const auto& color : colors) {
+        const glm::vec4 d = color - mean;
+        covariance += glm::outerProduct(d, d);
+    }
+    glm::vec4 axis = {1.0f, 1.0f, 1.0f, 1.0f};
+    for (u32 i = 0; i < 8; ++i) {
+        axis = covariance * axis;
+        const f32 length = glm::length(axis);
+        if (length < 1e-6f)
+            break;
+        axis /= length;
+    }
+    f32 t_min = 0.0f;
+    f32 t_max = 0.0f;
+    for (const auto& color : colors) {
+        const f32 t = glm::dot(color - mean, axis);
+        t_min = std::min(t_min, t);
+        t_max = std::max(t_max, t);
+    }
+
+    // Each endpoint takes whichever p bit puts it closest to the unquantized value
+    const auto quantize = [](const glm::vec4 endpoint, glm::uvec4& out_value, u32& out_p) {
+        f32 best_error = INFINITY;
+        for (u32 p = 0; p < 2; ++p) {
+            const auto value = glm::uvec4{glm::clamp(glm::round((endpoint - static_cast<f32>(p)) / 2.0f), 0.0f, 127.0f)};
+            const glm::vec4 error = glm::vec4{value * 2u + p} - endpoint;
+            if (glm::dot(error, error) < best_error) {
+                best_error = glm::dot(error, error);
+                out_value = value;
+                out_p = p;
+            }
+        }
+    };
+    std::array<glm::uvec4, 2> endpoints = {};
+    std::array<u32, 2> p_bits = {};
+    quantize(glm::clamp(mean + axis * t_min, 0.0f, 255.0f), endpoints[0], p_bits[0]);
+    quantize(glm::clamp(mean + axis * t_max, 0.0f, 255.0f), endpoints[1], p_bits[1]);
+
+    const glm::uvec4 e0 = endpoints[0] * 2u + p_bits[0];
+    const glm::uvec4 e1 = endpoints[1] * 2u + p_bits[1];
+    std::array<glm::vec4, 16> palette = {};
+    for (usize i = 0; i < 16; ++i) {
+        palette[i] = glm::vec4{(e0 * (64 - weights[i]) + e1 * weights[i] + 32u) / 64u};
+    }
+
+    std::array<u32, 16> indices = {};
+    for (usize i = 0; i < 16; ++i) {
+        f32 best_error = INFINITY;
+        for (u32 j = 0; j < 16; ++j) {
+            const glm::vec4 d = palette[j] - colors[i];
+            if (glm::dot(d, d) < best_error) {
+                best_error = glm::dot(d, d);
+                indices[i] = j;
+            }
+        }
+    }
+
+    // The first index is stored without its high bit, which swapping the endpoints clears
+    if (indices[0] >= 8) {
+        std::swap(endpoints[0], endpoints[1]);
+        std::swap(p_bits[0], p_bits[1]);
+        for (auto& index : indices) {
+            index = 15 - index;
+        }
+    }
+
+    BitWriter writer{block};
+    writer.write(1 << 6, 7);
+    for (u32 channel = 0; channel < 4; ++channel) {
+        writer.write(endpoints[0][channel], 7);
+        writer.write(endpoints[1][channel], 7);
+    }
+    writer.write(p_bits[0], 1);
+    writer.write(p_bits[1], 1);
+    writer.write(indices[0], 3);
+    for (usize i = 1; i < 16; ++i) {
+        writer.write(indices[i], 4);
+    }
+}
+
+// Signed BC4, with the endpoints at the block's extremes in the eight value mode
+void encode_bc4_snorm_block(const std::array<f32, 16>& values, BitWriter& writer) {
+    const auto [min, max] = std::ranges::minmax(values);
+    const i32 r0 = static_cast<i32>(std::round(std::clamp(max, -1.0f, 1.0f) * 127.0f));
+    const i32 r1 = static_cast<i32>(std::round(std::clamp(min, -1.0f, 1.0f) * 127.0f));
+
+    std::array<f32, 8> palette = {static_cast<f32>(r0), static_cast<f32>(r1)};
+    for (i32 i = 2; i < 8; ++i) {
+        palette[static_cast<usize>(i)] = static_cast<f32>((8 - i) * r0 + (i - 1) * r1) / 7.0f;
+    }
+
+    writer.write(static_cast<u32>(r0) & 0xff, 8);
+    writer.write(static_cast<u32>(r1) & 0xff, 8);
+    for (const f32 value : values) {
+        u32 index = 0;
+        if (r0 != r1) {
+            f32 best_error = INFINITY;
+            for (u32 j = 0; j < 8; ++j) {
+                const f32 error = std::abs(palette[j] - value * 127.0f);
+                if (error < best_error) {
+                    best_error = error;
+                    index = j;
+                }
+            }
+        }
+        writer.write(index, 3);
+    }
+}
+
+void encode_bc5_snorm_block(const std::array<glm::vec4, 16>& texels, Block& block) {
+    std::array<f32, 16> x = {};
+    std::array<f32, 16> y = {};
+    for (usize i = 0; i < 16; ++i) {
+        x[i] = texels[i].x;
+        y[i] = texels[i].y;
+    }
+
+    BitWriter writer{block};
+    encode_bc4_snorm_block(x, writer);
+    encode_bc4_snorm_block(y, writer);
+}
+
+} // namespace
+
+CompressedImage compress_bc7(const Image<u32>& image, const bool srgb) {
+    ASSERT(image.width() > 0);
+    ASSERT(image.height() > 0);
+
+    return compress(srgb ? vk::Format::eBc7SrgbBlock : vk::Format::eBc7UnormBlock, build_rgba_mips(image, srgb), encode_bc7_block);
+}
+
+CompressedImage build_mip_chain(const ImageData& image, const bool srgb) {
+    ASSERT(image.pixels != nullptr);
+    ASSERT(image.width > 0);
+    ASSERT(image.height > 0);
+
+    // ImageData is always loaded as RGBA8, which packs into u32 with red in the low byte
+    Image<u32> base = {{static_cast<usize>(image.width), static_cast<usize>(image.height)}};
+    std::memcpy(base.data(), image.pixels.get(), base.size() * sizeof(u32));
+    return build_mip_chain(base, srgb);
+}
+
+CompressedImage build_mip_chain(const Image<u32>& image, const bool srgb) {
+    ASSERT(image.width() > 0);
+    ASSERT(image.height() > 0);
+
+    const auto mips = build_rgba_mips(image, srgb);
+
+    usize size = 0;
+    for (const auto& mip : mips) {
+        size += mip.size() * sizeof(u32);
+    }
+
+    CompressedImage chain = {.format = srgb ? vk::Format::eR8G8B8A8Srgb : vk::Format::eR8G8B8A8Unorm};
+    chain.storage.resize(size);
+    usize offset = 0;
+    for (const auto& mip : mips) {
+        const usize bytes = mip.size() * sizeof(u32);
+        std::memcpy(chain.storage.data() + offset, mip.data(), bytes);
+        chain.levels.push_back({{chain.storage.data() + offset, bytes}, to_u32(mip.width()), to_u32(mip.height())});
+        offset += bytes;
+    }
+    return chain;
+}
+
+CompressedImage compress_bc5(const Image<glm::vec4>& normals) {
+    ASSERT(normals.width() > 0);
+    ASSERT(normals.height() > 0);
+
+    const auto average = [](const glm::vec4 a, const glm::vec4 b, const glm::vec4 c, const glm::vec4 d) {
+        const glm::vec3 sum = glm::vec3{a} + glm::vec3{b} + glm::vec3{c} + glm::vec3{d};
+        return glm::vec4{glm::length(sum) > 1e-6f ? glm::normalize(sum) : glm::vec3{0.0f, 0.0f, -1.0f}, 0.0f};
+    };
+
+    std::vector<Image<glm::vec4>> mips = {normals};
+    while (mips.back().width() > 1 || mips.back().height() > 1) {
+        mips.push_back(downsample(mips.back(), average));
+    }
+
+    return compress(vk::Format::eBc5SnormBlock, std::move(mips), encode_bc5_snorm_block);
+}
+
+} // namespace hg
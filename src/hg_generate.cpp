@@ -5,6 +5,23 @@
 #include <mikktspace/mikktspace.h>
 #include <welder/weldmesh.h>
 
+#include <algorithm>
+#include <array>
+#include <iterator>
+#include <limits>
+#include <numeric>
+#include <queue>
+#include <thread>
+#include <tuple>
+
+#if defined(__AVX2__)
+#include <immintrin.h>
+#elif defined(__SSE2__) || defined(_M_X64) || (defined(_M_IX86_FP) && _M_IX86_FP >= 2)
+#include <emmintrin.h>
+#elif defined(__ARM_NEON)
+#include <arm_neon.h>
+#endif
+
 namespace hg {
 
 void create_tangents(std::span<Vertex> primitives) {
@@ -46,19 +63,406 @@ void create_tangents(std::span<Vertex> primitives) {
     genTangSpaceDefault(&mikk_context);
 }
 
+// Any unit vector perpendicular to a unit normal, from Duff et al., Building an Orthonormal Basis, Revisited
+static glm::vec3 perpendicular(const glm::vec3 normal) {
+    const f32 sign = std::copysign(1.0f, normal.z);
+    const f32 a = -1.0f / (sign + normal.z);
+    return {1.0f + sign * normal.x * normal.x * a, sign * normal.x * normal.y * a, -sign * normal.x};
+}
+
+static glm::i16vec2 encode_octahedral(const glm::vec3 direction) {
+    const f32 length = std::abs(direction.x) + std::abs(direction.y) + std::abs(direction.z);
+    if (length == 0.0f)
+        return {0, 0};
+    const glm::vec3 n = direction / length;
+    glm::vec2 encoded = {n.x, n.y};
+    if (n.z < 0.0f) {
+        encoded = (glm::vec2{1.0f} - glm::abs(glm::vec2{n.y, n.x}))
+                * glm::vec2{n.x >= 0.0f ? 1.0f : -1.0f, n.y >= 0.0f ? 1.0f : -1.0f};
+    }
+    return glm::i16vec2{glm::round(glm::clamp(encoded, -1.0f, 1.0f) * 32767.0f)};
+}
+
+AABBf compute_aabb(const std::span<const Vertex> vertices) {
+    ASSERT(!vertices.empty());
+
+    AABBf aabb = {vertices[0].position, vertices[0].position};
+    for (const auto& vertex : vertices) {
+        aabb.min = glm::min(aabb.min, vertex.position);
+        aabb.max = glm::max(aabb.max, vertex.position);
+    }
+    return aabb;
+}
+
+BoundingSpheref compute_bounding_sphere(const std::span<const Vertex> vertices, const AABBf& aabb) {
+    ASSERT(!vertices.empty());
+
+    BoundingSpheref sphere = {.center = aabb.center()};
+    for (const auto& vertex : vertices) {
+        sphere.radius = std::max(sphere.radius, glm::distance(sphere.center, vertex.position));
+    }
+    return sphere;
+}
+
+f32 compute_uv_density(const std::span<const u32> indices, const std::span<const Vertex> vertices) {
+    ASSERT(indices.size() % 3 == 0);
+
+    f64 uv_area = 0.0;
+    f64 surface_area = 0.0;
+    for (usize i = 0; i + 2 < indices.size(); i += 3) {
+        ASSERT(indices[i] < vertices.size() && indices[i + 1] < vertices.size() && indices[i + 2] < vertices.size());
+        const Vertex& a = vertices[indices[i]];
+        const Vertex& b = vertices[indices[i + 1]];
+        const Vertex& c = vertices[indices[i + 2]];
+        const glm::vec2 uv_ab = b.tex_coord - a.tex_coord;
+        const glm::vec2 uv_ac = c.tex_coord - a.tex_coord;
+        uv_area += std::abs(uv_ab.x * uv_ac.y - uv_ab.y * uv_ac.x) * 0.5;
+        surface_area += glm::length(glm::cross(b.position - a.position, c.position - a.position)) * 0.5;
+    }
+    if (surface_area <= 0.0)
+        return 0.0f;
+    return static_cast<f32>(std::sqrt(uv_area / surface_area));
+}
+
+namespace {
+
+// Sum of squared distances to a set of planes, the upper triangle of its symmetric 4x4 matrix
+struct Quadric {
+    std::array<f64, 10> m = {};
+
+    [[nodiscard]] static Quadric from_plane(const glm::dvec3 n, const f64 d) {
+        return {{n.x * n.x, n.x * n.y, n.x * n.z, n.x * d, n.y * n.y, n.y * n.z, n.y * d, n.z * n.z, n.z * d, d * d}};
+    }
+
+    Quadric& operator+=(const Quadric& other) {
+        for (usize i = 0; i < m.size(); ++i) {
+            m[i] += other.m[i];
+        }
+        return *this;
+    }
+
+    [[nodiscard]] f64 evaluate(const glm::dvec3 p) const {
+        return m[0] * p.x * p.x + 2.0 * m[1] * p.x * p.y + 2.0 * m[2] * p.x * p.z + 2.0 * m[3] * p.x
+             + m[4] * p.y * p.y + 2.0 * m[5] * p.y * p.z + 2.0 * m[6] * p.y
+             + m[7] * p.z * p.z + 2.0 * m[8] * p.z
+             + m[9];
+    }
+};
+
+// Moves every vertex at position from onto position to, versions invalidate collapses queued before either changed
+struct Collapse {
+    f64 cost = 0.0;
+    u32 from = 0;
+    u32 to = 0;
+    u32 from_version = 0;
+    u32 to_version = 0;
+
+    [[nodiscard]] bool operator>(const Collapse& other) const { return cost > other.cost; }
+};
+
+} // namespace
+
+std::vector<u32> simplify_mesh(
+    const std::span<const u32> indices, const std::span<const Vertex> vertices, const usize target_index_count, f32& error
+) {
+    ASSERT(indices.size() % 3 == 0);
+    ASSERT(!vertices.empty());
+    error = 0.0f;
+
+    // Welds vertices by position, otherwise split normals and uvs would pin every seam in place
+    std::vector<u32> order(vertices.size());
+    std::iota(order.begin(), order.end(), 0);
+    const auto position_less = [&](const u32 a, const u32 b) {
+        const glm::vec3 p = vertices[a].position;
+        const glm::vec3 q = vertices[b].position;
+        return std::tie(p.x, p.y, p.z) < std::tie(q.x, q.y, q.z);
+    };
+    std::ranges::sort(order, position_less);
+    std::vector<u32> position_of(vertices.size());
+    std::vector<glm::dvec3> positions = {};
+    std::vector<std::vector<u32>> wedges = {};
+    for (usize i = 0; i < order.size(); ++i) {
+        if (i == 0 || vertices[order[i]].position != vertices[order[i - 1]].position) {
+            positions.emplace_back(vertices[order[i]].position);
+            wedges.emplace_back();
+        }
+        position_of[order[i]] = to_u32(positions.size() - 1);
+        wedges.back().push_back(order[i]);
+    }
+
+    const usize triangle_count = indices.size() / 3;
+    std::vector<std::array<u32, 3>> corners(triangle_count);
+    std::vector<bool> dead(triangle_count, false);
+    std::vector<std::vector<u32>> triangles_at(positions.size());
+    std::vector<Quadric> quadrics(positions.size());
+    std::vector<u64> edges = {};
+    usize live = 0;
+    for (usize t = 0; t < triangle_count; ++t) {
+        corners[t] = {indices[t * 3], indices[t * 3 + 1], indices[t * 3 + 2]};
+        const std::array p = {position_of[corners[t][0]], position_of[corners[t][1]], position_of[corners[t][2]]};
+        const glm::dvec3 normal = glm::cross(positions[p[1]] - positions[p[0]], positions[p[2]] - positions[p[0]]);
+        const f64 area = glm::length(normal);
+        if (p[0] == p[1] || p[1] == p[2] || p[0] == p[2] || area == 0.0) {
+            dead[t] = true;
+            continue;
+        }
+
+        const Quadric plane = Quadric::from_plane(normal / area, -glm::dot(normal / area, positions[p[0]]));
+        for (u32 i = 0; i < 3; ++i) {
+            quadrics[p[i]] += plane;
+            triangles_at[p[i]].push_back(to_u32(t));
+            const u32 a = std::min(p[i], p[(i + 1) % 3]);
+            const u32 b = std::max(p[i], p[(i + 1) % 3]);
+            edges.push_back(u64{a} << 32 | b);
+        }
+        ++live;
+    }
+
+    // Edges without exactly two triangles are open borders or non-manifold, moving their ends would tear the surface
+    std::vector<bool> locked(positions.size(), false);
+    std::ranges::sort(edges);
+    for (usize i = 0; i < edges.size();) {
+        usize end = i + 1;
+        while (end < edges.size() && edges[end] == edges[i]) {
+            ++end;
+        }
+        if (end - i != 2) {
+            locked[edges[i] >> 32] = true;
+            locked[edges[i] & 0xffffffff] = true;
+        }
+        i = end;
+    }
+
+    std::vector<u32> versions(positions.size(), 0);
+    std::vector<bool> removed(positions.size(), false);
+    std::priority_queue<Collapse, std::vector<Collapse>, std::greater<>> queue = {};
+    const auto push = [&](const u32 from, const u32 to) {
+        if (locked[from])
+            return;
+        Quadric quadric = quadrics[from];
+        quadric += quadrics[to];
+        queue.push({quadric.evaluate(positions[to]), from, to, versions[from], versions[to]});
+    };
+    for (usize t = 0; t < triangle_count; ++t) {
+        if (dead[t])
+            continue;
+        for (u32 i = 0; i < 3; ++i) {
+            push(position_of[corners[t][i]], position_of[corners[t][(i + 1) % 3]]);
+            push(position_of[corners[t][(i + 1) % 3]], position_of[corners[t][i]]);
+        }
+    }
+
+    // Each corner moved onto the new position takes the vertex there with the nearest uv and normal
+    const auto closest_wedge = [&](const u32 vertex, const u32 position) {
+        u32 closest = wedges[position][0];
+        f32 closest_distance = std::numeric_limits<f32>::max();
+        for (const u32 candidate : wedges[position]) {
+            const glm::vec2 uv = vertices[candidate].tex_coord - vertices[vertex].tex_coord;
+            const glm::vec3 normal = vertices[candidate].normal - vertices[vertex].normal;
+            const f32 distance = glm::dot(uv, uv) + glm::dot(normal, normal);
+            if (distance < closest_distance) {
+                closest = candidate;
+                closest_distance = distance;
+            }
+        }
+        return closest;
+    };
+
+    // The positions sharing a live triangle with position, sorted
+    const auto one_ring = [&](const u32 position, std::vector<u32>& ring) {
+        ring.clear();
+        for (const u32 t : triangles_at[position]) {
+            if (dead[t])
+                continue;
+            for (const u32 vertex : corners[t]) {
+                if (position_of[vertex] != position)
+                    ring.push_back(position_of[vertex]);
+            }
+        }
+        std::ranges::sort(ring);
+        const auto duplicates = std::ranges::unique(ring);
+        ring.erase(duplicates.begin(), duplicates.end());
+    };
+    std::vector<u32> opposite = {};
+    std::vector<u32> from_ring = {};
+    std::vector<u32> to_ring = {};
+    std::vector<u32> shared_ring = {};
+
+    f64 max_cost = 0.0;
+    const usize target_triangles = target_index_count / 3;
+    while (live > target_triangles && !queue.empty()) {
+        const Collapse collapse = queue.top();
+        queue.pop();
+        const u32 from = collapse.from;
+        const u32 to = collapse.to;
+        if (removed[from] || removed[to] || versions[from] != collapse.from_version || versions[to] != collapse.to_version)
+            continue;
+
+        // Triangles that keep their area have to keep facing the same way
+        bool adjacent = false;
+        bool flips = false;
+        opposite.clear();
+        for (const u32 t : triangles_at[from]) {
+            if (dead[t])
+                continue;
+            std::array<glm::dvec3, 3> before = {};
+            std::array<glm::dvec3, 3> after = {};
+            bool shared = false;
+            for (u32 i = 0; i < 3; ++i) {
+                const u32 position = position_of[corners[t][i]];
+                shared = shared || position == to;
+                before[i] = positions[position];
+                after[i] = position == from ? positions[to] : positions[position];
+            }
+            if (shared) {
+                adjacent = true;
+                for (const u32 vertex : corners[t]) {
+                    if (position_of[vertex] != from && position_of[vertex] != to)
+                        opposite.push_back(position_of[vertex]);
+                }
+                continue;
+            }
+            const glm::dvec3 before_normal = glm::cross(before[1] - before[0], before[2] - before[0]);
+            const glm::dvec3 after_normal = glm::cross(after[1] - after[0], after[2] - after[0]);
+            if (glm::dot(before_normal, after_normal) <= 0.0) {
+                flips = true;
+                break;
+            }
+        }
+        if (!adjacent || flips)
+            continue;
+
+        // The link condition: the ends may only share the neighbours opposite their edge, any other would be joined to
+        // the kept end by two edges that collapse into one non-manifold edge
+        std::ranges::sort(opposite);
+        const auto duplicates = std::ranges::unique(opposite);
+        opposite.erase(duplicates.begin(), duplicates.end());
+        one_ring(from, from_ring);
+        one_ring(to, to_ring);
+        shared_ring.clear();
+        std::ranges::set_intersection(from_ring, to_ring, std::back_inserter(shared_ring));
+        if (shared_ring != opposite)
+            continue;
+
+        for (const u32 t : triangles_at[from]) {
+            if (dead[t])
+                continue;
+            auto& triangle = corners[t];
+            if (std::ranges::any_of(triangle, [&](const u32 vertex) { return position_of[vertex] == to; })) {
+                dead[t] = true;
+                --live;
+                continue;
+            }
+            for (auto& vertex : triangle) {
+                if (position_of[vertex] == from)
+                    vertex = closest_wedge(vertex, to);
+            }
+            triangles_at[to].push_back(t);
+        }
+        quadrics[to] += quadrics[from];
+        triangles_at[from].clear();
+        removed[from] = true;
+        ++versions[to];
+        max_cost = std::max(max_cost, collapse.cost);
+
+        std::erase_if(triangles_at[to], [&](const u32 t) { return dead[t]; });
+        for (const u32 t : triangles_at[to]) {
+            for (const u32 vertex : corners[t]) {
+                const u32 position = position_of[vertex];
+                if (position == to)
+                    continue;
+                push(to, position);
+                push(position, to);
+            }
+        }
+    }
+
+    std::vector<u32> simplified = {};
+    simplified.reserve(live * 3);
+    for (usize t = 0; t < triangle_count; ++t) {
+        if (!dead[t])
+            simplified.insert(simplified.end(), corners[t].begin(), corners[t].end());
+    }
+    error = static_cast<f32>(std::sqrt(max_cost));
+    return simplified;
+}
+
+void generate_lods(Mesh& mesh) {
+    ASSERT(!mesh.indices.empty());
+    ASSERT(mesh.indices.size() % 3 == 0);
+
+    mesh.lod_indices.clear();
+    mesh.lods.clear();
+    // Each level is simplified from the full mesh, so errors don't compound through the chain
+    usize previous_count = mesh.indices.size();
+    f32 previous_error = 0.0f;
+    for (u32 level = 1; level < MaxMeshLods; ++level) {
+        const usize target = mesh.indices.size() / 3 >> level;
+        if (target == 0)
+            break;
+        f32 error = 0.0f;
+        const auto indices = simplify_mesh(mesh.indices, mesh.vertices, target * 3, error);
+        // Locked borders can stop the collapses well short of the target, a level that barely shrinks isn't worth it
+        if (indices.empty() || indices.size() * 5 > previous_count * 4)
+            break;
+
+        previous_error = std::max(previous_error, error);
+        mesh.lods.push_back({to_u32(mesh.lod_indices.size()), to_u32(indices.size()), previous_error});
+        mesh.lod_indices.insert(mesh.lod_indices.end(), indices.begin(), indices.end());
+        previous_count = indices.size();
+    }
+}
+
+bool can_pack_vertices(const std::span<const Vertex> vertices) {
+    return std::ranges::all_of(vertices, [](const Vertex& vertex) {
+        return glm::all(glm::greaterThanEqual(vertex.tex_coord, glm::vec2{0.0f}))
+            && glm::all(glm::lessThanEqual(vertex.tex_coord, glm::vec2{1.0f}));
+    });
+}
+
+std::vector<PackedVertex> pack_vertices(const std::span<const Vertex> vertices) {
+    ASSERT(can_pack_vertices(vertices));
+
+    std::vector<PackedVertex> packed = {};
+    packed.reserve(vertices.size());
+    for (const auto& vertex : vertices) {
+        // Missing, non finite and normal aligned tangents would decode to a basis that isn't one, so they are replaced
+        // by one perpendicular to the normal
+        glm::vec3 tangent = glm::vec3{vertex.tangent};
+        const bool invalid = glm::any(glm::isnan(tangent)) || glm::any(glm::isinf(tangent));
+        if (invalid || glm::length(glm::cross(vertex.normal, tangent)) <= 1e-6f * glm::length(tangent)) {
+            const f32 normal_length = glm::length(vertex.normal);
+            tangent = perpendicular(normal_length > 0.0f ? vertex.normal / normal_length : glm::vec3{0.0f, 0.0f, 1.0f});
+        }
+        packed.push_back({
+            .position = {
+                glm::packHalf1x16(vertex.position.x),
+                glm::packHalf1x16(vertex.position.y),
+                glm::packHalf1x16(vertex.position.z),
+                glm::packHalf1x16(vertex.tangent.w < 0.0f ? -1.0f : 1.0f),
+            },
+            .normal = encode_octahedral(vertex.normal),
+            .tangent = encode_octahedral(tangent),
+            .tex_coord = glm::u16vec2{glm::round(vertex.tex_coord * 65535.0f)},
+        });
+    }
+    return packed;
+}
+
 Mesh Mesh::from_primitives(const std::span<const Vertex> primitives) {
     ASSERT(primitives.size() % 3 == 0);
 
     Mesh mesh = {};
     mesh.indices.resize(primitives.size());
     mesh.vertices.resize(primitives.size());
-    WeldMesh(
+    const i32 unique_vertices = WeldMesh(
         reinterpret_cast<int*>(mesh.indices.data()),
         reinterpret_cast<float*>(mesh.vertices.data()),
         reinterpret_cast<const float*>(primitives.data()),
         static_cast<i32>(primitives.size()),
         sizeof(Vertex) / sizeof(float)
     );
+    mesh.vertices.resize(to_u32(unique_vertices));
 
     return mesh;
 }
@@ -199,149 +603,467 @@ Mesh generate_sphere(const glm::uvec2 fidelity) {
     return sphere;
 }
 
+void create_normal_row(const ImageView<const f32> heightmap, const usize y, const std::span<glm::vec4> normals) {
+    ASSERT(y < heightmap.height());
+    ASSERT(normals.size() == heightmap.width());
+
+    const usize width = heightmap.width();
+    const usize height = heightmap.height();
+    const f32* up = heightmap[y == 0 ? height - 1 : y - 1].data();
+    const f32* row = heightmap[y].data();
+    const f32* down = heightmap[y + 1 == height ? 0 : y + 1].data();
+
+    // cross(up, left) + cross(down, right) of the neighbouring height differences, which the texel's own height
+    // cancels out of
+    const auto normal = [&](const usize x, const usize left, const usize right) {
+        return glm::vec4{glm::normalize(glm::vec3{row[right] - row[left], down[x] - up[x], -2.0f}), 0.0f};
+    };
+    // Only the first and last texels wrap, so the rest of the row needs no index arithmetic
+    normals[0] = normal(0, width - 1, width > 1 ? 1 : 0);
+    for (usize x = 1; x + 1 < width; ++x) {
+        normals[x] = normal(x, x - 1, x + 1);
+    }
+    if (width > 1)
+        normals[width - 1] = normal(width - 1, width - 2, 0);
+}
+
 Image<glm::vec4> create_normals_from_heightmap(const Image<f32>& heightmap) {
     Image<glm::vec4> normals = {{heightmap.width(), heightmap.height()}};
+    for (usize y = 0; y < heightmap.height(); ++y) {
+        create_normal_row(heightmap.view(), y, normals[y]);
+    }
+    return normals;
+}
 
-    for (usize v = 0; v < heightmap.height(); ++v) {
-        for (usize u = 0; u < heightmap.width(); ++u) {
-            const f32 height = heightmap[v][u];
+namespace {
 
-            const usize v_up = v == 0 ? heightmap.height() - 1 : v - 1;
-            const usize u_left = u == 0 ? heightmap.width() - 1 : u - 1;
-            const glm::vec3 up  = {0.0f, -1.0f, heightmap[v_up][u] - height};
-            const glm::vec3 left  = {-1.0f, 0.0f, heightmap[v][u_left] - height};
+// The widest lanes the target was compiled for, AVX2 is only picked when building with -mavx2 or /arch:AVX2
+#if defined(__AVX2__)
+struct Lanes {
+    static constexpr usize Count = 8;
+    __m256 v;
 
-            const usize v_down = (v + 1) % heightmap.height();
-            const usize u_right = (u + 1) % heightmap.width();
-            const glm::vec3 down = {0.0f, 1.0f, heightmap[v_down][u] - height};
-            const glm::vec3 right  = {1.0f, 0.0f, heightmap[v][u_right] - height};
+    static Lanes load(const f32* p) { return {_mm256_loadu_ps(p)}; }
+    static Lanes splat(const f32 x) { return {_mm256_set1_ps(x)}; }
+    static Lanes gather(const f32* base, const i32* offsets) {
+        return {_mm256_i32gather_ps(base, _mm256_loadu_si256(reinterpret_cast<const __m256i*>(offsets)), sizeof(f32))};
+    }
+    void store(f32* p) const { _mm256_storeu_ps(p, v); }
 
-            normals[v][u] = glm::vec4{glm::normalize(glm::cross(up, left) + glm::cross(down, right)), 0.0f};
-        }
+    friend Lanes operator+(const Lanes a, const Lanes b) { return {_mm256_add_ps(a.v, b.v)}; }
+    friend Lanes operator-(const Lanes a, const Lanes b) { return {_mm256_sub_ps(a.v, b.v)}; }
+    friend Lanes operator*(const Lanes a, const Lanes b) { return {_mm256_mul_ps(a.v, b.v)}; }
+};
+#elif defined(__SSE2__) || defined(_M_X64) || (defined(_M_IX86_FP) && _M_IX86_FP >= 2)
+struct Lanes {
+    static constexpr usize Count = 4;
+    __m128 v;
+
+    static Lanes load(const f32* p) { return {_mm_loadu_ps(p)}; }
+    static Lanes splat(const f32 x) { return {_mm_set1_ps(x)}; }
+    static Lanes gather(const f32* base, const i32* offsets) {
+        return {_mm_setr_ps(base[offsets[0]], base[offsets[1]], base[offsets[2]], base[offsets[3]])};
     }
+    void store(f32* p) const { _mm_storeu_ps(p, v); }
 
-    return normals;
+    friend Lanes operator+(const Lanes a, const Lanes b) { return {_mm_add_ps(a.v, b.v)}; }
+    friend Lanes operator-(const Lanes a, const Lanes b) { return {_mm_sub_ps(a.v, b.v)}; }
+    friend Lanes operator*(const Lanes a, const Lanes b) { return {_mm_mul_ps(a.v, b.v)}; }
+};
+#elif defined(__ARM_NEON)
+struct Lanes {
+    static constexpr usize Count = 4;
+    float32x4_t v;
+
+    static Lanes load(const f32* p) { return {vld1q_f32(p)}; }
+    static Lanes splat(const f32 x) { return {vdupq_n_f32(x)}; }
+    static Lanes gather(const f32* base, const i32* offsets) {
+        const f32 vals[Count] = {base[offsets[0]], base[offsets[1]], base[offsets[2]], base[offsets[3]]};
+        return load(vals);
+    }
+    void store(f32* p) const { vst1q_f32(p, v); }
+
+    friend Lanes operator+(const Lanes a, const Lanes b) { return {vaddq_f32(a.v, b.v)}; }
+    friend Lanes operator-(const Lanes a, const Lanes b) { return {vsubq_f32(a.v, b.v)}; }
+    friend Lanes operator*(const Lanes a, const Lanes b) { return {vmulq_f32(a.v, b.v)}; }
+};
+#else
+#define HG_SCALAR_LANES
+#endif
+
+// Finishes the columns left over after the widest lanes, and stands in for them without simd
+struct ScalarLanes {
+    static constexpr usize Count = 1;
+    f32 v;
+
+    static ScalarLanes load(const f32* p) { return {*p}; }
+    static ScalarLanes splat(const f32 x) { return {x}; }
+    static ScalarLanes gather(const f32* base, const i32* offsets) { return {base[*offsets]}; }
+    void store(f32* p) const { *p = v; }
+
+    friend ScalarLanes operator+(const ScalarLanes a, const ScalarLanes b) { return {a.v + b.v}; }
+    friend ScalarLanes operator-(const ScalarLanes a, const ScalarLanes b) { return {a.v - b.v}; }
+    friend ScalarLanes operator*(const ScalarLanes a, const ScalarLanes b) { return {a.v * b.v}; }
+};
+
+#ifdef HG_SCALAR_LANES
+using Lanes = ScalarLanes;
+#endif
+
+// Integer lanes for hashing, sse2 has no 32 bit multiply so it is pieced together from two 64 bit ones
+#if defined(__AVX2__)
+struct HashLanes {
+    static constexpr usize Count = 8;
+    __m256i v;
+
+    static HashLanes splat(const u32 x) { return {_mm256_set1_epi32(static_cast<i32>(x))}; }
+    static HashLanes ramp(const u32 first) { return {_mm256_add_epi32(splat(first).v, _mm256_setr_epi32(0, 1, 2, 3, 4, 5, 6, 7))}; }
+    void store(u32* p) const { _mm256_storeu_si256(reinterpret_cast<__m256i*>(p), v); }
+    void store_unorm(f32* p) const {
+        _mm256_storeu_ps(p, _mm256_mul_ps(_mm256_cvtepi32_ps(_mm256_srli_epi32(v, 8)), _mm256_set1_ps(1.0f / 16777216.0f)));
+    }
+
+    friend HashLanes operator+(const HashLanes a, const HashLanes b) { return {_mm256_add_epi32(a.v, b.v)}; }
+    friend HashLanes operator*(const HashLanes a, const HashLanes b) { return {_mm256_mullo_epi32(a.v, b.v)}; }
+    friend HashLanes operator^(const HashLanes a, const HashLanes b) { return {_mm256_xor_si256(a.v, b.v)}; }
+    [[nodiscard]] HashLanes shift_right_16() const { return {_mm256_srli_epi32(v, 16)}; }
+};
+#elif defined(__SSE2__) || defined(_M_X64) || (defined(_M_IX86_FP) && _M_IX86_FP >= 2)
+struct HashLanes {
+    static constexpr usize Count = 4;
+    __m128i v;
+
+    static HashLanes splat(const u32 x) { return {_mm_set1_epi32(static_cast<i32>(x))}; }
+    static HashLanes ramp(const u32 first) { return {_mm_add_epi32(splat(first).v, _mm_setr_epi32(0, 1, 2, 3))}; }
+    void store(u32* p) const { _mm_storeu_si128(reinterpret_cast<__m128i*>(p), v); }
+    void store_unorm(f32* p) const {
+        _mm_storeu_ps(p, _mm_mul_ps(_mm_cvtepi32_ps(_mm_srli_epi32(v, 8)), _mm_set1_ps(1.0f / 16777216.0f)));
+    }
+
+    friend HashLanes operator+(const HashLanes a, const HashLanes b) { return {_mm_add_epi32(a.v, b.v)}; }
+    friend HashLanes operator*(const HashLanes a, const HashLanes b) {
+        const __m128i even = _mm_mul_epu32(a.v, b.v);
+        const __m128i odd = _mm_mul_epu32(_mm_srli_epi64(a.v, 32), _mm_srli_epi64(b.v, 32));
+        return {_mm_unpacklo_epi32(_mm_shuffle_epi32(even, _MM_SHUFFLE(0, 0, 2, 0)), _mm_shuffle_epi32(odd, _MM_SHUFFLE(0, 0, 2, 0)))};
+    }
+    friend HashLanes operator^(const HashLanes a, const HashLanes b) { return {_mm_xor_si128(a.v, b.v)}; }
+    [[nodiscard]] HashLanes shift_right_16() const { return {_mm_srli_epi32(v, 16)}; }
+};
+#elif defined(__ARM_NEON)
+struct HashLanes {
+    static constexpr usize Count = 4;
+    uint32x4_t v;
+
+    static HashLanes splat(const u32 x) { return {vdupq_n_u32(x)}; }
+    static HashLanes ramp(const u32 first) {
+        constexpr u32 offsets[Count] = {0, 1, 2, 3};
+        return {vaddq_u32(vdupq_n_u32(first), vld1q_u32(offsets))};
+    }
+    void store(u32* p) const { vst1q_u32(p, v); }
+    void store_unorm(f32* p) const { vst1q_f32(p, vmulq_n_f32(vcvtq_f32_u32(vshrq_n_u32(v, 8)), 1.0f / 16777216.0f)); }
+
+    friend HashLanes operator+(const HashLanes a, const HashLanes b) { return {vaddq_u32(a.v, b.v)}; }
+    friend HashLanes operator*(const HashLanes a, const HashLanes b) { return {vmulq_u32(a.v, b.v)}; }
+    friend HashLanes operator^(const HashLanes a, const HashLanes b) { return {veorq_u32(a.v, b.v)}; }
+    [[nodiscard]] HashLanes shift_right_16() const { return {vshrq_n_u32(v, 16)}; }
+};
+#endif
+
+struct ScalarHashLanes {
+    static constexpr usize Count = 1;
+    u32 v;
+
+    static ScalarHashLanes splat(const u32 x) { return {x}; }
+    static ScalarHashLanes ramp(const u32 first) { return {first}; }
+    void store(u32* p) const { *p = v; }
+    void store_unorm(f32* p) const { *p = HashRng::to_unorm(v); }
+
+    friend ScalarHashLanes operator+(const ScalarHashLanes a, const ScalarHashLanes b) { return {a.v + b.v}; }
+    friend ScalarHashLanes operator*(const ScalarHashLanes a, const ScalarHashLanes b) { return {a.v * b.v}; }
+    friend ScalarHashLanes operator^(const ScalarHashLanes a, const ScalarHashLanes b) { return {a.v ^ b.v}; }
+    [[nodiscard]] ScalarHashLanes shift_right_16() const { return {v >> 16}; }
+};
+
+#ifdef HG_SCALAR_LANES
+using HashLanes = ScalarHashLanes;
+#endif
+
+// The x of pcg3d for a run of x coordinates, with y and z already through pcg3d's first step
+template <typename H> H pcg3d_x(H x, H y, H z) {
+    x = x * H::splat(1664525u) + H::splat(1013904223u);
+    x = x + y * z;
+    y = y + z * x;
+    z = z + x * y;
+    x = x ^ x.shift_right_16();
+    y = y ^ y.shift_right_16();
+    z = z ^ z.shift_right_16();
+    return x + y * z;
+}
+
+// Calls store(lanes, offset) for every run of lanes across count coordinates, finishing the tail one at a time
+template <typename F> void for_each_hash_lanes(
+    const glm::uvec2 first, const u32 stream_key, const usize count, F store
+) {
+    const u32 y = first.y * 1664525u + 1013904223u;
+    const u32 z = stream_key * 1664525u + 1013904223u;
+    usize i = 0;
+    for (; i + HashLanes::Count <= count; i += HashLanes::Count) {
+        store(pcg3d_x(HashLanes::ramp(first.x + to_u32(i)), HashLanes::splat(y), HashLanes::splat(z)), i);
+    }
+    for (; i < count; ++i) {
+        store(pcg3d_x(ScalarHashLanes::ramp(first.x + to_u32(i)), ScalarHashLanes::splat(y), ScalarHashLanes::splat(z)), i);
+    }
+}
+
+template <typename L> L lerp_lanes(const L a, const L b, const L t) { return a + t * (b - a); }
+
+// Where each column of the image falls on the grid, the same for every row
+struct GridColumns {
+    std::vector<f32> t = {};
+    std::vector<f32> fade = {};
+    // In floats from the start of a grid row
+    std::vector<i32> left = {};
+    std::vector<i32> right = {};
+};
+
+template <typename F> GridColumns grid_columns(const usize width, const usize grid_width, const usize texel_floats, F fade) {
+    GridColumns columns = {};
+    columns.t.resize(width);
+    columns.fade.resize(width);
+    columns.left.resize(width);
+    columns.right.resize(width);
+    for (usize u = 0; u < width; ++u) {
+        const f32 x = static_cast<f32>(u) * static_cast<f32>(grid_width) / static_cast<f32>(width);
+        const usize x_floor = static_cast<usize>(std::floor(x));
+        columns.t[u] = x - std::floor(x);
+        columns.fade[u] = fade(columns.t[u]);
+        columns.left[u] = to_i32(to_u32(x_floor * texel_floats));
+        columns.right[u] = to_i32(to_u32((x_floor + 1) % grid_width * texel_floats));
+    }
+    return columns;
+}
+
+struct GridRow {
+    usize top = 0;
+    usize bottom = 0;
+    f32 t = 0.0f;
+    f32 fade = 0.0f;
+};
+
+template <typename F> GridRow grid_row(const usize v, const usize height, const usize grid_height, F fade) {
+    const f32 y = static_cast<f32>(v) * static_cast<f32>(grid_height) / static_cast<f32>(height);
+    const usize y_floor = static_cast<usize>(std::floor(y));
+    const f32 t = y - std::floor(y);
+    return {y_floor, (y_floor + 1) % grid_height, t, fade(t)};
+}
+
+template <typename T> struct NoiseOctave {
+    const Image<T>* grid = nullptr;
+    GridColumns columns = {};
+    f32 amplitude = 1.0f;
+};
+
+// Adds one row of value noise to out, the fixed points already hold the octave's amplitude
+template <typename L> void add_value_row(
+    const GridColumns& columns, const f32* top, const f32* bottom, const f32 fade_y, f32* out, const usize begin, const usize end
+) {
+    const L fy = L::splat(fade_y);
+    for (usize u = begin; u + L::Count <= end; u += L::Count) {
+        const L fx = L::load(&columns.fade[u]);
+        const L upper = lerp_lanes(L::gather(top, &columns.left[u]), L::gather(top, &columns.right[u]), fx);
+        const L lower = lerp_lanes(L::gather(bottom, &columns.left[u]), L::gather(bottom, &columns.right[u]), fx);
+        (L::load(&out[u]) + lerp_lanes(upper, lower, fy)).store(&out[u]);
+    }
+}
+
+// Adds one row of perlin noise scaled by amplitude to out, the gradient rows are interleaved x and y
+template <typename L> void add_perlin_row(
+    const GridColumns& columns, const f32* top, const f32* bottom, const f32 y_t, const f32 fade_y, const f32 amplitude,
+    f32* out, const usize begin, const usize end
+) {
+    const L one = L::splat(1.0f);
+    const L half = L::splat(0.5f);
+    const L yt = L::splat(y_t);
+    const L yt1 = L::splat(y_t - 1.0f);
+    const L fy = L::splat(fade_y);
+    const L scale = L::splat(amplitude);
+    for (usize u = begin; u + L::Count <= end; u += L::Count) {
+        const L xt = L::load(&columns.t[u]);
+        const L xt1 = xt - one;
+        const L fx = L::load(&columns.fade[u]);
+        const i32* left = &columns.left[u];
+        const i32* right = &columns.right[u];
+
+        const L n00 = L::gather(top, left) * xt + L::gather(top + 1, left) * yt;
+        const L n10 = L::gather(top, right) * xt1 + L::gather(top + 1, right) * yt;
+        const L n01 = L::gather(bottom, left) * xt + L::gather(bottom + 1, left) * yt1;
+        const L n11 = L::gather(bottom, right) * xt1 + L::gather(bottom + 1, right) * yt1;
+
+        const L noise = lerp_lanes(lerp_lanes(n00, n10, fx), lerp_lanes(n01, n11, fx), fy) * half + half;
+        (L::load(&out[u]) + noise * scale).store(&out[u]);
+    }
+}
+
+// Splits the rows into one band per hardware thread, images too small to be worth it stay on the calling thread
+template <typename F> void for_each_row_band(const usize width, const usize height, F rows) {
+    constexpr usize min_band_pixels = 1 << 16;
+    const usize threads = std::max<usize>(std::thread::hardware_concurrency(), 1);
+    const usize bands = std::clamp<usize>(width * height / min_band_pixels, 1, std::min(threads, height));
+
+    std::vector<std::jthread> workers = {};
+    workers.reserve(bands - 1);
+    for (usize band = 1; band < bands; ++band) {
+        workers.emplace_back([&rows, begin = height * band / bands, end = height * (band + 1) / bands] { rows(begin, end); });
+    }
+    rows(0, height / bands);
+}
+
+// Accumulates every octave into each row while it is in cache, in octave order so sums match adding whole images
+Image<f32> accumulate_value_octaves(const glm::vec<2, usize> size, const std::span<const NoiseOctave<f32>> octaves) {
+    Image<f32> image = size;
+    const usize vector_end = size.x / Lanes::Count * Lanes::Count;
+    for_each_row_band(size.x, size.y, [&](const usize begin, const usize end) {
+        for (usize v = begin; v < end; ++v) {
+            f32* out = image[v].data();
+            for (const auto& octave : octaves) {
+                const auto& grid = *octave.grid;
+                const auto row = grid_row(v, size.y, grid.height(), smoothstep<f32>);
+                const f32* top = grid[row.top].data();
+                const f32* bottom = grid[row.bottom].data();
+                add_value_row<Lanes>(octave.columns, top, bottom, row.fade, out, 0, vector_end);
+                add_value_row<ScalarLanes>(octave.columns, top, bottom, row.fade, out, vector_end, size.x);
+            }
+        }
+    });
+    return image;
+}
+
+Image<f32> accumulate_perlin_octaves(const glm::vec<2, usize> size, const std::span<const NoiseOctave<glm::vec2>> octaves) {
+    static_assert(sizeof(glm::vec2) == 2 * sizeof(f32));
+
+    Image<f32> image = size;
+    const usize vector_end = size.x / Lanes::Count * Lanes::Count;
+    for_each_row_band(size.x, size.y, [&](const usize begin, const usize end) {
+        for (usize v = begin; v < end; ++v) {
+            f32* out = image[v].data();
+            for (const auto& octave : octaves) {
+                const auto& grid = *octave.grid;
+                const auto row = grid_row(v, size.y, grid.height(), smoothstep_quintic<f32>);
+                const f32* top = &grid[row.top].data()->x;
+                const f32* bottom = &grid[row.bottom].data()->x;
+                add_perlin_row<Lanes>(octave.columns, top, bottom, row.t, row.fade, octave.amplitude, out, 0, vector_end);
+                add_perlin_row<ScalarLanes>(octave.columns, top, bottom, row.t, row.fade, octave.amplitude, out, vector_end, size.x);
+            }
+        }
+    });
+    return image;
+}
+
+usize count_octaves(const glm::vec<2, usize> size, const glm::vec<2, usize> initial_size, const usize max_octaves) {
+    return std::min(
+        max_octaves, static_cast<usize>(
+            std::floor(std::log2(std::min(
+                static_cast<f32>(size.x) / static_cast<f32>(initial_size.x),
+                static_cast<f32>(size.y) / static_cast<f32>(initial_size.y)
+            )))
+        )
+    );
+}
+
+// Halving each octave's weight, so they sum to one and the noise spans [0, 1]
+f32 first_octave_amplitude(const usize octave_count) {
+    return std::exp2f(static_cast<f32>(octave_count) - 1.0f) / (std::exp2f(static_cast<f32>(octave_count)) - 1.0f);
+}
+
+} // namespace
+
+void HashRng::hash_row(const glm::uvec2 first, const u32 stream, const std::span<u32> out) const {
+    for_each_hash_lanes(first, stream_key(stream), out.size(), [&](const auto lanes, const usize i) { lanes.store(&out[i]); });
+}
+
+void HashRng::unorm_row(const glm::uvec2 first, const u32 stream, const std::span<f32> out) const {
+    for_each_hash_lanes(first, stream_key(stream), out.size(), [&](const auto lanes, const usize i) { lanes.store_unorm(&out[i]); });
 }
 
 Image<f32> generate_value_noise(const glm::vec<2, usize> size, const Image<f32>& fixed_points) {
     ASSERT(fixed_points.width() < size.x);
     ASSERT(fixed_points.height() < size.y);
-    Image<f32> interpolated = size;
-    for (usize v = 0; v < size.y; ++v) {
-        for (usize u = 0; u < size.x; ++u) {
-            const f32 x = static_cast<f32>(u) * static_cast<f32>(fixed_points.width()) / static_cast<f32>(size.x);
-            const f32 y = static_cast<f32>(v) * static_cast<f32>(fixed_points.height()) / static_cast<f32>(size.y);
-            const usize x_floor = static_cast<usize>(std::floor(x));
-            const usize y_floor = static_cast<usize>(std::floor(y));
-            const usize x_ceil = (x_floor + 1) % fixed_points.width();
-            const usize y_ceil = (y_floor + 1) % fixed_points.height();
-            interpolated[v][u] = lerp(
-                lerp(
-                    fixed_points[y_floor][x_floor],
-                    fixed_points[y_floor][x_ceil],
-                    smoothstep(static_cast<f32>(x - std::floor(x)))
-                ),
-                lerp(
-                    fixed_points[y_ceil][x_floor],
-                    fixed_points[y_ceil][x_ceil],
-                    smoothstep(static_cast<f32>(x - std::floor(x)))
-                ),
-                smoothstep(static_cast<f32>(y - std::floor(y)))
-            );
-        }
-    }
-    return interpolated;
+
+    const std::array octaves = {NoiseOctave<f32>{
+        .grid = &fixed_points,
+        .columns = grid_columns(size.x, fixed_points.width(), 1, smoothstep<f32>),
+    }};
+    return accumulate_value_octaves(size, octaves);
 }
 
 Image<f32> generate_perlin_noise(const glm::vec<2, usize> size, const Image<glm::vec2>& gradients) {
     ASSERT(gradients.width() < size.x);
     ASSERT(gradients.height() < size.y);
-    Image<f32> interpolated = size;
-    for (usize v = 0; v < size.y; ++v) {
-        for (usize u = 0; u < size.x; ++u) {
-            const f32 x = static_cast<f32>(u) * static_cast<f32>(gradients.width()) / static_cast<f32>(size.x);
-            const f32 y = static_cast<f32>(v) * static_cast<f32>(gradients.height()) / static_cast<f32>(size.y);
-            const f32 x_t = x - std::floor(x);
-            const f32 y_t = y - std::floor(y);
-            const usize x_floor = static_cast<usize>(std::floor(x));
-            const usize y_floor = static_cast<usize>(std::floor(y));
-            const usize x_ceil = (x_floor + 1) % gradients.width();
-            const usize y_ceil = (y_floor + 1) % gradients.height();
-
-            interpolated[v][u] = lerp(
-                lerp(
-                    glm::dot(gradients[y_floor][x_floor], glm::vec2{x_t       , y_t}),
-                    glm::dot(gradients[y_floor][x_ceil] , glm::vec2{x_t - 1.0f, y_t}),
-                    smoothstep_quintic(x_t)
-                ),
-                lerp(
-                    glm::dot(gradients[y_ceil][x_floor], glm::vec2{x_t       , y_t - 1.0f}),
-                    glm::dot(gradients[y_ceil][x_ceil] , glm::vec2{x_t - 1.0f, y_t - 1.0f}),
-                    smoothstep_quintic(x_t)
-                ),
-                smoothstep_quintic(y_t)
-            ) * 0.5f + 0.5f;
-        }
-    }
-    return interpolated;
+
+    const std::array octaves = {NoiseOctave<glm::vec2>{
+        .grid = &gradients,
+        .columns = grid_columns(size.x, gradients.width(), 2, smoothstep_quintic<f32>),
+    }};
+    return accumulate_perlin_octaves(size, octaves);
 }
 
 Image<f32> generate_fractal_value_noise(
-    const glm::vec<2, usize> size, const glm::vec<2, usize> initial_size, const usize max_octaves
+    const glm::vec<2, usize> size, const glm::vec<2, usize> initial_size, const usize max_octaves, const u32 seed
 ) {
     ASSERT(size.x > initial_size.x && size.y > initial_size.y);
     ASSERT(initial_size.x > 0 && initial_size.y > 0);
     ASSERT(max_octaves > 0);
 
-    Image<f32> image = size;
+    const usize octave_count = count_octaves(size, initial_size, max_octaves);
+    const HashRng rng{seed};
+
+    std::vector<Image<f32>> grids = {};
+    grids.reserve(octave_count);
     auto octave_size = initial_size;
-    const usize octaves = std::min(
-        max_octaves, static_cast<usize>(
-            std::floor(std::log2(std::min(
-                static_cast<f32>(size.x) / static_cast<f32>(initial_size.x),
-                static_cast<f32>(size.y) / static_cast<f32>(initial_size.y)
-            )))
-        )
-    );
-    const f32 divisions = std::exp2f(static_cast<f32>(octaves)) - 1.0f;
-    f32 amplitude = std::floor(divisions / 2.0f) / divisions;
-    for (usize i = 0; i < octaves; ++i, octave_size *= 2, amplitude *= 0.5f) {
-        image += generate_value_noise(size,
-            generate_white_noise<f32>(
-                octave_size,
-                [amplitude]() -> f32 { return rng<f32>() * amplitude; }
-            )
-        );
+    f32 amplitude = first_octave_amplitude(octave_count);
+    for (usize i = 0; i < octave_count; ++i, octave_size *= 2, amplitude *= 0.5f) {
+        grids.push_back(transform_image(generate_white_noise<f32>(octave_size, rng, to_u32(i)), [amplitude](const f32 value) {
+            return value * amplitude;
+        }));
     }
-    return image;
+
+    std::vector<NoiseOctave<f32>> octaves = {};
+    octaves.reserve(octave_count);
+    for (const auto& grid : grids) {
+        octaves.push_back({.grid = &grid, .columns = grid_columns(size.x, grid.width(), 1, smoothstep<f32>)});
+    }
+    return accumulate_value_octaves(size, octaves);
 }
 
 Image<f32> generate_fractal_perlin_noise(
-    const glm::vec<2, usize> size, const glm::vec<2, usize> initial_size, const usize max_octaves
+    const glm::vec<2, usize> size, const glm::vec<2, usize> initial_size, const usize max_octaves, const u32 seed
 ) {
     ASSERT(size.x > initial_size.x && size.y > initial_size.y);
     ASSERT(initial_size.x > 0 && initial_size.y > 0);
     ASSERT(max_octaves > 0);
 
-    Image<f32> image = size;
+    const usize octave_count = count_octaves(size, initial_size, max_octaves);
+    const HashRng rng{seed};
+
+    std::vector<Image<glm::vec2>> grids = {};
+    grids.reserve(octave_count);
     auto octave_size = initial_size;
-    const usize octaves = std::min(
-        max_octaves, static_cast<usize>(
-            std::floor(std::log2(std::min(
-                static_cast<f32>(size.x) / static_cast<f32>(initial_size.x),
-                static_cast<f32>(size.y) / static_cast<f32>(initial_size.y)
-            )))
-        )
-    );
-    const f32 divisions = std::exp2f(static_cast<f32>(octaves)) - 1.0f;
-    f32 amplitude = std::floor(divisions / 2.0f) / divisions;
-    for (usize i = 0; i < octaves; ++i, octave_size *= 2, amplitude *= 0.5f) {
-        image += transform_image(
-            generate_perlin_noise(size, generate_white_noise<glm::vec2>(octave_size)),
-            [amplitude](const f32 val) -> f32 { return val * amplitude; }
-        );
+    for (usize i = 0; i < octave_count; ++i, octave_size *= 2) {
+        grids.push_back(generate_white_noise<glm::vec2>(octave_size, rng, to_u32(i)));
     }
-    return image;
+
+    std::vector<NoiseOctave<glm::vec2>> octaves = {};
+    octaves.reserve(octave_count);
+    f32 amplitude = first_octave_amplitude(octave_count);
+    for (const auto& grid : grids) {
+        octaves.push_back({
+            .grid = &grid,
+            .columns = grid_columns(size.x, grid.width(), 2, smoothstep_quintic<f32>),
+            .amplitude = amplitude,
+        });
+        amplitude *= 0.5f;
+    }
+    return accumulate_perlin_octaves(size, octaves);
 }
 
 } // namespace hg
@@ -0,0 +1,204 @@
+#include "hg_gpu_generate.h"
+
+#include "hg_utils.h"
+#include "hg_vulkan_engine.h"
+
+#include <cmath>
+
+namespace hg {
+
+Result<GpuNoiseGenerator> GpuNoiseGenerator::create(const Engine& engine) {
+    ASSERT(engine.device != nullptr);
+    ASSERT(engine.bindless != nullptr);
+    if (!engine.storage_images)
+        return Err::StorageImagesUnsupported;
+
+    auto generator = ok<GpuNoiseGenerator>();
+
+    generator->m_bindless_set = engine.bindless->get_set();
+    const auto set_layout = engine.bindless->get_set_layout();
+    const vk::PushConstantRange push_range = {vk::ShaderStageFlagBits::eCompute, 0, sizeof(Push)};
+    const auto pipeline_layout = engine.device.createPipelineLayout({
+        .setLayoutCount = 1,
+        .pSetLayouts = &set_layout,
+        .pushConstantRangeCount = 1,
+        .pPushConstantRanges = &push_range,
+    });
+    if (pipeline_layout.result != vk::Result::eSuccess)
+        return Err::CouldNotCreateVkPipelineLayout;
+    generator->m_pipeline_layout = pipeline_layout.value;
+
+    const auto shader = create_unlinked_shader(engine, {
+        .path = "../shaders/noise.comp.spv",
+        .stage = vk::ShaderStageFlagBits::eCompute,
+        .set_layouts = {&set_layout, 1},
+        .push_ranges = {&push_range, 1},
+    });
+    if (shader.has_err())
+        return shader.err();
+    generator->m_shader = *shader;
+
+    ASSERT(generator->m_bindless_set != nullptr);
+    ASSERT(generator->m_pipeline_layout != nullptr);
+    ASSERT(generator->m_shader != nullptr);
+    return generator;
+}
+
+void GpuNoiseGenerator::destroy(const Engine& engine) const {
+    ASSERT(engine.device != nullptr);
+
+    ASSERT(m_shader != nullptr);
+    engine.device.destroyShaderEXT(m_shader);
+    ASSERT(m_pipeline_layout != nullptr);
+    engine.device.destroyPipelineLayout(m_pipeline_layout);
+}
+
+Result<GpuNoiseGenerator::Target> GpuNoiseGenerator::create_target(
+    const Engine& engine, const GpuImage& image, const Output output, const vk::Extent2D extent, const u32 mip_levels
+) {
+    ASSERT(engine.device != nullptr);
+    ASSERT(engine.bindless != nullptr);
+    ASSERT(image.image != nullptr);
+    ASSERT(extent.width > 0);
+    ASSERT(extent.height > 0);
+    ASSERT(mip_levels > 0);
+
+    const auto format_properties = engine.gpu.getFormatProperties(output_format(output));
+    if (!(format_properties.optimalTilingFeatures & vk::FormatFeatureFlagBits::eStorageImage))
+        return Err::ImageFormatUnsupported;
+    if (mip_levels > 1 && !(format_properties.optimalTilingFeatures & vk::FormatFeatureFlagBits::eSampledImageFilterLinear))
+        return Err::CouldNotGenerateMipmaps;
+
+    // Storage descriptors can only see one level, so the image's own view can't be used once it has mips
+    const auto view = engine.device.createImageView({
+        .image = image.image,
+        .viewType = vk::ImageViewType::e2D,
+        .format = output_format(output),
+        .subresourceRange = {vk::ImageAspectFlagBits::eColor, 0, 1, 0, 1},
+    });
+    if (view.result != vk::Result::eSuccess)
+        return Err::CouldNotCreateGpuImageView;
+
+    const auto index = engine.bindless->add_storage_image(view.value);
+    if (index.has_err()) {
+        engine.device.destroyImageView(view.value);
+        return index.err();
+    }
+
+    auto target = ok<Target>(image.image, view.value, *index, output, extent, mip_levels);
+
+    ASSERT(target->view != nullptr);
+    ASSERT(target->index != BindlessHeap::InvalidIndex);
+    return target;
+}
+
+void GpuNoiseGenerator::destroy_target(const Engine& engine, const Target& target) {
+    ASSERT(engine.deletions != nullptr);
+    ASSERT(engine.bindless != nullptr);
+    ASSERT(target.view != nullptr);
+    ASSERT(target.index != BindlessHeap::InvalidIndex);
+
+    engine.bindless->remove_storage_image(engine, target.index);
+    engine.deletions->push([view = target.view](const Engine& e) { e.device.destroyImageView(view); });
+}
+
+void GpuNoiseGenerator::cmd_generate(
+    const vk::CommandBuffer cmd, const Target& target, const Config& config, const vk::ImageLayout final_layout
+) const {
+    ASSERT(cmd != nullptr);
+    ASSERT(target.image != nullptr);
+    ASSERT(target.index != BindlessHeap::InvalidIndex);
+    ASSERT(config.initial_size.x > 0 && config.initial_size.y > 0);
+    ASSERT(target.extent.width > config.initial_size.x && target.extent.height > config.initial_size.y);
+    ASSERT(config.max_octaves > 0);
+    ASSERT(final_layout != vk::ImageLayout::eUndefined);
+
+    // The same octaves as the cpu fractal noise, weighted to sum to one so the heights span [0, 1]
+    const u32 octave_count = std::min(config.max_octaves, static_cast<u32>(std::floor(std::log2(std::min(
+        static_cast<f32>(target.extent.width) / static_cast<f32>(config.initial_size.x),
+        static_cast<f32>(target.extent.height) / static_cast<f32>(config.initial_size.y)
+    )))));
+    const Push push = {
+        .extent = {target.extent.width, target.extent.height},
+        .initial_size = config.initial_size,
+        .octave_count = octave_count,
+        .amplitude = std::exp2f(static_cast<f32>(octave_count) - 1.0f) / (std::exp2f(static_cast<f32>(octave_count)) - 1.0f),
+        .seed = config.seed,
+        .noise = config.noise,
+        .output = target.output,
+        .image = target.index,
+    };
+
+    // Every earlier read of the image has to finish before it is overwritten, its old contents are discarded
+    BarrierBuilder(cmd)
+        .add_image_barrier(target.image, {vk::ImageAspectFlagBits::eColor, 0, 1, 0, 1})
+        .set_image_src(vk::PipelineStageFlagBits2::eAllCommands, vk::AccessFlagBits2::eNone, vk::ImageLayout::eUndefined)
+        .set_image_dst(vk::PipelineStageFlagBits2::eComputeShader, vk::AccessFlagBits2::eShaderStorageWrite, vk::ImageLayout::eGeneral)
+        .build_and_run();
+
+    cmd.bindShadersEXT({vk::ShaderStageFlagBits::eCompute}, {m_shader});
+    cmd.bindDescriptorSets(vk::PipelineBindPoint::eCompute, m_pipeline_layout, 0, {m_bindless_set}, {});
+    cmd.pushConstants(m_pipeline_layout, vk::ShaderStageFlagBits::eCompute, 0, sizeof(push), &push);
+    cmd.dispatch(
+        (target.extent.width + WorkgroupSize - 1) / WorkgroupSize,
+        (target.extent.height + WorkgroupSize - 1) / WorkgroupSize,
+        1
+    );
+
+    if (target.mip_levels > 1) {
+        cmd_generate_mipmaps(
+            cmd, target.image, target.mip_levels, {target.extent.width, target.extent.height, 1},
+            vk::ImageLayout::eGeneral, final_layout
+        );
+    } else {
+        BarrierBuilder(cmd)
+            .add_image_barrier(target.image, {vk::ImageAspectFlagBits::eColor, 0, 1, 0, 1})
+            .set_image_src(vk::PipelineStageFlagBits2::eComputeShader, vk::AccessFlagBits2::eShaderStorageWrite, vk::ImageLayout::eGeneral)
+            .set_image_dst(vk::PipelineStageFlagBits2::eAllCommands, vk::AccessFlagBits2::eMemoryRead, final_layout)
+            .build_and_run();
+    }
+}
+
+Result<GpuImage> GpuNoiseGenerator::generate_image(
+    const Engine& engine, const Output output, const vk::Extent2D extent, const Config& config
+) const {
+    ASSERT(engine.gpu != nullptr);
+    ASSERT(engine.bindless != nullptr);
+    ASSERT(extent.width > 0);
+    ASSERT(extent.height > 0);
+
+    const vk::Extent3D image_extent = {extent.width, extent.height, 1};
+    const auto format_properties = engine.gpu.getFormatProperties(output_format(output));
+    const u32 mip_levels = format_properties.optimalTilingFeatures & vk::FormatFeatureFlagBits::eSampledImageFilterLinear
+        ? get_mip_count(image_extent) : 1;
+
+    const auto image = GpuImage::create_result(engine, {
+        .extent = image_extent,
+        .format = output_format(output),
+        .usage = TargetUsage,
+        .mip_levels = mip_levels,
+    });
+    if (image.has_err())
+        return image.err();
+
+    const auto target = create_target(engine, *image, output, extent, mip_levels);
+    if (target.has_err()) {
+        image->destroy(engine);
+        return target.err();
+    }
+    defer(destroy_target(engine, *target));
+
+    // The target's descriptor has to be written before the submission, rather than at the end of the next frame
+    engine.bindless->flush_writes(engine);
+    const auto submit = submit_single_time_commands(engine, [&](const vk::CommandBuffer cmd) {
+        cmd_generate(cmd, *target, config);
+    });
+    if (submit.has_err()) {
+        image->destroy(engine);
+        return submit.err();
+    }
+
+    return image;
+}
+
+} // namespace hg
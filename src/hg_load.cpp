@@ -1,6 +1,18 @@
 #include "hg_load.h"
 #include "hg_generate.h"
 
+#ifdef _WIN32
+#define WIN32_LEAN_AND_MEAN
+#define NOMINMAX
+#define NOGDI
+#include <windows.h>
+#else
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+#endif
+
 #include <stb/stb_image.h>
 
 #define FASTGLTF_COMPILE_AS_CPP20
@@ -8,7 +20,10 @@
 #include <fastgltf/glm_element_traits.hpp>
 #include <fastgltf/tools.hpp>
 
+#include <bit>
+#include <cstring>
 #include <filesystem>
+#include <fstream>
 #include <memory>
 
 namespace hg {
@@ -26,6 +41,330 @@ Result<ImageData> ImageData::load(const std::filesystem::path path) {
     return ok<ImageData>(std::unique_ptr<u8[], decltype(FreeDeleter)>{pixels}, width, height, channels);
 }
 
+namespace {
+
+constexpr std::array<u8, 12> Ktx2Identifier = {0xAB, 'K', 'T', 'X', ' ', '2', '0', 0xBB, '\r', '\n', 0x1A, '\n'};
+
+struct Ktx2Header {
+    std::array<u8, 12> identifier = Ktx2Identifier;
+    u32 vk_format = 0;
+    u32 type_size = 1;
+    u32 pixel_width = 0;
+    u32 pixel_height = 0;
+    u32 pixel_depth = 0;
+    u32 layer_count = 0;
+    u32 face_count = 1;
+    u32 level_count = 0;
+    u32 supercompression_scheme = 0;
+    u32 dfd_byte_offset = 0;
+    u32 dfd_byte_length = 0;
+    u32 kvd_byte_offset = 0;
+    u32 kvd_byte_length = 0;
+    u64 sgd_byte_offset = 0;
+    u64 sgd_byte_length = 0;
+};
+static_assert(sizeof(Ktx2Header) == 80);
+
+struct Ktx2Level {
+    u64 byte_offset = 0;
+    u64 byte_length = 0;
+    u64 uncompressed_byte_length = 0;
+};
+
+struct DdsPixelFormat {
+    u32 size = 0;
+    u32 flags = 0;
+    u32 four_cc = 0;
+    u32 rgb_bit_count = 0;
+    std::array<u32, 4> masks = {};
+};
+
+struct DdsHeader {
+    u32 size = 0;
+    u32 flags = 0;
+    u32 height = 0;
+    u32 width = 0;
+    u32 pitch_or_linear_size = 0;
+    u32 depth = 0;
+    u32 mip_map_count = 0;
+    std::array<u32, 11> reserved = {};
+    DdsPixelFormat pixel_format = {};
+    std::array<u32, 4> caps = {};
+    u32 reserved_2 = 0;
+};
+static_assert(sizeof(DdsHeader) == 124);
+
+struct DdsHeaderDx10 {
+    u32 dxgi_format = 0;
+    u32 resource_dimension = 0;
+    u32 misc_flag = 0;
+    u32 array_size = 0;
+    u32 misc_flags_2 = 0;
+};
+
+// Levels until both sides reach one, a header claiming more would shift the extents past zero
+constexpr u32 max_level_count(const u32 width, const u32 height) {
+    return static_cast<u32>(std::bit_width(std::max(width, height)));
+}
+
+constexpr u32 four_cc(const char a, const char b, const char c, const char d) {
+    return static_cast<u32>(a) | static_cast<u32>(b) << 8 | static_cast<u32>(c) << 16 | static_cast<u32>(d) << 24;
+}
+
+vk::Format dds_four_cc_format(const u32 code) {
+    switch (code) {
+        case four_cc('D', 'X', 'T', '1'): return vk::Format::eBc1RgbaUnormBlock;
+        case four_cc('D', 'X', 'T', '3'): return vk::Format::eBc2UnormBlock;
+        case four_cc('D', 'X', 'T', '5'): return vk::Format::eBc3UnormBlock;
+        case four_cc('A', 'T', 'I', '1'): return vk::Format::eBc4UnormBlock;
+        case four_cc('B', 'C', '4', 'U'): return vk::Format::eBc4UnormBlock;
+        case four_cc('B', 'C', '4', 'S'): return vk::Format::eBc4SnormBlock;
+        case four_cc('A', 'T', 'I', '2'): return vk::Format::eBc5UnormBlock;
+        case four_cc('B', 'C', '5', 'U'): return vk::Format::eBc5UnormBlock;
+        case four_cc('B', 'C', '5', 'S'): return vk::Format::eBc5SnormBlock;
+        default: return vk::Format::eUndefined;
+    }
+}
+
+vk::Format dxgi_format(const u32 format) {
+    switch (format) {
+        case 71: return vk::Format::eBc1RgbaUnormBlock;
+        case 72: return vk::Format::eBc1RgbaSrgbBlock;
+        case 74: return vk::Format::eBc2UnormBlock;
+        case 75: return vk::Format::eBc2SrgbBlock;
+        case 77: return vk::Format::eBc3UnormBlock;
+        case 78: return vk::Format::eBc3SrgbBlock;
+        case 80: return vk::Format::eBc4UnormBlock;
+        case 81: return vk::Format::eBc4SnormBlock;
+        case 83: return vk::Format::eBc5UnormBlock;
+        case 84: return vk::Format::eBc5SnormBlock;
+        case 95: return vk::Format::eBc6HUfloatBlock;
+        case 96: return vk::Format::eBc6HSfloatBlock;
+        case 98: return vk::Format::eBc7UnormBlock;
+        case 99: return vk::Format::eBc7SrgbBlock;
+        default: return vk::Format::eUndefined;
+    }
+}
+
+// Bytes per 4x4 block of the bc formats dds files can hold
+u32 bc_block_size(const vk::Format format) {
+    switch (format) {
+        case vk::Format::eBc1RgbaUnormBlock:
+        case vk::Format::eBc1RgbaSrgbBlock:
+        case vk::Format::eBc4UnormBlock:
+        case vk::Format::eBc4SnormBlock:
+            return 8;
+        default:
+            return 16;
+    }
+}
+
+} // namespace
+
+Result<CompressedImage> CompressedImage::load(const std::filesystem::path& path) {
+    ASSERT(!path.empty());
+
+    if (path.extension() == ".ktx2")
+        return load_ktx2(path);
+    if (path.extension() == ".dds")
+        return load_dds(path);
+    return Err::ImageFormatUnsupported;
+}
+
+Result<CompressedImage> CompressedImage::load_ktx2(const std::filesystem::path& path) {
+    ASSERT(!path.empty());
+
+    auto file = MappedFile::open(path);
+    if (file.has_err())
+        return file.err() == Err::MeshFileNotFound ? Err::ImageFileNotFound : Err::ImageFileInvalid;
+    if (file->size() < sizeof(Ktx2Header))
+        return Err::ImageFileInvalid;
+
+    Ktx2Header header = {};
+    std::memcpy(&header, file->data(), sizeof(header));
+    if (header.identifier != Ktx2Identifier)
+        return Err::ImageFileInvalid;
+    if (header.pixel_width == 0 || header.pixel_height == 0)
+        return Err::ImageFileInvalid;
+    // Zstd and basis supercompression would need a transcoder, as would 3d, array and cubemap textures a new image type
+    if (header.vk_format == VK_FORMAT_UNDEFINED || header.supercompression_scheme != 0)
+        return Err::ImageFormatUnsupported;
+    if (header.pixel_depth > 1 || header.layer_count > 1 || header.face_count != 1)
+        return Err::ImageFormatUnsupported;
+
+    const u32 level_count = std::max(header.level_count, 1u);
+    if (level_count > max_level_count(header.pixel_width, header.pixel_height))
+        return Err::ImageFileInvalid;
+    if (sizeof(header) + usize{level_count} * sizeof(Ktx2Level) > file->size())
+        return Err::ImageFileInvalid;
+
+    const auto format = static_cast<vk::Format>(header.vk_format);
+    const auto block_extent = vk::blockExtent(format);
+    const u32 block_size = vk::blockSize(format);
+    if (block_size == 0)
+        return Err::ImageFormatUnsupported;
+
+    auto image = ok<CompressedImage>();
+    image->format = format;
+    image->levels.reserve(level_count);
+    for (u32 i = 0; i < level_count; ++i) {
+        Ktx2Level level = {};
+        std::memcpy(&level, file->data() + sizeof(header) + i * sizeof(Ktx2Level), sizeof(level));
+        // Each level is uploaded with a tightly packed copy, so it has to hold exactly its blocks
+        const u32 width = std::max(header.pixel_width >> i, 1u);
+        const u32 height = std::max(header.pixel_height >> i, 1u);
+        const usize size = usize{(width + block_extent[0] - 1) / block_extent[0]}
+                         * ((height + block_extent[1] - 1) / block_extent[1]) * block_size;
+        if (level.byte_length != size || level.byte_offset > file->size() || size > file->size() - level.byte_offset)
+            return Err::ImageFileInvalid;
+
+        image->levels.push_back({.data = {file->data() + level.byte_offset, size}, .width = width, .height = height});
+    }
+    image->file = std::move(*file);
+
+    ASSERT(!image->levels.empty());
+    return image;
+}
+
+Result<CompressedImage> CompressedImage::load_dds(const std::filesystem::path& path) {
+    ASSERT(!path.empty());
+
+    auto file = MappedFile::open(path);
+    if (file.has_err())
+        return file.err() == Err::MeshFileNotFound ? Err::ImageFileNotFound : Err::ImageFileInvalid;
+    if (file->size() < sizeof(u32) + sizeof(DdsHeader))
+        return Err::ImageFileInvalid;
+
+    u32 magic = 0;
+    std::memcpy(&magic, file->data(), sizeof(magic));
+    DdsHeader header = {};
+    std::memcpy(&header, file->data() + sizeof(magic), sizeof(header));
+    if (magic != four_cc('D', 'D', 'S', ' ') || header.size != sizeof(DdsHeader))
+        return Err::ImageFileInvalid;
+    if (header.width == 0 || header.height == 0)
+        return Err::ImageFileInvalid;
+
+    constexpr u32 FourCCFlag = 0x4;
+    if (!(header.pixel_format.flags & FourCCFlag))
+        return Err::ImageFormatUnsupported;
+
+    usize offset = sizeof(magic) + sizeof(header);
+    vk::Format format = dds_four_cc_format(header.pixel_format.four_cc);
+    if (header.pixel_format.four_cc == four_cc('D', 'X', '1', '0')) {
+        if (file->size() < offset + sizeof(DdsHeaderDx10))
+            return Err::ImageFileInvalid;
+        DdsHeaderDx10 dx10 = {};
+        std::memcpy(&dx10, file->data() + offset, sizeof(dx10));
+        offset += sizeof(dx10);
+
+        constexpr u32 Texture2D = 3;
+        if (dx10.resource_dimension != Texture2D || dx10.array_size > 1)
+            return Err::ImageFormatUnsupported;
+        format = dxgi_format(dx10.dxgi_format);
+    }
+    if (format == vk::Format::eUndefined)
+        return Err::ImageFormatUnsupported;
+
+    // Levels are stored largest first and tightly packed
+    const u32 level_count = std::max(header.mip_map_count, 1u);
+    if (level_count > max_level_count(header.width, header.height))
+        return Err::ImageFileInvalid;
+    auto image = ok<CompressedImage>();
+    image->format = format;
+    image->levels.reserve(level_count);
+    for (u32 i = 0; i < level_count; ++i) {
+        const u32 width = std::max(header.width >> i, 1u);
+        const u32 height = std::max(header.height >> i, 1u);
+        const usize size = usize{(width + 3) / 4} * ((height + 3) / 4) * bc_block_size(format);
+        if (offset + size > file->size())
+            return Err::ImageFileInvalid;
+
+        image->levels.push_back({.data = {file->data() + offset, size}, .width = width, .height = height});
+        offset += size;
+    }
+    image->file = std::move(*file);
+
+    ASSERT(!image->levels.empty());
+    return image;
+}
+
+Result<void> CompressedImage::save_ktx2(const std::filesystem::path& path) const {
+    ASSERT(!path.empty());
+    ASSERT(!levels.empty());
+
+    // Data format descriptor: 4x4 blocks of 16 bytes, one 128 bit sample for BC7 and a 64 bit one per channel for BC5
+    const bool bc7 = format == vk::Format::eBc7UnormBlock || format == vk::Format::eBc7SrgbBlock;
+    const bool bc5 = format == vk::Format::eBc5UnormBlock || format == vk::Format::eBc5SnormBlock;
+    ASSERT(bc7 || bc5);
+
+    constexpr u32 ModelBc5 = 132;
+    constexpr u32 ModelBc7 = 134;
+    constexpr u32 PrimariesBt709 = 1;
+    constexpr u32 TransferLinear = 1;
+    constexpr u32 TransferSrgb = 2;
+    constexpr u32 SampleSigned = 0x40;
+
+    const u32 sample_count = bc7 ? 1 : 2;
+    const u32 block_size = 24 + 16 * sample_count;
+    std::vector<u32> dfd = {
+        4 + block_size,
+        0,
+        2 | block_size << 16,
+        (bc7 ? ModelBc7 : ModelBc5) | PrimariesBt709 << 8
+            | (format == vk::Format::eBc7SrgbBlock ? TransferSrgb : TransferLinear) << 16,
+        3 | 3 << 8,
+        16,
+        0,
+    };
+    for (u32 sample = 0; sample < sample_count; ++sample) {
+        const bool is_signed = format == vk::Format::eBc5SnormBlock;
+        const u32 bit_length = bc7 ? 128 : 64;
+        dfd.push_back(sample * 64 | (bit_length - 1) << 16 | (sample | (is_signed ? SampleSigned : 0)) << 24);
+        dfd.push_back(0);
+        dfd.push_back(is_signed ? 0x80000000 : 0);
+        dfd.push_back(is_signed ? 0x7fffffff : 0xffffffff);
+    }
+
+    const usize level_index_end = sizeof(Ktx2Header) + levels.size() * sizeof(Ktx2Level);
+    const usize dfd_size = dfd.size() * sizeof(u32);
+    const Ktx2Header header = {
+        .vk_format = static_cast<u32>(format),
+        .pixel_width = levels[0].width,
+        .pixel_height = levels[0].height,
+        .level_count = to_u32(levels.size()),
+        .dfd_byte_offset = to_u32(level_index_end),
+        .dfd_byte_length = to_u32(dfd_size),
+    };
+
+    // Level data is stored smallest first, aligned to the 16 byte block size
+    std::vector<Ktx2Level> level_index(levels.size());
+    usize offset = level_index_end + dfd_size;
+    for (usize i = levels.size(); i-- > 0;) {
+        offset = (offset + 15) / 16 * 16;
+        level_index[i] = {offset, levels[i].data.size(), levels[i].data.size()};
+        offset += levels[i].data.size();
+    }
+
+    std::ofstream file{path, std::ios::binary | std::ios::trunc};
+    if (!file.is_open())
+        return Err::CouldNotWriteImageFile;
+
+    constexpr std::array<char, 16> padding = {};
+    file.write(reinterpret_cast<const char*>(&header), sizeof(header));
+    file.write(reinterpret_cast<const char*>(level_index.data()), static_cast<std::streamsize>(level_index.size() * sizeof(Ktx2Level)));
+    file.write(reinterpret_cast<const char*>(dfd.data()), static_cast<std::streamsize>(dfd_size));
+    usize written = level_index_end + dfd_size;
+    for (usize i = levels.size(); i-- > 0;) {
+        file.write(padding.data(), static_cast<std::streamsize>(level_index[i].byte_offset - written));
+        file.write(reinterpret_cast<const char*>(levels[i].data.data()), static_cast<std::streamsize>(levels[i].data.size()));
+        written = level_index[i].byte_offset + levels[i].data.size();
+    }
+    if (!file.good())
+        return Err::CouldNotWriteImageFile;
+
+    return ok();
+}
+
 Result<ModelData> ModelData::load_gltf(const std::filesystem::path path) {
     ASSERT(!path.empty());
 
@@ -94,10 +433,165 @@ Result<ModelData> ModelData::load_gltf(const std::filesystem::path path) {
 
     create_tangents(primitives);
     model->mesh = Mesh::from_primitives(primitives);
+    generate_lods(model->mesh);
 
     ASSERT(!model->mesh.indices.empty());
     ASSERT(!model->mesh.vertices.empty());
     return model;
 }
 
+Result<MappedFile> MappedFile::open(const std::filesystem::path& path) {
+    ASSERT(!path.empty());
+
+    auto file = ok<MappedFile>();
+#ifdef _WIN32
+    const HANDLE handle = CreateFileW(
+        path.c_str(), GENERIC_READ, FILE_SHARE_READ, nullptr, OPEN_EXISTING, FILE_FLAG_SEQUENTIAL_SCAN, nullptr
+    );
+    if (handle == INVALID_HANDLE_VALUE)
+        return Err::MeshFileNotFound;
+    defer(CloseHandle(handle));
+
+    LARGE_INTEGER size = {};
+    if (!GetFileSizeEx(handle, &size) || size.QuadPart == 0)
+        return Err::MeshFileInvalid;
+
+    const HANDLE mapping = CreateFileMappingW(handle, nullptr, PAGE_READONLY, 0, 0, nullptr);
+    if (mapping == nullptr)
+        return Err::MeshFileInvalid;
+    const auto data = MapViewOfFile(mapping, FILE_MAP_READ, 0, 0, 0);
+    if (data == nullptr) {
+        CloseHandle(mapping);
+        return Err::MeshFileInvalid;
+    }
+
+    file->m_data = data;
+    file->m_size = static_cast<usize>(size.QuadPart);
+    file->m_mapping = mapping;
+#else
+    const int fd = ::open(path.c_str(), O_RDONLY);
+    if (fd < 0)
+        return Err::MeshFileNotFound;
+    defer(::close(fd));
+
+    struct stat info = {};
+    if (fstat(fd, &info) != 0 || info.st_size == 0)
+        return Err::MeshFileInvalid;
+
+    const auto data = mmap(nullptr, static_cast<usize>(info.st_size), PROT_READ, MAP_PRIVATE, fd, 0);
+    if (data == MAP_FAILED)
+        return Err::MeshFileInvalid;
+    // The whole file is uploaded right away, so ask for it to be read ahead
+    madvise(data, static_cast<usize>(info.st_size), MADV_WILLNEED);
+
+    file->m_data = data;
+    file->m_size = static_cast<usize>(info.st_size);
+#endif
+
+    ASSERT(file->m_data != nullptr);
+    ASSERT(file->m_size > 0);
+    return file;
+}
+
+void MappedFile::close() {
+    if (m_data == nullptr)
+        return;
+#ifdef _WIN32
+    UnmapViewOfFile(m_data);
+    CloseHandle(m_mapping);
+#else
+    munmap(m_data, m_size);
+#endif
+    m_data = nullptr;
+    m_size = 0;
+    m_mapping = nullptr;
+}
+
+Result<BakedModel> BakedModel::load(const std::filesystem::path& path) {
+    ASSERT(!path.empty());
+
+    auto file = MappedFile::open(path);
+    if (file.has_err())
+        return file.err();
+    if (file->size() < sizeof(BakedMeshHeader))
+        return Err::MeshFileInvalid;
+
+    BakedMeshHeader header = {};
+    std::memcpy(&header, file->data(), sizeof(header));
+    if (header.magic != BakedMeshHeader::Magic)
+        return Err::MeshFileInvalid;
+    if (header.version != BakedMeshHeader::CurrentVersion || header.vertex_size != sizeof(Vertex))
+        return Err::MeshFileInvalid;
+    if (header.index_count == 0 || header.vertex_count == 0 || header.vertex_offset % alignof(Vertex) != 0)
+        return Err::MeshFileInvalid;
+    if (header.lod_count >= MaxMeshLods)
+        return Err::MeshFileInvalid;
+    const usize index_offset = sizeof(header) + usize{header.lod_count} * sizeof(MeshLod);
+    if (index_offset + (usize{header.index_count} + header.lod_index_count) * sizeof(u32) > header.vertex_offset)
+        return Err::MeshFileInvalid;
+    if (header.vertex_offset + usize{header.vertex_count} * sizeof(Vertex) > file->size())
+        return Err::MeshFileInvalid;
+
+    const u8* data = file->data();
+    auto model = ok<BakedModel>();
+    model->indices = {reinterpret_cast<const u32*>(data + index_offset), header.index_count};
+    model->lod_indices = {model->indices.data() + header.index_count, header.lod_index_count};
+    model->lods.resize(header.lod_count);
+    std::memcpy(model->lods.data(), data + sizeof(header), header.lod_count * sizeof(MeshLod));
+    for (const MeshLod& lod : model->lods) {
+        if (usize{lod.first_index} + lod.index_count > header.lod_index_count || lod.index_count % 3 != 0)
+            return Err::MeshFileInvalid;
+    }
+    // Indices are drawn straight from the file, so one past the vertices would read another model's
+    const std::span<const u32> all_indices = {model->indices.data(), usize{header.index_count} + header.lod_index_count};
+    if (std::ranges::max(all_indices) >= header.vertex_count)
+        return Err::MeshFileInvalid;
+    model->vertices = {reinterpret_cast<const Vertex*>(data + header.vertex_offset), header.vertex_count};
+    model->roughness = header.roughness;
+    model->metalness = header.metalness;
+    model->file = std::move(*file);
+
+    ASSERT(!model->indices.empty());
+    ASSERT(!model->vertices.empty());
+    return model;
+}
+
+Result<void> BakedModel::save(
+    const std::filesystem::path& path, const Mesh& mesh, const float roughness, const float metalness
+) {
+    ASSERT(!path.empty());
+    ASSERT(!mesh.indices.empty());
+    ASSERT(!mesh.vertices.empty());
+    ASSERT(mesh.lods.size() < MaxMeshLods);
+
+    const usize index_offset = sizeof(BakedMeshHeader) + mesh.lods.size() * sizeof(MeshLod);
+    const usize index_end = index_offset + (mesh.indices.size() + mesh.lod_indices.size()) * sizeof(u32);
+    const usize vertex_offset = (index_end + alignof(Vertex) - 1) / alignof(Vertex) * alignof(Vertex);
+    const BakedMeshHeader header = {
+        .index_count = to_u32(mesh.indices.size()),
+        .lod_count = to_u32(mesh.lods.size()),
+        .lod_index_count = to_u32(mesh.lod_indices.size()),
+        .vertex_count = to_u32(mesh.vertices.size()),
+        .vertex_offset = to_u32(vertex_offset),
+        .roughness = roughness,
+        .metalness = metalness,
+    };
+
+    std::ofstream file{path, std::ios::binary | std::ios::trunc};
+    if (!file.is_open())
+        return Err::CouldNotWriteMeshFile;
+
+    constexpr std::array<char, alignof(Vertex)> padding = {};
+    file.write(reinterpret_cast<const char*>(&header), sizeof(header));
+    file.write(reinterpret_cast<const char*>(mesh.lods.data()), static_cast<std::streamsize>(mesh.lods.size() * sizeof(MeshLod)));
+    file.write(reinterpret_cast<const char*>(mesh.indices.data()), static_cast<std::streamsize>(mesh.indices.size() * sizeof(u32)));
+    file.write(reinterpret_cast<const char*>(mesh.lod_indices.data()), static_cast<std::streamsize>(mesh.lod_indices.size() * sizeof(u32)));
+    file.write(padding.data(), static_cast<std::streamsize>(vertex_offset - index_end));
+    file.write(reinterpret_cast<const char*>(mesh.vertices.data()), static_cast<std::streamsize>(mesh.vertices.size() * sizeof(Vertex)));
+    if (!file.good())
+        return Err::CouldNotWriteMeshFile;
+
+    return ok();
+}
+
 } // namespace hg
@@ -6,7 +6,11 @@
 #include "hg_load.h"
 #include "hg_vulkan_engine.h"
 
+#include <bit>
+#include <cmath>
+#include <cstring>
 #include <filesystem>
+#include <limits>
 
 namespace hg {
 
@@ -16,30 +20,28 @@ Result<DefaultPipeline> DefaultPipeline::create(const Engine& engine, const vk::
 
     auto pipeline = ok<DefaultPipeline>();
 
-    pipeline->m_color_image = GpuImage::create(engine, {
-        .extent = {window_size.width, window_size.height, 1},
-        .format = Window::SwapchainImageFormat,
-        .usage = vk::ImageUsageFlagBits::eColorAttachment | vk::ImageUsageFlagBits::eTransferSrc,
-        .sample_count = vk::SampleCountFlagBits::e4,
-    });
-    pipeline->m_depth_image = GpuImage::create(engine, {
-        .extent = {window_size.width, window_size.height, 1},
-        .format = vk::Format::eD32Sfloat,
-        .usage = vk::ImageUsageFlagBits::eDepthStencilAttachment,
-        .aspect_flags = vk::ImageAspectFlagBits::eDepth,
-        .sample_count = vk::SampleCountFlagBits::e4,
-    });
+    // Every gpu supports four samples for color and depth, so only a gpu below the minimum limits needs a fallback
+    const auto& sample_limits = engine.gpu.getProperties().limits;
+    if (!(sample_limits.framebufferColorSampleCounts & sample_limits.framebufferDepthSampleCounts & pipeline->m_sample_count))
+        pipeline->m_sample_count = vk::SampleCountFlagBits::e1;
+    pipeline->create_render_targets(engine, window_size, false);
+    pipeline->m_extent = window_size;
+    pipeline->m_window_extent = window_size;
 
     const auto descriptor_pool = create_descriptor_pool(engine, 1, std::array{
-        vk::DescriptorPoolSize{vk::DescriptorType::eUniformBuffer, 2}
+        vk::DescriptorPoolSize{vk::DescriptorType::eUniformBufferDynamic, 1},
+        vk::DescriptorPoolSize{vk::DescriptorType::eStorageBufferDynamic, 2},
     });
     if (descriptor_pool.has_err())
         return descriptor_pool.err();
     pipeline->m_descriptor_pool = *descriptor_pool;
 
+    constexpr auto all_stages = vk::ShaderStageFlagBits::eVertex | vk::ShaderStageFlagBits::eFragment | vk::ShaderStageFlagBits::eCompute;
+    constexpr auto light_stages = vk::ShaderStageFlagBits::eFragment | vk::ShaderStageFlagBits::eCompute;
     const auto set_layout = create_descriptor_set_layout(engine, std::array{
-        vk::DescriptorSetLayoutBinding{0, vk::DescriptorType::eUniformBuffer, 1, vk::ShaderStageFlagBits::eVertex},
-        vk::DescriptorSetLayoutBinding{1, vk::DescriptorType::eUniformBuffer, 1, vk::ShaderStageFlagBits::eFragment},
+        vk::DescriptorSetLayoutBinding{0, vk::DescriptorType::eUniformBufferDynamic, 1, all_stages},
+        vk::DescriptorSetLayoutBinding{1, vk::DescriptorType::eStorageBufferDynamic, 1, light_stages},
+        vk::DescriptorSetLayoutBinding{2, vk::DescriptorType::eStorageBufferDynamic, 1, light_stages},
     });
     if (set_layout.has_err())
         return set_layout.err();
@@ -50,102 +52,363 @@ Result<DefaultPipeline> DefaultPipeline::create(const Engine& engine, const vk::
         return global_set.err();
     pipeline->m_global_set = *global_set;
 
+    ASSERT(engine.bindless != nullptr);
+    pipeline->m_bindless_set = engine.bindless->get_set();
+    pipeline->m_draw_set_layouts = {pipeline->m_set_layout, engine.bindless->get_set_layout()};
+    const auto draw_layout = engine.device.createPipelineLayout({
+        .setLayoutCount = to_u32(pipeline->m_draw_set_layouts.size()),
+        .pSetLayouts = pipeline->m_draw_set_layouts.data(),
+        .pushConstantRangeCount = 1,
+        .pPushConstantRanges = &DrawPushRange,
+    });
+    if (draw_layout.result != vk::Result::eSuccess)
+        return Err::CouldNotCreateVkPipelineLayout;
+    pipeline->m_draw_layout = draw_layout.value;
+
+    // Each frame in flight gets its own slot, so the cpu never writes what the gpu may still be reading
+    const auto& limits = engine.gpu.getProperties().limits;
+    const auto align = [](const vk::DeviceSize size, const vk::DeviceSize alignment) {
+        return (size + alignment - 1) / alignment * alignment;
+    };
+    pipeline->m_vp_stride = align(sizeof(ViewProjectionUniform), limits.minUniformBufferOffsetAlignment);
+    pipeline->m_light_stride = align(sizeof(LightBuffer), limits.minStorageBufferOffsetAlignment);
+    pipeline->m_cluster_stride = align(sizeof(Cluster) * ClusterCount, limits.minStorageBufferOffsetAlignment);
+
     pipeline->m_vp_buffer = GpuBuffer::create(engine, {
-        sizeof(ViewProjectionUniform),
-        vk::BufferUsageFlagBits::eUniformBuffer, GpuBuffer::RandomAccess
+        pipeline->m_vp_stride * MaxFramesInFlight,
+        vk::BufferUsageFlagBits::eUniformBuffer, GpuBuffer::Mapped
     });
     pipeline->m_light_buffer = GpuBuffer::create(engine, {
-        sizeof(LightUniform) * MaxLights,
-        vk::BufferUsageFlagBits::eUniformBuffer, GpuBuffer::RandomAccess
+        pipeline->m_light_stride * MaxFramesInFlight,
+        vk::BufferUsageFlagBits::eStorageBuffer, GpuBuffer::Mapped
+    });
+    pipeline->m_cluster_buffer = GpuBuffer::create(engine, {
+        pipeline->m_cluster_stride * MaxFramesInFlight,
+        vk::BufferUsageFlagBits::eStorageBuffer
     });
 
-    write_uniform_buffer_descriptor(engine, pipeline->m_global_set, 0, pipeline->m_vp_buffer.buffer, sizeof(ViewProjectionUniform));
-    write_uniform_buffer_descriptor(engine, pipeline->m_global_set, 1, pipeline->m_light_buffer.buffer, sizeof(LightUniform));
+    write_buffer_descriptor(
+        engine, pipeline->m_global_set, 0, vk::DescriptorType::eUniformBufferDynamic,
+        pipeline->m_vp_buffer.buffer, sizeof(ViewProjectionUniform)
+    );
+    write_buffer_descriptor(
+        engine, pipeline->m_global_set, 1, vk::DescriptorType::eStorageBufferDynamic,
+        pipeline->m_light_buffer.buffer, sizeof(LightBuffer)
+    );
+    write_buffer_descriptor(
+        engine, pipeline->m_global_set, 2, vk::DescriptorType::eStorageBufferDynamic,
+        pipeline->m_cluster_buffer.buffer, sizeof(Cluster) * ClusterCount
+    );
+    pipeline->update_cluster_params();
 
-    ASSERT(pipeline->m_color_image.allocation != nullptr);
-    ASSERT(pipeline->m_color_image.image != nullptr);
-    ASSERT(pipeline->m_color_image.view != nullptr);
+    const auto light_cull_layout = engine.device.createPipelineLayout({
+        .setLayoutCount = 1,
+        .pSetLayouts = &pipeline->m_set_layout,
+    });
+    if (light_cull_layout.result != vk::Result::eSuccess)
+        return Err::CouldNotCreateVkPipelineLayout;
+    pipeline->m_light_cull_layout = light_cull_layout.value;
+
+    const auto light_cull_shader = create_unlinked_shader(engine, {
+        .path = "../shaders/light_cull.comp.spv",
+        .stage = vk::ShaderStageFlagBits::eCompute,
+        .set_layouts = {&pipeline->m_set_layout, 1},
+    });
+    if (light_cull_shader.has_err())
+        return light_cull_shader.err();
+    pipeline->m_light_cull_shader = *light_cull_shader;
+
+    ASSERT(pipeline->m_sample_count == vk::SampleCountFlagBits::e1 || pipeline->m_color_image.image != nullptr);
     ASSERT(pipeline->m_depth_image.allocation != nullptr);
     ASSERT(pipeline->m_depth_image.image != nullptr);
     ASSERT(pipeline->m_depth_image.view != nullptr);
     ASSERT(pipeline->m_set_layout != nullptr);
     ASSERT(pipeline->m_global_set != nullptr);
-    ASSERT(pipeline->m_vp_buffer.allocation != nullptr);
+    ASSERT(pipeline->m_bindless_set != nullptr);
+    ASSERT(pipeline->m_draw_layout != nullptr);
+    ASSERT(pipeline->m_vp_buffer.mapped != nullptr);
     ASSERT(pipeline->m_vp_buffer.buffer != nullptr);
-    ASSERT(pipeline->m_light_buffer.allocation != nullptr);
+    ASSERT(pipeline->m_light_buffer.mapped != nullptr);
     ASSERT(pipeline->m_light_buffer.buffer != nullptr);
+    ASSERT(pipeline->m_cluster_buffer.buffer != nullptr);
+    ASSERT(pipeline->m_light_cull_layout != nullptr);
+    ASSERT(pipeline->m_light_cull_shader != nullptr);
     return pipeline;
 }
 
 void DefaultPipeline::destroy(const Engine& engine) const {
     ASSERT(engine.device != nullptr);
 
+    for (const auto& frames : m_secondaries) {
+        for (const auto& secondary : frames) {
+            if (secondary.pool != nullptr)
+                engine.device.destroyCommandPool(secondary.pool);
+        }
+    }
+
+    ASSERT(m_light_cull_shader != nullptr);
+    engine.device.destroyShaderEXT(m_light_cull_shader);
+    ASSERT(m_light_cull_layout != nullptr);
+    engine.device.destroyPipelineLayout(m_light_cull_layout);
+    ASSERT(m_draw_layout != nullptr);
+    engine.device.destroyPipelineLayout(m_draw_layout);
+
     ASSERT(m_set_layout != nullptr);
     engine.device.destroyDescriptorSetLayout(m_set_layout);
     ASSERT(m_descriptor_pool != nullptr);
     engine.device.destroyDescriptorPool(m_descriptor_pool);
+    ASSERT(m_cluster_buffer.buffer != nullptr);
+    m_cluster_buffer.destroy(engine);
     ASSERT(m_light_buffer.buffer != nullptr);
     m_light_buffer.destroy(engine);
     ASSERT(m_vp_buffer.buffer != nullptr);
     m_vp_buffer.destroy(engine);
 
-    m_depth_image.destroy(engine);
-    m_color_image.destroy(engine);
+    destroy_render_targets(engine, m_color_image, m_depth_image, m_scaled_image);
 }
 
-void DefaultPipeline::resize(const Engine& engine, const vk::Extent2D window_size) {
-    ASSERT(m_color_image.image != nullptr);
-    ASSERT(m_depth_image.image != nullptr);
-    ASSERT(window_size.width > 0);
-    ASSERT(window_size.height > 0);
-
-    m_color_image.destroy(engine);
-    m_color_image = GpuImage::create(engine, {
-        .extent = {window_size.width, window_size.height, 1},
-        .format = Window::SwapchainImageFormat,
-        .usage = vk::ImageUsageFlagBits::eColorAttachment | vk::ImageUsageFlagBits::eTransferSrc,
-        .sample_count = vk::SampleCountFlagBits::e4,
-    });
+void DefaultPipeline::destroy_render_targets(
+    const Engine& engine, const GpuImage& color, const GpuImage& depth, const GpuImage& scaled
+) {
+    if (scaled.image != nullptr)
+        scaled.destroy(engine);
+    depth.destroy(engine);
+    if (color.image != nullptr)
+        color.destroy(engine);
+}
 
-    m_depth_image.destroy(engine);
+void DefaultPipeline::create_render_targets(const Engine& engine, const vk::Extent2D extent, const bool scaled) {
+    ASSERT(extent.width > 0);
+    ASSERT(extent.height > 0);
+
+    // Multisampled color is never read outside the render pass, the pass resolves it into the single sampled output
+    m_color_image = {};
+    if (m_sample_count != vk::SampleCountFlagBits::e1) {
+        m_color_image = GpuImage::create(engine, {
+            .extent = {extent.width, extent.height, 1},
+            .format = Window::SwapchainImageFormat,
+            .usage = vk::ImageUsageFlagBits::eColorAttachment,
+            .sample_count = m_sample_count,
+        });
+    }
     m_depth_image = GpuImage::create(engine, {
-        .extent = {window_size.width, window_size.height, 1},
+        .extent = {extent.width, extent.height, 1},
         .format = vk::Format::eD32Sfloat,
         .usage = vk::ImageUsageFlagBits::eDepthStencilAttachment,
         .aspect_flags = vk::ImageAspectFlagBits::eDepth,
-        .sample_count = vk::SampleCountFlagBits::e4,
+        .sample_count = m_sample_count,
     });
+    m_scaled_image = {};
+    if (scaled) {
+        m_scaled_image = GpuImage::create(engine, {
+            .extent = {extent.width, extent.height, 1},
+            .format = Window::SwapchainImageFormat,
+            .usage = vk::ImageUsageFlagBits::eColorAttachment | vk::ImageUsageFlagBits::eTransferSrc,
+        });
+    }
+    m_target_extent = extent;
+    m_target_samples = m_sample_count;
 
-    ASSERT(m_color_image.image != nullptr);
+    ASSERT(m_sample_count == vk::SampleCountFlagBits::e1 || m_color_image.image != nullptr);
     ASSERT(m_depth_image.image != nullptr);
+    ASSERT(!scaled || m_scaled_image.image != nullptr);
 }
 
-void DefaultPipeline::update_camera(const Engine& engine, const Cameraf& camera) {
-    const glm::mat4 view = camera.view();
+Result<void> DefaultPipeline::set_sample_count(const Engine& engine, const vk::SampleCountFlagBits samples) {
+    ASSERT(engine.gpu != nullptr);
+    ASSERT(std::has_single_bit(static_cast<u32>(samples)));
+
+    const auto& limits = engine.gpu.getProperties().limits;
+    if (!(limits.framebufferColorSampleCounts & limits.framebufferDepthSampleCounts & samples))
+        return Err::SampleCountUnsupported;
+    // The targets are reallocated by the next begin_frame, frames in flight keep the old ones
+    m_sample_count = samples;
+    return ok();
+}
+
+void DefaultPipeline::begin_frame(const Engine& engine, const vk::Extent2D window_size, u32) {
+    ASSERT(engine.deletions != nullptr);
+    ASSERT(window_size.width > 0);
+    ASSERT(window_size.height > 0);
+
+    m_window_extent = window_size;
+    const vk::Extent2D extent = {
+        std::max(1u, static_cast<u32>(static_cast<f32>(window_size.width) * m_render_scale)),
+        std::max(1u, static_cast<u32>(static_cast<f32>(window_size.height) * m_render_scale)),
+    };
+    const bool scaled = extent != window_size;
 
-    ASSERT(m_lights.size() < MaxLights);
-    LightUniform lights = {.count = m_lights.size()};
-    for (usize i = 0; i < m_lights.size(); ++i) {
-        lights.vals[i] = {
-            .position = view * m_lights[i].position,
-            .color = m_lights[i].color,
+    // Targets only grow, to a multiple of TargetGranularity, and smaller render areas use a corner of them
+    if (extent.width > m_target_extent.width || extent.height > m_target_extent.height
+        || m_sample_count != m_target_samples || (scaled && m_scaled_image.image == nullptr)) {
+        const auto round_up = [](const u32 size) {
+            return (size + TargetGranularity - 1) / TargetGranularity * TargetGranularity;
         };
+        // Frames still in flight render into the old targets
+        engine.deletions->push([color = m_color_image, depth = m_depth_image, scaled_image = m_scaled_image](const Engine& e) {
+            destroy_render_targets(e, color, depth, scaled_image);
+        });
+        create_render_targets(engine, {
+            round_up(std::max(extent.width, m_target_extent.width)),
+            round_up(std::max(extent.height, m_target_extent.height)),
+        }, scaled);
     }
+    if (extent == m_extent)
+        return;
+    m_extent = extent;
+    update_cluster_params();
+}
+
+void DefaultPipeline::update_projection(const glm::mat4& projection) {
+    ASSERT(projection[2][3] != 0.0f);
+
+    m_vp.projection = projection;
+    update_cluster_params();
+}
 
-    m_light_buffer.write(engine, lights);
-    m_vp_buffer.write(engine, view, offsetof(ViewProjectionUniform, view));
+void DefaultPipeline::update_cluster_params() {
+    // Inverts the zero to one depth mapping of a perspective projection
+    const f32 depth_scale = m_vp.projection[2][2];
+    const f32 depth_offset = m_vp.projection[3][2];
+    const bool is_perspective = m_vp.projection[2][3] != 0.0f;
+    const f32 near = is_perspective ? -depth_offset / depth_scale : 0.1f;
+    const f32 far = is_perspective ? -depth_offset / (depth_scale - 1.0f) : 100.0f;
+
+    m_vp.inverse_projection = glm::inverse(m_vp.projection);
+    m_vp.cluster_grid = {ClusterCountX, ClusterCountY, ClusterCountZ, 0};
+    m_vp.screen = {static_cast<f32>(m_extent.width), static_cast<f32>(m_extent.height), near, far};
+}
+
+void DefaultPipeline::update_camera(const Cameraf& camera) {
+    const glm::mat4 view = camera.view();
+
+    ASSERT(m_lights.size() <= MaxLights);
+    // Lights whose range misses the frustum light nothing on screen, so they aren't binned into clusters
+    const usize light_count = m_lights.size();
+    std::vector<f32> x(light_count);
+    std::vector<f32> y(light_count);
+    std::vector<f32> z(light_count);
+    std::vector<f32> radius(light_count);
+    for (usize i = 0; i < light_count; ++i) {
+        x[i] = m_lights[i].position.x;
+        y[i] = m_lights[i].position.y;
+        z[i] = m_lights[i].position.z;
+        radius[i] = m_lights[i].position.w;
+    }
+    std::vector<u8> visible(light_count);
+    Frustumf::from_matrix(m_vp.projection * view).cull_spheres(x, y, z, radius, visible);
+
+    m_view_lights.clear();
+    for (usize i = 0; i < light_count; ++i) {
+        if (!visible[i])
+            continue;
+        const auto& light = m_lights[i];
+        m_view_lights.push_back({
+            .position = {glm::vec3{view * glm::vec4{glm::vec3{light.position}, 1.0f}}, light.position.w},
+            .color = light.color,
+        });
+    }
+    m_vp.view = view;
+}
+
+std::array<u32, DefaultPipeline::GlobalDynamicOffsetCount> DefaultPipeline::write_frame_uniforms(const u32 frame_index) const {
+    ASSERT(frame_index < MaxFramesInFlight);
+    ASSERT(m_vp_buffer.mapped != nullptr);
+    ASSERT(m_light_buffer.mapped != nullptr);
+    ASSERT(m_view_lights.size() <= MaxLights);
+
+    // The frame's fence has been waited on, so its slots are no longer read by the gpu
+    const std::array offsets = {
+        to_u32(frame_index * m_vp_stride),
+        to_u32(frame_index * m_light_stride),
+        to_u32(frame_index * m_cluster_stride),
+    };
+    const auto vp = static_cast<u8*>(m_vp_buffer.mapped) + offsets[0];
+    std::memcpy(vp, &m_vp, sizeof(m_vp));
+
+    const auto lights = static_cast<u8*>(m_light_buffer.mapped) + offsets[1];
+    const u32 light_count = to_u32(m_view_lights.size());
+    std::memcpy(lights + offsetof(LightBuffer, count), &light_count, sizeof(light_count));
+    if (!m_view_lights.empty())
+        std::memcpy(lights + offsetof(LightBuffer, vals), m_view_lights.data(), m_view_lights.size() * sizeof(Light));
+    return offsets;
 }
 
-void DefaultPipeline::cmd_draw(
-    const vk::CommandBuffer cmd, const vk::Image render_target, const vk::Extent2D window_size
+Result<void> DefaultPipeline::cmd_draw(
+    const vk::CommandBuffer cmd, const RenderTarget& target, const u32 frame_index, GpuProfiler& profiler
 ) const {
     ASSERT(cmd != nullptr);
-    ASSERT(render_target != nullptr);
-    ASSERT(window_size.width > 0);
-    ASSERT(window_size.height > 0);
+    ASSERT(target.image != nullptr);
+    ASSERT(target.view != nullptr);
+    ASSERT(target.extent == m_window_extent);
+    ASSERT(target.format == Window::SwapchainImageFormat);
+    ASSERT(frame_index < MaxFramesInFlight);
+    ASSERT(m_sample_count == m_target_samples);
+
+    // Uniforms, lights and clusters live in per frame slots, so the light cull never waits on the last frame
+    const auto global_offsets = write_frame_uniforms(frame_index);
+
+    const DrawContext ctx = {
+        .cmd = cmd,
+        .draw_layout = m_draw_layout,
+        .global_set = m_global_set,
+        .global_offsets = global_offsets,
+        .frame_index = frame_index,
+        .profiler = &profiler,
+        .frustum = Frustumf::from_matrix(m_vp.projection * m_vp.view),
+        .light_count = to_u32(m_view_lights.size()),
+        .depth_prepass = m_depth_prepass,
+    };
+
+    // Render systems are only read while recording, so the secondaries record alongside the rest of the primary
+    std::vector<std::future<Result<void>>> recordings = {};
+    if (m_thread_pool != nullptr) {
+        ASSERT(m_secondaries.size() == m_render_systems.size());
+        recordings.reserve(m_render_systems.size());
+        for (usize i = 0; i < m_render_systems.size(); ++i) {
+            recordings.push_back(m_thread_pool->submit([this, &ctx, i] {
+                return record_secondary(ctx, i);
+            }));
+        }
+    }
+
+    {
+        const GpuScope scope{profiler, cmd, "light_cull"};
+        constexpr u32 light_cull_group_size = 64;
+        cmd.bindShadersEXT({vk::ShaderStageFlagBits::eCompute}, {m_light_cull_shader});
+        cmd.bindDescriptorSets(vk::PipelineBindPoint::eCompute, m_light_cull_layout, 0, {m_global_set}, global_offsets);
+        cmd.dispatch((ClusterCount + light_cull_group_size - 1) / light_cull_group_size, 1, 1);
+    }
 
     BarrierBuilder(cmd)
-        .add_image_barrier(m_color_image.image, {vk::ImageAspectFlagBits::eColor, 0, 1, 0, 1})
+        .add_memory_barrier({
+            .srcStageMask = vk::PipelineStageFlagBits2::eComputeShader,
+            .srcAccessMask = vk::AccessFlagBits2::eShaderStorageWrite,
+            .dstStageMask = vk::PipelineStageFlagBits2::eFragmentShader,
+            .dstAccessMask = vk::AccessFlagBits2::eShaderStorageRead,
+        })
+        .build_and_run();
+
+    for (const auto& system : m_render_systems) {
+        const GpuScope scope{profiler, cmd, system->name()};
+        system->cmd_prepare(ctx);
+    }
+
+    // The pass leaves single sampled color in the target, or in the scaled image to be upscaled into it
+    const bool multisampled = m_sample_count != vk::SampleCountFlagBits::e1;
+    const bool scaled = m_extent != target.extent;
+    const vk::Image output_image = scaled ? m_scaled_image.image : target.image;
+    const vk::ImageView output_view = scaled ? m_scaled_image.view : target.view;
+    ASSERT(output_image != nullptr);
+
+    BarrierBuilder barriers(cmd);
+    if (multisampled) {
+        barriers.add_image_barrier(m_color_image.image, {vk::ImageAspectFlagBits::eColor, 0, 1, 0, 1})
+            .set_image_dst(vk::PipelineStageFlagBits2::eColorAttachmentOutput, vk::AccessFlagBits2::eColorAttachmentWrite, vk::ImageLayout::eColorAttachmentOptimal);
+    }
+    // Chains onto the window's wait for the image to be acquired, which blocks color attachment output
+    barriers.add_image_barrier(output_image, {vk::ImageAspectFlagBits::eColor, 0, 1, 0, 1})
+        .set_image_src(vk::PipelineStageFlagBits2::eColorAttachmentOutput, vk::AccessFlagBits2::eNone, vk::ImageLayout::eUndefined)
         .set_image_dst(vk::PipelineStageFlagBits2::eColorAttachmentOutput, vk::AccessFlagBits2::eColorAttachmentWrite, vk::ImageLayout::eColorAttachmentOptimal)
         .add_image_barrier(m_depth_image.image, {vk::ImageAspectFlagBits::eDepth, 0, 1, 0, 1})
         .set_image_dst(
@@ -154,135 +417,264 @@ void DefaultPipeline::cmd_draw(
         )
         .build_and_run();
 
+    // Resolving at the end of the pass lets tilers write out only the resolved samples
     const vk::RenderingAttachmentInfo color_attachment = {
-        .imageView = m_color_image.view,
+        .imageView = multisampled ? m_color_image.view : output_view,
         .imageLayout = vk::ImageLayout::eColorAttachmentOptimal,
+        .resolveMode = multisampled ? vk::ResolveModeFlagBits::eAverage : vk::ResolveModeFlagBits::eNone,
+        .resolveImageView = multisampled ? output_view : vk::ImageView{},
+        .resolveImageLayout = vk::ImageLayout::eColorAttachmentOptimal,
         .loadOp = vk::AttachmentLoadOp::eDontCare,
-        .storeOp = vk::AttachmentStoreOp::eStore,
+        .storeOp = multisampled ? vk::AttachmentStoreOp::eDontCare : vk::AttachmentStoreOp::eStore,
         .clearValue = {{std::array{0.0f, 0.0f, 0.0f, 1.0f}}},
     };
+    // The window set its state for the whole window, which the render area can be smaller than
+    cmd_set_default_state(cmd, m_extent);
+    cmd.setRasterizationSamplesEXT(m_sample_count);
+    cmd.setSampleMaskEXT(m_sample_count, vk::SampleMask{0xff});
+    cmd.bindDescriptorSets(vk::PipelineBindPoint::eGraphics, m_draw_layout, GlobalSet, {m_global_set, m_bindless_set}, global_offsets);
+
+    if (m_depth_prepass) {
+        const GpuScope scope{profiler, cmd, "depth_prepass"};
+        const vk::RenderingAttachmentInfo prepass_attachment = {
+            .imageView = m_depth_image.view,
+            .imageLayout = vk::ImageLayout::eDepthStencilAttachmentOptimal,
+            .loadOp = vk::AttachmentLoadOp::eClear,
+            .storeOp = vk::AttachmentStoreOp::eStore,
+            .clearValue = {.depthStencil = {.depth = 1.0f, .stencil = 0}},
+        };
+        cmd.beginRendering({
+            .renderArea = {{0, 0}, m_extent},
+            .layerCount = 1,
+            .pDepthAttachment = &prepass_attachment,
+        });
+        for (const auto& system : m_render_systems) {
+            system->cmd_draw_depth(ctx);
+        }
+        cmd.endRendering();
+
+        BarrierBuilder(cmd)
+            .add_image_barrier(m_depth_image.image, {vk::ImageAspectFlagBits::eDepth, 0, 1, 0, 1})
+            .set_image_src(
+                vk::PipelineStageFlagBits2::eLateFragmentTests,
+                vk::AccessFlagBits2::eDepthStencilAttachmentWrite, vk::ImageLayout::eDepthStencilAttachmentOptimal
+            )
+            .set_image_dst(
+                vk::PipelineStageFlagBits2::eEarlyFragmentTests | vk::PipelineStageFlagBits2::eLateFragmentTests,
+                vk::AccessFlagBits2::eDepthStencilAttachmentRead | vk::AccessFlagBits2::eDepthStencilAttachmentWrite,
+                vk::ImageLayout::eDepthStencilAttachmentOptimal
+            )
+            .build_and_run();
+    }
+
     const vk::RenderingAttachmentInfo depth_attachment = {
         .imageView = m_depth_image.view,
         .imageLayout = vk::ImageLayout::eDepthStencilAttachmentOptimal,
-        .loadOp = vk::AttachmentLoadOp::eClear,
+        .loadOp = m_depth_prepass ? vk::AttachmentLoadOp::eLoad : vk::AttachmentLoadOp::eClear,
         .storeOp = vk::AttachmentStoreOp::eDontCare,
         .clearValue = {.depthStencil = {.depth = 1.0f, .stencil = 0}},
     };
+
+    // Nothing but executeCommands may go inside a render pass of secondaries, so their timings are grouped
+    const bool parallel = m_thread_pool != nullptr;
+    const u32 draw_scope = parallel ? profiler.cmd_begin_scope(cmd, "draw") : GpuProfiler::InvalidScope;
     cmd.beginRendering({
-        .renderArea = {{0, 0}, window_size},
+        .flags = parallel ? vk::RenderingFlagBits::eContentsSecondaryCommandBuffers : vk::RenderingFlags{},
+        .renderArea = {{0, 0}, m_extent},
         .layerCount = 1,
         .colorAttachmentCount = 1,
         .pColorAttachments = &color_attachment,
         .pDepthAttachment = &depth_attachment,
     });
 
-    cmd.setRasterizationSamplesEXT(vk::SampleCountFlagBits::e4);
-    cmd.setSampleMaskEXT(vk::SampleCountFlagBits::e4, vk::SampleMask{0xff});
-
-    for (const auto& system : m_render_systems) {
-        system->cmd_draw(cmd, m_global_set);
+    // Every recording is waited on, they read ctx
+    Result<void> recorded = ok();
+    if (parallel) {
+        std::vector<vk::CommandBuffer> secondaries = {};
+        secondaries.reserve(recordings.size());
+        for (usize i = 0; i < recordings.size(); ++i) {
+            const auto recording = recordings[i].get();
+            if (recording.has_err()) {
+                if (!recorded.has_err())
+                    recorded = recording.err();
+                continue;
+            }
+            secondaries.push_back(m_secondaries[i][frame_index].cmd);
+        }
+        if (!secondaries.empty())
+            cmd.executeCommands(secondaries);
+    } else {
+        for (const auto& system : m_render_systems) {
+            const GpuScope scope{profiler, cmd, system->name()};
+            system->cmd_draw(ctx);
+        }
     }
 
     cmd.endRendering();
+    profiler.cmd_end_scope(cmd, draw_scope);
+
+    if (!scaled) {
+        BarrierBuilder(cmd)
+            .add_image_barrier(target.image, {vk::ImageAspectFlagBits::eColor, 0, 1, 0, 1})
+            .set_image_src(vk::PipelineStageFlagBits2::eColorAttachmentOutput, vk::AccessFlagBits2::eColorAttachmentWrite, vk::ImageLayout::eColorAttachmentOptimal)
+            .set_image_dst(vk::PipelineStageFlagBits2::eAllCommands, vk::AccessFlagBits2::eMemoryRead, target.final_layout)
+            .build_and_run();
+        return recorded;
+    }
 
+    const GpuScope upscale_scope{profiler, cmd, "upscale"};
     BarrierBuilder(cmd)
-        .add_image_barrier(m_color_image.image, {vk::ImageAspectFlagBits::eColor, 0, 1, 0, 1})
+        .add_image_barrier(m_scaled_image.image, {vk::ImageAspectFlagBits::eColor, 0, 1, 0, 1})
         .set_image_src(vk::PipelineStageFlagBits2::eColorAttachmentOutput, vk::AccessFlagBits2::eColorAttachmentWrite, vk::ImageLayout::eColorAttachmentOptimal)
         .set_image_dst(vk::PipelineStageFlagBits2::eTransfer, vk::AccessFlagBits2::eTransferRead, vk::ImageLayout::eTransferSrcOptimal)
-        .add_image_barrier(render_target, {vk::ImageAspectFlagBits::eColor, 0, 1, 0, 1})
+        .add_image_barrier(target.image, {vk::ImageAspectFlagBits::eColor, 0, 1, 0, 1})
+        .set_image_src(vk::PipelineStageFlagBits2::eColorAttachmentOutput, vk::AccessFlagBits2::eNone, vk::ImageLayout::eUndefined)
         .set_image_dst(vk::PipelineStageFlagBits2::eTransfer, vk::AccessFlagBits2::eTransferWrite, vk::ImageLayout::eTransferDstOptimal)
         .build_and_run();
 
-    const vk::ImageResolve2 resolve = {
+    vk::ImageBlit2 blit = {
         .srcSubresource = {vk::ImageAspectFlagBits::eColor, 0, 0, 1},
         .dstSubresource = {vk::ImageAspectFlagBits::eColor, 0, 0, 1},
-        .extent = vk::Extent3D{window_size.width, window_size.height, 1},
     };
-    cmd.resolveImage2({
-        .srcImage = m_color_image.image,
+    blit.srcOffsets[1] = vk::Offset3D{to_i32(m_extent.width), to_i32(m_extent.height), 1};
+    blit.dstOffsets[1] = vk::Offset3D{to_i32(target.extent.width), to_i32(target.extent.height), 1};
+    cmd.blitImage2({
+        .srcImage = m_scaled_image.image,
         .srcImageLayout = vk::ImageLayout::eTransferSrcOptimal,
-        .dstImage = render_target,
+        .dstImage = target.image,
         .dstImageLayout = vk::ImageLayout::eTransferDstOptimal,
         .regionCount = 1,
-        .pRegions = &resolve,
+        .pRegions = &blit,
+        .filter = vk::Filter::eLinear,
     });
 
     BarrierBuilder(cmd)
-        .add_image_barrier(render_target, {vk::ImageAspectFlagBits::eColor, 0, 1, 0, 1})
+        .add_image_barrier(target.image, {vk::ImageAspectFlagBits::eColor, 0, 1, 0, 1})
         .set_image_src(vk::PipelineStageFlagBits2::eTransfer, vk::AccessFlagBits2::eTransferWrite, vk::ImageLayout::eTransferDstOptimal)
-        .set_image_dst(vk::PipelineStageFlagBits2::eAllGraphics, vk::AccessFlagBits2::eNone, vk::ImageLayout::ePresentSrcKHR)
+        .set_image_dst(vk::PipelineStageFlagBits2::eAllCommands, vk::AccessFlagBits2::eMemoryRead, target.final_layout)
         .build_and_run();
+    return recorded;
 }
 
-Result<SkyboxRenderer> SkyboxRenderer::create(const Engine& engine, const DefaultPipeline& pipeline) {
-    auto renderer = ok<SkyboxRenderer>();
+Result<void> DefaultPipeline::enable_parallel_recording(const Engine& engine, ThreadPool& thread_pool) {
+    ASSERT(engine.device != nullptr);
+    ASSERT(m_thread_pool == nullptr);
+    ASSERT(m_secondaries.empty());
+
+    // Each system records on one thread at a time, so its pools are never shared between threads
+    m_secondaries.resize(m_render_systems.size());
+    for (auto& frames : m_secondaries) {
+        for (auto& secondary : frames) {
+            const auto pool = engine.device.createCommandPool({
+                .flags = vk::CommandPoolCreateFlagBits::eTransient | vk::CommandPoolCreateFlagBits::eResetCommandBuffer,
+                .queueFamilyIndex = engine.queue_family_index,
+            });
+            if (pool.result != vk::Result::eSuccess)
+                return Err::CouldNotCreateVkCommandPool;
+            secondary.pool = pool.value;
+
+            const vk::CommandBufferAllocateInfo cmd_info = {
+                .commandPool = secondary.pool,
+                .level = vk::CommandBufferLevel::eSecondary,
+                .commandBufferCount = 1,
+            };
+            const auto cmd_result = engine.device.allocateCommandBuffers(&cmd_info, &secondary.cmd);
+            if (cmd_result != vk::Result::eSuccess)
+                return Err::CouldNotAllocateVkCommandBuffers;
+        }
+    }
+    m_thread_pool = &thread_pool;
 
-    const auto set_layout = create_descriptor_set_layout(engine, std::array{
-        vk::DescriptorSetLayoutBinding{0, vk::DescriptorType::eCombinedImageSampler, 1, vk::ShaderStageFlagBits::eFragment},
-    });
-    if (set_layout.has_err())
-        return set_layout.err();
-    renderer->m_set_layout = *set_layout;
+    ASSERT(m_thread_pool != nullptr);
+    ASSERT(m_secondaries.size() == m_render_systems.size());
+    return ok();
+}
+
+Result<void> DefaultPipeline::record_secondary(const DrawContext& ctx, const usize system_index) const {
+    ASSERT(system_index < m_render_systems.size());
+    ASSERT(ctx.frame_index < MaxFramesInFlight);
 
-    std::array set_layouts = {pipeline.get_global_set_layout(), renderer->m_set_layout};
-    const auto pipeline_layout = engine.device.createPipelineLayout({
-        .setLayoutCount = to_u32(set_layouts.size()),
-        .pSetLayouts = set_layouts.data(),
+    const CpuScope scope{"record_secondary"};
+    const auto cmd = m_secondaries[system_index][ctx.frame_index].cmd;
+    ASSERT(cmd != nullptr);
+
+    const vk::Format color_format = Window::SwapchainImageFormat;
+    const vk::CommandBufferInheritanceRenderingInfo rendering_info = {
+        .colorAttachmentCount = 1,
+        .pColorAttachmentFormats = &color_format,
+        .depthAttachmentFormat = vk::Format::eD32Sfloat,
+        .rasterizationSamples = m_sample_count,
+    };
+    const vk::CommandBufferInheritanceInfo inheritance_info = {.pNext = &rendering_info};
+    const auto begin_result = cmd.begin({
+        .flags = vk::CommandBufferUsageFlagBits::eOneTimeSubmit | vk::CommandBufferUsageFlagBits::eRenderPassContinue,
+        .pInheritanceInfo = &inheritance_info,
     });
-    if (pipeline_layout.result != vk::Result::eSuccess)
-        return Err::CouldNotCreateVkPipelineLayout;
-    renderer->m_pipeline_layout = pipeline_layout.value;
+    if (begin_result != vk::Result::eSuccess)
+        return Err::CouldNotBeginVkCommandBuffer;
+
+    cmd_set_default_state(cmd, m_extent);
+    cmd.setRasterizationSamplesEXT(m_sample_count);
+    cmd.setSampleMaskEXT(m_sample_count, vk::SampleMask{0xff});
+    // Secondaries inherit no bindings either
+    cmd.bindDescriptorSets(vk::PipelineBindPoint::eGraphics, m_draw_layout, GlobalSet, {m_global_set, m_bindless_set}, ctx.global_offsets);
+
+    // The gpu profiler is single threaded, the primary times the whole render pass instead
+    DrawContext secondary_ctx = ctx;
+    secondary_ctx.cmd = cmd;
+    secondary_ctx.profiler = nullptr;
+    m_render_systems[system_index]->cmd_draw(secondary_ctx);
+
+    const auto end_result = cmd.end();
+    if (end_result != vk::Result::eSuccess)
+        return Err::CouldNotEndVkCommandBuffer;
+    return ok();
+}
+
+Result<SkyboxRenderer> SkyboxRenderer::create(const Engine& engine, const DefaultPipeline& pipeline) {
+    auto renderer = ok<SkyboxRenderer>();
 
+    const auto set_layouts = pipeline.get_draw_set_layouts();
     const auto skybox_shader_result = create_linked_shaders(engine, renderer->m_shaders, std::array{
         ShaderConfig{
             .path = "../shaders/skybox.vert.spv",
             .stage = vk::ShaderStageFlagBits::eVertex,
             .next_stage = vk::ShaderStageFlagBits::eFragment,
             .set_layouts = set_layouts,
-            .push_ranges = {},
+            .push_ranges = {&DefaultPipeline::DrawPushRange, 1},
         },
         ShaderConfig{
             .path = "../shaders/skybox.frag.spv",
             .stage = vk::ShaderStageFlagBits::eFragment,
             .next_stage = {},
             .set_layouts = set_layouts,
-            .push_ranges = {},
+            .push_ranges = {&DefaultPipeline::DrawPushRange, 1},
         },
     });
     if (skybox_shader_result.has_err())
         return skybox_shader_result.err();
 
-    const auto descriptor_pool = create_descriptor_pool(engine, 1, std::array{
-        vk::DescriptorPoolSize{vk::DescriptorType::eCombinedImageSampler, 1}
-    });
-    if (descriptor_pool.has_err())
-        return descriptor_pool.err();
-    renderer->m_descriptor_pool = *descriptor_pool;
-
-    const auto set = allocate_descriptor_set(engine, renderer->m_descriptor_pool, renderer->m_set_layout);
-    if (set.has_err())
-        return set.err();
-    renderer->m_set = *set;
-
-    ASSERT(renderer->m_set_layout != nullptr);
-    ASSERT(renderer->m_pipeline_layout != nullptr);
-    ASSERT(renderer->m_descriptor_pool != nullptr);
-    ASSERT(renderer->m_set != nullptr);
     for (const auto shader : renderer->m_shaders) {
         ASSERT(shader != nullptr);
     }
     return renderer;
 }
 
-Result<void> SkyboxRenderer::load_skybox(const Engine& engine, const std::filesystem::path path) {
+Result<void> SkyboxRenderer::load_skybox(const Engine& engine, UploadQueue& uploads, const std::filesystem::path path) {
     ASSERT(!path.empty());
+    ASSERT(engine.bindless != nullptr);
 
     const auto cubemap = GpuImage::create_cubemap(engine, path);
     if (cubemap.has_err())
         return cubemap.err();
     m_cubemap = *cubemap;
-    m_sampler = create_sampler(engine, {.type = SamplerType::Linear});
-    hg::write_image_sampler_descriptor(engine, m_set, 0, m_sampler, m_cubemap.view);
+    const auto sampler = engine.bindless->get_sampler(engine, {.type = SamplerType::Linear});
+    if (sampler.has_err())
+        return sampler.err();
+    const auto cubemap_index = engine.bindless->add_sampled_image(m_cubemap.view);
+    if (cubemap_index.has_err())
+        return cubemap_index.err();
+    m_push = {.cubemap = *cubemap_index, .sampler = *sampler};
 
     const auto mesh = generate_cube();
     std::vector<glm::vec3> positions = {};
@@ -298,14 +690,18 @@ Result<void> SkyboxRenderer::load_skybox(const Engine& engine, const std::filesy
         mesh.indices.size() * sizeof(mesh.indices[0]),
         vk::BufferUsageFlagBits::eIndexBuffer | vk::BufferUsageFlagBits::eTransferDst
     });
-    m_vertex_buffer.write(engine, positions.data(), positions.size() * sizeof(positions[0]), 0);
-    m_index_buffer.write(engine, mesh.indices.data(), mesh.indices.size() * sizeof(mesh.indices[0]), 0);
+    const auto vertex_upload = uploads.upload_buffer(engine, m_vertex_buffer, positions.data(), positions.size() * sizeof(positions[0]), 0);
+    if (vertex_upload.has_err())
+        return vertex_upload.err();
+    const auto index_upload = uploads.upload_buffer(engine, m_index_buffer, mesh.indices.data(), mesh.indices.size() * sizeof(mesh.indices[0]), 0);
+    if (index_upload.has_err())
+        return index_upload.err();
 
     ASSERT(m_cubemap.allocation != nullptr);
     ASSERT(m_cubemap.image != nullptr);
     ASSERT(m_cubemap.view != nullptr);
-    ASSERT(m_sampler != nullptr);
-    ASSERT(m_set != nullptr);
+    ASSERT(m_push.cubemap != BindlessHeap::InvalidIndex);
+    ASSERT(m_push.sampler != BindlessHeap::InvalidIndex);
     ASSERT(m_vertex_buffer.allocation != nullptr);
     ASSERT(m_vertex_buffer.buffer != nullptr);
     ASSERT(m_index_buffer.allocation != nullptr);
@@ -315,42 +711,35 @@ Result<void> SkyboxRenderer::load_skybox(const Engine& engine, const std::filesy
 
 void SkyboxRenderer::destroy(const Engine& engine) const {
     ASSERT(engine.device != nullptr);
+    ASSERT(engine.bindless != nullptr);
 
     m_vertex_buffer.destroy(engine);
     m_index_buffer.destroy(engine);
+    ASSERT(m_push.cubemap != BindlessHeap::InvalidIndex);
+    engine.bindless->remove_sampled_image(engine, m_push.cubemap);
     m_cubemap.destroy(engine);
 
-    ASSERT(m_sampler != nullptr);
-    engine.device.destroySampler(m_sampler);
-
     for (const auto& shader : m_shaders) {
         ASSERT(shader != nullptr);
         engine.device.destroyShaderEXT(shader);
     }
-
-    ASSERT(m_descriptor_pool != nullptr);
-    engine.device.destroyDescriptorPool(m_descriptor_pool);
-
-    ASSERT(m_pipeline_layout != nullptr);
-    engine.device.destroyPipelineLayout(m_pipeline_layout);
-
-    ASSERT(m_set_layout != nullptr);
-    engine.device.destroyDescriptorSetLayout(m_set_layout);
 }
 
-void SkyboxRenderer::cmd_draw(const vk::CommandBuffer cmd, const vk::DescriptorSet global_set) const {
-    ASSERT(m_set != nullptr);
+void SkyboxRenderer::cmd_draw(const DefaultPipeline::DrawContext& ctx) const {
+    ASSERT(m_push.cubemap != BindlessHeap::InvalidIndex);
     ASSERT(m_vertex_buffer.buffer != nullptr);
     ASSERT(m_index_buffer.buffer != nullptr);
-    ASSERT(cmd != nullptr);
-    ASSERT(global_set != nullptr);
+    ASSERT(ctx.cmd != nullptr);
+    ASSERT(ctx.draw_layout != nullptr);
+
+    const auto cmd = ctx.cmd;
 
     cmd.setDepthTestEnable(vk::False);
     cmd.setDepthWriteEnable(vk::False);
     cmd.setCullMode(vk::CullModeFlagBits::eFront);
 
     cmd.bindShadersEXT({vk::ShaderStageFlagBits::eVertex, vk::ShaderStageFlagBits::eFragment}, m_shaders);
-    cmd.bindDescriptorSets(vk::PipelineBindPoint::eGraphics, m_pipeline_layout, 0, {global_set, m_set}, {});
+    cmd.pushConstants(ctx.draw_layout, DefaultPipeline::DrawPushRange.stageFlags, 0, sizeof(m_push), &m_push);
 
     cmd.setVertexInputEXT(
         {vk::VertexInputBindingDescription2EXT{.stride = sizeof(glm::vec3), .inputRate = vk::VertexInputRate::eVertex, .divisor = 1}},
@@ -366,154 +755,702 @@ void SkyboxRenderer::cmd_draw(const vk::CommandBuffer cmd, const vk::DescriptorS
 }
 
 Result<PbrRenderer> PbrRenderer::create(const Engine& engine, const DefaultPipeline& pipeline) {
+    ASSERT(engine.bindless != nullptr);
+
     auto renderer = ok<PbrRenderer>();
 
-    const auto set_layout = create_descriptor_set_layout(
-        engine,
-        std::array{vk::DescriptorSetLayoutBinding{0, vk::DescriptorType::eCombinedImageSampler, MaxTextures, vk::ShaderStageFlagBits::eFragment},},
-        std::array{vk::DescriptorBindingFlags{vk::DescriptorBindingFlagBits::ePartiallyBound}}
-    );
-    if (set_layout.has_err())
-        return set_layout.err();
-    renderer->m_set_layout = *set_layout;
-
-    ASSERT(pipeline.get_global_set_layout() != nullptr);
-    std::array set_layouts = {pipeline.get_global_set_layout(), renderer->m_set_layout};
-    std::array push_ranges = {vk::PushConstantRange{
-        vk::ShaderStageFlagBits::eVertex | vk::ShaderStageFlagBits::eFragment, 0, sizeof(PushConstant)
-    }};
-    const auto pipeline_layout = engine.device.createPipelineLayout({
-        .setLayoutCount = to_u32(set_layouts.size()),
-        .pSetLayouts = set_layouts.data(),
-        .pushConstantRangeCount = to_u32(push_ranges.size()),
-        .pPushConstantRanges = push_ranges.data(),
-    });
-    if (pipeline_layout.result != vk::Result::eSuccess)
+    renderer->m_draw_set_layouts = pipeline.get_draw_set_layouts();
+
+    // The fragment stage is left unbound for the pre-pass, so the shader has no next stage
+    const auto depth_shader = create_unlinked_shader(engine, {
+        .path = "../shaders/pbr_depth.vert.spv",
+        .stage = vk::ShaderStageFlagBits::eVertex,
+        .set_layouts = renderer->m_draw_set_layouts,
+        .push_ranges = {&DefaultPipeline::DrawPushRange, 1},
+    });
+    if (depth_shader.has_err())
+        return depth_shader.err();
+    renderer->m_depth_shader = *depth_shader;
+
+    const auto cull_set_layout = create_descriptor_set_layout(engine, std::array{
+        vk::DescriptorSetLayoutBinding{0, vk::DescriptorType::eStorageBuffer, 1, vk::ShaderStageFlagBits::eCompute},
+        vk::DescriptorSetLayoutBinding{1, vk::DescriptorType::eStorageBuffer, 1, vk::ShaderStageFlagBits::eCompute},
+        vk::DescriptorSetLayoutBinding{2, vk::DescriptorType::eStorageBuffer, 1, vk::ShaderStageFlagBits::eCompute},
+        vk::DescriptorSetLayoutBinding{3, vk::DescriptorType::eStorageBuffer, 1, vk::ShaderStageFlagBits::eCompute},
+        vk::DescriptorSetLayoutBinding{4, vk::DescriptorType::eStorageBuffer, 1, vk::ShaderStageFlagBits::eCompute},
+    });
+    if (cull_set_layout.has_err())
+        return cull_set_layout.err();
+    renderer->m_cull_set_layout = *cull_set_layout;
+
+    const vk::PushConstantRange cull_push_range = {vk::ShaderStageFlagBits::eCompute, 0, sizeof(CullPush)};
+    const auto cull_pipeline_layout = engine.device.createPipelineLayout({
+        .setLayoutCount = 1,
+        .pSetLayouts = &renderer->m_cull_set_layout,
+        .pushConstantRangeCount = 1,
+        .pPushConstantRanges = &cull_push_range,
+    });
+    if (cull_pipeline_layout.result != vk::Result::eSuccess)
         return Err::CouldNotCreateVkPipelineLayout;
-    renderer->m_pipeline_layout = pipeline_layout.value;
+    renderer->m_cull_pipeline_layout = cull_pipeline_layout.value;
 
-    const auto shader_result = create_linked_shaders(engine, renderer->m_shaders, std::array{
-        ShaderConfig{
-            .path = "../shaders/pbr.vert.spv",
-            .stage = vk::ShaderStageFlagBits::eVertex,
-            .next_stage = vk::ShaderStageFlagBits::eFragment,
-            .set_layouts = set_layouts,
-            .push_ranges = push_ranges,
-        },
-        ShaderConfig{
-            .path = "../shaders/pbr.frag.spv",
-            .stage = vk::ShaderStageFlagBits::eFragment,
-            .next_stage = {},
-            .set_layouts = set_layouts,
-            .push_ranges = push_ranges,
-        },
+    const auto cull_shader = create_unlinked_shader(engine, {
+        .path = "../shaders/pbr_cull.comp.spv",
+        .stage = vk::ShaderStageFlagBits::eCompute,
+        .set_layouts = {&renderer->m_cull_set_layout, 1},
+        .push_ranges = {&cull_push_range, 1},
     });
-    if (shader_result.has_err())
-        return shader_result.err();
+    if (cull_shader.has_err())
+        return cull_shader.err();
+    renderer->m_cull_shader = *cull_shader;
+
+    const u32 max_draws = to_u32(MaxDraws);
+    constexpr vk::SpecializationMapEntry max_draws_entry = {.constantID = 0, .offset = 0, .size = sizeof(u32)};
+    const vk::SpecializationInfo compact_specialization = {
+        .mapEntryCount = 1,
+        .pMapEntries = &max_draws_entry,
+        .dataSize = sizeof(max_draws),
+        .pData = &max_draws,
+    };
+    const auto compact_shader = create_unlinked_shader(engine, {
+        .path = "../shaders/pbr_compact.comp.spv",
+        .stage = vk::ShaderStageFlagBits::eCompute,
+        .set_layouts = {&renderer->m_cull_set_layout, 1},
+        .push_ranges = {&cull_push_range, 1},
+        .specialization = &compact_specialization,
+    });
+    if (compact_shader.has_err())
+        return compact_shader.err();
+    renderer->m_compact_shader = *compact_shader;
 
     const auto descriptor_pool = create_descriptor_pool(engine, 1, std::array{
-        vk::DescriptorPoolSize{vk::DescriptorType::eCombinedImageSampler, MaxTextures}
+        vk::DescriptorPoolSize{vk::DescriptorType::eStorageBuffer, 5},
     });
     if (descriptor_pool.has_err())
         return descriptor_pool.err();
     renderer->m_descriptor_pool = *descriptor_pool;
 
-    const auto texture_set = allocate_descriptor_set(engine, renderer->m_descriptor_pool, renderer->m_set_layout);
-    if (texture_set.has_err())
-        return texture_set.err();
-    renderer->m_texture_set = *texture_set;
+    const auto cull_set = allocate_descriptor_set(engine, renderer->m_descriptor_pool, renderer->m_cull_set_layout);
+    if (cull_set.has_err())
+        return cull_set.err();
+    renderer->m_cull_set = *cull_set;
 
-    ASSERT(renderer->m_set_layout != nullptr);
-    ASSERT(renderer->m_pipeline_layout != nullptr);
-    for (const auto shader : renderer->m_shaders) {
-        ASSERT(shader != nullptr);
+    const auto instance_buffer = GpuBuffer::create_result(engine, {
+        sizeof(InstanceData) * MaxInstances * MaxFramesInFlight,
+        vk::BufferUsageFlagBits::eStorageBuffer, GpuBuffer::Mapped
+    });
+    if (instance_buffer.has_err())
+        return instance_buffer.err();
+    renderer->m_instance_buffer = *instance_buffer;
+    const auto instance_index = engine.bindless->add_storage_buffer(
+        renderer->m_instance_buffer.buffer, sizeof(InstanceData) * MaxInstances * MaxFramesInFlight
+    );
+    if (instance_index.has_err())
+        return instance_index.err();
+    renderer->m_draw_push.instance_buffer = *instance_index;
+    write_storage_buffer_descriptor(
+        engine, renderer->m_cull_set, 0, renderer->m_instance_buffer.buffer, sizeof(InstanceData) * MaxInstances * MaxFramesInFlight
+    );
+
+    // Draws are written per frame on the cpu and copied to the gpu, where culling counts their instances
+    const auto draw_staging_buffer = GpuBuffer::create_result(engine, {
+        sizeof(CullDraw) * MaxDraws * MaxFramesInFlight,
+        vk::BufferUsageFlagBits::eTransferSrc, GpuBuffer::Mapped
+    });
+    if (draw_staging_buffer.has_err())
+        return draw_staging_buffer.err();
+    renderer->m_draw_staging_buffer = *draw_staging_buffer;
+
+    const auto draw_buffer = GpuBuffer::create_result(engine, {
+        sizeof(CullDraw) * MaxDraws,
+        vk::BufferUsageFlagBits::eStorageBuffer | vk::BufferUsageFlagBits::eTransferDst
+    });
+    if (draw_buffer.has_err())
+        return draw_buffer.err();
+    renderer->m_draw_buffer = *draw_buffer;
+    write_storage_buffer_descriptor(engine, renderer->m_cull_set, 1, renderer->m_draw_buffer.buffer, sizeof(CullDraw) * MaxDraws);
+
+    const auto visible_buffer = GpuBuffer::create_result(engine, {
+        sizeof(u32) * MaxInstances,
+        vk::BufferUsageFlagBits::eStorageBuffer
+    });
+    if (visible_buffer.has_err())
+        return visible_buffer.err();
+    renderer->m_visible_buffer = *visible_buffer;
+    write_storage_buffer_descriptor(engine, renderer->m_cull_set, 2, renderer->m_visible_buffer.buffer, sizeof(u32) * MaxInstances);
+    const auto visible_index = engine.bindless->add_storage_buffer(renderer->m_visible_buffer.buffer, sizeof(u32) * MaxInstances);
+    if (visible_index.has_err())
+        return visible_index.err();
+    renderer->m_draw_push.visible_buffer = *visible_index;
+
+    const auto indirect_buffer = GpuBuffer::create_result(engine, {
+        sizeof(vk::DrawIndexedIndirectCommand) * MaxDraws * DrawBucketCount,
+        vk::BufferUsageFlagBits::eStorageBuffer | vk::BufferUsageFlagBits::eIndirectBuffer
+    });
+    if (indirect_buffer.has_err())
+        return indirect_buffer.err();
+    renderer->m_indirect_buffer = *indirect_buffer;
+    write_storage_buffer_descriptor(
+        engine, renderer->m_cull_set, 3, renderer->m_indirect_buffer.buffer,
+        sizeof(vk::DrawIndexedIndirectCommand) * MaxDraws * DrawBucketCount
+    );
+
+    const auto count_buffer = GpuBuffer::create_result(engine, {
+        sizeof(u32) * DrawBucketCount,
+        vk::BufferUsageFlagBits::eStorageBuffer | vk::BufferUsageFlagBits::eIndirectBuffer | vk::BufferUsageFlagBits::eTransferDst
+    });
+    if (count_buffer.has_err())
+        return count_buffer.err();
+    renderer->m_count_buffer = *count_buffer;
+    write_storage_buffer_descriptor(engine, renderer->m_cull_set, 4, renderer->m_count_buffer.buffer, sizeof(u32) * DrawBucketCount);
+
+    for (u32 format = 0; format < VertexFormatCount; ++format) {
+        const auto vertex_buffer = GpuBuffer::create_result(engine, {
+            vertex_size(static_cast<VertexFormat>(format)) * MaxVertices,
+            vk::BufferUsageFlagBits::eVertexBuffer | vk::BufferUsageFlagBits::eTransferDst
+        });
+        if (vertex_buffer.has_err())
+            return vertex_buffer.err();
+        renderer->m_vertex_buffers[format] = *vertex_buffer;
+        renderer->m_vertex_allocators[format] = FreeListAllocator{MaxVertices};
+
+        const auto position_buffer = GpuBuffer::create_result(engine, {
+            position_size(static_cast<VertexFormat>(format)) * MaxVertices,
+            vk::BufferUsageFlagBits::eVertexBuffer | vk::BufferUsageFlagBits::eTransferDst
+        });
+        if (position_buffer.has_err())
+            return position_buffer.err();
+        renderer->m_position_buffers[format] = *position_buffer;
     }
+
+    const auto index_buffer = GpuBuffer::create_result(engine, {
+        sizeof(u32) * MaxIndices,
+        vk::BufferUsageFlagBits::eIndexBuffer | vk::BufferUsageFlagBits::eTransferDst
+    });
+    if (index_buffer.has_err())
+        return index_buffer.err();
+    renderer->m_index_buffer = *index_buffer;
+    renderer->m_index_allocator = FreeListAllocator{MaxIndices};
+
+    renderer->m_textures = SlotMap<Texture>{to_u32(MaxTextures)};
+    renderer->m_models = SlotMap<Model>{to_u32(MaxModels)};
+
+    for (const auto layout : renderer->m_draw_set_layouts) {
+        ASSERT(layout != nullptr);
+    }
+    ASSERT(renderer->m_depth_shader != nullptr);
     ASSERT(renderer->m_descriptor_pool != nullptr);
-    ASSERT(renderer->m_texture_set != nullptr);
+    ASSERT(renderer->m_instance_buffer.buffer != nullptr);
+    ASSERT(renderer->m_instance_buffer.mapped != nullptr);
+    ASSERT(renderer->m_draw_push.instance_buffer != BindlessHeap::InvalidIndex);
+    ASSERT(renderer->m_draw_push.visible_buffer != BindlessHeap::InvalidIndex);
+    ASSERT(renderer->m_cull_set_layout != nullptr);
+    ASSERT(renderer->m_cull_pipeline_layout != nullptr);
+    ASSERT(renderer->m_cull_shader != nullptr);
+    ASSERT(renderer->m_compact_shader != nullptr);
+    ASSERT(renderer->m_cull_set != nullptr);
+    ASSERT(renderer->m_draw_staging_buffer.mapped != nullptr);
+    ASSERT(renderer->m_draw_buffer.buffer != nullptr);
+    ASSERT(renderer->m_visible_buffer.buffer != nullptr);
+    ASSERT(renderer->m_indirect_buffer.buffer != nullptr);
+    ASSERT(renderer->m_count_buffer.buffer != nullptr);
+    for (const auto& vertex_buffer : renderer->m_vertex_buffers) {
+        ASSERT(vertex_buffer.buffer != nullptr);
+    }
+    for (const auto& position_buffer : renderer->m_position_buffers) {
+        ASSERT(position_buffer.buffer != nullptr);
+    }
+    ASSERT(renderer->m_index_buffer.buffer != nullptr);
     return renderer;
 }
 
 void PbrRenderer::destroy(const Engine& engine) const {
     ASSERT(engine.device != nullptr);
-
-    for (const auto& texture : m_textures)
-    texture.destroy(engine);
-    for (const auto& model : m_models)
-    model.destroy(engine);
-
-    for (const auto& shader : m_shaders) {
-        ASSERT(shader != nullptr);
-        engine.device.destroyShaderEXT(shader);
+    ASSERT(engine.bindless != nullptr);
+
+    m_textures.for_each([&](const Texture& texture) {
+        if (texture.descriptor == BindlessHeap::InvalidIndex)
+            return;
+        engine.bindless->remove_sampled_image(engine, texture.descriptor);
+        if (texture.level_view != nullptr)
+            engine.device.destroyImageView(texture.level_view);
+        texture.image.destroy(engine);
+    });
+    engine.bindless->remove_storage_buffer(engine, m_draw_push.visible_buffer);
+    engine.bindless->remove_storage_buffer(engine, m_draw_push.instance_buffer);
+    m_index_buffer.destroy(engine);
+    for (const auto& position_buffer : m_position_buffers) {
+        position_buffer.destroy(engine);
+    }
+    for (const auto& vertex_buffer : m_vertex_buffers) {
+        vertex_buffer.destroy(engine);
+    }
+    m_count_buffer.destroy(engine);
+    m_indirect_buffer.destroy(engine);
+    m_visible_buffer.destroy(engine);
+    m_draw_buffer.destroy(engine);
+    m_draw_staging_buffer.destroy(engine);
+    m_instance_buffer.destroy(engine);
+
+    ASSERT(m_compact_shader != nullptr);
+    engine.device.destroyShaderEXT(m_compact_shader);
+    ASSERT(m_cull_shader != nullptr);
+    engine.device.destroyShaderEXT(m_cull_shader);
+
+    for (const auto& shaders : m_shaders) {
+        for (const auto shader : shaders) {
+            if (shader != nullptr)
+                engine.device.destroyShaderEXT(shader);
+        }
     }
+    ASSERT(m_depth_shader != nullptr);
+    engine.device.destroyShaderEXT(m_depth_shader);
 
     ASSERT(m_descriptor_pool != nullptr);
     engine.device.destroyDescriptorPool(m_descriptor_pool);
 
-    ASSERT(m_pipeline_layout != nullptr);
-    engine.device.destroyPipelineLayout(m_pipeline_layout);
+    ASSERT(m_cull_pipeline_layout != nullptr);
+    engine.device.destroyPipelineLayout(m_cull_pipeline_layout);
 
-    ASSERT(m_set_layout != nullptr);
-    engine.device.destroyDescriptorSetLayout(m_set_layout);
+    ASSERT(m_cull_set_layout != nullptr);
+    engine.device.destroyDescriptorSetLayout(m_cull_set_layout);
 }
 
-void PbrRenderer::cmd_draw(const vk::CommandBuffer cmd, const vk::DescriptorSet global_set) const {
-    ASSERT(cmd != nullptr);
-    ASSERT(global_set != nullptr);
+void PbrRenderer::cmd_prepare(const DefaultPipeline::DrawContext& ctx) const {
+    ASSERT(ctx.cmd != nullptr);
+    ASSERT(ctx.frame_index < MaxFramesInFlight);
+    ASSERT(m_render_queue.size() <= MaxInstances);
+    ASSERT(m_instance_buffer.mapped != nullptr);
+    ASSERT(m_draw_staging_buffer.mapped != nullptr);
+
+    if (m_render_queue.empty())
+        return;
+
+    const auto cmd = ctx.cmd;
+
+    // Tickets are sorted by draw bucket, model, level of detail, then distance past the near plane, so each level's
+    // instances are contiguous and nearest first. Keys hold the bucket in bits 28 to 31, the model in 16 to 27, the
+    // level in 14 and 15 and the depth below.
+    static_assert(DrawBucketCount <= 16 && MaxModels <= 1 << 12 && MaxMeshLods <= 4 && MaxDraws <= 1 << 14);
+    const auto depth_key = [&](const glm::vec3& position) -> u32 {
+        const auto& near = ctx.frustum.planes[4];
+        // The bits of a positive float sort like the float, the top 14 below the sign are kept
+        return std::bit_cast<u32>(std::max(glm::dot(glm::vec3{near}, position) + near.w, 0.0f)) >> 17;
+    };
+    std::vector<u64> tickets = {};
+    tickets.reserve(m_render_queue.size());
+    for (u32 i = 0; i < m_render_queue.size(); ++i) {
+        const auto& ticket = m_render_queue[i];
+        const auto& model = m_models[ticket.model];
+        if (!is_resident(model))
+            continue;
+        const u32 lod = std::min(ticket.lod, model.lod_count - 1);
+        const u64 key = draw_bucket(model) << 28 | ticket.model.index << 16 | lod << 14 | depth_key(ticket.transform.position);
+        tickets.push_back(key << 32 | i);
+    }
+    std::vector<u64> scratch(tickets.size());
+    radix_sort(tickets, scratch);
+
+    // Each level's draw is keyed by its nearest instance, so within a bucket the draws go front to back. The draw's
+    // index takes the low 14 bits.
+    std::vector<u32> group_starts = {};
+    std::vector<u64> groups = {};
+    for (u32 i = 0; i < tickets.size(); ++i) {
+        const u64 key = tickets[i] >> 32;
+        if (i > 0 && key >> 14 == tickets[i - 1] >> 46)
+            continue;
+        groups.push_back((key >> 28 << 28 | (key & 0x3fff) << 14 | group_starts.size()) << 32);
+        group_starts.push_back(i);
+    }
+    group_starts.push_back(to_u32(tickets.size()));
+    ASSERT(groups.size() <= MaxDraws);
+    scratch.resize(groups.size());
+    radix_sort(groups, scratch);
+
+    const u32 frame_offset = ctx.frame_index * to_u32(MaxInstances);
+    const auto instances = static_cast<InstanceData*>(m_instance_buffer.mapped) + frame_offset;
+    const auto draws = static_cast<CullDraw*>(m_draw_staging_buffer.mapped) + ctx.frame_index * MaxDraws;
+    const u32 draw_count = to_u32(groups.size());
+    u32 instance_count = 0;
+    for (u32 draw = 0; draw < draw_count; ++draw) {
+        const u32 group = (groups[draw] >> 32) & 0x3fff;
+        const auto& first_ticket = m_render_queue[tickets[group_starts[group]] & 0xffffffff];
+        const auto& model = m_models[first_ticket.model];
+        const auto& lod = model.lods[(tickets[group_starts[group]] >> 46) & 0x3];
+        draws[draw] = {
+            .command = {
+                .indexCount = lod.index_count,
+                .instanceCount = 0,
+                .firstIndex = lod.first_index,
+                .vertexOffset = to_i32(model.first_vertex),
+                .firstInstance = instance_count,
+            },
+            .bucket = draw_bucket(model),
+            .bounds = {model.bounds.center, model.bounds.radius},
+        };
 
+        const auto& texture = m_textures[model.texture];
+        const Texture normal_map = model.normal_map.is_valid() ? m_textures[model.normal_map] : Texture{};
+        for (u32 i = group_starts[group]; i < group_starts[group + 1]; ++i) {
+            instances[instance_count++] = {
+                .model = m_render_queue[tickets[i] & 0xffffffff].transform.matrix(),
+                .normal_map_index = normal_map.descriptor,
+                .texture_index = texture.descriptor,
+                .roughness = model.roughness,
+                .metalness = model.metalness,
+                .draw_index = draw,
+                .normal_map_sampler = normal_map.sampler,
+                .texture_sampler = texture.sampler,
+                .alpha_cutoff = model.alpha_cutoff,
+            };
+        }
+    }
+
+    // The previous frame may still be drawing from the buffers rewritten here
+    BarrierBuilder(cmd)
+        .add_memory_barrier({
+            .srcStageMask = vk::PipelineStageFlagBits2::eDrawIndirect | vk::PipelineStageFlagBits2::eVertexShader,
+            .srcAccessMask = vk::AccessFlagBits2::eIndirectCommandRead | vk::AccessFlagBits2::eShaderStorageRead,
+            .dstStageMask = vk::PipelineStageFlagBits2::eTransfer | vk::PipelineStageFlagBits2::eComputeShader,
+            .dstAccessMask = vk::AccessFlagBits2::eTransferWrite | vk::AccessFlagBits2::eShaderStorageWrite,
+        })
+        .build_and_run();
+
+    if (draw_count > 0) {
+        cmd.copyBuffer(m_draw_staging_buffer.buffer, m_draw_buffer.buffer, {vk::BufferCopy{
+            .srcOffset = ctx.frame_index * MaxDraws * sizeof(CullDraw),
+            .dstOffset = 0,
+            .size = draw_count * sizeof(CullDraw),
+        }});
+    }
+    cmd.fillBuffer(m_count_buffer.buffer, 0, vk::WholeSize, 0);
+
+    BarrierBuilder(cmd)
+        .add_memory_barrier({
+            .srcStageMask = vk::PipelineStageFlagBits2::eTransfer,
+            .srcAccessMask = vk::AccessFlagBits2::eTransferWrite,
+            .dstStageMask = vk::PipelineStageFlagBits2::eComputeShader | vk::PipelineStageFlagBits2::eDrawIndirect,
+            .dstAccessMask = vk::AccessFlagBits2::eShaderStorageRead | vk::AccessFlagBits2::eShaderStorageWrite
+                           | vk::AccessFlagBits2::eIndirectCommandRead,
+        })
+        .build_and_run();
+
+    if (draw_count == 0)
+        return;
+
+    constexpr u32 group_size = 64;
+    const CullPush push = {
+        .planes = ctx.frustum.planes,
+        .instance_offset = frame_offset,
+        .instance_count = instance_count,
+        .draw_count = draw_count,
+    };
+    cmd.bindDescriptorSets(vk::PipelineBindPoint::eCompute, m_cull_pipeline_layout, 0, {m_cull_set}, {});
+    cmd.pushConstants(m_cull_pipeline_layout, vk::ShaderStageFlagBits::eCompute, 0, sizeof(push), &push);
+
+    cmd.bindShadersEXT({vk::ShaderStageFlagBits::eCompute}, {m_cull_shader});
+    cmd.dispatch((push.instance_count + group_size - 1) / group_size, 1, 1);
+
+    BarrierBuilder(cmd)
+        .add_memory_barrier({
+            .srcStageMask = vk::PipelineStageFlagBits2::eComputeShader,
+            .srcAccessMask = vk::AccessFlagBits2::eShaderStorageWrite,
+            .dstStageMask = vk::PipelineStageFlagBits2::eComputeShader,
+            .dstAccessMask = vk::AccessFlagBits2::eShaderStorageRead | vk::AccessFlagBits2::eShaderStorageWrite,
+        })
+        .build_and_run();
+
+    // A single workgroup compacts the draws in order, keeping them front to back within each bucket
+    cmd.bindShadersEXT({vk::ShaderStageFlagBits::eCompute}, {m_compact_shader});
+    cmd.dispatch(1, 1, 1);
+
+    BarrierBuilder(cmd)
+        .add_memory_barrier({
+            .srcStageMask = vk::PipelineStageFlagBits2::eComputeShader,
+            .srcAccessMask = vk::AccessFlagBits2::eShaderStorageWrite,
+            .dstStageMask = vk::PipelineStageFlagBits2::eDrawIndirect | vk::PipelineStageFlagBits2::eVertexShader,
+            .dstAccessMask = vk::AccessFlagBits2::eIndirectCommandRead | vk::AccessFlagBits2::eShaderStorageRead,
+        })
+        .build_and_run();
+}
+
+void PbrRenderer::cmd_draw_depth(const DefaultPipeline::DrawContext& ctx) const {
+    ASSERT(ctx.cmd != nullptr);
+    ASSERT(ctx.draw_layout != nullptr);
+    ASSERT(m_depth_shader != nullptr);
+
+    if (m_render_queue.empty())
+        return;
+
+    const auto cmd = ctx.cmd;
     cmd.setCullMode(vk::CullModeFlagBits::eBack);
 
-    cmd.setVertexInputEXT({
-        vk::VertexInputBindingDescription2EXT{.stride = sizeof(Vertex), .inputRate = vk::VertexInputRate::eVertex, .divisor = 1}
-    }, {
-        vk::VertexInputAttributeDescription2EXT{.location = 0, .format = vk::Format::eR32G32B32Sfloat, .offset = offsetof(Vertex, position)},
-        vk::VertexInputAttributeDescription2EXT{.location = 1, .format = vk::Format::eR32G32B32Sfloat, .offset = offsetof(Vertex, normal)},
-        vk::VertexInputAttributeDescription2EXT{.location = 2, .format = vk::Format::eR32G32B32A32Sfloat, .offset = offsetof(Vertex, tangent)},
-        vk::VertexInputAttributeDescription2EXT{.location = 3, .format = vk::Format::eR32G32Sfloat, .offset = offsetof(Vertex, tex_coord)}
-    });
-    cmd.bindShadersEXT({vk::ShaderStageFlagBits::eVertex, vk::ShaderStageFlagBits::eFragment}, m_shaders);
+    cmd.bindShadersEXT({vk::ShaderStageFlagBits::eVertex, vk::ShaderStageFlagBits::eFragment}, {m_depth_shader, vk::ShaderEXT{}});
+    cmd.pushConstants(ctx.draw_layout, DefaultPipeline::DrawPushRange.stageFlags, 0, sizeof(m_draw_push), &m_draw_push);
+    cmd.bindIndexBuffer(m_index_buffer.buffer, 0, vk::IndexType::eUint32);
 
-    cmd.bindDescriptorSets(vk::PipelineBindPoint::eGraphics, m_pipeline_layout, 0, {global_set, m_texture_set}, {});
-    for (const auto& ticket : m_render_queue) {
-        const auto& model = m_models[ticket.model.index];
-
-        PushConstant model_push = {
-            .model = ticket.transform.matrix(),
-            .normal_map_index = to_u32(model.normal_map.index),
-            .texture_index = to_u32(model.texture.index),
-            .roughness = model.roughness,
-            .metalness = model.metalness
-        };
-        cmd.pushConstants(
-            m_pipeline_layout,
-            vk::ShaderStageFlagBits::eVertex | vk::ShaderStageFlagBits::eFragment,
-            0, sizeof(model_push), &model_push
+    const u32 buckets = queued_buckets();
+    u32 bound_format = UINT32_MAX;
+    for (u32 bucket = 0; bucket < DrawBucketCount; ++bucket) {
+        if ((buckets & (1u << bucket)) == 0 || is_alpha_tested(bucket))
+            continue;
+
+        const u32 format = bucket / MaterialBucketCount;
+        if (format != bound_format) {
+            const bool packed = format == static_cast<u32>(VertexFormat::Packed);
+            cmd.setVertexInputEXT({vk::VertexInputBindingDescription2EXT{
+                .stride = to_u32(position_size(static_cast<VertexFormat>(format))),
+                .inputRate = vk::VertexInputRate::eVertex,
+                .divisor = 1,
+            }}, {vk::VertexInputAttributeDescription2EXT{
+                .location = 0,
+                .format = packed ? vk::Format::eR16G16B16A16Sfloat : vk::Format::eR32G32B32Sfloat,
+            }});
+            cmd.bindVertexBuffers(0, {m_position_buffers[format].buffer}, {vk::DeviceSize{0}});
+            bound_format = format;
+        }
+
+        cmd.drawIndexedIndirectCount(
+            m_indirect_buffer.buffer, bucket * MaxDraws * sizeof(vk::DrawIndexedIndirectCommand),
+            m_count_buffer.buffer, bucket * sizeof(u32),
+            to_u32(MaxDraws), sizeof(vk::DrawIndexedIndirectCommand)
         );
+    }
+
+    cmd.setCullMode(vk::CullModeFlagBits::eNone);
+}
 
-        cmd.bindIndexBuffer(model.index_buffer.buffer, 0, vk::IndexType::eUint32);
-        cmd.bindVertexBuffers(0, {model.vertex_buffer.buffer}, {vk::DeviceSize{0}});
-        cmd.drawIndexed(model.index_count, 1, 0, 0, 1);
+void PbrRenderer::cmd_draw(const DefaultPipeline::DrawContext& ctx) const {
+    ASSERT(ctx.cmd != nullptr);
+    ASSERT(ctx.draw_layout != nullptr);
+    ASSERT(m_indirect_buffer.buffer != nullptr);
+    ASSERT(m_count_buffer.buffer != nullptr);
+
+    if (m_render_queue.empty())
+        return;
+
+    const auto cmd = ctx.cmd;
+    cmd.setCullMode(vk::CullModeFlagBits::eBack);
+
+    cmd.pushConstants(ctx.draw_layout, DefaultPipeline::DrawPushRange.stageFlags, 0, sizeof(m_draw_push), &m_draw_push);
+    cmd.bindIndexBuffer(m_index_buffer.buffer, 0, vk::IndexType::eUint32);
+
+    // Empty buckets are skipped on the cpu instead of binding their shaders for a zero count draw
+    const u32 buckets = queued_buckets();
+
+    // Buckets are ordered by vertex format, so the vertex input changes at most once per format
+    const auto tier = light_tier(ctx.light_count);
+    u32 bound_format = UINT32_MAX;
+    for (u32 bucket = 0; bucket < DrawBucketCount; ++bucket) {
+        if ((buckets & (1u << bucket)) == 0)
+            continue;
+
+        // Depth from the pre-pass matches exactly, alpha tested models weren't in it and still write their own
+        if (ctx.depth_prepass) {
+            const bool prepassed = !is_alpha_tested(bucket);
+            cmd.setDepthCompareOp(prepassed ? vk::CompareOp::eEqual : vk::CompareOp::eLess);
+            cmd.setDepthWriteEnable(prepassed ? vk::False : vk::True);
+        }
+
+        const u32 format = bucket / MaterialBucketCount;
+        if (format != bound_format) {
+            if (format == static_cast<u32>(VertexFormat::Packed)) {
+                cmd.setVertexInputEXT({
+                    vk::VertexInputBindingDescription2EXT{.stride = sizeof(PackedVertex), .inputRate = vk::VertexInputRate::eVertex, .divisor = 1}
+                }, {
+                    vk::VertexInputAttributeDescription2EXT{.location = 0, .format = vk::Format::eR16G16B16A16Sfloat, .offset = offsetof(PackedVertex, position)},
+                    vk::VertexInputAttributeDescription2EXT{.location = 1, .format = vk::Format::eR16G16Snorm, .offset = offsetof(PackedVertex, normal)},
+                    vk::VertexInputAttributeDescription2EXT{.location = 2, .format = vk::Format::eR16G16Snorm, .offset = offsetof(PackedVertex, tangent)},
+                    vk::VertexInputAttributeDescription2EXT{.location = 3, .format = vk::Format::eR16G16Unorm, .offset = offsetof(PackedVertex, tex_coord)}
+                });
+            } else {
+                cmd.setVertexInputEXT({
+                    vk::VertexInputBindingDescription2EXT{.stride = sizeof(Vertex), .inputRate = vk::VertexInputRate::eVertex, .divisor = 1}
+                }, {
+                    vk::VertexInputAttributeDescription2EXT{.location = 0, .format = vk::Format::eR32G32B32Sfloat, .offset = offsetof(Vertex, position)},
+                    vk::VertexInputAttributeDescription2EXT{.location = 1, .format = vk::Format::eR32G32B32Sfloat, .offset = offsetof(Vertex, normal)},
+                    vk::VertexInputAttributeDescription2EXT{.location = 2, .format = vk::Format::eR32G32B32A32Sfloat, .offset = offsetof(Vertex, tangent)},
+                    vk::VertexInputAttributeDescription2EXT{.location = 3, .format = vk::Format::eR32G32Sfloat, .offset = offsetof(Vertex, tex_coord)}
+                });
+            }
+            cmd.bindVertexBuffers(0, {m_vertex_buffers[format].buffer}, {vk::DeviceSize{0}});
+            bound_format = format;
+        }
+
+        const auto& shaders = m_shaders[variant_index(bucket, tier)];
+        ASSERT(shaders[0] != nullptr && shaders[1] != nullptr);
+        cmd.bindShadersEXT({vk::ShaderStageFlagBits::eVertex, vk::ShaderStageFlagBits::eFragment}, shaders);
+
+        cmd.drawIndexedIndirectCount(
+            m_indirect_buffer.buffer, bucket * MaxDraws * sizeof(vk::DrawIndexedIndirectCommand),
+            m_count_buffer.buffer, bucket * sizeof(u32),
+            to_u32(MaxDraws), sizeof(vk::DrawIndexedIndirectCommand)
+        );
     }
 
+    cmd.setDepthCompareOp(vk::CompareOp::eLess);
+    cmd.setDepthWriteEnable(vk::True);
     cmd.setCullMode(vk::CullModeFlagBits::eNone);
 }
 
-Result<PbrRenderer::TextureHandle> PbrRenderer::load_texture(const Engine& engine, std::filesystem::path path) {
-    ASSERT(m_textures.size() < MaxTextures);
+u32 PbrRenderer::queued_buckets() const {
+    u32 buckets = 0;
+    for (const auto& ticket : m_render_queue) {
+        const auto& model = m_models[ticket.model];
+        if (is_resident(model))
+            buckets |= 1u << draw_bucket(model);
+    }
+    return buckets;
+}
+
+Result<PbrRenderer::TextureHandle> PbrRenderer::load_texture(const Engine& engine, UploadQueue& uploads, std::filesystem::path path) {
     ASSERT(!path.empty());
 
     const auto texture_data = ImageData::load(path);
     if (texture_data.has_err())
         return texture_data.err();
 
-    return ok(load_texture_from_data(engine, {
+    return load_texture_from_data(engine, uploads, {
         texture_data->pixels.get(), 4, {to_u32(texture_data->width), to_u32(texture_data->height), 1}
-    }));
+    });
+}
+
+Result<PbrRenderer::TextureHandle> PbrRenderer::load_texture_from_data(
+    const Engine& engine, UploadQueue& uploads, const GpuImage::Data& data, const vk::Format format
+) {
+    const auto texture = insert_texture(engine);
+    if (texture.has_err())
+        return texture.err();
+    const auto written = write_texture(engine, uploads, *texture, data, format);
+    if (written.has_err()) {
+        m_textures.erase(*texture, engine.deletions->completed_serial());
+        return written.err();
+    }
+    return texture;
+}
+
+Result<PbrRenderer::TextureHandle> PbrRenderer::load_texture_async(const Engine& engine, std::future<Result<ImageData>> data) {
+    ASSERT(data.valid());
+
+    const auto texture = insert_texture(engine);
+    if (texture.has_err())
+        return texture.err();
+    m_pending_textures.emplace_back(*texture, std::move(data));
+    return texture;
 }
 
-PbrRenderer::TextureHandle PbrRenderer::load_texture_from_data(
-    const Engine& engine, const GpuImage::Data& data, const vk::Format format
+Result<PbrRenderer::TextureHandle> PbrRenderer::load_compressed_texture(
+    const Engine& engine, UploadQueue& uploads, const std::filesystem::path& path
 ) {
-    ASSERT(m_textures.size() < MaxTextures);
+    ASSERT(!path.empty());
+
+    const auto image = CompressedImage::load(path);
+    if (image.has_err())
+        return image.err();
+    return load_texture_from_compressed(engine, uploads, *image);
+}
+
+Result<PbrRenderer::TextureHandle> PbrRenderer::load_texture_from_compressed(
+    const Engine& engine, UploadQueue& uploads, const CompressedImage& image
+) {
+    if (!is_format_sampleable(engine, image.format))
+        return Err::ImageFormatUnsupported;
+
+    const auto texture = insert_texture(engine);
+    if (texture.has_err())
+        return texture.err();
+    const auto written = write_compressed_texture(engine, uploads, *texture, image);
+    if (written.has_err()) {
+        m_textures.erase(*texture, engine.deletions->completed_serial());
+        return written.err();
+    }
+    return texture;
+}
+
+Result<PbrRenderer::TextureHandle> PbrRenderer::load_texture_async(const Engine& engine, std::future<Result<CompressedImage>> data) {
+    ASSERT(data.valid());
+
+    const auto texture = insert_texture(engine);
+    if (texture.has_err())
+        return texture.err();
+    m_pending_compressed_textures.emplace_back(*texture, std::move(data));
+    return texture;
+}
+
+Result<PbrRenderer::TextureHandle> PbrRenderer::load_texture_streamed(const Engine& engine, std::future<Result<CompressedImage>> data) {
+    ASSERT(data.valid());
+
+    const auto texture = insert_texture(engine);
+    if (texture.has_err())
+        return texture.err();
+    m_pending_streamed_textures.emplace_back(*texture, std::move(data));
+    return texture;
+}
+
+Result<PbrRenderer::TextureHandle> PbrRenderer::load_texture_from_image(const Engine& engine, const GpuImage& image) {
+    ASSERT(engine.bindless != nullptr);
+    ASSERT(image.allocation != nullptr);
+    ASSERT(image.image != nullptr);
+    ASSERT(image.view != nullptr);
+
+    const auto sampler = engine.bindless->get_sampler(engine, {.type = SamplerType::Linear});
+    if (sampler.has_err())
+        return sampler.err();
+    const auto descriptor = engine.bindless->add_sampled_image(image.view);
+    if (descriptor.has_err())
+        return descriptor.err();
+    const auto texture = insert_texture(engine);
+    if (texture.has_err()) {
+        engine.bindless->remove_sampled_image(engine, *descriptor);
+        return texture.err();
+    }
+    m_textures[*texture] = {image, *descriptor, *sampler};
+    return texture;
+}
+
+void PbrRenderer::unload_texture(const Engine& engine, const TextureHandle texture) {
+    ASSERT(engine.deletions != nullptr);
+    ASSERT(engine.bindless != nullptr);
+    ASSERT(m_textures.contains(texture));
+
+    std::erase_if(m_pending_textures, [texture](const PendingTexture<ImageData>& pending) { return pending.texture == texture; });
+    std::erase_if(m_pending_compressed_textures, [texture](const PendingTexture<CompressedImage>& pending) {
+        return pending.texture == texture;
+    });
+    std::erase_if(m_pending_streamed_textures, [texture](const PendingTexture<CompressedImage>& pending) {
+        return pending.texture == texture;
+    });
+    std::erase_if(m_streamed_textures, [texture](const StreamedTexture& streamed) { return streamed.texture == texture; });
+
+    // Frames in flight may still sample it, so its image and heap index are only freed once they have finished
+    const auto& resident = m_textures[texture];
+    if (resident.descriptor != BindlessHeap::InvalidIndex) {
+        engine.bindless->remove_sampled_image(engine, resident.descriptor);
+        engine.deletions->push([image = resident.image, view = resident.level_view](const Engine& e) {
+            if (view != nullptr)
+                e.device.destroyImageView(view);
+            image.destroy(e);
+        });
+    }
+    m_textures.erase(texture, engine.deletions->next_serial());
+}
+
+Result<PbrRenderer::TextureHandle> PbrRenderer::insert_texture(const Engine& engine) {
+    ASSERT(engine.deletions != nullptr);
+
+    const auto texture = m_textures.insert({}, engine.deletions->completed_serial());
+    if (!texture.has_value())
+        return Err::TextureRegistryFull;
+    return ok(*texture);
+}
+
+Result<void> PbrRenderer::write_texture(
+    const Engine& engine, UploadQueue& uploads, const TextureHandle texture, const GpuImage::Data& data, const vk::Format format
+) {
+    ASSERT(engine.bindless != nullptr);
+    ASSERT(engine.deletions != nullptr);
+    ASSERT(m_textures.contains(texture));
+    ASSERT(m_textures[texture].descriptor == BindlessHeap::InvalidIndex);
     ASSERT(data.ptr != nullptr);
     ASSERT(data.alignment > 0);
     ASSERT(data.extent.width > 0);
@@ -521,8 +1458,11 @@ PbrRenderer::TextureHandle PbrRenderer::load_texture_from_data(
     ASSERT(data.extent.depth > 0);
     ASSERT(format != vk::Format::eUndefined);
 
+    const auto sampler = engine.bindless->get_sampler(engine, {.type = SamplerType::Linear});
+    if (sampler.has_err())
+        return sampler.err();
     const u32 mips = get_mip_count(data.extent);
-    const auto image = GpuImage::create(engine, {
+    const auto image = GpuImage::create_result(engine, {
         .extent = data.extent,
         .format = format,
         .usage = vk::ImageUsageFlagBits::eSampled
@@ -530,73 +1470,854 @@ PbrRenderer::TextureHandle PbrRenderer::load_texture_from_data(
                | vk::ImageUsageFlagBits::eTransferDst,
         .mip_levels = mips,
     });
-    image.write(engine, data, vk::ImageLayout::eShaderReadOnlyOptimal);
-    image.generate_mipmaps(engine, mips, data.extent, format, vk::ImageLayout::eShaderReadOnlyOptimal);
-    const auto sampler = create_sampler(engine, {.type = SamplerType::Linear, .mip_levels = mips});
+    if (image.has_err())
+        return image.err();
+
+    const auto descriptor = [&]() -> Result<u32> {
+        const auto upload_layout = mips > 1 ? vk::ImageLayout::eTransferDstOptimal : vk::ImageLayout::eShaderReadOnlyOptimal;
+        const auto upload = uploads.upload_image(engine, image->image, data, upload_layout);
+        if (upload.has_err())
+            return upload.err();
+        if (mips > 1) {
+            const auto mipmaps = uploads.generate_mipmaps(
+                engine, image->image, mips, data.extent, format,
+                vk::ImageLayout::eTransferDstOptimal, vk::ImageLayout::eShaderReadOnlyOptimal
+            );
+            if (mipmaps.has_err())
+                return mipmaps.err();
+        }
+        return engine.bindless->add_sampled_image(image->view);
+    }();
+    // Uploads already recorded may still write the image
+    if (descriptor.has_err()) {
+        engine.deletions->push([image = *image](const Engine& e) { image.destroy(e); });
+        return descriptor.err();
+    }
 
-    usize index = m_textures.size();
-    write_image_sampler_descriptor(engine, m_texture_set, 0, sampler, image.view, to_u32(index));
+    ASSERT(image->allocation != nullptr);
+    ASSERT(image->image != nullptr);
+    ASSERT(image->view != nullptr);
+    m_textures[texture] = {*image, *descriptor, *sampler, data.extent, format, mips};
+    return ok();
+}
 
-    ASSERT(image.allocation != nullptr);
-    ASSERT(image.image != nullptr);
-    ASSERT(image.view != nullptr);
-    ASSERT(sampler != nullptr);
-    m_textures.emplace_back(image, sampler);
-    return {index};
+Result<void> PbrRenderer::write_compressed_texture(
+    const Engine& engine, UploadQueue& uploads, const TextureHandle texture, const CompressedImage& image
+) {
+    ASSERT(engine.bindless != nullptr);
+    ASSERT(engine.deletions != nullptr);
+    ASSERT(m_textures.contains(texture));
+    ASSERT(m_textures[texture].descriptor == BindlessHeap::InvalidIndex);
+    ASSERT(!image.levels.empty());
+    ASSERT(image.format != vk::Format::eUndefined);
+
+    const auto sampler = engine.bindless->get_sampler(engine, {.type = SamplerType::Linear});
+    if (sampler.has_err())
+        return sampler.err();
+    const auto& base = image.levels[0];
+    const auto gpu_image = GpuImage::create_result(engine, {
+        .extent = {base.width, base.height, 1},
+        .format = image.format,
+        .usage = vk::ImageUsageFlagBits::eSampled
+               | vk::ImageUsageFlagBits::eTransferSrc
+               | vk::ImageUsageFlagBits::eTransferDst,
+        .mip_levels = to_u32(image.levels.size()),
+    });
+    if (gpu_image.has_err())
+        return gpu_image.err();
+
+    std::vector<UploadQueue::ImageLevel> levels(image.levels.size());
+    for (usize i = 0; i < levels.size(); ++i) {
+        levels[i] = {image.levels[i].data.data(), image.levels[i].data.size(), {image.levels[i].width, image.levels[i].height, 1}};
+    }
+    const auto descriptor = [&]() -> Result<u32> {
+        const auto upload = uploads.upload_image_levels(engine, gpu_image->image, levels, vk::ImageLayout::eShaderReadOnlyOptimal);
+        if (upload.has_err())
+            return upload.err();
+        return engine.bindless->add_sampled_image(gpu_image->view);
+    }();
+    if (descriptor.has_err()) {
+        engine.deletions->push([image = *gpu_image](const Engine& e) { image.destroy(e); });
+        return descriptor.err();
+    }
+
+    ASSERT(gpu_image->allocation != nullptr);
+    ASSERT(gpu_image->image != nullptr);
+    ASSERT(gpu_image->view != nullptr);
+    m_textures[texture] = {*gpu_image, *descriptor, *sampler, {base.width, base.height, 1}, image.format, to_u32(levels.size())};
+    return ok();
+}
+
+bool PbrRenderer::can_evict_mip(const TextureHandle texture) const {
+    ASSERT(m_textures.contains(texture));
+
+    const auto& resident = m_textures[texture];
+    if (resident.descriptor == BindlessHeap::InvalidIndex || resident.mip_levels <= 1)
+        return false;
+    if (resident.extent.width / 2 < MinEvictedExtent || resident.extent.height / 2 < MinEvictedExtent)
+        return false;
+    // Levels still waiting on their upload have nothing to copy down
+    const auto streamed = std::ranges::find(m_streamed_textures, texture, &StreamedTexture::texture);
+    return streamed == m_streamed_textures.end() || (streamed->loaded_level == 0 && streamed->top_level < streamed->base_level);
+}
+
+bool PbrRenderer::evict_texture_mip(const Engine& engine, UploadQueue& uploads, const TextureHandle texture) {
+    ASSERT(engine.deletions != nullptr);
+    ASSERT(engine.bindless != nullptr);
+    ASSERT(m_textures.contains(texture));
+
+    if (!can_evict_mip(texture))
+        return false;
+    const Texture old = m_textures[texture];
+    ASSERT(old.level_view == nullptr);
+    const auto streamed = std::ranges::find(m_streamed_textures, texture, &StreamedTexture::texture);
+
+    const vk::Extent3D extent = {old.extent.width / 2, old.extent.height / 2, 1};
+    const u32 mips = old.mip_levels - 1;
+    const auto image = GpuImage::create_result(engine, {
+        .extent = extent,
+        .format = old.format,
+        .usage = vk::ImageUsageFlagBits::eSampled
+               | vk::ImageUsageFlagBits::eTransferSrc
+               | vk::ImageUsageFlagBits::eTransferDst,
+        .mip_levels = mips,
+    });
+    if (image.has_err())
+        return false;
+    const auto copy = uploads.copy_image_levels(
+        engine, old.image.image, vk::ImageLayout::eShaderReadOnlyOptimal, 1, image->image, 0, mips, extent,
+        vk::ImageLayout::eShaderReadOnlyOptimal
+    );
+    if (copy.has_err()) {
+        image->destroy(engine);
+        return false;
+    }
+    const auto descriptor = engine.bindless->add_sampled_image(image->view);
+    if (descriptor.has_err()) {
+        engine.deletions->push([image = *image](const Engine& e) { image.destroy(e); });
+        return false;
+    }
+
+    // Frames in flight may still sample the old image, cmd_prepare picks up the new descriptor from the next frame
+    engine.bindless->remove_sampled_image(engine, old.descriptor);
+    engine.deletions->push([image = old.image](const Engine& e) { image.destroy(e); });
+    m_textures[texture] = {*image, *descriptor, old.sampler, extent, old.format, mips};
+    if (streamed != m_streamed_textures.end())
+        ++streamed->top_level;
+    return true;
+}
+
+Result<void> PbrRenderer::write_streamed_texture(
+    const Engine& engine, UploadQueue& uploads, const TextureHandle texture, CompressedImage image
+) {
+    ASSERT(engine.bindless != nullptr);
+    ASSERT(engine.deletions != nullptr);
+    ASSERT(m_textures.contains(texture));
+    ASSERT(m_textures[texture].descriptor == BindlessHeap::InvalidIndex);
+    ASSERT(!image.levels.empty());
+    ASSERT(image.format != vk::Format::eUndefined);
+
+    const auto sampler = engine.bindless->get_sampler(engine, {.type = SamplerType::Linear});
+    if (sampler.has_err())
+        return sampler.err();
+    u32 top_level = 0;
+    while (top_level + 1 < image.levels.size()
+        && std::max(image.levels[top_level].width, image.levels[top_level].height) > StreamedBaseExtent) {
+        ++top_level;
+    }
+    const auto& top = image.levels[top_level];
+    const u32 mips = to_u32(image.levels.size()) - top_level;
+    const auto gpu_image = GpuImage::create_result(engine, {
+        .extent = {top.width, top.height, 1},
+        .format = image.format,
+        .usage = vk::ImageUsageFlagBits::eSampled
+               | vk::ImageUsageFlagBits::eTransferSrc
+               | vk::ImageUsageFlagBits::eTransferDst,
+        .mip_levels = mips,
+    });
+    if (gpu_image.has_err())
+        return gpu_image.err();
+
+    std::vector<UploadQueue::ImageLevel> levels(mips);
+    for (u32 i = 0; i < mips; ++i) {
+        const auto& level = image.levels[top_level + i];
+        levels[i] = {level.data.data(), level.data.size(), {level.width, level.height, 1}};
+    }
+    const auto descriptor = [&]() -> Result<u32> {
+        const auto upload = uploads.upload_image_levels(engine, gpu_image->image, levels, vk::ImageLayout::eShaderReadOnlyOptimal);
+        if (upload.has_err())
+            return upload.err();
+        return engine.bindless->add_sampled_image(gpu_image->view);
+    }();
+    if (descriptor.has_err()) {
+        engine.deletions->push([image = *gpu_image](const Engine& e) { image.destroy(e); });
+        return descriptor.err();
+    }
+
+    ASSERT(gpu_image->allocation != nullptr);
+    ASSERT(gpu_image->image != nullptr);
+    ASSERT(gpu_image->view != nullptr);
+    m_textures[texture] = {*gpu_image, *descriptor, *sampler, {top.width, top.height, 1}, image.format, mips};
+    m_streamed_textures.push_back({.texture = texture, .source = std::move(image), .base_level = top_level, .top_level = top_level});
+    return ok();
+}
+
+f32 PbrRenderer::pixels_per_model_unit(
+    const DefaultPipeline::ViewProjectionUniform& vp, const Model& model, const Transform3Df& transform
+) {
+    // Pixels covered by one unit at a distance of one, along the screen's height
+    const f32 pixels_per_unit = vp.projection[1][1] * vp.screen.y * 0.5f;
+    const f32 near = vp.screen.z;
+
+    const auto& scale = transform.scale;
+    const auto bounds = model.bounds.transformed(transform.matrix(), scale);
+    const f32 distance = std::max(glm::length(glm::vec3{vp.view * glm::vec4{bounds.center, 1.0f}}) - bounds.radius, near);
+    const f32 max_scale = std::max({std::abs(scale.x), std::abs(scale.y), std::abs(scale.z)});
+    return max_scale * pixels_per_unit / distance;
+}
+
+void PbrRenderer::select_lods(const DefaultPipeline& pipeline) {
+    const auto& vp = pipeline.get_view_projection();
+    for (u32 i = 0; i < m_render_queue.size(); ++i) {
+        auto& ticket = m_render_queue[i];
+        const auto& model = m_models[ticket.model];
+        ticket.lod = 0;
+        if (model.lod_count <= 1)
+            continue;
+
+        const bool seen = i < m_previous_lods.size() && m_previous_lods[i].first == ticket.model;
+        const u32 previous = seen ? m_previous_lods[i].second : 0;
+        const f32 pixels = pixels_per_model_unit(vp, model, ticket.transform);
+        // Errors grow with each level, so the coarsest one within its threshold is taken
+        for (u32 lod = model.lod_count - 1; lod > 0; --lod) {
+            const f32 threshold = lod > previous ? LodErrorPixels * LodHysteresis : LodErrorPixels;
+            if (model.lods[lod].error * pixels <= threshold) {
+                ticket.lod = lod;
+                break;
+            }
+        }
+    }
+
+    m_previous_lods.resize(m_render_queue.size());
+    std::ranges::transform(m_render_queue, m_previous_lods.begin(), [](const RenderTicket& ticket) {
+        return std::pair{ticket.model, ticket.lod};
+    });
+}
+
+void PbrRenderer::update_uv_per_pixel(const DefaultPipeline& pipeline) {
+    m_uv_per_pixel.assign(m_textures.slot_count(), std::numeric_limits<f32>::infinity());
+    if (m_streamed_textures.empty())
+        return;
+
+    // Assumes the model's uvs are spread evenly over its surface, and measures from the nearest point of its bounds
+    const auto& vp = pipeline.get_view_projection();
+    for (const auto& ticket : m_render_queue) {
+        const auto& model = m_models[ticket.model];
+        if (model.index_count == 0 || model.uv_density <= 0.0f)
+            continue;
+        const f32 uv_per_pixel = model.uv_density / pixels_per_model_unit(vp, model, ticket.transform);
+
+        for (const auto texture : {model.texture, model.normal_map}) {
+            if (texture.is_valid() && texture.index < m_uv_per_pixel.size())
+                m_uv_per_pixel[texture.index] = std::min(m_uv_per_pixel[texture.index], uv_per_pixel);
+        }
+    }
+}
+
+// A view that leaves out the image's levels above first_level, so they aren't sampled before they're uploaded
+static Result<vk::ImageView> create_level_view(
+    const Engine& engine, const vk::Image image, const vk::Format format, const u32 first_level, const u32 level_count
+) {
+    ASSERT(engine.device != nullptr);
+    ASSERT(image != nullptr);
+    ASSERT(level_count > 0);
+
+    const auto view = engine.device.createImageView({
+        .image = image,
+        .viewType = vk::ImageViewType::e2D,
+        .format = format,
+        .subresourceRange = {vk::ImageAspectFlagBits::eColor, first_level, level_count, 0, 1},
+    });
+    if (view.result != vk::Result::eSuccess)
+        return Err::CouldNotCreateGpuImageView;
+
+    ASSERT(view.value != nullptr);
+    return ok(view.value);
+}
+
+Result<void> PbrRenderer::grow_streamed_texture(
+    const Engine& engine, UploadQueue& uploads, StreamedTexture& streamed, const u32 top_level
+) {
+    ASSERT(engine.bindless != nullptr);
+    ASSERT(engine.deletions != nullptr);
+    ASSERT(m_textures.contains(streamed.texture));
+    ASSERT(top_level < streamed.top_level);
+    ASSERT(streamed.loaded_level == 0);
+
+    const Texture old = m_textures[streamed.texture];
+    ASSERT(old.level_view == nullptr);
+    const auto& top = streamed.source.levels[top_level];
+    const u32 added = streamed.top_level - top_level;
+    const u32 mips = old.mip_levels + added;
+    const auto image = GpuImage::create_result(engine, {
+        .extent = {top.width, top.height, 1},
+        .format = old.format,
+        .usage = vk::ImageUsageFlagBits::eSampled
+               | vk::ImageUsageFlagBits::eTransferSrc
+               | vk::ImageUsageFlagBits::eTransferDst,
+        .mip_levels = mips,
+    });
+    if (image.has_err())
+        return image.err();
+    const auto view = create_level_view(engine, image->image, old.format, added, old.mip_levels);
+    if (view.has_err()) {
+        image->destroy(engine);
+        return view.err();
+    }
+
+    // The resident levels move down the new chain, and the new ones are left for upload_streamed_level to fill
+    const auto copy = uploads.copy_image_levels(
+        engine, old.image.image, vk::ImageLayout::eShaderReadOnlyOptimal, 0, image->image, added, old.mip_levels,
+        old.extent, vk::ImageLayout::eShaderReadOnlyOptimal
+    );
+    if (copy.has_err()) {
+        engine.device.destroyImageView(*view);
+        image->destroy(engine);
+        return copy.err();
+    }
+    const auto descriptor = engine.bindless->add_sampled_image(*view);
+    if (descriptor.has_err()) {
+        engine.deletions->push([image = *image, view = *view](const Engine& e) {
+            e.device.destroyImageView(view);
+            image.destroy(e);
+        });
+        return descriptor.err();
+    }
+
+    engine.bindless->remove_sampled_image(engine, old.descriptor);
+    engine.deletions->push([image = old.image](const Engine& e) { image.destroy(e); });
+    m_textures[streamed.texture] = {*image, *descriptor, old.sampler, {top.width, top.height, 1}, old.format, mips, *view};
+    streamed.top_level = top_level;
+    streamed.loaded_level = added;
+    return ok();
+}
+
+Result<vk::DeviceSize> PbrRenderer::upload_streamed_level(const Engine& engine, UploadQueue& uploads, StreamedTexture& streamed) {
+    ASSERT(engine.bindless != nullptr);
+    ASSERT(engine.deletions != nullptr);
+    ASSERT(m_textures.contains(streamed.texture));
+    ASSERT(streamed.loaded_level > 0);
+
+    const u32 level = streamed.loaded_level - 1;
+    const auto& source = streamed.source.levels[streamed.top_level + level];
+    const UploadQueue::ImageLevel upload_level = {source.data.data(), source.data.size(), {source.width, source.height, 1}};
+    auto& texture = m_textures[streamed.texture];
+    const auto upload = uploads.upload_image_levels(
+        engine, texture.image.image, {&upload_level, 1}, vk::ImageLayout::eShaderReadOnlyOptimal,
+        vk::ImageAspectFlagBits::eColor, level
+    );
+    if (upload.has_err())
+        return upload.err();
+
+    // Levels land smallest first, so each new view only uncovers uploaded levels. Frames in flight keep sampling
+    // through the old view until they finish.
+    vk::ImageView view = texture.image.view;
+    if (level > 0) {
+        const auto level_view = create_level_view(engine, texture.image.image, texture.format, level, texture.mip_levels - level);
+        if (level_view.has_err())
+            return level_view.err();
+        view = *level_view;
+    }
+    const auto descriptor = engine.bindless->add_sampled_image(view);
+    if (descriptor.has_err()) {
+        if (level > 0)
+            engine.device.destroyImageView(view);
+        return descriptor.err();
+    }
+    engine.bindless->remove_sampled_image(engine, texture.descriptor);
+    if (texture.level_view != nullptr)
+        engine.deletions->push([old = texture.level_view](const Engine& e) { e.device.destroyImageView(old); });
+    texture.descriptor = *descriptor;
+    texture.level_view = level > 0 ? view : nullptr;
+    streamed.loaded_level = level;
+    return ok(vk::DeviceSize{source.data.size()});
 }
 
 Result<PbrRenderer::ModelHandle> PbrRenderer::load_model(
-    const Engine& engine, const std::filesystem::path path,
-    const TextureHandle normal_map, const TextureHandle texture
+    const Engine& engine, UploadQueue& uploads, const std::filesystem::path path,
+    const TextureHandle normal_map, const TextureHandle texture, const VertexFormat format
 ) {
     ASSERT(!path.empty());
-    ASSERT(texture.index < m_textures.size());
+    ASSERT(m_textures.contains(texture));
 
     const auto model = ModelData::load_gltf(path);
     if (model.has_err())
         return model.err();
 
-    return ok(load_model_from_data(engine, model->mesh, normal_map, texture, model->roughness, model->metalness));
+    return load_model_from_data(engine, uploads, model->mesh, normal_map, texture, model->roughness, model->metalness, format);
 }
 
-PbrRenderer::ModelHandle PbrRenderer::load_model_from_data(
+Result<PbrRenderer::ModelHandle> PbrRenderer::load_model_from_data(
     const Engine& engine,
+    UploadQueue& uploads,
     const Mesh& data,
     const TextureHandle normal_map,
     const TextureHandle texture,
     const float roughness,
-    const float metalness
+    const float metalness,
+    const VertexFormat format
 ) {
-    ASSERT(!data.indices.empty());
-    ASSERT(!data.vertices.empty());
-    ASSERT(texture.index < m_textures.size());
+    ASSERT(m_textures.contains(texture));
+
+    const auto model = insert_model(engine, {.normal_map = normal_map, .texture = texture, .vertex_format = format});
+    if (model.has_err())
+        return model.err();
+    const auto write_result = write_model(
+        engine, uploads, *model, data.indices, data.lod_indices, data.lods, data.vertices, roughness, metalness
+    );
+    if (write_result.has_err()) {
+        m_models.erase(*model, engine.deletions->completed_serial());
+        return write_result.err();
+    }
+    return model;
+}
+
+Result<PbrRenderer::ModelHandle> PbrRenderer::load_baked_model(
+    const Engine& engine, UploadQueue& uploads, const std::filesystem::path path,
+    const TextureHandle normal_map, const TextureHandle texture, const VertexFormat format
+) {
+    ASSERT(!path.empty());
+    ASSERT(m_textures.contains(texture));
+
+    const auto baked = BakedModel::load(path);
+    if (baked.has_err())
+        return baked.err();
+
+    const auto model = insert_model(engine, {.normal_map = normal_map, .texture = texture, .vertex_format = format});
+    if (model.has_err())
+        return model.err();
+    const auto write_result = write_model(
+        engine, uploads, *model, baked->indices, baked->lod_indices, baked->lods, baked->vertices, baked->roughness, baked->metalness
+    );
+    if (write_result.has_err()) {
+        m_models.erase(*model, engine.deletions->completed_serial());
+        return write_result.err();
+    }
+    return model;
+}
+
+Result<PbrRenderer::ModelHandle> PbrRenderer::load_model_async(
+    const Engine& engine, std::future<Result<ModelData>> data,
+    const TextureHandle normal_map, const TextureHandle texture, const VertexFormat format
+) {
+    ASSERT(data.valid());
+    ASSERT(m_textures.contains(texture));
+
+    const auto model = insert_model(engine, {.normal_map = normal_map, .texture = texture, .vertex_format = format});
+    if (model.has_err())
+        return model.err();
+    m_pending_models.emplace_back(*model, std::move(data));
+    return model;
+}
+
+Result<PbrRenderer::ModelHandle> PbrRenderer::load_model_async(
+    const Engine& engine, std::future<Result<BakedModel>> data,
+    const TextureHandle normal_map, const TextureHandle texture, const VertexFormat format
+) {
+    ASSERT(data.valid());
+    ASSERT(m_textures.contains(texture));
+
+    const auto model = insert_model(engine, {.normal_map = normal_map, .texture = texture, .vertex_format = format});
+    if (model.has_err())
+        return model.err();
+    m_pending_baked_models.emplace_back(*model, std::move(data));
+    return model;
+}
+
+void PbrRenderer::unload_model(const Engine& engine, const ModelHandle model) {
+    ASSERT(engine.deletions != nullptr);
+    ASSERT(m_models.contains(model));
+
+    std::erase_if(m_pending_models, [model](const PendingModel<ModelData>& pending) { return pending.model == model; });
+    std::erase_if(m_pending_baked_models, [model](const PendingModel<BakedModel>& pending) { return pending.model == model; });
+    std::erase_if(m_render_queue, [model](const RenderTicket& ticket) { return ticket.model == model; });
+
+    // Frames in flight may still draw from its ranges of the geometry arenas
+    const u64 serial = engine.deletions->next_serial();
+    if (m_models[model].index_count > 0)
+        m_retired_geometry.push_back({serial, m_models[model]});
+    m_models.erase(model, serial);
+}
+
+void PbrRenderer::set_alpha_cutoff(const Engine& engine, const ModelHandle model, const float cutoff) {
+    ASSERT(m_models.contains(model));
+    ASSERT(cutoff >= 0.0f && cutoff <= 1.0f);
+
+    m_models[model].alpha_cutoff = cutoff;
+    // Models still streaming get their variants once write_model settles their vertex format
+    if (m_models[model].index_count > 0 && create_variants(engine, draw_bucket(m_models[model])).has_err())
+        ERROR("Could not create pbr shader variants");
+}
+
+Result<PbrRenderer::ModelHandle> PbrRenderer::insert_model(const Engine& engine, const Model& model) {
+    ASSERT(engine.deletions != nullptr);
+
+    const auto handle = m_models.insert(model, engine.deletions->completed_serial());
+    if (!handle.has_value())
+        return Err::ModelRegistryFull;
+    return ok(*handle);
+}
+
+Result<void> PbrRenderer::create_variants(const Engine& engine, const u32 bucket) {
+    ASSERT(bucket < DrawBucketCount);
+    for (const auto layout : m_draw_set_layouts) {
+        ASSERT(layout != nullptr);
+    }
+
+    const vk::Bool32 packed = bucket / MaterialBucketCount == static_cast<u32>(VertexFormat::Packed);
+    constexpr vk::SpecializationMapEntry packed_entry = {.constantID = 0, .offset = 0, .size = sizeof(vk::Bool32)};
+    const vk::SpecializationInfo vertex_specialization = {
+        .mapEntryCount = 1,
+        .pMapEntries = &packed_entry,
+        .dataSize = sizeof(packed),
+        .pData = &packed,
+    };
+
+    // Matches the constants in pbr.frag
+    struct FragmentConstants {
+        vk::Bool32 normal_mapped = vk::False;
+        vk::Bool32 alpha_tested = vk::False;
+        u32 max_cluster_lights = 0;
+    };
+    constexpr std::array fragment_entries = {
+        vk::SpecializationMapEntry{.constantID = 0, .offset = offsetof(FragmentConstants, normal_mapped), .size = sizeof(vk::Bool32)},
+        vk::SpecializationMapEntry{.constantID = 1, .offset = offsetof(FragmentConstants, alpha_tested), .size = sizeof(vk::Bool32)},
+        vk::SpecializationMapEntry{.constantID = 2, .offset = offsetof(FragmentConstants, max_cluster_lights), .size = sizeof(u32)},
+    };
+
+    for (u32 tier = 0; tier < LightTierCount; ++tier) {
+        auto& shaders = m_shaders[variant_index(bucket, static_cast<LightTier>(tier))];
+        if (shaders[0] != nullptr)
+            continue;
+
+        const FragmentConstants constants = {
+            .normal_mapped = (bucket & 1) != 0,
+            .alpha_tested = is_alpha_tested(bucket),
+            .max_cluster_lights = static_cast<LightTier>(tier) == LightTier::None ? 0
+                                : static_cast<LightTier>(tier) == LightTier::Few ? FewLights
+                                : DefaultPipeline::MaxLightsPerCluster,
+        };
+        const vk::SpecializationInfo fragment_specialization = {
+            .mapEntryCount = to_u32(fragment_entries.size()),
+            .pMapEntries = fragment_entries.data(),
+            .dataSize = sizeof(constants),
+            .pData = &constants,
+        };
+        const auto shader_result = create_linked_shaders(engine, shaders, std::array{
+            ShaderConfig{
+                .path = "../shaders/pbr.vert.spv",
+                .stage = vk::ShaderStageFlagBits::eVertex,
+                .next_stage = vk::ShaderStageFlagBits::eFragment,
+                .set_layouts = m_draw_set_layouts,
+                .push_ranges = {&DefaultPipeline::DrawPushRange, 1},
+                .specialization = &vertex_specialization,
+            },
+            ShaderConfig{
+                .path = "../shaders/pbr.frag.spv",
+                .stage = vk::ShaderStageFlagBits::eFragment,
+                .next_stage = {},
+                .set_layouts = m_draw_set_layouts,
+                .push_ranges = {&DefaultPipeline::DrawPushRange, 1},
+                .specialization = &fragment_specialization,
+            },
+        });
+        if (shader_result.has_err())
+            return shader_result.err();
+    }
+
+    for (u32 tier = 0; tier < LightTierCount; ++tier) {
+        ASSERT(m_shaders[variant_index(bucket, static_cast<LightTier>(tier))][0] != nullptr);
+        ASSERT(m_shaders[variant_index(bucket, static_cast<LightTier>(tier))][1] != nullptr);
+    }
+    return ok();
+}
+
+void PbrRenderer::reclaim_geometry(const Engine& engine) {
+    ASSERT(engine.deletions != nullptr);
+
+    const u64 completed = engine.deletions->completed_serial();
+    std::erase_if(m_retired_geometry, [&](const RetiredGeometry& retired) {
+        if (retired.serial > completed)
+            return false;
+        m_index_allocator.free(retired.model.first_index, retired.model.index_count);
+        m_vertex_allocators[static_cast<usize>(retired.model.vertex_format)].free(
+            retired.model.first_vertex, retired.model.vertex_count
+        );
+        return true;
+    });
+}
+
+Result<void> PbrRenderer::write_model(
+    const Engine& engine, UploadQueue& uploads, const ModelHandle handle,
+    const std::span<const u32> indices, const std::span<const u32> lod_indices, const std::span<const MeshLod> lods,
+    const std::span<const Vertex> vertices, const float roughness, const float metalness
+) {
+    ASSERT(m_models.contains(handle));
+    ASSERT(m_models[handle].index_count == 0);
+    ASSERT(!indices.empty());
+    ASSERT(lods.size() < MaxMeshLods);
+    ASSERT(!vertices.empty());
     ASSERT(roughness >= 0.0 && roughness <= 1.0);
     ASSERT(metalness >= 0.0 && metalness <= 1.0);
 
-    const auto index_buffer = GpuBuffer::create(engine, {
-        data.indices.size() * sizeof(data.indices[0]),
-        vk::BufferUsageFlagBits::eIndexBuffer | vk::BufferUsageFlagBits::eTransferDst
+    auto& model = m_models[handle];
+    if (model.vertex_format == VertexFormat::Packed && !can_pack_vertices(vertices))
+        model.vertex_format = VertexFormat::Full;
+    const auto format = static_cast<usize>(model.vertex_format);
+
+    const auto variants = create_variants(engine, draw_bucket(model));
+    if (variants.has_err())
+        return variants.err();
+
+    reclaim_geometry(engine);
+    // The coarser levels follow the full mesh in one range, sharing its vertices
+    const usize index_count = indices.size() + lod_indices.size();
+    const auto first_index = m_index_allocator.alloc(index_count);
+    if (!first_index.has_value())
+        return Err::GeometryArenaFull;
+    const auto first_vertex = m_vertex_allocators[format].alloc(vertices.size());
+    if (!first_vertex.has_value()) {
+        m_index_allocator.free(*first_index, index_count);
+        return Err::GeometryArenaFull;
+    }
+
+    const auto upload = [&]() -> Result<void> {
+        const auto index_upload = uploads.upload_buffer(
+            engine, m_index_buffer, indices.data(), indices.size_bytes(), *first_index * sizeof(u32)
+        );
+        if (index_upload.has_err())
+            return index_upload.err();
+        if (!lod_indices.empty()) {
+            const auto lod_upload = uploads.upload_buffer(
+                engine, m_index_buffer, lod_indices.data(), lod_indices.size_bytes(), (*first_index + indices.size()) * sizeof(u32)
+            );
+            if (lod_upload.has_err())
+                return lod_upload.err();
+        }
+
+        if (model.vertex_format == VertexFormat::Packed) {
+            const auto packed = pack_vertices(vertices);
+            const auto vertex_upload = uploads.upload_buffer(
+                engine, m_vertex_buffers[format], packed.data(), packed.size() * sizeof(PackedVertex), *first_vertex * sizeof(PackedVertex)
+            );
+            if (vertex_upload.has_err())
+                return vertex_upload.err();
+
+            std::vector<glm::u16vec4> positions(packed.size());
+            std::ranges::transform(packed, positions.begin(), [](const PackedVertex& vertex) { return vertex.position; });
+            const auto position_upload = uploads.upload_buffer(
+                engine, m_position_buffers[format], positions.data(), positions.size() * sizeof(glm::u16vec4),
+                *first_vertex * sizeof(glm::u16vec4)
+            );
+            if (position_upload.has_err())
+                return position_upload.err();
+        } else {
+            const auto vertex_upload = uploads.upload_buffer(
+                engine, m_vertex_buffers[format], vertices.data(), vertices.size_bytes(), *first_vertex * sizeof(Vertex)
+            );
+            if (vertex_upload.has_err())
+                return vertex_upload.err();
+
+            std::vector<glm::vec3> positions(vertices.size());
+            std::ranges::transform(vertices, positions.begin(), [](const Vertex& vertex) { return vertex.position; });
+            const auto position_upload = uploads.upload_buffer(
+                engine, m_position_buffers[format], positions.data(), positions.size() * sizeof(glm::vec3),
+                *first_vertex * sizeof(glm::vec3)
+            );
+            if (position_upload.has_err())
+                return position_upload.err();
+        }
+        return ok();
+    };
+    const auto upload_result = upload();
+    if (upload_result.has_err()) {
+        // Copies already recorded into the ranges land before those of whichever model takes them next
+        m_index_allocator.free(*first_index, index_count);
+        m_vertex_allocators[format].free(*first_vertex, vertices.size());
+        return upload_result.err();
+    }
+
+    model.first_index = to_u32(*first_index);
+    model.index_count = to_u32(index_count);
+    model.lods[0] = {model.first_index, to_u32(indices.size()), 0.0f};
+    for (usize i = 0; i < lods.size(); ++i) {
+        ASSERT(usize{lods[i].first_index} + lods[i].index_count <= lod_indices.size());
+        model.lods[i + 1] = {to_u32(*first_index + indices.size()) + lods[i].first_index, lods[i].index_count, lods[i].error};
+    }
+    model.lod_count = to_u32(lods.size()) + 1;
+    model.first_vertex = to_u32(*first_vertex);
+    model.vertex_count = to_u32(vertices.size());
+    model.aabb = compute_aabb(vertices);
+    model.bounds = compute_bounding_sphere(vertices, model.aabb);
+    model.uv_density = compute_uv_density(indices, vertices);
+    model.roughness = roughness;
+    model.metalness = metalness;
+
+    ASSERT(model.index_count > 0);
+    return ok();
+}
+
+Result<void> PbrRenderer::update_streaming(const Engine& engine, UploadQueue& uploads, const DefaultPipeline& pipeline) {
+    Result<void> result = ok();
+
+    const auto pressure = get_memory_pressure(engine);
+    // The budget only drops once the evicted image is freed, so one eviction is waited out before the next
+    if (pressure == MemoryPressure::Evict && engine.deletions->completed_serial() >= m_eviction_serial) {
+        u32 largest = UINT32_MAX;
+        vk::DeviceSize largest_texels = 0;
+        for (u32 i = 0; i < m_textures.slot_count(); ++i) {
+            if (!m_textures.is_live(i) || !can_evict_mip(m_textures.handle_at(i)))
+                continue;
+            const auto& texture = m_textures.at(i);
+            const vk::DeviceSize texels = static_cast<vk::DeviceSize>(texture.extent.width) * texture.extent.height;
+            if (texels > largest_texels) {
+                largest = i;
+                largest_texels = texels;
+            }
+        }
+        if (largest != UINT32_MAX && evict_texture_mip(engine, uploads, m_textures.handle_at(largest)))
+            m_eviction_serial = engine.deletions->next_serial();
+    }
+
+    // Meshes are comparatively small, so only textures are held back until memory frees up
+    const bool hold_textures = pressure != MemoryPressure::None;
+    std::erase_if(m_pending_textures, [&](PendingTexture<ImageData>& pending) {
+        if (hold_textures || !is_ready(pending.data))
+            return false;
+
+        const auto data = pending.data.get();
+        if (data.has_err()) {
+            m_textures[pending.texture].error = data.err();
+            return true;
+        }
+        const auto written = write_texture(engine, uploads, pending.texture, {
+            data->pixels.get(), 4, {to_u32(data->width), to_u32(data->height), 1}
+        }, vk::Format::eR8G8B8A8Srgb);
+        if (written.has_err())
+            m_textures[pending.texture].error = written.err();
+        return true;
     });
-    const auto vertex_buffer = GpuBuffer::create(engine, {
-        data.vertices.size() * sizeof(data.vertices[0]),
-        vk::BufferUsageFlagBits::eVertexBuffer | vk::BufferUsageFlagBits::eTransferDst
+
+    std::erase_if(m_pending_compressed_textures, [&](PendingTexture<CompressedImage>& pending) {
+        if (hold_textures || !is_ready(pending.data))
+            return false;
+
+        const auto data = pending.data.get();
+        if (data.has_err()) {
+            m_textures[pending.texture].error = data.err();
+            return true;
+        }
+        if (!is_format_sampleable(engine, data->format)) {
+            m_textures[pending.texture].error = Err::ImageFormatUnsupported;
+            return true;
+        }
+        const auto written = write_compressed_texture(engine, uploads, pending.texture, *data);
+        if (written.has_err())
+            m_textures[pending.texture].error = written.err();
+        return true;
     });
 
-    index_buffer.write(engine, data.indices.data(), data.indices.size() * sizeof(data.indices[0]), 0);
-    vertex_buffer.write(engine, data.vertices.data(), data.vertices.size() * sizeof(data.vertices[0]), 0);
+    // Only the small levels are uploaded at first, so these aren't held back
+    std::erase_if(m_pending_streamed_textures, [&](PendingTexture<CompressedImage>& pending) {
+        if (!is_ready(pending.data))
+            return false;
+
+        auto data = pending.data.get();
+        if (data.has_err()) {
+            m_textures[pending.texture].error = data.err();
+            return true;
+        }
+        if (!is_format_sampleable(engine, data->format)) {
+            m_textures[pending.texture].error = Err::ImageFormatUnsupported;
+            return true;
+        }
+        const auto written = write_streamed_texture(engine, uploads, pending.texture, std::move(*data));
+        if (written.has_err())
+            m_textures[pending.texture].error = written.err();
+        return true;
+    });
 
-    ASSERT(data.indices.size() > 0);
-    ASSERT(index_buffer.allocation != nullptr);
-    ASSERT(index_buffer.buffer != nullptr);
-    ASSERT(vertex_buffer.allocation != nullptr);
-    ASSERT(vertex_buffer.buffer != nullptr);
-    m_models.emplace_back(
-        to_u32(data.indices.size()),
-        index_buffer, vertex_buffer,
-        normal_map, texture,
-        roughness, metalness
-    );
-    return {m_models.size() - 1};
+    update_uv_per_pixel(pipeline);
+    vk::DeviceSize stream_budget = StreamedBytesPerFrame;
+    for (auto& streamed : m_streamed_textures) {
+        const auto& source = streamed.source.levels[0];
+        const f32 texels_per_pixel = m_uv_per_pixel[streamed.texture.index] * static_cast<f32>(std::max(source.width, source.height));
+        u32 wanted = streamed.base_level;
+        if (std::isfinite(texels_per_pixel))
+            wanted = std::min(texels_per_pixel <= 1.0f ? 0 : static_cast<u32>(std::log2(texels_per_pixel)), streamed.base_level);
+
+        if (streamed.loaded_level == 0 && wanted < streamed.top_level && pressure == MemoryPressure::None && stream_budget > 0) {
+            // Running out of memory only means the texture waits for the pressure to be noticed and relieved
+            const auto grown = grow_streamed_texture(engine, uploads, streamed, wanted);
+            if (grown.has_err() && grown.err() != Err::OutOfGpuMemory && !result.has_err())
+                result = grown.err();
+        }
+        while (streamed.loaded_level > 0 && stream_budget > 0) {
+            const auto uploaded = upload_streamed_level(engine, uploads, streamed);
+            if (uploaded.has_err()) {
+                if (!result.has_err())
+                    result = uploaded.err();
+                break;
+            }
+            stream_budget -= std::min(stream_budget, *uploaded);
+        }
+
+        // Dropped a level at a time, so a model that briefly leaves the queue doesn't lose all its detail
+        if (wanted <= streamed.top_level) {
+            streamed.idle_frames = 0;
+        } else if (++streamed.idle_frames >= StreamedIdleFrames) {
+            streamed.idle_frames = 0;
+            evict_texture_mip(engine, uploads, streamed.texture);
+        }
+    }
+
+    std::erase_if(m_pending_models, [&](PendingModel<ModelData>& pending) {
+        if (!is_ready(pending.data))
+            return false;
+
+        const auto data = pending.data.get();
+        if (data.has_err()) {
+            m_models[pending.model].error = data.err();
+            return true;
+        }
+        const auto write_result = write_model(
+            engine, uploads, pending.model, data->mesh.indices, data->mesh.lod_indices, data->mesh.lods, data->mesh.vertices,
+            data->roughness, data->metalness
+        );
+        if (write_result.has_err())
+            m_models[pending.model].error = write_result.err();
+        return true;
+    });
+
+    std::erase_if(m_pending_baked_models, [&](PendingModel<BakedModel>& pending) {
+        if (!is_ready(pending.data))
+            return false;
+
+        const auto data = pending.data.get();
+        if (data.has_err()) {
+            m_models[pending.model].error = data.err();
+            return true;
+        }
+        const auto write_result = write_model(
+            engine, uploads, pending.model, data->indices, data->lod_indices, data->lods, data->vertices,
+            data->roughness, data->metalness
+        );
+        if (write_result.has_err())
+            m_models[pending.model].error = write_result.err();
+        return true;
+    });
+
+    return result;
 }
 
 } // namespace hg
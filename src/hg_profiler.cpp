@@ -0,0 +1,228 @@
+#include "hg_profiler.h"
+#include "hg_vulkan_engine.h"
+
+#include <fstream>
+
+namespace hg {
+
+namespace {
+
+struct ThreadRegistration {
+    const void* owner = nullptr;
+    void* events = nullptr;
+};
+
+thread_local ThreadRegistration t_registration = {};
+
+} // namespace
+
+Profiler::ThreadEvents& Profiler::thread_events() {
+    if (t_registration.owner == this)
+        return *static_cast<ThreadEvents*>(t_registration.events);
+
+    const std::lock_guard lock{m_threads_mutex};
+    auto& events = m_threads.emplace_back(std::make_unique<ThreadEvents>());
+    events->thread = to_u32(m_threads.size() - 1);
+    t_registration = {this, events.get()};
+    return *events;
+}
+
+void Profiler::begin_cpu_scope(const char* name) {
+    ASSERT(name != nullptr);
+
+    auto& events = thread_events();
+    ASSERT(events.depth < MaxDepth);
+    events.open[events.depth++] = {name, now_ns()};
+}
+
+void Profiler::end_cpu_scope() {
+    const u64 end = now_ns();
+    auto& events = thread_events();
+    ASSERT(events.depth > 0);
+
+    const auto& open = events.open[--events.depth];
+    const u64 written = events.written.load(std::memory_order_relaxed);
+    // A slot is only reused once the collector has released it, so it is never written while being copied
+    if (written - events.read.load(std::memory_order_acquire) >= ThreadCapacity)
+        return;
+    events.scopes[written % ThreadCapacity] = {
+        .name = open.name,
+        .begin_ns = open.begin_ns,
+        .end_ns = end,
+        .thread = events.thread,
+        .depth = events.depth,
+    };
+    events.written.store(written + 1, std::memory_order_release);
+}
+
+void Profiler::next_frame() {
+    const u64 end = now_ns();
+    FrameStats stats = {.frame = m_frame, .begin_ns = m_frame_begin_ns, .end_ns = end};
+
+    {
+        const std::lock_guard lock{m_threads_mutex};
+        for (const auto& events : m_threads) {
+            const u64 written = events->written.load(std::memory_order_acquire);
+            for (u64 i = events->read.load(std::memory_order_relaxed); i < written; ++i) {
+                stats.cpu_scopes.push_back(events->scopes[i % ThreadCapacity]);
+            }
+            events->read.store(written, std::memory_order_release);
+        }
+    }
+
+    m_history.push_back(std::move(stats));
+    if (m_history.size() > FrameHistory)
+        m_history.pop_front();
+
+    ++m_frame;
+    m_frame_begin_ns = end;
+}
+
+void Profiler::add_gpu_scopes(const u64 frame, const std::span<const ProfileScope> scopes) {
+    const auto stats = std::ranges::find_if(m_history, [frame](const FrameStats& s) { return s.frame == frame; });
+    if (stats == m_history.end())
+        return;
+    stats->gpu_scopes.assign(scopes.begin(), scopes.end());
+}
+
+Result<void> Profiler::export_chrome_trace(const std::filesystem::path& path) const {
+    ASSERT(!path.empty());
+
+    std::ofstream file{path, std::ios::trunc};
+    if (!file.is_open())
+        return Err::CouldNotWriteTraceFile;
+
+    // Chrome traces are in microseconds, gpu scopes are placed at the start of their cpu frame on their own process
+    const auto write_event = [&](const ProfileScope& scope, const u64 base_ns, const u32 pid, bool& first) {
+        file << std::format(
+            "{}{{\"name\":\"{}\",\"ph\":\"X\",\"ts\":{:.3f},\"dur\":{:.3f},\"pid\":{},\"tid\":{}}}",
+            first ? "" : ",\n",
+            escape_json(scope.name),
+            static_cast<f64>(base_ns + scope.begin_ns) / 1000.0,
+            static_cast<f64>(scope.end_ns - scope.begin_ns) / 1000.0,
+            pid,
+            scope.thread
+        );
+        first = false;
+    };
+
+    bool first = true;
+    file << "{\"traceEvents\":[\n";
+    for (const auto& stats : m_history) {
+        for (const auto& scope : stats.cpu_scopes) {
+            write_event(scope, 0, 0, first);
+        }
+        for (const auto& scope : stats.gpu_scopes) {
+            write_event(scope, stats.begin_ns, 1, first);
+        }
+    }
+    file << "\n]}\n";
+
+    if (!file.good())
+        return Err::CouldNotWriteTraceFile;
+    return ok();
+}
+
+Result<GpuProfiler> GpuProfiler::create(const Engine& engine) {
+    ASSERT(engine.gpu != nullptr);
+    ASSERT(engine.device != nullptr);
+
+    auto profiler = ok<GpuProfiler>();
+
+    const auto properties = engine.gpu.getProperties();
+    const auto families = engine.gpu.getQueueFamilyProperties();
+    ASSERT(engine.queue_family_index < families.size());
+    const u32 valid_bits = families[engine.queue_family_index].timestampValidBits;
+    if (properties.limits.timestampComputeAndGraphics != vk::True || valid_bits == 0)
+        return profiler;
+
+    profiler->m_period_ns = properties.limits.timestampPeriod;
+    profiler->m_valid_mask = valid_bits >= 64 ? UINT64_MAX : (u64{1} << valid_bits) - 1;
+
+    for (auto& pool : profiler->m_pools) {
+        const auto new_pool = engine.device.createQueryPool({
+            .queryType = vk::QueryType::eTimestamp,
+            .queryCount = MaxScopes * 2,
+        });
+        if (new_pool.result != vk::Result::eSuccess)
+            return Err::CouldNotCreateVkQueryPool;
+        pool = new_pool.value;
+    }
+
+    for (const auto pool : profiler->m_pools) {
+        ASSERT(pool != nullptr);
+    }
+    return profiler;
+}
+
+void GpuProfiler::destroy(const Engine& engine) const {
+    ASSERT(engine.device != nullptr);
+
+    for (const auto pool : m_pools) {
+        if (pool != nullptr)
+            engine.device.destroyQueryPool(pool);
+    }
+}
+
+void GpuProfiler::cmd_begin_frame(const Engine& engine, const vk::CommandBuffer cmd, const u32 frame_index) {
+    ASSERT(cmd != nullptr);
+    ASSERT(frame_index < MaxFramesInFlight);
+    ASSERT(m_depth == 0);
+
+    m_frame_index = frame_index;
+    if (!is_supported())
+        return;
+
+    auto& frame = m_frames[frame_index];
+    if (!frame.scopes.empty()) {
+        const usize query_count = frame.scopes.size() * 2;
+        std::vector<u64> timestamps(query_count);
+        const auto result = engine.device.getQueryPoolResults(
+            m_pools[frame_index], 0, to_u32(query_count), timestamps.size() * sizeof(u64), timestamps.data(),
+            sizeof(u64), vk::QueryResultFlagBits::e64
+        );
+        if (result == vk::Result::eSuccess) {
+            const u64 origin = timestamps[0] & m_valid_mask;
+            const auto to_ns = [&](const u64 timestamp) {
+                return static_cast<u64>(static_cast<f64>((timestamp & m_valid_mask) - origin) * m_period_ns);
+            };
+            for (usize i = 0; i < frame.scopes.size(); ++i) {
+                frame.scopes[i].begin_ns = to_ns(timestamps[i * 2]);
+                frame.scopes[i].end_ns = to_ns(timestamps[i * 2 + 1]);
+            }
+            g_profiler.add_gpu_scopes(frame.frame, frame.scopes);
+        }
+    }
+
+    frame.frame = g_profiler.frame();
+    frame.scopes.clear();
+    cmd.resetQueryPool(m_pools[frame_index], 0, MaxScopes * 2);
+}
+
+u32 GpuProfiler::cmd_begin_scope(const vk::CommandBuffer cmd, const char* name) {
+    ASSERT(cmd != nullptr);
+    ASSERT(name != nullptr);
+
+    auto& frame = m_frames[m_frame_index];
+    if (!is_supported() || frame.scopes.size() >= MaxScopes)
+        return InvalidScope;
+
+    const u32 scope = to_u32(frame.scopes.size());
+    frame.scopes.push_back({.name = name, .depth = m_depth++});
+    cmd.writeTimestamp2(vk::PipelineStageFlagBits2::eTopOfPipe, m_pools[m_frame_index], scope * 2);
+    return scope;
+}
+
+void GpuProfiler::cmd_end_scope(const vk::CommandBuffer cmd, const u32 scope) {
+    ASSERT(cmd != nullptr);
+
+    if (scope == InvalidScope)
+        return;
+    ASSERT(scope < m_frames[m_frame_index].scopes.size());
+    ASSERT(m_depth > 0);
+
+    --m_depth;
+    cmd.writeTimestamp2(vk::PipelineStageFlagBits2::eAllCommands, m_pools[m_frame_index], scope * 2 + 1);
+}
+
+} // namespace hg
@@ -0,0 +1,44 @@
+#include "hg_threads.h"
+
+#include "hg_utils.h"
+
+#include <mutex>
+
+namespace hg {
+
+ThreadPool::ThreadPool(const usize thread_count) {
+    ASSERT(thread_count > 0);
+
+    m_threads.reserve(thread_count);
+    for (usize i = 0; i < thread_count; ++i) {
+        m_threads.emplace_back([this] { work(); });
+    }
+}
+
+ThreadPool::~ThreadPool() {
+    {
+        const std::lock_guard lock{m_mutex};
+        m_stopping = true;
+    }
+    m_job_available.notify_all();
+    for (auto& thread : m_threads) {
+        thread.join();
+    }
+}
+
+void ThreadPool::work() {
+    while (true) {
+        std::function<void()> job = {};
+        {
+            std::unique_lock lock{m_mutex};
+            m_job_available.wait(lock, [this] { return m_stopping || !m_jobs.empty(); });
+            if (m_jobs.empty())
+                return;
+            job = std::move(m_jobs.front());
+            m_jobs.pop_front();
+        }
+        job();
+    }
+}
+
+} // namespace hg
@@ -0,0 +1,771 @@
+#include "hg_upload_queue.h"
+
+#include "hg_pch.h"
+#include "hg_utils.h"
+#include "hg_vulkan_engine.h"
+
+#include <algorithm>
+#include <cstring>
+
+namespace hg {
+
+static constexpr vk::DeviceSize align_up(const vk::DeviceSize value, const vk::DeviceSize alignment) {
+    return (value + alignment - 1) / alignment * alignment;
+}
+
+static Result<vk::CommandPool> create_upload_pool(const Engine& engine, const u32 queue_family) {
+    const auto pool = engine.device.createCommandPool({
+        .flags = vk::CommandPoolCreateFlagBits::eTransient | vk::CommandPoolCreateFlagBits::eResetCommandBuffer,
+        .queueFamilyIndex = queue_family,
+    });
+    if (pool.result != vk::Result::eSuccess)
+        return Err::CouldNotCreateVkCommandPool;
+    return ok(pool.value);
+}
+
+Result<UploadQueue> UploadQueue::create(const Engine& engine, const Config& config) {
+    ASSERT(engine.device != nullptr);
+    ASSERT(engine.queue_family_index != UINT32_MAX);
+    ASSERT(engine.transfer_queue_family_index != UINT32_MAX);
+    ASSERT(config.staging_size > 0);
+
+    auto queue = ok<UploadQueue>();
+
+    queue->m_graphics_family = engine.queue_family_index;
+    queue->m_transfer_family = config.use_transfer_queue ? engine.transfer_queue_family_index : engine.queue_family_index;
+    queue->m_transfer_queue = config.use_transfer_queue ? engine.transfer_queue : engine.queue;
+
+    const auto graphics_pool = create_upload_pool(engine, queue->m_graphics_family);
+    if (graphics_pool.has_err())
+        return graphics_pool.err();
+    queue->m_graphics.pool = *graphics_pool;
+    queue->m_release.pool = *graphics_pool;
+
+    if (queue->uses_transfer_queue()) {
+        const auto transfer_pool = create_upload_pool(engine, queue->m_transfer_family);
+        if (transfer_pool.has_err())
+            return transfer_pool.err();
+        queue->m_transfer.pool = *transfer_pool;
+    }
+
+    vk::SemaphoreTypeCreateInfo timeline_info = {
+        .semaphoreType = vk::SemaphoreType::eTimeline,
+        .initialValue = 0,
+    };
+    const auto timeline = engine.device.createSemaphore({.pNext = &timeline_info});
+    if (timeline.result != vk::Result::eSuccess)
+        return Err::CouldNotCreateVkSemaphore;
+    queue->m_timeline = timeline.value;
+
+    if (queue->uses_transfer_queue()) {
+        const auto transfer_timeline = engine.device.createSemaphore({.pNext = &timeline_info});
+        if (transfer_timeline.result != vk::Result::eSuccess)
+            return Err::CouldNotCreateVkSemaphore;
+        queue->m_transfer_timeline = transfer_timeline.value;
+    }
+
+    queue->m_staging_size = align_up(config.staging_size, StagingAlignment);
+    const auto staging = GpuBuffer::create_result(engine, {
+        queue->m_staging_size, vk::BufferUsageFlagBits::eTransferSrc, GpuBuffer::Mapped
+    });
+    if (staging.has_err())
+        return staging.err();
+    queue->m_staging = *staging;
+
+    ASSERT(queue->m_graphics.pool != nullptr);
+    if (queue->uses_transfer_queue())
+        ASSERT(queue->m_transfer.pool != nullptr);
+    ASSERT(queue->m_transfer_queue != nullptr);
+    ASSERT(queue->m_timeline != nullptr);
+    if (queue->uses_transfer_queue())
+        ASSERT(queue->m_transfer_timeline != nullptr);
+    ASSERT(queue->m_staging.mapped != nullptr);
+    return queue;
+}
+
+void UploadQueue::destroy(const Engine& engine) const {
+    ASSERT(engine.device != nullptr);
+    ASSERT(m_batch_empty);
+
+    const auto wait_result = wait(engine, m_last_submitted);
+    if (wait_result.has_err())
+        ERROR("Could not wait for uploads to finish");
+
+    for (const auto& batch : m_in_flight) {
+        for (const auto& buffer : batch.dedicated_staging) {
+            buffer.destroy(engine);
+        }
+    }
+    m_staging.destroy(engine);
+
+    ASSERT(m_timeline != nullptr);
+    engine.device.destroySemaphore(m_timeline);
+    if (m_transfer_timeline != nullptr)
+        engine.device.destroySemaphore(m_transfer_timeline);
+
+    if (m_transfer.pool != nullptr)
+        engine.device.destroyCommandPool(m_transfer.pool);
+    ASSERT(m_graphics.pool != nullptr);
+    engine.device.destroyCommandPool(m_graphics.pool);
+}
+
+Result<vk::CommandBuffer> UploadQueue::begin_stream(const Engine& engine, Stream& stream) {
+    ASSERT(engine.device != nullptr);
+    ASSERT(stream.pool != nullptr);
+
+    if (stream.cmd != nullptr)
+        return ok(stream.cmd);
+
+    vk::CommandBuffer cmd = {};
+    if (stream.free_cmds.empty()) {
+        const vk::CommandBufferAllocateInfo alloc_info = {
+            .commandPool = stream.pool,
+            .commandBufferCount = 1,
+        };
+        const auto cmd_result = engine.device.allocateCommandBuffers(&alloc_info, &cmd);
+        if (cmd_result != vk::Result::eSuccess)
+            return Err::CouldNotAllocateVkCommandBuffers;
+    } else {
+        cmd = stream.free_cmds.back();
+        stream.free_cmds.pop_back();
+    }
+
+    const auto begin_result = cmd.begin({.flags = vk::CommandBufferUsageFlagBits::eOneTimeSubmit});
+    if (begin_result != vk::Result::eSuccess)
+        return Err::CouldNotBeginVkCommandBuffer;
+
+    stream.cmd = cmd;
+    m_batch_empty = false;
+
+    ASSERT(stream.cmd != nullptr);
+    return ok(stream.cmd);
+}
+
+Result<vk::CommandBuffer> UploadQueue::cmd_graphics(const Engine& engine) {
+    return begin_stream(engine, m_graphics);
+}
+
+Result<vk::CommandBuffer> UploadQueue::cmd_transfer(const Engine& engine) {
+    if (!uses_transfer_queue())
+        return cmd_graphics(engine);
+    return begin_stream(engine, m_transfer);
+}
+
+Result<void> UploadQueue::acquire_for_transfer(const Engine& engine, const vk::CommandBuffer cmd, const vk::Buffer buffer) {
+    ASSERT(uses_transfer_queue());
+    ASSERT(cmd != nullptr);
+    ASSERT(buffer != nullptr);
+
+    if (std::ranges::find(m_batch_buffers, buffer) != m_batch_buffers.end())
+        return ok();
+    m_batch_buffers.push_back(buffer);
+    if (!m_graphics_buffers.contains(buffer))
+        return ok();
+
+    // Ownership moves with the whole buffer, so the rest of an arena keeps its contents
+    const auto release_cmd = begin_stream(engine, m_release);
+    if (release_cmd.has_err())
+        return release_cmd.err();
+
+    vk::BufferMemoryBarrier2 ownership = {
+        .srcStageMask = vk::PipelineStageFlagBits2::eAllCommands,
+        .srcAccessMask = vk::AccessFlagBits2::eMemoryWrite,
+        .srcQueueFamilyIndex = m_graphics_family,
+        .dstQueueFamilyIndex = m_transfer_family,
+        .buffer = buffer,
+        .offset = 0,
+        .size = vk::WholeSize,
+    };
+    BarrierBuilder(*release_cmd).add_buffer_barrier(ownership).build_and_run();
+
+    ownership.srcStageMask = vk::PipelineStageFlagBits2::eNone;
+    ownership.srcAccessMask = vk::AccessFlagBits2::eNone;
+    ownership.dstStageMask = vk::PipelineStageFlagBits2::eTransfer;
+    ownership.dstAccessMask = vk::AccessFlagBits2::eTransferWrite;
+    BarrierBuilder(cmd).add_buffer_barrier(ownership).build_and_run();
+    return ok();
+}
+
+Result<vk::DeviceSize> UploadQueue::alloc_staging(const Engine& engine, const vk::DeviceSize size) {
+    ASSERT(size > 0);
+    ASSERT(size <= m_staging_size);
+
+    while (true) {
+        retire_completed(engine);
+        if (m_used == 0) {
+            m_head = 0;
+            m_tail = 0;
+        }
+
+        // Free space is [head, end) and [0, tail) when head is ahead of tail, and [head, tail) once it has wrapped
+        std::optional<vk::DeviceSize> offset = std::nullopt;
+        vk::DeviceSize wasted = 0;
+        if (m_used == 0 || m_head > m_tail) {
+            if (m_staging_size - m_head >= size) {
+                offset = m_head;
+            } else if (m_tail >= size) {
+                offset = 0;
+                wasted = m_staging_size - m_head;
+            }
+        } else if (m_tail - m_head >= size) {
+            offset = m_head;
+        }
+
+        if (offset.has_value()) {
+            m_used += size + wasted;
+            m_batch_bytes += size + wasted;
+            m_head = *offset + size;
+            return ok(*offset);
+        }
+
+        if (m_in_flight.empty()) {
+            const auto flush_result = flush(engine);
+            if (flush_result.has_err())
+                return flush_result.err();
+        }
+        const auto retire_result = retire_oldest(engine);
+        if (retire_result.has_err())
+            return retire_result.err();
+    }
+}
+
+Result<u8*> UploadQueue::reserve_staging(
+    const Engine& engine, const vk::DeviceSize size, vk::Buffer& out_buffer, vk::DeviceSize& out_offset
+) {
+    ASSERT(size > 0);
+
+    const vk::DeviceSize aligned_size = align_up(size, StagingAlignment);
+    if (aligned_size > m_staging_size) {
+        const auto dedicated = GpuBuffer::create_result(engine, {size, vk::BufferUsageFlagBits::eTransferSrc, GpuBuffer::Mapped});
+        if (dedicated.has_err())
+            return dedicated.err();
+        m_batch_dedicated.emplace_back(*dedicated);
+        m_staged_bytes += size;
+
+        out_buffer = dedicated->buffer;
+        out_offset = 0;
+        return ok(static_cast<u8*>(dedicated->mapped));
+    }
+
+    const auto offset = alloc_staging(engine, aligned_size);
+    if (offset.has_err())
+        return offset.err();
+
+    m_staged_bytes += size;
+    out_buffer = m_staging.buffer;
+    out_offset = *offset;
+    return ok(static_cast<u8*>(m_staging.mapped) + *offset);
+}
+
+Result<void> UploadQueue::stage(
+    const Engine& engine, const void* data, const vk::DeviceSize size, vk::Buffer& out_buffer, vk::DeviceSize& out_offset
+) {
+    ASSERT(data != nullptr);
+    ASSERT(size > 0);
+
+    const auto staging = reserve_staging(engine, size, out_buffer, out_offset);
+    if (staging.has_err())
+        return staging.err();
+    std::memcpy(*staging, data, size);
+    return ok();
+}
+
+Result<UploadQueue::Token> UploadQueue::upload_buffer(
+    const Engine& engine, const GpuBuffer& dst, const void* data, const vk::DeviceSize size, const vk::DeviceSize offset
+) {
+    ASSERT(dst.buffer != nullptr);
+    ASSERT(data != nullptr);
+    ASSERT(size > 0);
+
+    if (dst.memory_type != GpuBuffer::DeviceLocal) {
+        const auto write_result = dst.write_result(engine, data, size, offset);
+        if (write_result.has_err())
+            return write_result.err();
+        return ok(m_last_submitted);
+    }
+
+    vk::Buffer staging_buffer = {};
+    vk::DeviceSize staging_offset = 0;
+    const auto stage_result = stage(engine, data, size, staging_buffer, staging_offset);
+    if (stage_result.has_err())
+        return stage_result.err();
+
+    const auto cmd = cmd_transfer(engine);
+    if (cmd.has_err())
+        return cmd.err();
+    // The buffer is handed back to the main queue once for the whole batch, in flush
+    if (uses_transfer_queue()) {
+        const auto acquire_result = acquire_for_transfer(engine, *cmd, dst.buffer);
+        if (acquire_result.has_err())
+            return acquire_result.err();
+    }
+    cmd->copyBuffer(staging_buffer, dst.buffer, {vk::BufferCopy(staging_offset, offset, size)});
+
+    return ok(m_batch_token);
+}
+
+Result<UploadQueue::Token> UploadQueue::upload_image(
+    const Engine& engine, const vk::Image dst, const GpuImage::Data& data, const vk::ImageLayout final_layout,
+    const vk::ImageSubresourceRange& subresource
+) {
+    ASSERT(dst != nullptr);
+    ASSERT(data.ptr != nullptr);
+    ASSERT(data.alignment > 0);
+    ASSERT(data.extent.width > 0);
+    ASSERT(data.extent.height > 0);
+    ASSERT(data.extent.depth > 0);
+    ASSERT(final_layout != vk::ImageLayout::eUndefined);
+
+    const vk::DeviceSize size = data.extent.width * data.extent.height * data.extent.depth * data.alignment;
+
+    vk::Buffer staging_buffer = {};
+    vk::DeviceSize staging_offset = 0;
+    const auto stage_result = stage(engine, data.ptr, size, staging_buffer, staging_offset);
+    if (stage_result.has_err())
+        return stage_result.err();
+
+    return copy_staged_image(engine, dst, staging_buffer, staging_offset, data.extent, final_layout, subresource);
+}
+
+Result<UploadQueue::Token> UploadQueue::copy_staged_image(
+    const Engine& engine, const vk::Image dst, const vk::Buffer staging_buffer, const vk::DeviceSize staging_offset,
+    const vk::Extent3D extent, const vk::ImageLayout final_layout, const vk::ImageSubresourceRange& subresource
+) {
+    ASSERT(dst != nullptr);
+    ASSERT(staging_buffer != nullptr);
+    ASSERT(extent.width > 0 && extent.height > 0 && extent.depth > 0);
+    ASSERT(final_layout != vk::ImageLayout::eUndefined);
+
+    const auto cmd = cmd_transfer(engine);
+    if (cmd.has_err())
+        return cmd.err();
+
+    BarrierBuilder(*cmd)
+        .add_image_barrier(dst, subresource)
+        .set_image_dst(vk::PipelineStageFlagBits2::eTransfer, vk::AccessFlagBits2::eTransferWrite, vk::ImageLayout::eTransferDstOptimal)
+        .build_and_run();
+
+    const vk::BufferImageCopy2 copy_region = {
+        .bufferOffset = staging_offset,
+        .imageSubresource = {subresource.aspectMask, 0, 0, 1},
+        .imageExtent = extent,
+    };
+    cmd->copyBufferToImage2({
+        .srcBuffer = staging_buffer,
+        .dstImage = dst,
+        .dstImageLayout = vk::ImageLayout::eTransferDstOptimal,
+        .regionCount = 1,
+        .pRegions = &copy_region,
+    });
+
+    return finish_image_upload(engine, *cmd, dst, subresource, final_layout);
+}
+
+Result<UploadQueue::Token> UploadQueue::upload_image_levels(
+    const Engine& engine, const vk::Image dst, const std::span<const ImageLevel> levels, const vk::ImageLayout final_layout,
+    const vk::ImageAspectFlags aspect, const u32 first_level
+) {
+    ASSERT(dst != nullptr);
+    ASSERT(!levels.empty());
+    ASSERT(final_layout != vk::ImageLayout::eUndefined);
+
+    // Levels share one staging allocation, so they can't be split across batches by the ring filling up
+    vk::DeviceSize staging_size = 0;
+    for (const auto& level : levels) {
+        ASSERT(level.data != nullptr);
+        ASSERT(level.size > 0);
+        ASSERT(level.extent.width > 0 && level.extent.height > 0 && level.extent.depth > 0);
+        staging_size = align_up(staging_size, StagingAlignment) + level.size;
+    }
+
+    vk::Buffer staging_buffer = {};
+    vk::DeviceSize staging_offset = 0;
+    const auto staging = reserve_staging(engine, staging_size, staging_buffer, staging_offset);
+    if (staging.has_err())
+        return staging.err();
+
+    std::vector<vk::BufferImageCopy2> regions(levels.size());
+    vk::DeviceSize level_offset = 0;
+    for (u32 level = 0; level < levels.size(); ++level) {
+        level_offset = align_up(level_offset, StagingAlignment);
+        std::memcpy(*staging + level_offset, levels[level].data, levels[level].size);
+        regions[level] = {
+            .bufferOffset = staging_offset + level_offset,
+            .imageSubresource = {aspect, first_level + level, 0, 1},
+            .imageExtent = levels[level].extent,
+        };
+        level_offset += levels[level].size;
+    }
+
+    const auto cmd = cmd_transfer(engine);
+    if (cmd.has_err())
+        return cmd.err();
+
+    const vk::ImageSubresourceRange subresource = {aspect, first_level, to_u32(levels.size()), 0, 1};
+    BarrierBuilder(*cmd)
+        .add_image_barrier(dst, subresource)
+        .set_image_dst(vk::PipelineStageFlagBits2::eTransfer, vk::AccessFlagBits2::eTransferWrite, vk::ImageLayout::eTransferDstOptimal)
+        .build_and_run();
+
+    cmd->copyBufferToImage2({
+        .srcBuffer = staging_buffer,
+        .dstImage = dst,
+        .dstImageLayout = vk::ImageLayout::eTransferDstOptimal,
+        .regionCount = to_u32(regions.size()),
+        .pRegions = regions.data(),
+    });
+
+    return finish_image_upload(engine, *cmd, dst, subresource, final_layout);
+}
+
+Result<UploadQueue::Token> UploadQueue::finish_image_upload(
+    const Engine& engine, const vk::CommandBuffer cmd, const vk::Image dst, const vk::ImageSubresourceRange& subresource,
+    const vk::ImageLayout final_layout
+) {
+    ASSERT(cmd != nullptr);
+    ASSERT(dst != nullptr);
+
+    if (!uses_transfer_queue()) {
+        BarrierBuilder(cmd)
+            .add_image_barrier(dst, subresource)
+            .set_image_src(vk::PipelineStageFlagBits2::eTransfer, vk::AccessFlagBits2::eTransferWrite, vk::ImageLayout::eTransferDstOptimal)
+            .set_image_dst(vk::PipelineStageFlagBits2::eAllCommands, vk::AccessFlagBits2::eMemoryRead, final_layout)
+            .build_and_run();
+        return ok(m_batch_token);
+    }
+
+    const auto graphics_cmd = cmd_graphics(engine);
+    if (graphics_cmd.has_err())
+        return graphics_cmd.err();
+
+    vk::ImageMemoryBarrier2 ownership = {
+        .srcStageMask = vk::PipelineStageFlagBits2::eTransfer,
+        .srcAccessMask = vk::AccessFlagBits2::eTransferWrite,
+        .oldLayout = vk::ImageLayout::eTransferDstOptimal,
+        .newLayout = final_layout,
+        .srcQueueFamilyIndex = m_transfer_family,
+        .dstQueueFamilyIndex = m_graphics_family,
+        .image = dst,
+        .subresourceRange = subresource,
+    };
+    BarrierBuilder(cmd).add_image_barrier(ownership).build_and_run();
+
+    ownership.srcStageMask = vk::PipelineStageFlagBits2::eNone;
+    ownership.srcAccessMask = vk::AccessFlagBits2::eNone;
+    ownership.dstStageMask = vk::PipelineStageFlagBits2::eAllCommands;
+    ownership.dstAccessMask = vk::AccessFlagBits2::eMemoryRead;
+    BarrierBuilder(*graphics_cmd).add_image_barrier(ownership).build_and_run();
+
+    return ok(m_batch_token);
+}
+
+Result<UploadQueue::Token> UploadQueue::generate_mipmaps(
+    const Engine& engine, const vk::Image image, const u32 mip_levels, const vk::Extent3D extent, const vk::Format format,
+    const vk::ImageLayout current_layout, const vk::ImageLayout final_layout
+) {
+    ASSERT(engine.gpu != nullptr);
+    ASSERT(image != nullptr);
+    ASSERT(mip_levels > 1);
+    ASSERT(extent.width > 0);
+    ASSERT(extent.height > 0);
+    ASSERT(extent.depth > 0);
+    ASSERT(format != vk::Format::eUndefined);
+    ASSERT(final_layout != vk::ImageLayout::eUndefined);
+
+    const auto format_properties = engine.gpu.getFormatProperties(format);
+    if (!(format_properties.optimalTilingFeatures & vk::FormatFeatureFlagBits::eSampledImageFilterLinear))
+        return Err::CouldNotGenerateMipmaps;
+
+    // Blits need a graphics queue, so mipmaps are always recorded on the main queue's stream
+    const auto cmd = cmd_graphics(engine);
+    if (cmd.has_err())
+        return cmd.err();
+
+    cmd_generate_mipmaps(*cmd, image, mip_levels, extent, current_layout, final_layout);
+
+    return ok(m_batch_token);
+}
+
+Result<UploadQueue::Token> UploadQueue::copy_image_levels(
+    const Engine& engine, const vk::Image src, const vk::ImageLayout src_layout, const u32 src_first_level,
+    const vk::Image dst, const u32 dst_first_level, const u32 level_count, const vk::Extent3D dst_extent,
+    const vk::ImageLayout final_layout, const vk::ImageAspectFlags aspect
+) {
+    ASSERT(src != nullptr);
+    ASSERT(src_layout != vk::ImageLayout::eUndefined);
+    ASSERT(dst != nullptr);
+    ASSERT(level_count > 0);
+    ASSERT(dst_extent.width > 0);
+    ASSERT(dst_extent.height > 0);
+    ASSERT(dst_extent.depth > 0);
+    ASSERT(final_layout != vk::ImageLayout::eUndefined);
+
+    // The source is usually sampled by the main queue, so the copy stays on it rather than moving ownership twice
+    const auto cmd = cmd_graphics(engine);
+    if (cmd.has_err())
+        return cmd.err();
+
+    const vk::ImageSubresourceRange src_range = {aspect, src_first_level, level_count, 0, 1};
+    const vk::ImageSubresourceRange dst_range = {aspect, 0, dst_first_level + level_count, 0, 1};
+    BarrierBuilder(*cmd)
+        .add_image_barrier(src, src_range)
+        .set_image_src(vk::PipelineStageFlagBits2::eAllCommands, vk::AccessFlagBits2::eMemoryRead | vk::AccessFlagBits2::eMemoryWrite, src_layout)
+        .set_image_dst(vk::PipelineStageFlagBits2::eTransfer, vk::AccessFlagBits2::eTransferRead, vk::ImageLayout::eTransferSrcOptimal)
+        .add_image_barrier(dst, dst_range)
+        .set_image_src(vk::PipelineStageFlagBits2::eNone, vk::AccessFlagBits2::eNone, vk::ImageLayout::eUndefined)
+        .set_image_dst(vk::PipelineStageFlagBits2::eTransfer, vk::AccessFlagBits2::eTransferWrite, vk::ImageLayout::eTransferDstOptimal)
+        .build_and_run();
+
+    std::vector<vk::ImageCopy> regions = {};
+    regions.reserve(level_count);
+    vk::Extent3D extent = dst_extent;
+    for (u32 level = 0; level < level_count; ++level) {
+        regions.push_back({
+            .srcSubresource = {aspect, src_first_level + level, 0, 1},
+            .dstSubresource = {aspect, dst_first_level + level, 0, 1},
+            .extent = extent,
+        });
+        extent = {std::max(extent.width / 2, 1u), std::max(extent.height / 2, 1u), std::max(extent.depth / 2, 1u)};
+    }
+    cmd->copyImage(
+        src, vk::ImageLayout::eTransferSrcOptimal, dst, vk::ImageLayout::eTransferDstOptimal,
+        to_u32(regions.size()), regions.data()
+    );
+
+    BarrierBuilder(*cmd)
+        .add_image_barrier(dst, dst_range)
+        .set_image_src(vk::PipelineStageFlagBits2::eTransfer, vk::AccessFlagBits2::eTransferWrite, vk::ImageLayout::eTransferDstOptimal)
+        .set_image_dst(vk::PipelineStageFlagBits2::eAllCommands, vk::AccessFlagBits2::eMemoryRead, final_layout)
+        .build_and_run();
+
+    return ok(m_batch_token);
+}
+
+Result<UploadQueue::Token> UploadQueue::flush(const Engine& engine) {
+    ASSERT(engine.queue != nullptr);
+    ASSERT(m_transfer_queue != nullptr);
+    const CpuScope scope{"upload_flush"};
+
+    retire_completed(engine);
+    if (m_batch_empty)
+        return ok(m_last_submitted);
+
+    // Makes the batch visible to everything submitted to the main queue afterwards, without a cpu wait
+    const auto graphics_cmd = cmd_graphics(engine);
+    if (graphics_cmd.has_err())
+        return graphics_cmd.err();
+    BarrierBuilder(*graphics_cmd)
+        .add_memory_barrier({
+            .srcStageMask = vk::PipelineStageFlagBits2::eTransfer,
+            .srcAccessMask = vk::AccessFlagBits2::eTransferWrite,
+            .dstStageMask = vk::PipelineStageFlagBits2::eAllCommands,
+            .dstAccessMask = vk::AccessFlagBits2::eMemoryRead,
+        })
+        .build_and_run();
+
+    const Token token = m_batch_token;
+
+    if (m_release.cmd != nullptr) {
+        const auto end_result = m_release.cmd.end();
+        if (end_result != vk::Result::eSuccess)
+            return Err::CouldNotEndVkCommandBuffer;
+
+        const vk::CommandBufferSubmitInfo cmd_info = {.commandBuffer = m_release.cmd};
+        const vk::SemaphoreSubmitInfo signal_info = {
+            .semaphore = m_timeline,
+            .value = release_value(token),
+            .stageMask = vk::PipelineStageFlagBits2::eAllCommands,
+        };
+        const vk::SubmitInfo2 submit_info = {
+            .commandBufferInfoCount = 1,
+            .pCommandBufferInfos = &cmd_info,
+            .signalSemaphoreInfoCount = 1,
+            .pSignalSemaphoreInfos = &signal_info,
+        };
+        const auto submit_result = engine.queue.submit2({submit_info});
+        if (submit_result != vk::Result::eSuccess)
+            return Err::CouldNotSubmitVkCommandBuffer;
+    }
+
+    if (m_transfer.cmd != nullptr) {
+        vk::BufferMemoryBarrier2 ownership = {
+            .srcStageMask = vk::PipelineStageFlagBits2::eTransfer,
+            .srcAccessMask = vk::AccessFlagBits2::eTransferWrite,
+            .srcQueueFamilyIndex = m_transfer_family,
+            .dstQueueFamilyIndex = m_graphics_family,
+            .offset = 0,
+            .size = vk::WholeSize,
+        };
+        BarrierBuilder release_barriers(m_transfer.cmd);
+        BarrierBuilder acquire_barriers(*graphics_cmd);
+        for (const auto buffer : m_batch_buffers) {
+            ownership.buffer = buffer;
+            ownership.srcStageMask = vk::PipelineStageFlagBits2::eTransfer;
+            ownership.srcAccessMask = vk::AccessFlagBits2::eTransferWrite;
+            ownership.dstStageMask = vk::PipelineStageFlagBits2::eNone;
+            ownership.dstAccessMask = vk::AccessFlagBits2::eNone;
+            release_barriers.add_buffer_barrier(ownership);
+            ownership.srcStageMask = vk::PipelineStageFlagBits2::eNone;
+            ownership.srcAccessMask = vk::AccessFlagBits2::eNone;
+            ownership.dstStageMask = vk::PipelineStageFlagBits2::eAllCommands;
+            ownership.dstAccessMask = vk::AccessFlagBits2::eMemoryRead;
+            acquire_barriers.add_buffer_barrier(ownership);
+            m_graphics_buffers.insert(buffer);
+        }
+        if (!m_batch_buffers.empty()) {
+            release_barriers.build_and_run();
+            acquire_barriers.build_and_run();
+        }
+
+        const auto end_result = m_transfer.cmd.end();
+        if (end_result != vk::Result::eSuccess)
+            return Err::CouldNotEndVkCommandBuffer;
+
+        // Waiting on the release also keeps the transfer queue behind every earlier use of those buffers
+        const vk::SemaphoreSubmitInfo wait_info = {
+            .semaphore = m_timeline,
+            .value = release_value(token),
+            .stageMask = vk::PipelineStageFlagBits2::eAllCommands,
+        };
+        const vk::CommandBufferSubmitInfo cmd_info = {.commandBuffer = m_transfer.cmd};
+        const vk::SemaphoreSubmitInfo signal_info = {
+            .semaphore = m_transfer_timeline,
+            .value = token,
+            .stageMask = vk::PipelineStageFlagBits2::eAllCommands,
+        };
+        const vk::SubmitInfo2 submit_info = {
+            .waitSemaphoreInfoCount = m_release.cmd != nullptr ? 1u : 0u,
+            .pWaitSemaphoreInfos = &wait_info,
+            .commandBufferInfoCount = 1,
+            .pCommandBufferInfos = &cmd_info,
+            .signalSemaphoreInfoCount = 1,
+            .pSignalSemaphoreInfos = &signal_info,
+        };
+        const auto submit_result = m_transfer_queue.submit2({submit_info});
+        if (submit_result != vk::Result::eSuccess)
+            return Err::CouldNotSubmitVkCommandBuffer;
+    }
+
+    const auto end_result = m_graphics.cmd.end();
+    if (end_result != vk::Result::eSuccess)
+        return Err::CouldNotEndVkCommandBuffer;
+
+    const vk::SemaphoreSubmitInfo wait_info = {
+        .semaphore = m_transfer_timeline,
+        .value = token,
+        .stageMask = vk::PipelineStageFlagBits2::eAllCommands,
+    };
+    const vk::CommandBufferSubmitInfo cmd_info = {.commandBuffer = m_graphics.cmd};
+    const vk::SemaphoreSubmitInfo signal_info = {
+        .semaphore = m_timeline,
+        .value = graphics_value(token),
+        .stageMask = vk::PipelineStageFlagBits2::eAllCommands,
+    };
+    const vk::SubmitInfo2 submit_info = {
+        .waitSemaphoreInfoCount = m_transfer.cmd != nullptr ? 1u : 0u,
+        .pWaitSemaphoreInfos = &wait_info,
+        .commandBufferInfoCount = 1,
+        .pCommandBufferInfos = &cmd_info,
+        .signalSemaphoreInfoCount = 1,
+        .pSignalSemaphoreInfos = &signal_info,
+    };
+    const auto submit_result = engine.queue.submit2({submit_info});
+    if (submit_result != vk::Result::eSuccess)
+        return Err::CouldNotSubmitVkCommandBuffer;
+
+    m_in_flight.push_back({
+        .token = token,
+        .ring_end = m_head,
+        .ring_bytes = m_batch_bytes,
+        .release_cmd = m_release.cmd,
+        .transfer_cmd = m_transfer.cmd,
+        .graphics_cmd = m_graphics.cmd,
+        .dedicated_staging = std::move(m_batch_dedicated),
+    });
+    m_batch_dedicated.clear();
+    m_batch_buffers.clear();
+    m_batch_bytes = 0;
+    m_release.cmd = nullptr;
+    m_transfer.cmd = nullptr;
+    m_graphics.cmd = nullptr;
+    m_batch_empty = true;
+    m_last_submitted = token;
+    ++m_batch_token;
+
+    return ok(token);
+}
+
+Result<void> UploadQueue::wait(const Engine& engine, const Token token) const {
+    ASSERT(engine.device != nullptr);
+    ASSERT(token <= m_last_submitted);
+
+    if (token == 0)
+        return ok();
+
+    const u64 value = graphics_value(token);
+    const auto wait_result = engine.device.waitSemaphores({
+        .semaphoreCount = 1,
+        .pSemaphores = &m_timeline,
+        .pValues = &value,
+    }, UINT64_MAX);
+    if (wait_result != vk::Result::eSuccess)
+        return Err::CouldNotWaitForVkSemaphore;
+    return ok();
+}
+
+bool UploadQueue::is_complete(const Engine& engine, const Token token) const {
+    ASSERT(engine.device != nullptr);
+
+    if (token > m_last_submitted)
+        return false;
+    const auto value = engine.device.getSemaphoreCounterValue(m_timeline);
+    if (value.result != vk::Result::eSuccess)
+        return false;
+    return value.value >= graphics_value(token);
+}
+
+Result<void> UploadQueue::retire_oldest(const Engine& engine) {
+    ASSERT(!m_in_flight.empty());
+
+    const auto wait_result = wait(engine, m_in_flight.front().token);
+    if (wait_result.has_err())
+        return wait_result.err();
+    retire_completed(engine);
+    return ok();
+}
+
+void UploadQueue::retire_completed(const Engine& engine) {
+    ASSERT(engine.device != nullptr);
+
+    if (m_in_flight.empty())
+        return;
+    const auto value = engine.device.getSemaphoreCounterValue(m_timeline);
+    if (value.result != vk::Result::eSuccess)
+        return;
+
+    while (!m_in_flight.empty() && graphics_value(m_in_flight.front().token) <= value.value) {
+        release(engine, m_in_flight.front());
+        m_in_flight.pop_front();
+    }
+}
+
+void UploadQueue::release(const Engine& engine, Batch& batch) {
+    ASSERT(batch.ring_bytes <= m_used);
+
+    m_used -= batch.ring_bytes;
+    m_tail = batch.ring_end;
+
+    if (batch.release_cmd != nullptr)
+        m_release.free_cmds.push_back(batch.release_cmd);
+    if (batch.transfer_cmd != nullptr)
+        m_transfer.free_cmds.push_back(batch.transfer_cmd);
+    ASSERT(batch.graphics_cmd != nullptr);
+    m_graphics.free_cmds.push_back(batch.graphics_cmd);
+
+    for (const auto& buffer : batch.dedicated_staging) {
+        buffer.destroy(engine);
+    }
+    batch.dedicated_staging.clear();
+}
+
+} // namespace hg
@@ -6,10 +6,16 @@
 
 #include <algorithm>
 #include <array>
+#include <cstring>
 #include <format>
 #include <fstream>
+#include <future>
 #include <iostream>
+#include <optional>
 #include <span>
+#include <string_view>
+#include <thread>
+#include <type_traits>
 #include <vector>
 
 namespace hg {
@@ -19,10 +25,11 @@ inline constexpr std::array<const char*, 0> ValidationLayers = {};
 #else
 inline constexpr std::array ValidationLayers = {"VK_LAYER_KHRONOS_validation"};
 #endif
+// Headless engines go without VK_KHR_swapchain, so they can run on gpus with no display
 constexpr std::array DeviceExtensions = {
-    VK_KHR_SWAPCHAIN_EXTENSION_NAME,
     VK_EXT_SHADER_OBJECT_EXTENSION_NAME,
     VK_EXT_DESCRIPTOR_INDEXING_EXTENSION_NAME,
+    VK_KHR_DRAW_INDIRECT_COUNT_EXTENSION_NAME,
 };
 
 static vk::Bool32 debug_callback(
@@ -46,16 +53,18 @@ const vk::DebugUtilsMessengerCreateInfoEXT DebugUtilsMessengerCreateInfo = {
     .pfnUserCallback = debug_callback,
 };
 
-[[nodiscard]] static Result<std::vector<const char*>> get_required_instance_extensions() {
-    u32 glfw_extension_count = 0;
-    const char** glfw_extensions = glfwGetRequiredInstanceExtensions(&glfw_extension_count);
-    if (glfw_extensions == nullptr)
-        return Err::GlfwFailure;
-
+[[nodiscard]] static Result<std::vector<const char*>> get_required_instance_extensions(const bool headless) {
     auto required_extensions = ok<std::vector<const char*>>();
-    required_extensions->reserve(glfw_extension_count + 1);
-    for (usize i = 0; i < glfw_extension_count; ++i)
-        required_extensions->emplace_back(glfw_extensions[i]);
+    if (!headless) {
+        u32 glfw_extension_count = 0;
+        const char** glfw_extensions = glfwGetRequiredInstanceExtensions(&glfw_extension_count);
+        if (glfw_extensions == nullptr)
+            return Err::GlfwFailure;
+
+        required_extensions->reserve(glfw_extension_count + 1);
+        for (usize i = 0; i < glfw_extension_count; ++i)
+            required_extensions->emplace_back(glfw_extensions[i]);
+    }
 #ifndef NDEBUG
     required_extensions->emplace_back(VK_EXT_DEBUG_UTILS_EXTENSION_NAME);
 #endif
@@ -77,7 +86,7 @@ const vk::DebugUtilsMessengerCreateInfoEXT DebugUtilsMessengerCreateInfo = {
     }));
 }
 
-static Result<vk::Instance> init_instance() {
+static Result<vk::Instance> init_instance(const bool headless) {
     const vk::ApplicationInfo app_info = {
         .pApplicationName = "Hurdy Gurdy",
         .applicationVersion = 0,
@@ -86,15 +95,18 @@ static Result<vk::Instance> init_instance() {
         .apiVersion = VK_API_VERSION_1_3,
     };
 
-    const auto required_extensions = get_required_instance_extensions();
+    const auto required_extensions = get_required_instance_extensions(headless);
     if (required_extensions.has_err())
         return required_extensions.err();
 
-    const auto extensions_available = check_instance_extension_availability(*required_extensions);
-    if (extensions_available.has_err())
-        return extensions_available.err();
-    if (!*extensions_available)
-        return Err::VulkanExtensionsUnavailable;
+    // A headless release build needs no instance extensions at all
+    if (!required_extensions->empty()) {
+        const auto extensions_available = check_instance_extension_availability(*required_extensions);
+        if (extensions_available.has_err())
+            return extensions_available.err();
+        if (!*extensions_available)
+            return Err::VulkanExtensionsUnavailable;
+    }
 
     const auto instance = vk::createInstance({
         .pNext = &DebugUtilsMessengerCreateInfo,
@@ -116,7 +128,22 @@ static Result<u32> find_queue_family(const vk::PhysicalDevice gpu) {
 
     const auto queue_families = gpu.getQueueFamilyProperties();
     const auto queue_family = std::ranges::find_if(queue_families, [](const vk::QueueFamilyProperties family) {
-        return static_cast<bool>(family.queueFlags & (vk::QueueFlagBits::eGraphics | vk::QueueFlagBits::eCompute));
+        constexpr auto required = vk::QueueFlagBits::eGraphics | vk::QueueFlagBits::eCompute;
+        return (family.queueFlags & required) == required;
+    });
+    if (queue_family == queue_families.end())
+        return Err::VkQueueFamilyUnavailable;
+
+    return ok(static_cast<u32>(queue_family - queue_families.begin()));
+}
+
+static Result<u32> find_transfer_queue_family(const vk::PhysicalDevice gpu) {
+    ASSERT(gpu != nullptr);
+
+    const auto queue_families = gpu.getQueueFamilyProperties();
+    const auto queue_family = std::ranges::find_if(queue_families, [](const vk::QueueFamilyProperties family) {
+        return (family.queueFlags & vk::QueueFlagBits::eTransfer)
+            && !(family.queueFlags & (vk::QueueFlagBits::eGraphics | vk::QueueFlagBits::eCompute));
     });
     if (queue_family == queue_families.end())
         return Err::VkQueueFamilyUnavailable;
@@ -131,16 +158,22 @@ static Result<vk::PhysicalDevice> find_gpu(const Engine& engine) {
     if (gpus.result != vk::Result::eSuccess)
         return Err::VkPhysicalDevicesUnavailable;
 
+    std::vector<const char*> required_extensions{DeviceExtensions.begin(), DeviceExtensions.end()};
+    if (!engine.headless)
+        required_extensions.push_back(VK_KHR_SWAPCHAIN_EXTENSION_NAME);
+
     for (const auto gpu : gpus.value) {
         const auto features = gpu.getFeatures();
         if (features.sampleRateShading != vk::True || features.samplerAnisotropy != vk::True)
             continue;
+        if (features.multiDrawIndirect != vk::True || features.drawIndirectFirstInstance != vk::True)
+            continue;
 
         const auto extensions = gpu.enumerateDeviceExtensionProperties();
         if (extensions.result != vk::Result::eSuccess)
             return Err::VulkanFailure;
 
-        if (!std::ranges::all_of(DeviceExtensions, [&](const char* required) {
+        if (!std::ranges::all_of(required_extensions, [&](const char* required) {
             return std::ranges::any_of(extensions.value, [&](const vk::ExtensionProperties extension) {
                 return strcmp(required, extension.extensionName);
             });
@@ -157,11 +190,76 @@ static Result<vk::PhysicalDevice> find_gpu(const Engine& engine) {
     return Err::VkPhysicalDevicesUnsuitable;
 }
 
+static bool supports_present_wait(const vk::PhysicalDevice gpu) {
+    ASSERT(gpu != nullptr);
+
+    const auto extensions = gpu.enumerateDeviceExtensionProperties();
+    if (extensions.result != vk::Result::eSuccess)
+        return false;
+    const auto has_extension = [&](const std::string_view name) {
+        return std::ranges::any_of(extensions.value, [&](const vk::ExtensionProperties& extension) {
+            return name == extension.extensionName.data();
+        });
+    };
+    if (!has_extension(VK_KHR_PRESENT_ID_EXTENSION_NAME) || !has_extension(VK_KHR_PRESENT_WAIT_EXTENSION_NAME))
+        return false;
+
+    vk::PhysicalDevicePresentWaitFeaturesKHR present_wait_feature = {};
+    vk::PhysicalDevicePresentIdFeaturesKHR present_id_feature = {.pNext = &present_wait_feature};
+    vk::PhysicalDeviceFeatures2 features = {.pNext = &present_id_feature};
+    gpu.getFeatures2(&features);
+    return present_id_feature.presentId == vk::True && present_wait_feature.presentWait == vk::True;
+}
+
+static bool supports_memory_budget(const vk::PhysicalDevice gpu) {
+    ASSERT(gpu != nullptr);
+
+    const auto extensions = gpu.enumerateDeviceExtensionProperties();
+    if (extensions.result != vk::Result::eSuccess)
+        return false;
+    return std::ranges::any_of(extensions.value, [](const vk::ExtensionProperties& extension) {
+        return std::string_view{VK_EXT_MEMORY_BUDGET_EXTENSION_NAME} == extension.extensionName.data();
+    });
+}
+
+static bool supports_storage_images(const vk::PhysicalDevice gpu) {
+    ASSERT(gpu != nullptr);
+
+    vk::PhysicalDeviceDescriptorIndexingFeatures indexing_features = {};
+    vk::PhysicalDeviceFeatures2 features = {.pNext = &indexing_features};
+    gpu.getFeatures2(&features);
+    vk::PhysicalDeviceDescriptorIndexingProperties indexing_properties = {};
+    vk::PhysicalDeviceProperties2 properties = {.pNext = &indexing_properties};
+    gpu.getProperties2(&properties);
+    return features.features.shaderStorageImageArrayDynamicIndexing == vk::True
+        && indexing_features.descriptorBindingStorageImageUpdateAfterBind == vk::True
+        && indexing_properties.maxPerStageDescriptorUpdateAfterBindStorageImages > 0
+        && indexing_properties.maxDescriptorSetUpdateAfterBindStorageImages > 0;
+}
+
 static Result<vk::Device> init_device(const Engine& engine) {
     ASSERT(engine.gpu != nullptr);
     ASSERT(engine.queue_family_index != UINT32_MAX);
+    ASSERT(engine.transfer_queue_family_index != UINT32_MAX);
+
+    // Present wait is optional, Window falls back to fence pacing without it
+    vk::PhysicalDevicePresentWaitFeaturesKHR present_wait_feature = {.pNext = nullptr, .presentWait = vk::True};
+    vk::PhysicalDevicePresentIdFeaturesKHR present_id_feature = {.pNext = &present_wait_feature, .presentId = vk::True};
+    std::vector<const char*> extensions{DeviceExtensions.begin(), DeviceExtensions.end()};
+    if (!engine.headless)
+        extensions.push_back(VK_KHR_SWAPCHAIN_EXTENSION_NAME);
+    if (engine.memory_budget)
+        extensions.push_back(VK_EXT_MEMORY_BUDGET_EXTENSION_NAME);
+    if (engine.present_wait) {
+        extensions.push_back(VK_KHR_PRESENT_ID_EXTENSION_NAME);
+        extensions.push_back(VK_KHR_PRESENT_WAIT_EXTENSION_NAME);
+    }
 
-    vk::PhysicalDeviceBufferAddressFeaturesEXT buffer_address_feature = {.pNext = nullptr, .bufferDeviceAddress = vk::True};
+    vk::PhysicalDeviceTimelineSemaphoreFeatures timeline_semaphore_feature = {
+        .pNext = engine.present_wait ? &present_id_feature : nullptr,
+        .timelineSemaphore = vk::True,
+    };
+    vk::PhysicalDeviceBufferAddressFeaturesEXT buffer_address_feature = {.pNext = &timeline_semaphore_feature, .bufferDeviceAddress = vk::True};
     vk::PhysicalDeviceDescriptorIndexingFeatures descriptor_indexing_features = {
         .pNext = &buffer_address_feature,
         // .shaderInputAttachmentArrayDynamicIndexing = true,
@@ -175,12 +273,12 @@ static Result<vk::Device> init_device(const Engine& engine) {
         // .shaderUniformTexelBufferArrayNonUniformIndexing = true,
         // .shaderStorageTexelBufferArrayNonUniformIndexing = true,
         // .descriptorBindingUniformBufferUpdateAfterBind = true,
-        // .descriptorBindingSampledImageUpdateAfterBind = true,
-        // .descriptorBindingStorageImageUpdateAfterBind = true,
-        // .descriptorBindingStorageBufferUpdateAfterBind = true,
+        .descriptorBindingSampledImageUpdateAfterBind = true,
+        .descriptorBindingStorageImageUpdateAfterBind = engine.storage_images ? vk::True : vk::False,
+        .descriptorBindingStorageBufferUpdateAfterBind = true,
         // .descriptorBindingUniformTexelBufferUpdateAfterBind = true,
         // .descriptorBindingStorageTexelBufferUpdateAfterBind = true,
-        // .descriptorBindingUpdateUnusedWhilePending = true,
+        .descriptorBindingUpdateUnusedWhilePending = true,
         .descriptorBindingPartiallyBound = true,
         // .descriptorBindingVariableDescriptorCount = true,
         .runtimeDescriptorArray = true,
@@ -188,26 +286,41 @@ static Result<vk::Device> init_device(const Engine& engine) {
     vk::PhysicalDeviceShaderObjectFeaturesEXT shader_object_feature = {.pNext = &descriptor_indexing_features, .shaderObject = vk::True};
     vk::PhysicalDeviceDynamicRenderingFeatures dynamic_rendering_feature = {.pNext = &shader_object_feature, .dynamicRendering = vk::True};
     vk::PhysicalDeviceSynchronization2Features synchronization2_feature = {.pNext = &dynamic_rendering_feature, .synchronization2 = vk::True};
-    constexpr vk::PhysicalDeviceFeatures features = {
+    // Compressed texture formats are optional, textures in them are rejected when unsupported
+    const vk::PhysicalDeviceFeatures features = {
         .sampleRateShading = vk::True,
+        .multiDrawIndirect = vk::True,
+        .drawIndirectFirstInstance = vk::True,
         .samplerAnisotropy = vk::True,
+        .textureCompressionETC2 = engine.texture_compression_etc2 ? vk::True : vk::False,
+        .textureCompressionASTC_LDR = engine.texture_compression_astc ? vk::True : vk::False,
+        .textureCompressionBC = engine.texture_compression_bc ? vk::True : vk::False,
+        .shaderStorageImageArrayDynamicIndexing = engine.storage_images ? vk::True : vk::False,
     };
 
     constexpr float queue_priority = 1.0f;
-    const vk::DeviceQueueCreateInfo queue_info{
-        .queueFamilyIndex = engine.queue_family_index,
-        .queueCount = 1,
-        .pQueuePriorities = &queue_priority
+    const std::array queue_infos = {
+        vk::DeviceQueueCreateInfo{
+            .queueFamilyIndex = engine.queue_family_index,
+            .queueCount = 1,
+            .pQueuePriorities = &queue_priority
+        },
+        vk::DeviceQueueCreateInfo{
+            .queueFamilyIndex = engine.transfer_queue_family_index,
+            .queueCount = 1,
+            .pQueuePriorities = &queue_priority
+        },
     };
+    const u32 queue_info_count = engine.transfer_queue_family_index == engine.queue_family_index ? 1 : 2;
 
     const auto device = engine.gpu.createDevice({
-        .pNext = synchronization2_feature,
-        .queueCreateInfoCount = 1,
-        .pQueueCreateInfos = &queue_info,
+        .pNext = &synchronization2_feature,
+        .queueCreateInfoCount = queue_info_count,
+        .pQueueCreateInfos = queue_infos.data(),
         .enabledLayerCount = to_u32(ValidationLayers.size()),
         .ppEnabledLayerNames = ValidationLayers.data(),
-        .enabledExtensionCount = to_u32(DeviceExtensions.size()),
-        .ppEnabledExtensionNames = DeviceExtensions.data(),
+        .enabledExtensionCount = to_u32(extensions.size()),
+        .ppEnabledExtensionNames = extensions.data(),
         .pEnabledFeatures = &features,
     });
     if (device.result != vk::Result::eSuccess)
@@ -227,6 +340,8 @@ static Result<VmaAllocator> init_allocator(const Engine& engine) {
     info.device = engine.device;
     info.instance = engine.instance;
     info.vulkanApiVersion = VK_API_VERSION_1_3;
+    if (engine.memory_budget)
+        info.flags |= VMA_ALLOCATOR_CREATE_EXT_MEMORY_BUDGET_BIT;
 
     auto allocator = ok<VmaAllocator>(nullptr);
     const auto result = vmaCreateAllocator(&info, &*allocator);
@@ -235,22 +350,43 @@ static Result<VmaAllocator> init_allocator(const Engine& engine) {
     return allocator;
 }
 
+void DeletionQueue::flush(const Engine& engine, const u64 completed) {
+    ASSERT(completed <= m_submitted);
+
+    m_completed = std::max(m_completed, completed);
+    while (!m_deleters.empty() && m_deleters.front().serial <= m_completed) {
+        m_deleters.front().deleter(engine);
+        m_deleters.pop_front();
+    }
+}
+
+void DeletionQueue::flush_all(const Engine& engine) {
+    for (const auto& entry : m_deleters) {
+        entry.deleter(engine);
+    }
+    m_deleters.clear();
+    m_completed = m_submitted;
+}
+
 static bool s_engine_initialized = false;
 
-Result<Engine> Engine::create() {
+Result<Engine> Engine::create(const Config& config) {
     if (s_engine_initialized)
         ERROR("Cannot initialize more than one engine");
 
     auto engine = ok<Engine>();
+    engine->headless = config.headless;
 
-    const auto glfw_success = glfwInit();
-    if (glfw_success == GLFW_FALSE)
-        return Err::CouldNotInitializeGlfw;
-    glfwWindowHint(GLFW_CLIENT_API, GLFW_NO_API);
+    if (!engine->headless) {
+        const auto glfw_success = glfwInit();
+        if (glfw_success == GLFW_FALSE)
+            return Err::CouldNotInitializeGlfw;
+        glfwWindowHint(GLFW_CLIENT_API, GLFW_NO_API);
+    }
 
     VULKAN_HPP_DEFAULT_DISPATCHER.init();
 
-    const auto instance = init_instance();
+    const auto instance = init_instance(engine->headless);
     if (instance.has_err())
         return instance.err();
     engine->instance = *instance;
@@ -272,6 +408,18 @@ Result<Engine> Engine::create() {
         return queue_family.err();
     engine->queue_family_index = *queue_family;
 
+    const auto transfer_queue_family = find_transfer_queue_family(engine->gpu);
+    engine->transfer_queue_family_index = transfer_queue_family.has_err() ? *queue_family : *transfer_queue_family;
+
+    engine->present_wait = !engine->headless && supports_present_wait(engine->gpu);
+    engine->memory_budget = supports_memory_budget(engine->gpu);
+    engine->storage_images = supports_storage_images(engine->gpu);
+
+    const auto gpu_features = engine->gpu.getFeatures();
+    engine->texture_compression_bc = gpu_features.textureCompressionBC == vk::True;
+    engine->texture_compression_etc2 = gpu_features.textureCompressionETC2 == vk::True;
+    engine->texture_compression_astc = gpu_features.textureCompressionASTC_LDR == vk::True;
+
     const auto device = init_device(*engine);
     if (device.has_err())
         return device.err();
@@ -283,10 +431,16 @@ Result<Engine> Engine::create() {
     if (engine->queue == nullptr)
         return Err::VkQueueUnavailable;
 
+    engine->transfer_queue = engine->device.getQueue(engine->transfer_queue_family_index, 0);
+    if (engine->transfer_queue == nullptr)
+        return Err::VkQueueUnavailable;
+
     const auto allocator = init_allocator(*engine);
     if (allocator.has_err())
         return allocator.err();
     engine->allocator = *allocator;
+    engine->memory = new MemoryTracker{};
+    engine->set_layout_hashes = new std::unordered_map<VkDescriptorSetLayout, u64>{};
 
     const auto pool = engine->device.createCommandPool({
         .flags = vk::CommandPoolCreateFlagBits::eResetCommandBuffer,
@@ -304,6 +458,13 @@ Result<Engine> Engine::create() {
         return Err::CouldNotCreateVkCommandPool;
     engine->single_time_command_pool = transient_pool.value;
 
+    engine->deletions = new DeletionQueue{};
+
+    const auto bindless = BindlessHeap::create(*engine);
+    if (bindless.has_err())
+        return bindless.err();
+    engine->bindless = new BindlessHeap{*bindless};
+
     s_engine_initialized = true;
     ASSERT(engine->instance != nullptr);
     ASSERT(engine->debug_messenger != nullptr);
@@ -312,8 +473,13 @@ Result<Engine> Engine::create() {
     ASSERT(engine->allocator != nullptr);
     ASSERT(engine->queue_family_index != UINT32_MAX);
     ASSERT(engine->queue != nullptr);
+    ASSERT(engine->transfer_queue_family_index != UINT32_MAX);
+    ASSERT(engine->transfer_queue != nullptr);
     ASSERT(engine->command_pool != nullptr);
     ASSERT(engine->single_time_command_pool != nullptr);
+    ASSERT(engine->deletions != nullptr);
+    ASSERT(engine->bindless != nullptr);
+    ASSERT(engine->memory != nullptr);
     return engine;
 }
 
@@ -321,6 +487,15 @@ void Engine::destroy() const {
     if (!s_engine_initialized)
         ERROR("Cannot destroy uninitialized engine");
 
+    ASSERT(deletions != nullptr);
+    deletions->flush_all(*this);
+
+    // Freeing heap indices is deferred through the deletion queue, so the heap goes after it has been flushed
+    ASSERT(bindless != nullptr);
+    bindless->destroy(*this);
+    delete bindless;
+    delete deletions;
+
     ASSERT(single_time_command_pool != nullptr);
     device.destroyCommandPool(single_time_command_pool);
     ASSERT(command_pool != nullptr);
@@ -328,6 +503,10 @@ void Engine::destroy() const {
 
     ASSERT(allocator != nullptr);
     vmaDestroyAllocator(allocator);
+    ASSERT(memory != nullptr);
+    delete memory;
+    ASSERT(set_layout_hashes != nullptr);
+    delete set_layout_hashes;
 
     ASSERT(device != nullptr);
     device.destroy();
@@ -341,18 +520,23 @@ void Engine::destroy() const {
     s_engine_initialized = false;
 }
 
-Result<Window> Window::create(const Engine& engine, const bool fullscreen, const i32 width, const i32 height) {
+Result<Window> Window::create(const Engine& engine, const Config& config) {
+    ASSERT(!engine.headless);
     ASSERT(engine.instance != nullptr);
     ASSERT(engine.device != nullptr);
     ASSERT(engine.command_pool != nullptr);
-    if (!fullscreen) {
-        ASSERT(width > 0);
-        ASSERT(height > 0);
+    if (!config.fullscreen) {
+        ASSERT(config.width > 0);
+        ASSERT(config.height > 0);
     }
+    ASSERT(config.frames_in_flight > 0 && config.frames_in_flight <= MaxFramesInFlight);
+    ASSERT(config.swapchain_images <= MaxSwapchainImages);
+    ASSERT(config.frame_rate_limit >= 0.0);
 
     auto window = ok<Window>();
+    window->m_config = config;
 
-    if (fullscreen) {
+    if (config.fullscreen) {
         const auto monitor = glfwGetPrimaryMonitor();
         if (monitor == nullptr)
             return Err::GlfwFailure;
@@ -361,11 +545,11 @@ Result<Window> Window::create(const Engine& engine, const bool fullscreen, const
         if (video_mode == nullptr)
             return Err::GlfwFailure;
 
-        window->m_window = glfwCreateWindow(video_mode->width, video_mode->width, "Hurdy Gurdy", monitor, nullptr);
+        window->m_window = glfwCreateWindow(video_mode->width, video_mode->height, "Hurdy Gurdy", monitor, nullptr);
         if (window->m_window == nullptr)
             return Err::GlfwFailure;
     } else {
-        window->m_window = glfwCreateWindow(width, height, "Hurdy Gurdy", nullptr, nullptr);
+        window->m_window = glfwCreateWindow(config.width, config.height, "Hurdy Gurdy", nullptr, nullptr);
         if (window->m_window == nullptr)
             return Err::GlfwFailure;
     }
@@ -376,7 +560,7 @@ Result<Window> Window::create(const Engine& engine, const bool fullscreen, const
         return Err::GlfwFailure;
     window->m_surface = surface;
 
-    const auto window_result = window->resize(engine);
+    const auto window_result = window->recreate_swapchain(engine);
     if (window_result.has_err())
         return window_result.err();
 
@@ -400,19 +584,18 @@ Result<Window> Window::create(const Engine& engine, const bool fullscreen, const
             return Err::CouldNotCreateVkSemaphore;
         semaphore = new_semaphore.value;
     }
-    for (auto& semaphore : window->m_ready_to_present_semaphores) {
-        const auto new_semaphore = engine.device.createSemaphore({});
-        if (new_semaphore.result != vk::Result::eSuccess)
-            return Err::CouldNotCreateVkSemaphore;
-        semaphore = new_semaphore.value;
-    }
+
+    const auto profiler = GpuProfiler::create(engine);
+    if (profiler.has_err())
+        return profiler.err();
+    window->m_profiler = *profiler;
 
     ASSERT(window->m_window != nullptr);
     ASSERT(window->m_surface != nullptr);
     ASSERT(window->m_extent != nullptr);
     ASSERT(window->m_swapchain != nullptr);
-    for (const auto image : window->m_swapchain_images) {
-        ASSERT(image != nullptr);
+    for (u32 i = 0; i < window->m_image_count; ++i) {
+        ASSERT(window->m_swapchain_images[i] != nullptr);
     }
     for (const auto cmd : window->m_command_buffers) {
         ASSERT(cmd != nullptr);
@@ -423,8 +606,8 @@ Result<Window> Window::create(const Engine& engine, const bool fullscreen, const
     for (const auto semaphore : window->m_image_available_semaphores) {
         ASSERT(semaphore != nullptr);
     }
-    for (const auto semaphore : window->m_ready_to_present_semaphores) {
-        ASSERT(semaphore != nullptr);
+    for (u32 i = 0; i < window->m_image_count; ++i) {
+        ASSERT(window->m_ready_to_present_semaphores[i] != nullptr);
     }
     return window;
 }
@@ -432,6 +615,8 @@ Result<Window> Window::create(const Engine& engine, const bool fullscreen, const
 void Window::destroy(const Engine& engine) const {
     ASSERT(engine.device != nullptr);
 
+    m_profiler.destroy(engine);
+
     for (const auto fence : m_frame_finished_fences) {
         ASSERT(fence != nullptr);
         engine.device.destroyFence(fence);
@@ -441,9 +626,16 @@ void Window::destroy(const Engine& engine) const {
         engine.device.destroySemaphore(semaphore);
     }
     for (const auto semaphore : m_ready_to_present_semaphores) {
-        ASSERT(semaphore != nullptr);
-        engine.device.destroySemaphore(semaphore);
+        if (semaphore != nullptr)
+            engine.device.destroySemaphore(semaphore);
     }
+    for (const auto view : m_swapchain_views) {
+        if (view != nullptr)
+            engine.device.destroyImageView(view);
+    }
+    // Retired swapchains have to go before the surface
+    ASSERT(engine.deletions != nullptr);
+    engine.deletions->flush_all(engine);
 
     ASSERT(engine.command_pool != nullptr);
     for (const auto cmd : m_command_buffers) {
@@ -461,9 +653,10 @@ void Window::destroy(const Engine& engine) const {
     glfwDestroyWindow(m_window);
 }
 
-Result<void> Window::resize(const Engine& engine) {
+Result<void> Window::recreate_swapchain(const Engine& engine) {
     ASSERT(engine.gpu != nullptr);
     ASSERT(engine.device != nullptr);
+    ASSERT(!m_recording);
 
     const auto [surface_result, surface_capabilities] = engine.gpu.getSurfaceCapabilitiesKHR(m_surface);
     if (surface_result != vk::Result::eSuccess)
@@ -475,48 +668,150 @@ Result<void> Window::resize(const Engine& engine) {
     if (present_mode_result != vk::Result::eSuccess)
         return Err::VulkanFailure;
 
+    const u32 max_image_count = surface_capabilities.maxImageCount == 0
+                              ? MaxSwapchainImages
+                              : std::min(surface_capabilities.maxImageCount, MaxSwapchainImages);
+    const u32 requested_image_count = m_config.swapchain_images == 0
+                                    ? surface_capabilities.minImageCount + 1
+                                    : m_config.swapchain_images;
+    m_present_mode = std::ranges::find(present_modes, m_config.present_mode) != present_modes.end()
+                   ? m_config.present_mode
+                   : vk::PresentModeKHR::eFifo;
+
     const auto new_swapchain = engine.device.createSwapchainKHR({
         .surface = m_surface,
-        .minImageCount = surface_capabilities.maxImageCount == 0
-                         ? MaxSwapchainImages
-                         : std::min(surface_capabilities.minImageCount + 1, surface_capabilities.maxImageCount),
+        .minImageCount = std::clamp(requested_image_count, surface_capabilities.minImageCount, max_image_count),
         .imageFormat = SwapchainImageFormat,
         .imageColorSpace = SwapchainColorSpace,
         .imageExtent = surface_capabilities.currentExtent,
         .imageArrayLayers = 1,
         .imageUsage = vk::ImageUsageFlagBits::eColorAttachment | vk::ImageUsageFlagBits::eTransferDst,
         .preTransform = surface_capabilities.currentTransform,
-        .presentMode = std::ranges::any_of(present_modes, [](const vk::PresentModeKHR mode) { return mode == vk::PresentModeKHR::eMailbox; })
-            // ? vk::PresentModeKHR::eMailbox
-            ? vk::PresentModeKHR::eFifo
-            : vk::PresentModeKHR::eFifo,
+        .presentMode = m_present_mode,
         .clipped = vk::True,
         .oldSwapchain = m_swapchain,
     });
     if (new_swapchain.result != vk::Result::eSuccess)
         return Err::CouldNotCreateVkSwapchain;
 
-    const auto wait_result = engine.queue.waitIdle();
-    if (wait_result != vk::Result::eSuccess)
-        return Err::CouldNotWaitForVkQueue;
-
+    // Frames still in flight may present from the old swapchain, so it and its semaphores outlive them
     if (m_swapchain != nullptr) {
-        engine.device.destroySwapchainKHR(m_swapchain);
+        engine.deletions->push([
+            swapchain = m_swapchain, semaphores = m_ready_to_present_semaphores, views = m_swapchain_views
+        ](const Engine& e) {
+            for (const auto semaphore : semaphores) {
+                if (semaphore != nullptr)
+                    e.device.destroySemaphore(semaphore);
+            }
+            for (const auto view : views) {
+                if (view != nullptr)
+                    e.device.destroyImageView(view);
+            }
+            e.device.destroySwapchainKHR(swapchain);
+        });
+        m_ready_to_present_semaphores = {};
+        m_swapchain_views = {};
     }
     m_swapchain = new_swapchain.value;
     m_extent = surface_capabilities.currentExtent;
+    m_present_id = 0;
+    m_swapchain_dirty = false;
 
     const vk::Result image_count_result = engine.device.getSwapchainImagesKHR(m_swapchain, &m_image_count, nullptr);
     if (image_count_result != vk::Result::eSuccess)
         return Err::VkSwapchainImagesUnavailable;
+    // The driver may create more images than requested
+    if (m_image_count > MaxSwapchainImages)
+        return Err::VkSwapchainImagesUnavailable;
     const vk::Result image_result = engine.device.getSwapchainImagesKHR(m_swapchain, &m_image_count, m_swapchain_images.data());
     if (image_result != vk::Result::eSuccess)
         return Err::VkSwapchainImagesUnavailable;
 
+    for (u32 i = 0; i < m_image_count; ++i) {
+        const auto new_semaphore = engine.device.createSemaphore({});
+        if (new_semaphore.result != vk::Result::eSuccess)
+            return Err::CouldNotCreateVkSemaphore;
+        m_ready_to_present_semaphores[i] = new_semaphore.value;
+
+        // Pipelines can render or resolve straight into the swapchain image through its view
+        const auto view = engine.device.createImageView({
+            .image = m_swapchain_images[i],
+            .viewType = vk::ImageViewType::e2D,
+            .format = SwapchainImageFormat,
+            .subresourceRange = {vk::ImageAspectFlagBits::eColor, 0, 1, 0, 1},
+        });
+        if (view.result != vk::Result::eSuccess)
+            return Err::CouldNotCreateGpuImageView;
+        m_swapchain_views[i] = view.value;
+    }
+
     ASSERT(m_swapchain != nullptr);
-    for (const auto image : m_swapchain_images) {
-        ASSERT(image != nullptr);
+    for (u32 i = 0; i < m_image_count; ++i) {
+        ASSERT(m_swapchain_images[i] != nullptr);
+        ASSERT(m_swapchain_views[i] != nullptr);
+        ASSERT(m_ready_to_present_semaphores[i] != nullptr);
+    }
+    return ok();
+}
+
+void Window::set_present_mode(const vk::PresentModeKHR present_mode) {
+    m_config.present_mode = present_mode;
+    m_swapchain_dirty = true;
+}
+
+Result<void> Window::set_frames_in_flight(const Engine& engine, const u32 frames_in_flight) {
+    ASSERT(!m_recording);
+    ASSERT(frames_in_flight > 0 && frames_in_flight <= MaxFramesInFlight);
+
+    // Frames are indexed modulo the count, so none may be pending when it changes
+    const auto wait_result = engine.queue.waitIdle();
+    if (wait_result != vk::Result::eSuccess)
+        return Err::CouldNotWaitForVkQueue;
+
+    engine.deletions->flush(engine, engine.deletions->next_serial() - 1);
+    m_config.frames_in_flight = frames_in_flight;
+    m_current_frame_index = 0;
+    return ok();
+}
+
+void Window::set_frame_rate_limit(const f64 frame_rate_limit) {
+    ASSERT(frame_rate_limit >= 0.0);
+    m_config.frame_rate_limit = frame_rate_limit;
+}
+
+void Window::set_low_latency(const bool low_latency) {
+    m_config.low_latency = low_latency;
+}
+
+Result<void> Window::pace_frame(const Engine& engine) {
+    ASSERT(!m_recording);
+    ASSERT(engine.device != nullptr);
+
+    if (m_paced)
+        return ok();
+    const CpuScope scope{"pace_frame"};
+
+    if (m_config.frame_rate_limit > 0.0) {
+        const auto interval = std::chrono::duration_cast<std::chrono::steady_clock::duration>(
+            std::chrono::duration<f64>{1.0 / m_config.frame_rate_limit}
+        );
+        const auto now = std::chrono::steady_clock::now();
+        if (now < m_next_frame_time)
+            std::this_thread::sleep_until(m_next_frame_time);
+        m_next_frame_time = std::max(m_next_frame_time, now) + interval;
     }
+
+    // Keeps at most frames_in_flight - 1 presents queued ahead of the display
+    if (m_config.low_latency && engine.present_wait && m_present_id >= m_config.frames_in_flight) {
+        const u64 present_id = m_present_id - (m_config.frames_in_flight - 1);
+        const auto wait_result = engine.device.waitForPresentKHR(m_swapchain, present_id, m_config.frame_timeout_ns);
+        // An out of date swapchain is reported by acquire or present instead
+        if (wait_result != vk::Result::eSuccess && wait_result != vk::Result::eTimeout
+            && wait_result != vk::Result::eSuboptimalKHR && wait_result != vk::Result::eErrorOutOfDateKHR)
+            return Err::CouldNotWaitForVkPresent;
+    }
+
+    m_paced = true;
     return ok();
 }
 
@@ -526,52 +821,62 @@ Result<vk::CommandBuffer> Window::begin_frame(const Engine& engine) {
     ASSERT(is_frame_finished() != nullptr);
     ASSERT(is_image_available() != nullptr);
     ASSERT(engine.device != nullptr);
+    ASSERT(engine.deletions != nullptr);
 
-    const auto wait_result = engine.device.waitForFences({is_frame_finished()}, vk::True, 1'000'000'000);
-    if (wait_result != vk::Result::eSuccess)
-        return Err::CouldNotWaitForVkFence;
-    const auto reset_result = engine.device.resetFences({is_frame_finished()});
-    if (reset_result != vk::Result::eSuccess)
-        return Err::VulkanFailure;
+    g_profiler.next_frame();
+
+    const auto pace_result = pace_frame(engine);
+    if (pace_result.has_err())
+        return pace_result.err();
+    // Consumed here so that any return below, such as on an out of date swapchain, paces the retried frame again
+    m_paced = false;
+
+    {
+        const CpuScope scope{"wait_for_frame"};
+        const auto wait_result = engine.device.waitForFences({is_frame_finished()}, vk::True, m_config.frame_timeout_ns);
+        if (wait_result != vk::Result::eSuccess)
+            return Err::CouldNotWaitForVkFence;
+    }
+    engine.deletions->flush(engine, m_frame_serials[m_current_frame_index]);
 
-    const auto acquire_result = engine.device.acquireNextImageKHR(m_swapchain, UINT64_MAX, is_image_available(), nullptr);
-    if (acquire_result.result != vk::Result::eSuccess)
+    if (m_swapchain_dirty) {
+        const auto recreate_result = recreate_swapchain(engine);
+        if (recreate_result.has_err())
+            return recreate_result.err();
+    }
+
+    auto acquire_result = engine.device.acquireNextImageKHR(
+        m_swapchain, m_config.frame_timeout_ns, is_image_available(), nullptr
+    );
+    if (acquire_result.result == vk::Result::eErrorOutOfDateKHR) {
+        const auto recreate_result = recreate_swapchain(engine);
+        if (recreate_result.has_err())
+            return recreate_result.err();
+        acquire_result = engine.device.acquireNextImageKHR(
+            m_swapchain, m_config.frame_timeout_ns, is_image_available(), nullptr
+        );
+    }
+    // A suboptimal image has still been acquired and will signal its semaphore, so it is used for this frame
+    if (acquire_result.result == vk::Result::eSuboptimalKHR)
+        m_swapchain_dirty = true;
+    else if (acquire_result.result != vk::Result::eSuccess)
         return Err::CouldNotAcquireVkSwapchainImage;
     m_current_image_index = acquire_result.value;
 
+    // Only reset once a frame is sure to be submitted, an early return would leave the fence unsignaled forever
+    const auto reset_result = engine.device.resetFences({is_frame_finished()});
+    if (reset_result != vk::Result::eSuccess)
+        return Err::VulkanFailure;
+
     const auto begin_result = current_cmd().begin({.flags = vk::CommandBufferUsageFlagBits::eOneTimeSubmit});
     if (begin_result != vk::Result::eSuccess)
         return Err::CouldNotBeginVkCommandBuffer;
     m_recording = true;
 
-    const vk::Viewport viewport = {
-        0.0f, 0.0f,
-        static_cast<f32>(m_extent.width), static_cast<f32>(m_extent.height),
-        0.0f, 1.0f,
-    };
-    current_cmd().setViewportWithCount({viewport});
-    const vk::Rect2D scissor = {{0, 0}, m_extent};
-    current_cmd().setScissorWithCount({scissor});
-
-    current_cmd().setRasterizerDiscardEnable(vk::False);
-    current_cmd().setPrimitiveRestartEnable(vk::False);
-    current_cmd().setPrimitiveTopology(vk::PrimitiveTopology::eTriangleList);
-    current_cmd().setPolygonModeEXT(vk::PolygonMode::eFill);
-    current_cmd().setFrontFace(vk::FrontFace::eCounterClockwise);
-    current_cmd().setCullMode(vk::CullModeFlagBits::eNone);
-    current_cmd().setDepthTestEnable(vk::True);
-    current_cmd().setDepthWriteEnable(vk::True);
-    current_cmd().setDepthCompareOp(vk::CompareOp::eLess);
-    current_cmd().setDepthBiasEnable(vk::False);
-    current_cmd().setStencilTestEnable(vk::False);
-    current_cmd().setRasterizationSamplesEXT(vk::SampleCountFlagBits::e1);
-    current_cmd().setSampleMaskEXT(vk::SampleCountFlagBits::e1, vk::SampleMask{0xff});
-    current_cmd().setAlphaToCoverageEnableEXT(vk::False);
-    current_cmd().setColorWriteMaskEXT(0, {
-        vk::ColorComponentFlagBits::eR | vk::ColorComponentFlagBits::eG |
-        vk::ColorComponentFlagBits::eB | vk::ColorComponentFlagBits::eA
-    });
-    current_cmd().setColorBlendEnableEXT(0, {vk::False});
+    m_profiler.cmd_begin_frame(engine, current_cmd(), m_current_frame_index);
+    m_frame_scope = m_profiler.cmd_begin_scope(current_cmd(), "frame");
+
+    cmd_set_default_state(current_cmd(), m_extent);
 
     return ok(current_cmd());
 }
@@ -584,6 +889,13 @@ Result<void> Window::end_frame(const Engine& engine) {
     ASSERT(is_ready_to_present() != nullptr);
     ASSERT(engine.device != nullptr);
 
+    m_profiler.cmd_end_scope(current_cmd(), m_frame_scope);
+    m_frame_scope = GpuProfiler::InvalidScope;
+
+    // Update after bind lets descriptors written while recording reach the frame, as long as it is before submission
+    ASSERT(engine.bindless != nullptr);
+    engine.bindless->flush_writes(engine);
+
     const auto end_result = current_cmd().end();
     if (end_result != vk::Result::eSuccess)
         return Err::CouldNotEndVkCommandBuffer;
@@ -603,24 +915,308 @@ Result<void> Window::end_frame(const Engine& engine) {
     const auto submit_result = engine.queue.submit({submit_info}, is_frame_finished());
     if (submit_result != vk::Result::eSuccess)
         return Err::CouldNotSubmitVkCommandBuffer;
+    m_frame_serials[m_current_frame_index] = engine.deletions->submit();
 
+    ++m_present_id;
+    const vk::PresentIdKHR present_id_info = {
+        .swapchainCount = 1,
+        .pPresentIds = &m_present_id,
+    };
     const vk::PresentInfoKHR present_info = {
+        .pNext = engine.present_wait ? &present_id_info : nullptr,
         .waitSemaphoreCount = 1,
         .pWaitSemaphores = &is_ready_to_present(),
         .swapchainCount = 1,
         .pSwapchains = &m_swapchain,
         .pImageIndices = &m_current_image_index,
     };
+    // The frame has been submitted either way, so the frame index still advances
+    m_current_frame_index = (m_current_frame_index + 1) % m_config.frames_in_flight;
+
     const auto present_result = engine.queue.presentKHR(present_info);
-    if (present_result == vk::Result::eErrorOutOfDateKHR)
-        return Err::InvalidWindowSize;
+    if (present_result == vk::Result::eErrorOutOfDateKHR || present_result == vk::Result::eSuboptimalKHR) {
+        m_swapchain_dirty = true;
+        return ok();
+    }
     if (present_result != vk::Result::eSuccess)
         return Err::CouldNotPresentVkSwapchainImage;
 
-    m_current_frame_index = (m_current_frame_index + 1) % MaxFramesInFlight;
     return ok();
 }
 
+Result<HeadlessTarget> HeadlessTarget::create(const Engine& engine, const Config& config) {
+    ASSERT(engine.device != nullptr);
+    ASSERT(engine.command_pool != nullptr);
+    ASSERT(config.width > 0);
+    ASSERT(config.height > 0);
+    ASSERT(config.frames_in_flight > 0 && config.frames_in_flight <= MaxFramesInFlight);
+
+    auto target = ok<HeadlessTarget>();
+    target->m_config = config;
+    target->m_extent = vk::Extent2D{config.width, config.height};
+
+    // Upscaling pipelines blit into the target, and the transfer source lets frames be read back
+    const auto image = GpuImage::create_result(engine, {
+        .extent = {config.width, config.height, 1},
+        .format = Format,
+        .usage = vk::ImageUsageFlagBits::eColorAttachment
+               | vk::ImageUsageFlagBits::eTransferSrc
+               | vk::ImageUsageFlagBits::eTransferDst,
+    });
+    if (image.has_err())
+        return image.err();
+    target->m_image = *image;
+
+    const vk::CommandBufferAllocateInfo cmd_info{
+        .commandPool = engine.command_pool,
+        .commandBufferCount = MaxFramesInFlight,
+    };
+    const auto cmd_result = engine.device.allocateCommandBuffers(&cmd_info, target->m_command_buffers.data());
+    if (cmd_result != vk::Result::eSuccess)
+        return Err::CouldNotAllocateVkCommandBuffers;
+
+    for (auto& fence : target->m_frame_finished_fences) {
+        const auto new_fence = engine.device.createFence({.flags = vk::FenceCreateFlagBits::eSignaled});
+        if (new_fence.result != vk::Result::eSuccess)
+            return Err::CouldNotCreateVkFence;
+        fence = new_fence.value;
+    }
+
+    const auto profiler = GpuProfiler::create(engine);
+    if (profiler.has_err())
+        return profiler.err();
+    target->m_profiler = *profiler;
+
+    ASSERT(target->m_image.image != nullptr);
+    for (const auto cmd : target->m_command_buffers) {
+        ASSERT(cmd != nullptr);
+    }
+    for (const auto fence : target->m_frame_finished_fences) {
+        ASSERT(fence != nullptr);
+    }
+    return target;
+}
+
+void HeadlessTarget::destroy(const Engine& engine) const {
+    ASSERT(engine.device != nullptr);
+    ASSERT(engine.deletions != nullptr);
+
+    const auto wait_result = wait_idle(engine);
+    if (wait_result.has_err())
+        ERROR("Could not wait for headless frames");
+    engine.deletions->flush_all(engine);
+
+    m_profiler.destroy(engine);
+
+    for (const auto fence : m_frame_finished_fences) {
+        ASSERT(fence != nullptr);
+        engine.device.destroyFence(fence);
+    }
+
+    ASSERT(engine.command_pool != nullptr);
+    for (const auto cmd : m_command_buffers) {
+        ASSERT(cmd != nullptr);
+    }
+    engine.device.freeCommandBuffers(engine.command_pool, to_u32(m_command_buffers.size()), m_command_buffers.data());
+
+    m_image.destroy(engine);
+}
+
+Result<vk::CommandBuffer> HeadlessTarget::begin_frame(const Engine& engine) {
+    ASSERT(!m_recording);
+    ASSERT(engine.device != nullptr);
+    ASSERT(engine.deletions != nullptr);
+
+    const auto cmd = m_command_buffers[m_current_frame_index];
+    const auto fence = m_frame_finished_fences[m_current_frame_index];
+    ASSERT(cmd != nullptr);
+    ASSERT(fence != nullptr);
+
+    g_profiler.next_frame();
+
+    {
+        const CpuScope scope{"wait_for_frame"};
+        const auto wait_result = engine.device.waitForFences({fence}, vk::True, m_config.frame_timeout_ns);
+        if (wait_result != vk::Result::eSuccess)
+            return Err::CouldNotWaitForVkFence;
+    }
+    engine.deletions->flush(engine, m_frame_serials[m_current_frame_index]);
+
+    const auto reset_result = engine.device.resetFences({fence});
+    if (reset_result != vk::Result::eSuccess)
+        return Err::VulkanFailure;
+
+    const auto begin_result = cmd.begin({.flags = vk::CommandBufferUsageFlagBits::eOneTimeSubmit});
+    if (begin_result != vk::Result::eSuccess)
+        return Err::CouldNotBeginVkCommandBuffer;
+    m_recording = true;
+
+    m_profiler.cmd_begin_frame(engine, cmd, m_current_frame_index);
+    m_frame_scope = m_profiler.cmd_begin_scope(cmd, "frame");
+
+    cmd_set_default_state(cmd, m_extent);
+
+    return ok(cmd);
+}
+
+Result<void> HeadlessTarget::end_frame(const Engine& engine) {
+    ASSERT(m_recording);
+    ASSERT(engine.device != nullptr);
+
+    const auto cmd = m_command_buffers[m_current_frame_index];
+    ASSERT(cmd != nullptr);
+
+    m_profiler.cmd_end_scope(cmd, m_frame_scope);
+    m_frame_scope = GpuProfiler::InvalidScope;
+
+    ASSERT(engine.bindless != nullptr);
+    engine.bindless->flush_writes(engine);
+
+    const auto end_result = cmd.end();
+    if (end_result != vk::Result::eSuccess)
+        return Err::CouldNotEndVkCommandBuffer;
+    m_recording = false;
+
+    // Nothing is acquired, so consecutive frames are only ordered by the pipeline's own barriers on the image
+    const vk::SubmitInfo submit_info = {
+        .commandBufferCount = 1,
+        .pCommandBuffers = &cmd,
+    };
+    const auto submit_result = engine.queue.submit({submit_info}, m_frame_finished_fences[m_current_frame_index]);
+    if (submit_result != vk::Result::eSuccess)
+        return Err::CouldNotSubmitVkCommandBuffer;
+    m_frame_serials[m_current_frame_index] = engine.deletions->submit();
+
+    m_current_frame_index = (m_current_frame_index + 1) % m_config.frames_in_flight;
+    return ok();
+}
+
+Result<void> HeadlessTarget::wait_idle(const Engine& engine) const {
+    ASSERT(!m_recording);
+    ASSERT(engine.device != nullptr);
+
+    const auto wait_result = engine.device.waitForFences(
+        {m_config.frames_in_flight, m_frame_finished_fences.data()}, vk::True, m_config.frame_timeout_ns
+    );
+    if (wait_result != vk::Result::eSuccess)
+        return Err::CouldNotWaitForVkFence;
+    return ok();
+}
+
+static MemoryCategory get_memory_category(const vk::BufferUsageFlags usage) {
+    if (usage & (vk::BufferUsageFlagBits::eVertexBuffer | vk::BufferUsageFlagBits::eIndexBuffer))
+        return MemoryCategory::Geometry;
+    if (usage == vk::BufferUsageFlagBits::eTransferSrc)
+        return MemoryCategory::Staging;
+    return MemoryCategory::Other;
+}
+
+static MemoryCategory get_memory_category(const vk::ImageUsageFlags usage) {
+    if (usage & (vk::ImageUsageFlagBits::eColorAttachment | vk::ImageUsageFlagBits::eDepthStencilAttachment))
+        return MemoryCategory::RenderTarget;
+    if (usage & (vk::ImageUsageFlagBits::eSampled | vk::ImageUsageFlagBits::eStorage))
+        return MemoryCategory::Texture;
+    return MemoryCategory::Other;
+}
+
+void MemoryTracker::track(const VmaAllocator allocator, const VmaAllocation allocation, const MemoryCategory category) {
+    ASSERT(allocator != nullptr);
+    ASSERT(allocation != nullptr);
+    ASSERT(static_cast<usize>(category) < MemoryCategoryCount);
+
+    // Offset by one, so an allocation made outside of the tracker is told apart by its null user data
+    vmaSetAllocationUserData(allocator, allocation, reinterpret_cast<void*>(static_cast<uintptr_t>(category) + 1));
+    VmaAllocationInfo info = {};
+    vmaGetAllocationInfo(allocator, allocation, &info);
+    m_allocations[static_cast<usize>(category)].fetch_add(1, std::memory_order_relaxed);
+    m_bytes[static_cast<usize>(category)].fetch_add(info.size, std::memory_order_relaxed);
+}
+
+void MemoryTracker::untrack(const VmaAllocator allocator, const VmaAllocation allocation) {
+    ASSERT(allocator != nullptr);
+    ASSERT(allocation != nullptr);
+
+    VmaAllocationInfo info = {};
+    vmaGetAllocationInfo(allocator, allocation, &info);
+    ASSERT(info.pUserData != nullptr);
+    const usize category = reinterpret_cast<uintptr_t>(info.pUserData) - 1;
+    ASSERT(category < MemoryCategoryCount);
+    m_allocations[category].fetch_sub(1, std::memory_order_relaxed);
+    m_bytes[category].fetch_sub(info.size, std::memory_order_relaxed);
+}
+
+MemoryTracker::CategoryStats MemoryTracker::get_category(const MemoryCategory category) const {
+    ASSERT(static_cast<usize>(category) < MemoryCategoryCount);
+    return {
+        m_allocations[static_cast<usize>(category)].load(std::memory_order_relaxed),
+        m_bytes[static_cast<usize>(category)].load(std::memory_order_relaxed),
+    };
+}
+
+MemoryReport get_memory_report(const Engine& engine) {
+    ASSERT(engine.allocator != nullptr);
+    ASSERT(engine.memory != nullptr);
+
+    const VkPhysicalDeviceMemoryProperties* memory_properties = nullptr;
+    vmaGetMemoryProperties(engine.allocator, &memory_properties);
+    std::array<VmaBudget, VK_MAX_MEMORY_HEAPS> budgets = {};
+    vmaGetHeapBudgets(engine.allocator, budgets.data());
+    VmaTotalStatistics stats = {};
+    vmaCalculateStatistics(engine.allocator, &stats);
+
+    MemoryReport report = {};
+    report.heaps.resize(memory_properties->memoryHeapCount);
+    for (u32 i = 0; i < memory_properties->memoryHeapCount; ++i) {
+        report.heaps[i] = {
+            .budget = budgets[i].budget,
+            .usage = budgets[i].usage,
+            .block_bytes = stats.memoryHeap[i].statistics.blockBytes,
+            .allocation_bytes = stats.memoryHeap[i].statistics.allocationBytes,
+            .device_local = (memory_properties->memoryHeaps[i].flags & VK_MEMORY_HEAP_DEVICE_LOCAL_BIT) != 0,
+        };
+    }
+    for (usize i = 0; i < MemoryCategoryCount; ++i) {
+        report.categories[i] = engine.memory->get_category(static_cast<MemoryCategory>(i));
+    }
+
+    const auto& total = stats.total;
+    report.block_count = total.statistics.blockCount;
+    report.allocation_count = total.statistics.allocationCount;
+    report.unused_bytes = total.statistics.blockBytes - total.statistics.allocationBytes;
+    report.largest_unused_range = total.unusedRangeCount > 0 ? total.unusedRangeSizeMax : 0;
+    if (report.unused_bytes > 0) {
+        report.fragmentation = 1.0f - static_cast<f32>(
+            static_cast<f64>(report.largest_unused_range) / static_cast<f64>(report.unused_bytes)
+        );
+    }
+    return report;
+}
+
+MemoryPressure get_memory_pressure(const Engine& engine) {
+    ASSERT(engine.allocator != nullptr);
+    ASSERT(engine.memory != nullptr);
+
+    const VkPhysicalDeviceMemoryProperties* memory_properties = nullptr;
+    vmaGetMemoryProperties(engine.allocator, &memory_properties);
+    std::array<VmaBudget, VK_MAX_MEMORY_HEAPS> budgets = {};
+    vmaGetHeapBudgets(engine.allocator, budgets.data());
+
+    // Integrated gpus only have device local heaps, so host heaps never limit residency on their own
+    f64 fullest = 0.0;
+    for (u32 i = 0; i < memory_properties->memoryHeapCount; ++i) {
+        if (!(memory_properties->memoryHeaps[i].flags & VK_MEMORY_HEAP_DEVICE_LOCAL_BIT) || budgets[i].budget == 0)
+            continue;
+        fullest = std::max(fullest, static_cast<f64>(budgets[i].usage) / static_cast<f64>(budgets[i].budget));
+    }
+
+    const auto& thresholds = engine.memory->get_thresholds();
+    if (fullest >= thresholds.evict)
+        return MemoryPressure::Evict;
+    if (fullest >= thresholds.throttle)
+        return MemoryPressure::Throttle;
+    return MemoryPressure::None;
+}
+
 Result<GpuBuffer> GpuBuffer::create_result(const Engine& engine, const Config& config) {
     ASSERT(engine.allocator != nullptr);
     ASSERT(config.size != 0);
@@ -641,20 +1237,31 @@ Result<GpuBuffer> GpuBuffer::create_result(const Engine& engine, const Config& c
     } else if (config.memory_type == DeviceLocal) {
         alloc_info.usage = VMA_MEMORY_USAGE_AUTO_PREFER_DEVICE;
         alloc_info.flags = 0;
+    } else if (config.memory_type == Mapped) {
+        alloc_info.usage = VMA_MEMORY_USAGE_AUTO;
+        alloc_info.flags = VMA_ALLOCATION_CREATE_HOST_ACCESS_SEQUENTIAL_WRITE_BIT | VMA_ALLOCATION_CREATE_MAPPED_BIT;
+        alloc_info.requiredFlags = VK_MEMORY_PROPERTY_HOST_COHERENT_BIT;
     } else {
         ERROR("Invalid buffer memory type");
     }
 
     VkBuffer buffer = nullptr;
     VmaAllocation allocation = nullptr;
-    const auto buffer_result = vmaCreateBuffer(engine.allocator, &buffer_info, &alloc_info, &buffer, &allocation, nullptr);
+    VmaAllocationInfo allocation_info = {};
+    const auto buffer_result = vmaCreateBuffer(engine.allocator, &buffer_info, &alloc_info, &buffer, &allocation, &allocation_info);
+    if (buffer_result == VK_ERROR_OUT_OF_DEVICE_MEMORY || buffer_result == VK_ERROR_OUT_OF_HOST_MEMORY)
+        return Err::OutOfGpuMemory;
     if (buffer_result != VK_SUCCESS) {
         return Err::CouldNotCreateGpuBuffer;
     }
+    ASSERT(engine.memory != nullptr);
+    engine.memory->track(engine.allocator, allocation, get_memory_category(config.usage));
 
     ASSERT(allocation != nullptr);
     ASSERT(buffer != nullptr);
-    return ok<GpuBuffer>(allocation, buffer, config.memory_type);
+    if (config.memory_type == Mapped)
+        ASSERT(allocation_info.pMappedData != nullptr);
+    return ok<GpuBuffer>(allocation, buffer, config.memory_type, config.memory_type == Mapped ? allocation_info.pMappedData : nullptr);
 }
 
 Result<void> GpuBuffer::write_result(
@@ -668,6 +1275,11 @@ Result<void> GpuBuffer::write_result(
     if (memory_type == Staging)
         ASSERT(offset == 0);
 
+    if (memory_type == Mapped) {
+        ASSERT(mapped != nullptr);
+        std::memcpy(static_cast<u8*>(mapped) + offset, data, size);
+        return ok();
+    }
     if (memory_type == RandomAccess || memory_type == Staging) {
         const auto copy_result = vmaCopyMemoryToAllocation(engine.allocator, data, allocation, offset, size);
         if (copy_result != VK_SUCCESS) {
@@ -680,13 +1292,13 @@ Result<void> GpuBuffer::write_result(
     const auto staging_buffer = create_result(engine, {size, vk::BufferUsageFlagBits::eTransferSrc, Staging});
     if (staging_buffer.has_err())
         return staging_buffer.err();
-    defer(vmaDestroyBuffer(engine.allocator, staging_buffer->buffer, staging_buffer->allocation));
+    defer(staging_buffer->destroy(engine));
     const auto copy_result = vmaCopyMemoryToAllocation(engine.allocator, data, staging_buffer->allocation, 0, size);
     if (copy_result != VK_SUCCESS)
         return staging_buffer.err();
 
     auto submit = submit_single_time_commands(engine, [&](const vk::CommandBuffer cmd) {
-        cmd.copyBuffer(staging_buffer->buffer, buffer, {vk::BufferCopy(offset, 0, size)});
+        cmd.copyBuffer(staging_buffer->buffer, buffer, {vk::BufferCopy(0, offset, size)});
     });
     if (submit.has_err())
         return Err::CouldNotWriteGpuBuffer;
@@ -727,8 +1339,12 @@ Result<StagingGpuImage> StagingGpuImage::create(const Engine& engine, const Conf
     VkImage image = VK_NULL_HANDLE;
     VmaAllocation allocation = VK_NULL_HANDLE;
     const auto image_result = vmaCreateImage(engine.allocator, &image_info, &alloc_info, &image, &allocation, nullptr);
+    if (image_result == VK_ERROR_OUT_OF_DEVICE_MEMORY || image_result == VK_ERROR_OUT_OF_HOST_MEMORY)
+        return Err::OutOfGpuMemory;
     if (image_result != VK_SUCCESS)
         return Err::CouldNotCreateGpuImage;
+    ASSERT(engine.memory != nullptr);
+    engine.memory->track(engine.allocator, allocation, get_memory_category(config.usage));
 
     ASSERT(allocation != nullptr);
     ASSERT(image != nullptr);
@@ -755,7 +1371,7 @@ Result<void> StagingGpuImage::write(
     });
     if (staging_buffer.has_err())
         return staging_buffer.err();
-    defer(vmaDestroyBuffer(engine.allocator, staging_buffer->buffer, staging_buffer->allocation));
+    defer(staging_buffer->destroy(engine));
     const auto staging_write = staging_buffer->write_result(engine, data.ptr, size, 0);
     if (staging_write.has_err())
         return staging_write.err();
@@ -806,7 +1422,7 @@ Result<GpuImage> GpuImage::create_result(const Engine& engine, const Config& con
         config.extent, config.format, config.usage, config.sample_count, config.mip_levels
     });
     if (staging.has_err())
-        return Err::CouldNotCreateGpuImage;
+        return staging.err();
 
     vk::ImageViewType dimensions = vk::ImageViewType::e3D;
     if (config.extent.depth == 1) {
@@ -887,8 +1503,12 @@ Result<GpuImage> GpuImage::create_cubemap(const Engine& engine, const std::files
     VkImage image = VK_NULL_HANDLE;
     VmaAllocation allocation = VK_NULL_HANDLE;
     const auto image_result = vmaCreateImage(engine.allocator, &image_info, &alloc_info, &image, &allocation, nullptr);
+    if (image_result == VK_ERROR_OUT_OF_DEVICE_MEMORY || image_result == VK_ERROR_OUT_OF_HOST_MEMORY)
+        return Err::OutOfGpuMemory;
     if (image_result != VK_SUCCESS)
         return Err::CouldNotCreateGpuImage;
+    ASSERT(engine.memory != nullptr);
+    engine.memory->track(engine.allocator, allocation, MemoryCategory::Texture);
 
     const auto view = engine.device.createImageView({
         .image = image,
@@ -1043,10 +1663,24 @@ Result<void> GpuImage::generate_mipmaps_result(
     return ok();
 }
 
+bool is_format_sampleable(const Engine& engine, const vk::Format format) {
+    ASSERT(engine.gpu != nullptr);
+
+    const auto value = static_cast<VkFormat>(format);
+    if (value >= VK_FORMAT_BC1_RGB_UNORM_BLOCK && value <= VK_FORMAT_BC7_SRGB_BLOCK && !engine.texture_compression_bc)
+        return false;
+    if (value >= VK_FORMAT_ETC2_R8G8B8_UNORM_BLOCK && value <= VK_FORMAT_EAC_R11G11_SNORM_BLOCK && !engine.texture_compression_etc2)
+        return false;
+    if (value >= VK_FORMAT_ASTC_4x4_UNORM_BLOCK && value <= VK_FORMAT_ASTC_12x12_SRGB_BLOCK && !engine.texture_compression_astc)
+        return false;
+
+    const auto properties = engine.gpu.getFormatProperties(format);
+    return static_cast<bool>(properties.optimalTilingFeatures & vk::FormatFeatureFlagBits::eSampledImageFilterLinear);
+}
+
 Result<vk::Sampler> create_sampler_result(const Engine& engine, const SamplerConfig& config) {
     ASSERT(engine.device != nullptr);
     ASSERT(engine.gpu != nullptr);
-    ASSERT(config.mip_levels >= 1);
     const auto limits = engine.gpu.getProperties().limits;
 
     vk::SamplerCreateInfo sampler_info = {
@@ -1055,7 +1689,7 @@ Result<vk::Sampler> create_sampler_result(const Engine& engine, const SamplerCon
         .addressModeW = config.edge_mode,
         .anisotropyEnable = vk::True,
         .maxAnisotropy = limits.maxSamplerAnisotropy,
-        .maxLod = static_cast<f32>(config.mip_levels),
+        .maxLod = VK_LOD_CLAMP_NONE,
         .borderColor = vk::BorderColor::eIntOpaqueBlack,
     };
     if (config.type == SamplerType::Linear) {
@@ -1080,13 +1714,15 @@ Result<vk::Sampler> create_sampler_result(const Engine& engine, const SamplerCon
 
 Result<vk::DescriptorPool> create_descriptor_pool(
     const Engine& engine, const u32 max_sets,
-    const std::span<const vk::DescriptorPoolSize> descriptors
+    const std::span<const vk::DescriptorPoolSize> descriptors,
+    const vk::DescriptorPoolCreateFlags pool_flags
 ) {
     ASSERT(engine.device != nullptr);
     ASSERT(max_sets >= 1);
     ASSERT(!descriptors.empty());
 
     const auto pool = engine.device.createDescriptorPool({
+        .flags = pool_flags,
         .maxSets = max_sets, 
         .poolSizeCount = to_u32(descriptors.size()), 
         .pPoolSizes = descriptors.data(),
@@ -1098,10 +1734,26 @@ Result<vk::DescriptorPool> create_descriptor_pool(
     return ok(pool.value);
 }
 
+// FNV-1a
+constexpr u64 HashSeed = 0xcbf29ce484222325;
+static u64 hash_bytes(u64 hash, const void* data, const usize size) {
+    for (usize i = 0; i < size; ++i) {
+        hash ^= static_cast<const u8*>(data)[i];
+        hash *= 0x100000001b3;
+    }
+    return hash;
+}
+
+template <typename T> static u64 hash_value(const u64 hash, const T value) {
+    static_assert(std::has_unique_object_representations_v<T>);
+    return hash_bytes(hash, &value, sizeof(value));
+}
+
 Result<vk::DescriptorSetLayout> create_descriptor_set_layout(
     const Engine& engine,
     const std::span<const vk::DescriptorSetLayoutBinding> bindings,
-    const std::span<const vk::DescriptorBindingFlags> flags
+    const std::span<const vk::DescriptorBindingFlags> flags,
+    const vk::DescriptorSetLayoutCreateFlags layout_flags
 ) {
     ASSERT(engine.device != nullptr);
     ASSERT(!bindings.empty());
@@ -1114,12 +1766,25 @@ Result<vk::DescriptorSetLayout> create_descriptor_set_layout(
     };
     const auto layout = engine.device.createDescriptorSetLayout({
         .pNext = flags.empty() ? nullptr : &flag_info,
+        .flags = layout_flags,
         .bindingCount = to_u32(bindings.size()),
         .pBindings = bindings.data(),
     });
     if (layout.result != vk::Result::eSuccess)
         return Err::CouldNotCreateVkDescriptorSetLayout;
 
+    u64 hash = hash_value(HashSeed, static_cast<VkDescriptorSetLayoutCreateFlags>(layout_flags));
+    for (usize i = 0; i < bindings.size(); ++i) {
+        hash = hash_value(hash, bindings[i].binding);
+        hash = hash_value(hash, static_cast<VkDescriptorType>(bindings[i].descriptorType));
+        hash = hash_value(hash, bindings[i].descriptorCount);
+        hash = hash_value(hash, static_cast<VkShaderStageFlags>(bindings[i].stageFlags));
+        hash = hash_value(hash, flags.empty() ? 0 : static_cast<VkDescriptorBindingFlags>(flags[i]));
+    }
+    // A destroyed layout's handle can be reused, so the new layout's hash replaces the old one
+    ASSERT(engine.set_layout_hashes != nullptr);
+    engine.set_layout_hashes->insert_or_assign(static_cast<VkDescriptorSetLayout>(layout.value), hash);
+
     ASSERT(layout.value != nullptr);
     return ok(layout.value);
 }
@@ -1156,8 +1821,8 @@ Result<void> allocate_descriptor_sets(
     return ok();
 }
 
-void write_uniform_buffer_descriptor(
-    const Engine& engine, const vk::DescriptorSet set, const u32 binding,
+void write_buffer_descriptor(
+    const Engine& engine, const vk::DescriptorSet set, const u32 binding, const vk::DescriptorType type,
     const vk::Buffer buffer, const vk::DeviceSize size, const vk::DeviceSize offset,
     const u32 binding_array_index
 ) {
@@ -1172,12 +1837,28 @@ void write_uniform_buffer_descriptor(
         .dstBinding = binding,
         .dstArrayElement = binding_array_index,
         .descriptorCount = 1,
-        .descriptorType = vk::DescriptorType::eUniformBuffer,
+        .descriptorType = type,
         .pBufferInfo = &buffer_info,
     };
     engine.device.updateDescriptorSets({descriptor_write}, {});
 }
 
+void write_uniform_buffer_descriptor(
+    const Engine& engine, const vk::DescriptorSet set, const u32 binding,
+    const vk::Buffer buffer, const vk::DeviceSize size, const vk::DeviceSize offset,
+    const u32 binding_array_index
+) {
+    write_buffer_descriptor(engine, set, binding, vk::DescriptorType::eUniformBuffer, buffer, size, offset, binding_array_index);
+}
+
+void write_storage_buffer_descriptor(
+    const Engine& engine, const vk::DescriptorSet set, const u32 binding,
+    const vk::Buffer buffer, const vk::DeviceSize size, const vk::DeviceSize offset,
+    const u32 binding_array_index
+) {
+    write_buffer_descriptor(engine, set, binding, vk::DescriptorType::eStorageBuffer, buffer, size, offset, binding_array_index);
+}
+
 void write_image_sampler_descriptor(
     const Engine& engine, const vk::DescriptorSet set, const u32 binding,
     const vk::Sampler sampler, const vk::ImageView view,
@@ -1200,7 +1881,222 @@ void write_image_sampler_descriptor(
     engine.device.updateDescriptorSets({descriptor_write}, {});
 }
 
-static Result<std::vector<char>> read_shader(const std::filesystem::path path) {
+static constexpr std::array BindlessDescriptorTypes = {
+    vk::DescriptorType::eSampledImage,
+    vk::DescriptorType::eSampler,
+    vk::DescriptorType::eStorageBuffer,
+    vk::DescriptorType::eStorageImage,
+};
+
+Result<BindlessHeap> BindlessHeap::create(const Engine& engine) {
+    ASSERT(engine.device != nullptr);
+    ASSERT(engine.gpu != nullptr);
+
+    auto heap = ok<BindlessHeap>();
+
+    vk::PhysicalDeviceDescriptorIndexingProperties indexing = {};
+    vk::PhysicalDeviceProperties2 properties = {.pNext = &indexing};
+    engine.gpu.getProperties2(&properties);
+    heap->m_images.capacity = std::min({
+        MaxSampledImages,
+        indexing.maxDescriptorSetUpdateAfterBindSampledImages,
+        indexing.maxPerStageDescriptorUpdateAfterBindSampledImages,
+    });
+    heap->m_sampler_capacity = std::min({
+        MaxSamplers,
+        indexing.maxDescriptorSetUpdateAfterBindSamplers,
+        indexing.maxPerStageDescriptorUpdateAfterBindSamplers,
+    });
+    heap->m_buffers.capacity = std::min({
+        MaxStorageBuffers,
+        indexing.maxDescriptorSetUpdateAfterBindStorageBuffers,
+        indexing.maxPerStageDescriptorUpdateAfterBindStorageBuffers,
+    });
+    if (engine.storage_images) {
+        heap->m_storage_images.capacity = std::min({
+            MaxStorageImages,
+            indexing.maxDescriptorSetUpdateAfterBindStorageImages,
+            indexing.maxPerStageDescriptorUpdateAfterBindStorageImages,
+        });
+    }
+
+    const std::array counts = {
+        heap->m_images.capacity, heap->m_sampler_capacity, heap->m_buffers.capacity, heap->m_storage_images.capacity
+    };
+    std::array<vk::DescriptorPoolSize, BindlessDescriptorTypes.size()> pool_sizes = {};
+    std::array<vk::DescriptorSetLayoutBinding, BindlessDescriptorTypes.size()> bindings = {};
+    std::array<vk::DescriptorBindingFlags, BindlessDescriptorTypes.size()> binding_flags = {};
+    // The storage image binding is last, so it is simply left out when the gpu can't update it after bind
+    static_assert(StorageImageBinding == BindlessDescriptorTypes.size() - 1);
+    const u32 binding_count = engine.storage_images ? to_u32(BindlessDescriptorTypes.size()) : StorageImageBinding;
+    for (u32 i = 0; i < binding_count; ++i) {
+        ASSERT(counts[i] > 0);
+        pool_sizes[i] = {BindlessDescriptorTypes[i], counts[i]};
+        bindings[i] = {
+            i, BindlessDescriptorTypes[i], counts[i],
+            vk::ShaderStageFlagBits::eVertex | vk::ShaderStageFlagBits::eFragment | vk::ShaderStageFlagBits::eCompute
+        };
+        binding_flags[i] = vk::DescriptorBindingFlagBits::ePartiallyBound
+                         | vk::DescriptorBindingFlagBits::eUpdateAfterBind
+                         | vk::DescriptorBindingFlagBits::eUpdateUnusedWhilePending;
+    }
+
+    const auto pool = create_descriptor_pool(
+        engine, 1, std::span{pool_sizes}.first(binding_count), vk::DescriptorPoolCreateFlagBits::eUpdateAfterBind
+    );
+    if (pool.has_err())
+        return pool.err();
+    heap->m_pool = *pool;
+
+    const auto set_layout = create_descriptor_set_layout(
+        engine, std::span{bindings}.first(binding_count), std::span{binding_flags}.first(binding_count),
+        vk::DescriptorSetLayoutCreateFlagBits::eUpdateAfterBindPool
+    );
+    if (set_layout.has_err())
+        return set_layout.err();
+    heap->m_set_layout = *set_layout;
+
+    const auto set = allocate_descriptor_set(engine, heap->m_pool, heap->m_set_layout);
+    if (set.has_err())
+        return set.err();
+    heap->m_set = *set;
+
+    ASSERT(heap->m_pool != nullptr);
+    ASSERT(heap->m_set_layout != nullptr);
+    ASSERT(heap->m_set != nullptr);
+    return heap;
+}
+
+void BindlessHeap::destroy(const Engine& engine) const {
+    ASSERT(engine.device != nullptr);
+
+    for (const auto& [config, sampler] : m_samplers) {
+        ASSERT(sampler != nullptr);
+        engine.device.destroySampler(sampler);
+    }
+
+    ASSERT(m_set_layout != nullptr);
+    engine.device.destroyDescriptorSetLayout(m_set_layout);
+    ASSERT(m_pool != nullptr);
+    engine.device.destroyDescriptorPool(m_pool);
+}
+
+Result<u32> BindlessHeap::Slots::alloc() {
+    if (!free.empty()) {
+        const u32 index = free.back();
+        free.pop_back();
+        return ok(index);
+    }
+    if (count == capacity)
+        return Err::BindlessHeapFull;
+    return ok(count++);
+}
+
+Result<u32> BindlessHeap::add_sampled_image(const vk::ImageView view, const vk::ImageLayout layout) {
+    ASSERT(view != nullptr);
+
+    const auto index = m_images.alloc();
+    if (index.has_err())
+        return index.err();
+    m_writes.push_back({.binding = SampledImageBinding, .index = *index, .image = {nullptr, view, layout}});
+
+    ASSERT(*index < m_images.capacity);
+    return index;
+}
+
+Result<u32> BindlessHeap::add_storage_buffer(const vk::Buffer buffer, const vk::DeviceSize size, const vk::DeviceSize offset) {
+    ASSERT(buffer != nullptr);
+    ASSERT(size > 0);
+
+    const auto index = m_buffers.alloc();
+    if (index.has_err())
+        return index.err();
+    m_writes.push_back({.binding = StorageBufferBinding, .index = *index, .buffer = {buffer, offset, size}});
+
+    ASSERT(*index < m_buffers.capacity);
+    return index;
+}
+
+Result<u32> BindlessHeap::add_storage_image(const vk::ImageView view) {
+    ASSERT(view != nullptr);
+    ASSERT(m_storage_images.capacity > 0);
+
+    const auto index = m_storage_images.alloc();
+    if (index.has_err())
+        return index.err();
+    m_writes.push_back({.binding = StorageImageBinding, .index = *index, .image = {nullptr, view, vk::ImageLayout::eGeneral}});
+
+    ASSERT(*index < m_storage_images.capacity);
+    return index;
+}
+
+void BindlessHeap::remove_sampled_image(const Engine& engine, const u32 index) {
+    ASSERT(engine.deletions != nullptr);
+    ASSERT(index < m_images.count);
+
+    // The stale descriptor is left in place, it is partially bound and never read until the index is rewritten
+    engine.deletions->push([this, index](const Engine&) { m_images.free.push_back(index); });
+}
+
+void BindlessHeap::remove_storage_buffer(const Engine& engine, const u32 index) {
+    ASSERT(engine.deletions != nullptr);
+    ASSERT(index < m_buffers.count);
+
+    engine.deletions->push([this, index](const Engine&) { m_buffers.free.push_back(index); });
+}
+
+void BindlessHeap::remove_storage_image(const Engine& engine, const u32 index) {
+    ASSERT(engine.deletions != nullptr);
+    ASSERT(index < m_storage_images.count);
+
+    engine.deletions->push([this, index](const Engine&) { m_storage_images.free.push_back(index); });
+}
+
+Result<u32> BindlessHeap::get_sampler(const Engine& engine, const SamplerConfig& config) {
+    const auto cached = std::ranges::find(m_samplers, config, &std::pair<SamplerConfig, vk::Sampler>::first);
+    if (cached != m_samplers.end())
+        return ok(to_u32(cached - m_samplers.begin()));
+
+    if (m_samplers.size() == m_sampler_capacity)
+        return Err::BindlessHeapFull;
+    const auto sampler = create_sampler_result(engine, config);
+    if (sampler.has_err())
+        return sampler.err();
+
+    const u32 index = to_u32(m_samplers.size());
+    m_samplers.emplace_back(config, *sampler);
+    m_writes.push_back({.binding = SamplerBinding, .index = index, .image = {*sampler, nullptr, vk::ImageLayout::eUndefined}});
+
+    ASSERT(index < m_sampler_capacity);
+    return ok(index);
+}
+
+void BindlessHeap::flush_writes(const Engine& engine) {
+    ASSERT(engine.device != nullptr);
+    ASSERT(m_set != nullptr);
+
+    if (m_writes.empty())
+        return;
+
+    std::vector<vk::WriteDescriptorSet> writes = {};
+    writes.reserve(m_writes.size());
+    for (const auto& write : m_writes) {
+        const bool is_buffer = write.binding == StorageBufferBinding;
+        writes.push_back({
+            .dstSet = m_set,
+            .dstBinding = write.binding,
+            .dstArrayElement = write.index,
+            .descriptorCount = 1,
+            .descriptorType = BindlessDescriptorTypes[write.binding],
+            .pImageInfo = is_buffer ? nullptr : &write.image,
+            .pBufferInfo = is_buffer ? &write.buffer : nullptr,
+        });
+    }
+    engine.device.updateDescriptorSets(writes, {});
+    m_writes.clear();
+}
+
+static Result<std::vector<char>> read_shader(const std::filesystem::path& path) {
     ASSERT(!path.empty());
 
     auto file = std::ifstream{path, std::ios::ate | std::ios::binary};
@@ -1217,38 +2113,258 @@ static Result<std::vector<char>> read_shader(const std::filesystem::path path) {
     if (code->empty())
         return Err::ShaderFileInvalid;
 
+    // Binary shader code has to be 16 byte aligned, which operator new already guarantees
+    ASSERT(reinterpret_cast<uptr>(code->data()) % 16 == 0);
     ASSERT(!code->empty());
     return code;
 }
 
+// Prefixes each file in Engine::shader_cache. Drivers reject binaries from another shaderBinaryUUID or
+// shaderBinaryVersion themselves, the device and driver version are checked too so a stale file is never handed over.
+struct ShaderCacheHeader {
+    std::array<char, 4> magic = {'h', 'g', 's', 'b'};
+    u32 version = 1;
+    u64 key = 0;
+    std::array<u8, VK_UUID_SIZE> device_uuid = {};
+    std::array<u8, VK_UUID_SIZE> binary_uuid = {};
+    u32 driver_version = 0;
+    u32 binary_version = 0;
+    u64 size = 0;
+
+    bool operator==(const ShaderCacheHeader&) const = default;
+};
+
+static ShaderCacheHeader get_shader_cache_header(const Engine& engine) {
+    ASSERT(engine.gpu != nullptr);
+
+    vk::PhysicalDeviceShaderObjectPropertiesEXT shader_object = {};
+    vk::PhysicalDeviceIDProperties ids = {.pNext = &shader_object};
+    vk::PhysicalDeviceProperties2 properties = {.pNext = &ids};
+    engine.gpu.getProperties2(&properties);
+
+    ShaderCacheHeader header = {
+        .driver_version = properties.properties.driverVersion,
+        .binary_version = shader_object.shaderBinaryVersion,
+    };
+    std::memcpy(header.device_uuid.data(), ids.deviceUUID.data(), VK_UUID_SIZE);
+    std::memcpy(header.binary_uuid.data(), shader_object.shaderBinaryUUID.data(), VK_UUID_SIZE);
+    return header;
+}
+
+// Everything in the create info that changes the compiled binary. Set layouts are handles which differ between runs,
+// so the bindings recorded when each layout was created are hashed instead.
+static u64 hash_shader(const Engine& engine, u64 hash, const ShaderConfig& config, const std::span<const char> code, const vk::ShaderCreateFlagsEXT flags) {
+    hash = hash_bytes(hash, code.data(), code.size());
+    hash = hash_value(hash, static_cast<VkShaderStageFlags>(config.stage));
+    hash = hash_value(hash, static_cast<VkShaderStageFlags>(config.next_stage));
+    hash = hash_value(hash, static_cast<VkShaderCreateFlagsEXT>(flags));
+    hash = hash_value(hash, config.set_layouts.size());
+    for (const auto layout : config.set_layouts) {
+        ASSERT(engine.set_layout_hashes->contains(static_cast<VkDescriptorSetLayout>(layout)));
+        hash = hash_value(hash, engine.set_layout_hashes->at(static_cast<VkDescriptorSetLayout>(layout)));
+    }
+    for (const auto& range : config.push_ranges) {
+        hash = hash_value(hash, static_cast<VkShaderStageFlags>(range.stageFlags));
+        hash = hash_value(hash, range.offset);
+        hash = hash_value(hash, range.size);
+    }
+    if (config.specialization != nullptr) {
+        for (u32 i = 0; i < config.specialization->mapEntryCount; ++i) {
+            const auto& entry = config.specialization->pMapEntries[i];
+            hash = hash_value(hash, entry.constantID);
+            hash = hash_value(hash, entry.offset);
+            hash = hash_value(hash, entry.size);
+        }
+        hash = hash_bytes(hash, config.specialization->pData, config.specialization->dataSize);
+    }
+    return hash;
+}
+
+static std::filesystem::path get_shader_cache_path(const Engine& engine, const u64 key) {
+    return engine.shader_cache / std::format("{:016x}.bin", key);
+}
+
+// Missing, truncated and mismatched files all just mean the shader is compiled again
+static std::optional<std::vector<char>> load_shader_binary(const Engine& engine, ShaderCacheHeader expected) {
+    ASSERT(!engine.shader_cache.empty());
+
+    auto file = std::ifstream{get_shader_cache_path(engine, expected.key), std::ios::binary};
+    if (!file.is_open())
+        return std::nullopt;
+
+    ShaderCacheHeader header = {};
+    if (!file.read(reinterpret_cast<char*>(&header), sizeof(header)))
+        return std::nullopt;
+    expected.size = header.size;
+    if (header != expected || header.size == 0)
+        return std::nullopt;
+
+    std::vector<char> data(header.size);
+    if (!file.read(data.data(), static_cast<std::streamsize>(data.size())))
+        return std::nullopt;
+
+    ASSERT(reinterpret_cast<uptr>(data.data()) % 16 == 0);
+    return data;
+}
+
+// Best effort, a cache that can't be written only costs the next startup its compile
+static void save_shader_binary(const Engine& engine, ShaderCacheHeader header, const vk::ShaderEXT shader) {
+    ASSERT(engine.device != nullptr);
+    ASSERT(!engine.shader_cache.empty());
+    ASSERT(shader != nullptr);
+
+    usize size = 0;
+    if (engine.device.getShaderBinaryDataEXT(shader, &size, nullptr) != vk::Result::eSuccess || size == 0)
+        return;
+    std::vector<char> data(size);
+    if (engine.device.getShaderBinaryDataEXT(shader, &size, data.data()) != vk::Result::eSuccess)
+        return;
+    header.size = size;
+
+    std::error_code error = {};
+    std::filesystem::create_directories(engine.shader_cache, error);
+    if (error)
+        return;
+
+    // Written beside the cached file and renamed over it, so a reader never sees half a binary
+    const auto path = get_shader_cache_path(engine, header.key);
+    auto temp_path = path;
+    temp_path += std::format(".{}.tmp", std::hash<std::thread::id>{}(std::this_thread::get_id()));
+    {
+        auto file = std::ofstream{temp_path, std::ios::binary | std::ios::trunc};
+        if (!file.is_open())
+            return;
+        file.write(reinterpret_cast<const char*>(&header), sizeof(header));
+        file.write(data.data(), static_cast<std::streamsize>(data.size()));
+        if (!file)
+            return;
+    }
+    std::filesystem::rename(temp_path, path, error);
+    if (error)
+        std::filesystem::remove(temp_path, error);
+}
+
+static void destroy_created_shaders(const Engine& engine, const std::span<vk::ShaderEXT> shaders) {
+    for (auto& shader : shaders) {
+        if (shader != nullptr)
+            engine.device.destroyShaderEXT(shader);
+        shader = nullptr;
+    }
+}
+
+// Shaders found in Engine::shader_cache are created from their driver binaries, skipping the spirv compile.
+// When any is missing or the driver rejects it, the whole set is created from spirv and cached for next time.
+static Result<void> create_shaders(
+    const Engine& engine,
+    const std::span<vk::ShaderEXT> out_shaders,
+    const std::span<const ShaderConfig> configs,
+    const bool linked
+) {
+    ASSERT(engine.device != nullptr);
+    ASSERT(out_shaders.size() == configs.size());
+
+    // Each file is read on its own thread, a set's stages usually aren't near each other on disk
+    std::vector<std::future<Result<std::vector<char>>>> reads = {};
+    reads.reserve(configs.size());
+    for (const auto& config : configs) {
+        reads.push_back(std::async(std::launch::async, [&config] { return read_shader(config.path); }));
+    }
+    std::vector<std::vector<char>> codes = {};
+    codes.reserve(configs.size());
+    for (auto& read : reads) {
+        auto code = read.get();
+        if (code.has_err())
+            return code.err();
+        codes.emplace_back(std::move(*code));
+    }
+
+    std::vector<vk::ShaderCreateFlagsEXT> flags = {};
+    flags.reserve(configs.size());
+    for (const auto& config : configs) {
+        flags.push_back(linked ? config.flags | vk::ShaderCreateFlagBitsEXT::eLinkStage : config.flags);
+    }
+
+    const auto create = [&](const std::span<const std::vector<char>> code, const bool binary) {
+        std::vector<vk::ShaderCreateInfoEXT> shader_infos = {};
+        shader_infos.reserve(configs.size());
+        for (usize i = 0; i < configs.size(); ++i) {
+            shader_infos.push_back({
+                .flags = flags[i],
+                .stage = configs[i].stage,
+                .nextStage = configs[i].next_stage,
+                .codeType = binary ? vk::ShaderCodeTypeEXT::eBinary : configs[i].code_type,
+                .codeSize = code[i].size(),
+                .pCode = code[i].data(),
+                .pName = "main",
+                .setLayoutCount = to_u32(configs[i].set_layouts.size()),
+                .pSetLayouts = configs[i].set_layouts.data(),
+                .pushConstantRangeCount = to_u32(configs[i].push_ranges.size()),
+                .pPushConstantRanges = configs[i].push_ranges.data(),
+                .pSpecializationInfo = configs[i].specialization,
+            });
+        }
+        // Shaders can be created even when others in the set fail, which would leak
+        const auto result = engine.device.createShadersEXT(to_u32(shader_infos.size()), shader_infos.data(), nullptr, out_shaders.data());
+        if (result != vk::Result::eSuccess)
+            destroy_created_shaders(engine, out_shaders);
+        return result == vk::Result::eSuccess;
+    };
+
+    const bool cache = !engine.shader_cache.empty() && std::ranges::all_of(configs, [](const ShaderConfig& config) {
+        return config.code_type == vk::ShaderCodeTypeEXT::eSpirv;
+    });
+    if (!cache) {
+        if (!create(codes, false))
+            return Err::CouldNotCreateVkShader;
+        return ok();
+    }
+
+    // Linked shaders are compiled against each other, so each one's key covers the whole set
+    u64 set_key = HashSeed;
+    for (usize i = 0; i < configs.size(); ++i) {
+        set_key = hash_shader(engine, set_key, configs[i], codes[i], flags[i]);
+    }
+    const auto header = get_shader_cache_header(engine);
+    std::vector<ShaderCacheHeader> headers(configs.size(), header);
+    for (usize i = 0; i < configs.size(); ++i) {
+        headers[i].key = hash_value(set_key, i);
+    }
+
+    std::vector<std::future<std::optional<std::vector<char>>>> loads = {};
+    loads.reserve(configs.size());
+    for (const auto& h : headers) {
+        loads.push_back(std::async(std::launch::async, [&engine, &h] { return load_shader_binary(engine, h); }));
+    }
+    std::vector<std::vector<char>> binaries = {};
+    binaries.reserve(configs.size());
+    for (auto& load : loads) {
+        auto binary = load.get();
+        if (binary.has_value())
+            binaries.emplace_back(std::move(*binary));
+    }
+    if (binaries.size() == configs.size() && create(binaries, true))
+        return ok();
+
+    if (!create(codes, false))
+        return Err::CouldNotCreateVkShader;
+    for (usize i = 0; i < configs.size(); ++i) {
+        save_shader_binary(engine, headers[i], out_shaders[i]);
+    }
+    return ok();
+}
+
 Result<vk::ShaderEXT> create_unlinked_shader(const Engine& engine, const ShaderConfig& config) {
     ASSERT(engine.device != nullptr);
     ASSERT(!config.path.empty());
-    ASSERT(config.code_type == vk::ShaderCodeTypeEXT::eSpirv && "binary shader code types untested");
     ASSERT(config.stage != vk::ShaderStageFlagBits{0});
 
-    const auto code = read_shader(config.path);
-    if (code.has_err())
-        return code.err();
-
-    const auto shader = engine.device.createShaderEXT({
-        .flags = config.flags,
-        .stage = config.stage,
-        .nextStage = config.next_stage,
-        .codeType = config.code_type,
-        .codeSize = code->size(),
-        .pCode = code->data(),
-        .pName = "main",
-        .setLayoutCount = to_u32(config.set_layouts.size()),
-        .pSetLayouts = config.set_layouts.data(),
-        .pushConstantRangeCount = to_u32(config.push_ranges.size()),
-        .pPushConstantRanges = config.push_ranges.data(),
-    });
-    if (shader.result != vk::Result::eSuccess)
-        return Err::CouldNotCreateVkShader;
+    auto shader = ok<vk::ShaderEXT>();
+    const auto created = create_shaders(engine, {&*shader, 1}, {&config, 1}, false);
+    if (created.has_err())
+        return created.err();
 
-    ASSERT(shader.value != nullptr);
-    return ok(shader.value);
+    ASSERT(*shader != nullptr);
+    return shader;
 }
 
 Result<void> create_linked_shaders(
@@ -1265,44 +2381,12 @@ Result<void> create_linked_shaders(
     }
     for (const auto& config : configs) {
         ASSERT(!config.path.empty());
-        ASSERT(config.code_type == vk::ShaderCodeTypeEXT::eSpirv && "binary shader code types untested");
         ASSERT(config.stage != vk::ShaderStageFlagBits{0});
     }
 
-    std::vector<std::vector<char>> codes = {};
-    codes.reserve(configs.size());
-    for (const auto& config : configs) {
-        ASSERT(!config.path.empty());
-        ASSERT(config.code_type == vk::ShaderCodeTypeEXT::eSpirv && "binary shader code types untested");
-        ASSERT(config.stage != vk::ShaderStageFlagBits{0});
-
-        const auto code = read_shader(config.path);
-        if (code.has_err())
-            return code.err();
-        codes.emplace_back(std::move(*code));
-    }
-
-    std::vector<vk::ShaderCreateInfoEXT> shader_infos = {};
-    shader_infos.reserve(configs.size());
-    for (usize i = 0; i < codes.size(); ++i) {
-        shader_infos.push_back({
-            .flags = configs[i].flags | vk::ShaderCreateFlagBitsEXT::eLinkStage,
-            .stage = configs[i].stage,
-            .nextStage = configs[i].next_stage,
-            .codeType = configs[i].code_type,
-            .codeSize = codes[i].size(),
-            .pCode = codes[i].data(),
-            .pName = "main",
-            .setLayoutCount = to_u32(configs[i].set_layouts.size()),
-            .pSetLayouts = configs[i].set_layouts.data(),
-            .pushConstantRangeCount = to_u32(configs[i].push_ranges.size()),
-            .pPushConstantRanges = configs[i].push_ranges.data(),
-        });
-    }
-
-    const auto shader_result = engine.device.createShadersEXT(to_u32(shader_infos.size()), shader_infos.data(), nullptr, out_shaders.data());
-    if (shader_result != vk::Result::eSuccess)
-        return Err::CouldNotCreateVkShader;
+    const auto created = create_shaders(engine, out_shaders, configs, true);
+    if (created.has_err())
+        return created.err();
 
     for (const auto shader : out_shaders) {
         ASSERT(shader != nullptr);
@@ -1361,4 +2445,104 @@ Result<void> end_single_time_commands(const Engine& engine, const vk::CommandBuf
     return ok();
 }
 
+void cmd_set_default_state(const vk::CommandBuffer cmd, const vk::Extent2D extent) {
+    ASSERT(cmd != nullptr);
+    ASSERT(extent.width > 0);
+    ASSERT(extent.height > 0);
+
+    const vk::Viewport viewport = {
+        0.0f, 0.0f,
+        static_cast<f32>(extent.width), static_cast<f32>(extent.height),
+        0.0f, 1.0f,
+    };
+    cmd.setViewportWithCount({viewport});
+    const vk::Rect2D scissor = {{0, 0}, extent};
+    cmd.setScissorWithCount({scissor});
+
+    cmd.setRasterizerDiscardEnable(vk::False);
+    cmd.setPrimitiveRestartEnable(vk::False);
+    cmd.setPrimitiveTopology(vk::PrimitiveTopology::eTriangleList);
+    cmd.setPolygonModeEXT(vk::PolygonMode::eFill);
+    cmd.setFrontFace(vk::FrontFace::eCounterClockwise);
+    cmd.setCullMode(vk::CullModeFlagBits::eNone);
+    cmd.setDepthTestEnable(vk::True);
+    cmd.setDepthWriteEnable(vk::True);
+    cmd.setDepthCompareOp(vk::CompareOp::eLess);
+    cmd.setDepthBiasEnable(vk::False);
+    cmd.setStencilTestEnable(vk::False);
+    cmd.setRasterizationSamplesEXT(vk::SampleCountFlagBits::e1);
+    cmd.setSampleMaskEXT(vk::SampleCountFlagBits::e1, vk::SampleMask{0xff});
+    cmd.setAlphaToCoverageEnableEXT(vk::False);
+    cmd.setColorWriteMaskEXT(0, {
+        vk::ColorComponentFlagBits::eR | vk::ColorComponentFlagBits::eG |
+        vk::ColorComponentFlagBits::eB | vk::ColorComponentFlagBits::eA
+    });
+    cmd.setColorBlendEnableEXT(0, {vk::False});
+}
+
+void cmd_generate_mipmaps(
+    const vk::CommandBuffer cmd, const vk::Image image, const u32 mip_levels, const vk::Extent3D extent,
+    const vk::ImageLayout current_layout, const vk::ImageLayout final_layout
+) {
+    ASSERT(cmd != nullptr);
+    ASSERT(image != nullptr);
+    ASSERT(mip_levels > 1);
+    ASSERT(extent.width > 0);
+    ASSERT(extent.height > 0);
+    ASSERT(extent.depth > 0);
+    ASSERT(final_layout != vk::ImageLayout::eUndefined);
+
+    vk::Offset3D mip_offset = {to_i32(extent.width), to_i32(extent.height), to_i32(extent.depth)};
+
+    BarrierBuilder(cmd)
+        .add_image_barrier(image, {vk::ImageAspectFlagBits::eColor, 0, 1, 0, 1})
+        .set_image_src(vk::PipelineStageFlagBits2::eAllCommands, vk::AccessFlagBits2::eMemoryWrite, current_layout)
+        .set_image_dst(vk::PipelineStageFlagBits2::eTransfer, vk::AccessFlagBits2::eTransferRead, vk::ImageLayout::eTransferSrcOptimal)
+        .build_and_run();
+
+    for (u32 level = 0; level < mip_levels - 1; ++level) {
+        // Chained to the first barrier, so earlier reads of the level finish before it is overwritten
+        BarrierBuilder(cmd)
+            .add_image_barrier(image, {vk::ImageAspectFlagBits::eColor, level + 1, 1, 0, 1})
+            .set_image_src(vk::PipelineStageFlagBits2::eTransfer, vk::AccessFlagBits2::eNone, vk::ImageLayout::eUndefined)
+            .set_image_dst(vk::PipelineStageFlagBits2::eTransfer, vk::AccessFlagBits2::eTransferWrite, vk::ImageLayout::eTransferDstOptimal)
+            .build_and_run();
+
+        vk::ImageBlit2 region = {
+            .srcSubresource = {vk::ImageAspectFlagBits::eColor, level, 0, 1},
+            .dstSubresource = {vk::ImageAspectFlagBits::eColor, level + 1, 0, 1},
+        };
+        region.srcOffsets[1] = mip_offset;
+        if (mip_offset.x > 1)
+            mip_offset.x /= 2;
+        if (mip_offset.y > 1)
+            mip_offset.y /= 2;
+        if (mip_offset.z > 1)
+            mip_offset.z /= 2;
+        region.dstOffsets[1] = mip_offset;
+
+        cmd.blitImage2({
+            .srcImage = image,
+            .srcImageLayout = vk::ImageLayout::eTransferSrcOptimal,
+            .dstImage = image,
+            .dstImageLayout = vk::ImageLayout::eTransferDstOptimal,
+            .regionCount = 1,
+            .pRegions = &region,
+            .filter = vk::Filter::eLinear,
+        });
+
+        BarrierBuilder(cmd)
+            .add_image_barrier(image, {vk::ImageAspectFlagBits::eColor, level + 1, 1, 0, 1})
+            .set_image_src(vk::PipelineStageFlagBits2::eTransfer, vk::AccessFlagBits2::eTransferWrite, vk::ImageLayout::eTransferDstOptimal)
+            .set_image_dst(vk::PipelineStageFlagBits2::eTransfer, vk::AccessFlagBits2::eTransferRead, vk::ImageLayout::eTransferSrcOptimal)
+            .build_and_run();
+    }
+
+    BarrierBuilder(cmd)
+        .add_image_barrier(image, {vk::ImageAspectFlagBits::eColor, 0, mip_levels, 0, 1})
+        .set_image_src(vk::PipelineStageFlagBits2::eTransfer, vk::AccessFlagBits2::eTransferRead, vk::ImageLayout::eTransferSrcOptimal)
+        .set_image_dst(vk::PipelineStageFlagBits2::eAllCommands, vk::AccessFlagBits2::eMemoryRead, final_layout)
+        .build_and_run();
+}
+
 } // namespace hg
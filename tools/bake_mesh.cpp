@@ -0,0 +1,52 @@
+#include "hg_utils.h"
+#include "hg_load.h"
+
+#include <filesystem>
+#include <format>
+#include <iostream>
+
+using namespace hg;
+
+// Bakes every .gltf under the input directory into a .hgmesh at the same relative path in the output directory
+int main(const int argc, const char* argv[]) {
+    if (argc != 3) {
+        std::cerr << std::format("usage: {} <gltf directory> <output directory>\n", argv[0]);
+        return 1;
+    }
+    const std::filesystem::path input = argv[1];
+    const std::filesystem::path output = argv[2];
+    if (!std::filesystem::is_directory(input)) {
+        std::cerr << std::format("{} is not a directory\n", input.string());
+        return 1;
+    }
+
+    Timer timer = {};
+    usize baked = 0;
+    usize failed = 0;
+    for (const auto& entry : std::filesystem::recursive_directory_iterator(input)) {
+        if (!entry.is_regular_file() || entry.path().extension() != ".gltf")
+            continue;
+
+        const auto model = ModelData::load_gltf(entry.path());
+        if (model.has_err()) {
+            std::cerr << std::format("{}: {}\n", entry.path().string(), to_string(model.err()));
+            ++failed;
+            continue;
+        }
+
+        auto baked_path = output / std::filesystem::relative(entry.path(), input);
+        baked_path.replace_extension(".hgmesh");
+        std::filesystem::create_directories(baked_path.parent_path());
+
+        const auto save = BakedModel::save(baked_path, model->mesh, model->roughness, model->metalness);
+        if (save.has_err()) {
+            std::cerr << std::format("{}: {}\n", baked_path.string(), to_string(save.err()));
+            ++failed;
+            continue;
+        }
+        ++baked;
+    }
+
+    timer.stop(std::format("Baked {} meshes, {} failed", baked, failed));
+    return failed == 0 ? 0 : 1;
+}
@@ -0,0 +1,301 @@
+#include "hg_utils.h"
+#include <hurdy_gurdy.h>
+
+#include <algorithm>
+#include <bit>
+#include <charconv>
+#include <cstring>
+#include <format>
+#include <fstream>
+#include <iostream>
+#include <string>
+#include <string_view>
+#include <vector>
+
+using namespace hg;
+
+namespace {
+
+struct BenchConfig {
+    u32 tiles = 1024;
+    u32 lights = 64;
+    u32 models = 8;
+    u32 warmup_frames = 60;
+    u32 frames = 600;
+    u32 width = 1920;
+    u32 height = 1080;
+    u32 samples = 4;
+    f32 render_scale = 1.0f;
+    bool depth_prepass = true;
+    std::string output = {};
+};
+
+constexpr std::string_view Usage =
+    "usage: {} [--tiles N] [--lights M] [--models K] [--warmup F] [--frames F] [--width W] [--height H]\n"
+    "          [--samples S] [--scale R] [--no-prepass] [--output path]\n";
+
+[[nodiscard]] bool parse_u32(const std::string_view text, u32& out) {
+    const auto result = std::from_chars(text.data(), text.data() + text.size(), out);
+    return result.ec == std::errc{} && result.ptr == text.data() + text.size();
+}
+
+[[nodiscard]] bool parse_args(const int argc, const char* argv[], BenchConfig& config) {
+    for (int i = 1; i < argc; ++i) {
+        const std::string_view arg = argv[i];
+        if (arg == "--no-prepass") {
+            config.depth_prepass = false;
+            continue;
+        }
+        if (i + 1 >= argc)
+            return false;
+        const std::string_view value = argv[++i];
+
+        if (arg == "--output") {
+            config.output = value;
+        } else if (arg == "--scale") {
+            config.render_scale = std::strtof(std::string{value}.c_str(), nullptr);
+            if (!(config.render_scale > 0.0f && config.render_scale <= 1.0f))
+                return false;
+        } else {
+            u32* target = arg == "--tiles" ? &config.tiles
+                        : arg == "--lights" ? &config.lights
+                        : arg == "--models" ? &config.models
+                        : arg == "--warmup" ? &config.warmup_frames
+                        : arg == "--frames" ? &config.frames
+                        : arg == "--width" ? &config.width
+                        : arg == "--height" ? &config.height
+                        : arg == "--samples" ? &config.samples
+                        : nullptr;
+            if (target == nullptr || !parse_u32(value, *target))
+                return false;
+        }
+    }
+    return config.models > 0 && config.frames > 0 && config.width > 0 && config.height > 0
+        && std::has_single_bit(config.samples) && config.samples <= 64
+        && config.lights <= DefaultPipeline::MaxLights && config.tiles <= PbrRenderer::MaxInstances;
+}
+
+// Milliseconds, as a json object
+[[nodiscard]] std::string summarize(std::vector<f64> samples) {
+    if (samples.empty())
+        return "null";
+    std::ranges::sort(samples);
+    f64 sum = 0.0;
+    for (const f64 sample : samples) {
+        sum += sample;
+    }
+    const auto percentile = [&](const f64 p) {
+        return samples[std::min(samples.size() - 1, static_cast<usize>(p * static_cast<f64>(samples.size())))];
+    };
+    return std::format(
+        R"({{"mean": {:.4f}, "median": {:.4f}, "p95": {:.4f}, "p99": {:.4f}, "max": {:.4f}, "samples": {}}})",
+        sum / static_cast<f64>(samples.size()), percentile(0.5), percentile(0.95), percentile(0.99), samples.back(),
+        samples.size()
+    );
+}
+
+#define errf(e) std::format("{} error: {}", #e, to_string(e.err()))
+
+} // namespace
+
+// Renders a generated scene with no window and prints its frame timings, upload throughput and memory use as json,
+// so regressions can be tracked per commit on machines without a display
+int main(const int argc, const char* argv[]) {
+    BenchConfig config = {};
+    if (!parse_args(argc, argv, config)) {
+        std::cerr << std::format(Usage, argv[0]);
+        return 1;
+    }
+
+    const auto engine = Engine::create({.headless = true});
+    if (engine.has_err())
+        ERROR(errf(engine));
+    defer(engine->destroy());
+
+    auto uploads = UploadQueue::create(*engine, {});
+    if (uploads.has_err())
+        ERROR(errf(uploads));
+    defer(uploads->destroy(*engine));
+
+    auto target = HeadlessTarget::create(*engine, {.width = config.width, .height = config.height});
+    if (target.has_err())
+        ERROR(errf(target));
+    defer(target->destroy(*engine));
+
+    auto pipeline = DefaultPipeline::create(*engine, target->extent());
+    if (pipeline.has_err())
+        ERROR(errf(pipeline));
+    defer(pipeline->destroy(*engine));
+    const auto samples = pipeline->set_sample_count(*engine, static_cast<vk::SampleCountFlagBits>(config.samples));
+    if (samples.has_err())
+        ERROR(errf(samples));
+    pipeline->set_render_scale(config.render_scale);
+    pipeline->set_depth_prepass(config.depth_prepass);
+
+    auto model_renderer = PbrRenderer::create(*engine, *pipeline);
+    if (model_renderer.has_err())
+        ERROR(errf(model_renderer));
+    defer(model_renderer->destroy(*engine));
+    pipeline->add_render_system(*model_renderer);
+
+    // Every model is a unique mesh, so the draws can't be merged across them
+    const auto upload_begin_ns = Profiler::now_ns();
+    const u64 upload_begin_bytes = uploads->staged_bytes();
+
+    std::array<glm::vec4, 4> normal_image = {};
+    normal_image.fill(glm::vec4{0.0f, 0.0f, -1.0f, 0.0f});
+    const auto normal_texture = model_renderer->load_texture_from_data(
+        *engine, *uploads, {normal_image.data(), sizeof(glm::vec4), {2, 2, 1}}, vk::Format::eR32G32B32A32Sfloat
+    );
+    if (normal_texture.has_err())
+        ERROR(errf(normal_texture));
+    std::array<u32, 4> gray_image = {};
+    gray_image.fill(0xff777777);
+    const auto gray_texture = model_renderer->load_texture_from_data(*engine, *uploads, {gray_image.data(), 4, {2, 2, 1}});
+    if (gray_texture.has_err())
+        ERROR(errf(gray_texture));
+
+    std::vector<PbrRenderer::ModelHandle> models = {};
+    models.reserve(config.models);
+    for (u32 i = 0; i < config.models; ++i) {
+        const auto model = model_renderer->load_model_from_data(
+            *engine, *uploads, generate_sphere({16 + i * 4, 8 + i * 2}), *normal_texture, *gray_texture, 0.5f, 0.0f,
+            PbrRenderer::VertexFormat::Packed
+        );
+        if (model.has_err())
+            ERROR(errf(model));
+        models.push_back(*model);
+    }
+
+    const auto scene_uploads = uploads->flush(*engine);
+    if (scene_uploads.has_err())
+        ERROR(errf(scene_uploads));
+    const auto scene_wait = uploads->wait(*engine, *scene_uploads);
+    if (scene_wait.has_err())
+        ERROR(errf(scene_wait));
+    const f64 upload_sec = static_cast<f64>(Profiler::now_ns() - upload_begin_ns) / 1e9;
+    const u64 upload_bytes = uploads->staged_bytes() - upload_begin_bytes;
+
+    // Tiles fill a hexagon of axial coordinates row by row, cycling through the models
+    const HashRng rng{0};
+    const i32 rings = static_cast<i32>(std::ceil(std::sqrt(static_cast<f32>(config.tiles) / 3.0f))) + 1;
+    u32 placed = 0;
+    for (i32 q = -rings; q <= rings && placed < config.tiles; ++q) {
+        for (i32 r = std::max(-rings, -q - rings); r <= std::min(rings, -q + rings) && placed < config.tiles; ++r) {
+            const glm::vec3 position = {
+                static_cast<f32>(q) * 1.5f,
+                0.0f,
+                (static_cast<f32>(r) + static_cast<f32>(q) * 0.5f) * std::sqrt(3.0f),
+            };
+            model_renderer->queue_model(models[placed % config.models], {.position = position, .scale = glm::vec3{0.5f}});
+            ++placed;
+        }
+    }
+
+    const f32 extent = static_cast<f32>(rings) * 1.5f;
+    for (u32 i = 0; i < config.lights; ++i) {
+        const glm::vec2 spread = glm::vec2{rng.at<f32>({i, 0}), rng.at<f32>({i, 1})} * 2.0f - 1.0f;
+        const glm::vec3 color = {rng.at<f32>({i, 2}), rng.at<f32>({i, 3}), rng.at<f32>({i, 4})};
+        pipeline->add_light({spread.x * extent, -1.0f, spread.y * extent}, color * 20.0f);
+    }
+
+    Cameraf camera = {};
+    camera.translate({0.0f, -extent, -extent * 1.5f});
+    camera.rotate_internal(glm::angleAxis<f32, glm::defaultp>(glm::pi<f32>() / 5.0f, {-1.0f, 0.0f, 0.0f}));
+    const f32 aspect_ratio = static_cast<f32>(config.width) / static_cast<f32>(config.height);
+    pipeline->update_projection(glm::perspective(glm::pi<f32>() / 4.0f, aspect_ratio, 0.1f, extent * 8.0f));
+    pipeline->update_camera(camera);
+
+    // A frame's gpu timestamps are read back once its frame index comes around again, so the measured frames are
+    // collected a few frames late and a few unmeasured frames run after them
+    const u32 readback_latency = MaxFramesInFlight + 1;
+    const u32 total_frames = config.warmup_frames + config.frames + readback_latency;
+    std::vector<u64> frame_ids = {};
+    frame_ids.reserve(total_frames);
+    std::vector<f64> record_ms = {};
+    std::vector<f64> gpu_ms = {};
+    const auto collect = [&](const u64 frame_id) {
+        const auto& history = g_profiler.history();
+        const auto frame = std::ranges::find(history, frame_id, &FrameStats::frame);
+        if (frame == history.end())
+            return;
+        for (const auto& scope : frame->cpu_scopes) {
+            if (scope.name != nullptr && std::strcmp(scope.name, "record_frame") == 0)
+                record_ms.push_back(static_cast<f64>(scope.end_ns - scope.begin_ns) / 1e6);
+        }
+        for (const auto& scope : frame->gpu_scopes) {
+            if (scope.depth == 0 && scope.name != nullptr && std::strcmp(scope.name, "frame") == 0)
+                gpu_ms.push_back(static_cast<f64>(scope.end_ns - scope.begin_ns) / 1e6);
+        }
+    };
+
+    u64 measure_begin_ns = 0;
+    u64 measure_end_ns = 0;
+    for (u32 i = 0; i < total_frames; ++i) {
+        if (i == config.warmup_frames)
+            measure_begin_ns = Profiler::now_ns();
+        const auto frame_result = target->draw_frame(*engine, *pipeline);
+        if (frame_result.has_err())
+            ERROR(errf(frame_result));
+        frame_ids.push_back(g_profiler.frame());
+
+        if (i + 1 == config.warmup_frames + config.frames) {
+            const auto wait_result = target->wait_idle(*engine);
+            if (wait_result.has_err())
+                ERROR(errf(wait_result));
+            measure_end_ns = Profiler::now_ns();
+        }
+        // Frames only reach the history once the next begins
+        if (i >= readback_latency) {
+            const u32 collected = i - readback_latency;
+            if (collected >= config.warmup_frames && collected < config.warmup_frames + config.frames)
+                collect(frame_ids[collected]);
+        }
+    }
+    (void)engine->device.waitIdle();
+
+    const auto memory = get_memory_report(*engine);
+    const auto category_bytes = [&](const MemoryCategory category) {
+        return memory.categories[static_cast<usize>(category)].bytes;
+    };
+
+    const auto properties = engine->gpu.getProperties();
+    const f64 measure_sec = static_cast<f64>(measure_end_ns - measure_begin_ns) / 1e9;
+    const std::string report = std::format(
+        "{{\n"
+        R"(  "gpu": "{}",)" "\n"
+        R"(  "scene": {{"tiles": {}, "lights": {}, "models": {}, "width": {}, "height": {}, "samples": {}, "scale": {}, "depth_prepass": {}}},)" "\n"
+        R"(  "frames": {},)" "\n"
+        R"(  "fps": {:.2f},)" "\n"
+        R"(  "cpu_record_ms": {},)" "\n"
+        R"(  "gpu_frame_ms": {},)" "\n"
+        R"(  "upload": {{"bytes": {}, "seconds": {:.6f}, "mb_per_second": {:.2f}}},)" "\n"
+        R"(  "memory": {{"allocations": {}, "blocks": {}, "unused_bytes": {}, "fragmentation": {:.4f}, )"
+        R"("geometry_bytes": {}, "texture_bytes": {}, "render_target_bytes": {}, "staging_bytes": {}, "other_bytes": {}}})" "\n"
+        "}}\n",
+        escape_json(properties.deviceName.data()),
+        placed, config.lights, config.models, config.width, config.height, config.samples, config.render_scale,
+        config.depth_prepass,
+        config.frames,
+        measure_sec > 0.0 ? static_cast<f64>(config.frames) / measure_sec : 0.0,
+        summarize(record_ms),
+        summarize(gpu_ms),
+        upload_bytes, upload_sec, upload_sec > 0.0 ? static_cast<f64>(upload_bytes) / upload_sec / 1e6 : 0.0,
+        memory.allocation_count, memory.block_count, memory.unused_bytes, memory.fragmentation,
+        category_bytes(MemoryCategory::Geometry), category_bytes(MemoryCategory::Texture),
+        category_bytes(MemoryCategory::RenderTarget), category_bytes(MemoryCategory::Staging),
+        category_bytes(MemoryCategory::Other)
+    );
+
+    if (config.output.empty()) {
+        std::cout << report;
+        return 0;
+    }
+    std::ofstream file{config.output};
+    file << report;
+    if (!file) {
+        std::cerr << std::format("Could not write {}\n", config.output);
+        return 1;
+    }
+    return 0;
+}
@@ -0,0 +1,74 @@
+#include "hg_utils.h"
+#include "hg_load.h"
+#include "hg_compress.h"
+#include "hg_threads.h"
+
+#include <cstring>
+#include <filesystem>
+#include <format>
+#include <iostream>
+#include <string_view>
+
+using namespace hg;
+
+// Compresses every .png and .jpg under the input directory into a .ktx2 at the same relative path in the output
+// directory, as BC7 albedo or, with --normal, as BC5 normals
+int main(const int argc, const char* argv[]) {
+    const bool normals = argc == 4 && std::string_view{argv[1]} == "--normal";
+    if (argc != 3 && !normals) {
+        std::cerr << std::format("usage: {} [--normal] <image directory> <output directory>\n", argv[0]);
+        return 1;
+    }
+    const std::filesystem::path input = argv[argc - 2];
+    const std::filesystem::path output = argv[argc - 1];
+    if (!std::filesystem::is_directory(input)) {
+        std::cerr << std::format("{} is not a directory\n", input.string());
+        return 1;
+    }
+
+    std::vector<std::filesystem::path> paths = {};
+    for (const auto& entry : std::filesystem::recursive_directory_iterator(input)) {
+        const auto extension = entry.path().extension();
+        if (entry.is_regular_file() && (extension == ".png" || extension == ".jpg"))
+            paths.push_back(entry.path());
+    }
+
+    const auto compress_file = [&](const std::filesystem::path& path) -> Result<void> {
+        const auto data = ImageData::load(path);
+        if (data.has_err())
+            return data.err();
+
+        Image<u32> pixels = {{to_u32(data->width), to_u32(data->height)}};
+        std::memcpy(pixels.data(), data->pixels.get(), pixels.size() * sizeof(u32));
+        const auto compressed = normals
+            ? compress_bc5(map_image<glm::vec4>(pixels, [](const u32 pixel) {
+                const glm::vec3 unorm = glm::vec3{pixel & 0xff, pixel >> 8 & 0xff, pixel >> 16 & 0xff} / 255.0f;
+                return glm::vec4{unorm * 2.0f - 1.0f, 0.0f};
+            }))
+            : compress_bc7(pixels);
+
+        auto compressed_path = output / std::filesystem::relative(path, input);
+        compressed_path.replace_extension(".ktx2");
+        std::filesystem::create_directories(compressed_path.parent_path());
+        return compressed.save_ktx2(compressed_path);
+    };
+
+    Timer timer = {};
+    ThreadPool pool{};
+    std::vector<std::future<Result<void>>> results = {};
+    for (const auto& path : paths) {
+        results.push_back(pool.submit([&compress_file, &path] { return compress_file(path); }));
+    }
+
+    usize failed = 0;
+    for (usize i = 0; i < paths.size(); ++i) {
+        const auto result = results[i].get();
+        if (result.has_err()) {
+            std::cerr << std::format("{}: {}\n", paths[i].string(), to_string(result.err()));
+            ++failed;
+        }
+    }
+
+    timer.stop(std::format("Compressed {} images, {} failed", paths.size() - failed, failed));
+    return failed == 0 ? 0 : 1;
+}